@@ -0,0 +1,7 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+#include <stdio.h>
+
+/* 从 tar（ustar/pax/GNU 长文件名）或 newc cpio 流中直接创建目录和文件，不解包到磁盘 */
+int copy_archive_to_fatfs(FILE* in, const char* arc_name, const char* fatfs_dir_path, int flags);
+#endif
@@ -0,0 +1,335 @@
+#include "backends.h"
+#include <windows.h>    // 用于重叠I/O
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 写入缓冲池：槽位个数和每个槽位的大小
+#define AIO_SLOTS       32
+#define AIO_SLOT_SIZE   (256 * 1024)
+// 直接拷贝PC文件时同时在途的缓冲区个数和大小
+#define AIO_COPY_DEPTH  8
+#define AIO_COPY_CHUNK  (1024 * 1024)
+
+/*
+ 异步后端：disk_write 把数据复制到缓冲池中的一个槽位，提交重叠写入后立即返回；
+ disk_read 只等待与读取区域重叠的在途写入；CTRL_SYNC 等待全部写入完成。
+ 同一区域的两次写入之间也会先等待前一次完成，保证落盘顺序与 FatFs 的写入顺序一致。
+*/
+
+/* 一个在途写入 */
+typedef struct {
+    OVERLAPPED ov;
+    BYTE* buf;
+    uint64_t offset;
+    DWORD len;
+    int busy;
+} aio_slot;
+
+typedef struct {
+    fatimage_backend ops;
+    HANDLE h;                   // 以 FILE_FLAG_OVERLAPPED 打开的镜像文件
+    CRITICAL_SECTION lock;      // 同一镜像的多个分区可能在不同线程中同时读写
+    HANDLE read_event;
+    aio_slot slots[AIO_SLOTS];
+    BYTE* pool;                 // 所有槽位的缓冲区，创建时一次分配
+    int next;                   // 下一个使用的槽位（轮转，即最早提交的写入）
+    int error;                  // 已完成的写入中出现过错误，在下一次读/写/同步时报告
+    DWORD clone_unit;           // 块克隆的对齐单位，0表示不支持（由 lock 保护）
+} async_backend;
+
+/*
+=================================================================================
+ 1. 辅助函数：等待在途写入
+=================================================================================
+*/
+
+static void set_offset(OVERLAPPED* ov, uint64_t offset) {
+    HANDLE ev = ov->hEvent;
+    memset(ov, 0, sizeof(*ov));
+    ov->hEvent = ev;
+    ov->Offset = (DWORD)offset;
+    ov->OffsetHigh = (DWORD)(offset >> 32);
+}
+
+static void slot_wait(async_backend* ab, aio_slot* s) {
+    DWORD done;
+    if (!s->busy) {
+        return;
+    }
+    s->busy = 0;
+    if (!GetOverlappedResult(ab->h, &s->ov, &done, TRUE) || done != s->len) {
+        ab->error = 1;
+    }
+}
+
+/**
+ * @brief Waits for every in-flight write that overlaps [offset, offset + bytes).
+ */
+static void wait_overlapping(async_backend* ab, uint64_t offset, uint64_t bytes) {
+    for (int i = 0; i < AIO_SLOTS; i++) {
+        aio_slot* s = &ab->slots[i];
+        if (s->busy && s->offset < offset + bytes && offset < s->offset + s->len) {
+            slot_wait(ab, s);
+        }
+    }
+}
+
+static void drain(async_backend* ab) {
+    for (int i = 0; i < AIO_SLOTS; i++) {
+        slot_wait(ab, &ab->slots[i]);
+    }
+}
+
+/*
+=================================================================================
+ 2. 后端操作
+=================================================================================
+*/
+
+static int async_write(fatimage_backend* be, const void* buff, uint64_t offset, size_t bytes) {
+    async_backend* ab = (async_backend*)be;
+    const BYTE* p = (const BYTE*)buff;
+    int ret = 0;
+
+    EnterCriticalSection(&ab->lock);
+    wait_overlapping(ab, offset, bytes);
+    while (bytes > 0 && !ab->error) {
+        aio_slot* s = &ab->slots[ab->next];
+        DWORD len = (bytes > AIO_SLOT_SIZE) ? AIO_SLOT_SIZE : (DWORD)bytes;
+
+        ab->next = (ab->next + 1) % AIO_SLOTS;
+        slot_wait(ab, s); // 缓冲池已满时等待最早的写入完成
+        memcpy(s->buf, p, len);
+        set_offset(&s->ov, offset);
+        s->offset = offset;
+        s->len = len;
+        if (!WriteFile(ab->h, s->buf, len, NULL, &s->ov) && GetLastError() != ERROR_IO_PENDING) {
+            ab->error = 1;
+            break;
+        }
+        s->busy = 1;
+        p += len;
+        offset += len;
+        bytes -= len;
+    }
+    if (ab->error) {
+        ret = -1;
+    }
+    LeaveCriticalSection(&ab->lock);
+    return ret;
+}
+
+static int async_read(fatimage_backend* be, void* buff, uint64_t offset, size_t bytes) {
+    async_backend* ab = (async_backend*)be;
+    OVERLAPPED ov;
+    DWORD done;
+    int ret = -1;
+
+    EnterCriticalSection(&ab->lock);
+    // 只等待与读取区域重叠的写入，其它写入继续在后台进行
+    wait_overlapping(ab, offset, bytes);
+    ov.hEvent = ab->read_event;
+    set_offset(&ov, offset);
+    if (!ab->error && bytes <= 0xFFFFFFFFu &&
+        (ReadFile(ab->h, buff, (DWORD)bytes, NULL, &ov) || GetLastError() == ERROR_IO_PENDING) &&
+        GetOverlappedResult(ab->h, &ov, &done, TRUE) && done == bytes) {
+        ret = 0;
+    }
+    LeaveCriticalSection(&ab->lock);
+    return ret;
+}
+
+static int async_sync(fatimage_backend* be) {
+    async_backend* ab = (async_backend*)be;
+    int ret;
+
+    EnterCriticalSection(&ab->lock);
+    drain(ab);
+    ret = ab->error ? -1 : 0;
+    LeaveCriticalSection(&ab->lock);
+    return ret;
+}
+
+static int async_close(fatimage_backend* be) {
+    async_backend* ab = (async_backend*)be;
+
+    drain(ab);
+    // 镜像完成时统一刷新到磁盘，而不是在每次 CTRL_SYNC 时刷新
+    int ret = (!ab->error && FlushFileBuffers(ab->h)) ? 0 : -1;
+    for (int i = 0; i < AIO_SLOTS; i++) {
+        CloseHandle(ab->slots[i].ov.hEvent);
+    }
+    CloseHandle(ab->read_event);
+    CloseHandle(ab->h);
+    DeleteCriticalSection(&ab->lock);
+    free(ab->pool);
+    free(ab);
+    return ret;
+}
+
+/**
+ * @brief Copies the first bytes of a PC file into the image at offset. Tries a block clone first
+ *        (see filedisk.c); otherwise keeps AIO_COPY_DEPTH overlapped reads/writes in flight, each
+ *        buffer alternating between reading the next source chunk and writing it to the image.
+ * @return 0 on success, -1 on failure.
+ */
+static int async_copy_file(fatimage_backend* be, const char* pc_path, uint64_t offset, uint64_t bytes) {
+    async_backend* ab = (async_backend*)be;
+    struct {
+        OVERLAPPED ov;
+        BYTE* buf;
+        uint64_t pos;       // 在源文件中的偏移
+        DWORD len;
+        int state;          // 0:空闲 1:读取中 2:写入中
+    } q[AIO_COPY_DEPTH];
+    uint64_t next_pos = 0, written = 0;
+    int ret = 0;
+
+    HANDLE src = CreateFile(pc_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (src == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Cannot open PC file '%s'.\n", pc_path);
+        return -1;
+    }
+
+    // 目标簇段可能还有排队中的写入（例如之前的文件删除后重新分配），先等待它们
+    EnterCriticalSection(&ab->lock);
+    wait_overlapping(ab, offset, bytes);
+    DWORD clone_unit = ab->clone_unit;
+    LeaveCriticalSection(&ab->lock);
+
+    // 1. 块克隆（镜像以重叠方式打开，FSCTL 也要带 OVERLAPPED 并等待完成）
+    if (clone_unit && offset % clone_unit == 0) {
+        DUPLICATE_EXTENTS_DATA dup;
+        dup.FileHandle = src;
+        dup.SourceFileOffset.QuadPart = 0;
+        dup.TargetFileOffset.QuadPart = (LONGLONG)offset;
+        dup.ByteCount.QuadPart = (LONGLONG)(bytes / clone_unit * clone_unit);
+        if (dup.ByteCount.QuadPart > 0 &&
+            device_control(ab->h, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &dup, sizeof(dup), NULL, 0)) {
+            next_pos = written = (uint64_t)dup.ByteCount.QuadPart;
+        } else {
+            EnterCriticalSection(&ab->lock);
+            ab->clone_unit = 0;
+            LeaveCriticalSection(&ab->lock);
+        }
+    }
+
+    // 2. 流水线拷贝剩余部分
+    memset(q, 0, sizeof(q));
+    for (int i = 0; i < AIO_COPY_DEPTH; i++) {
+        q[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        q[i].buf = (BYTE*)malloc(AIO_COPY_CHUNK);
+        if (!q[i].ov.hEvent || !q[i].buf) {
+            ret = -1;
+        }
+    }
+    for (int i = 0; ret == 0 && written < bytes; i = (i + 1) % AIO_COPY_DEPTH) {
+        DWORD done;
+        if (q[i].state == 1) {
+            // 读取完成 -> 写入镜像中的对应位置
+            if (!GetOverlappedResult(src, &q[i].ov, &done, TRUE) || done != q[i].len) {
+                fprintf(stderr, "Error: Failed reading from PC file '%s'.\n", pc_path);
+                ret = -1;
+                break;
+            }
+            set_offset(&q[i].ov, offset + q[i].pos);
+            if (!WriteFile(ab->h, q[i].buf, q[i].len, NULL, &q[i].ov) && GetLastError() != ERROR_IO_PENDING) {
+                ret = -1;
+                break;
+            }
+            q[i].state = 2;
+            continue;
+        }
+        if (q[i].state == 2) {
+            if (!GetOverlappedResult(ab->h, &q[i].ov, &done, TRUE) || done != q[i].len) {
+                fprintf(stderr, "Error: Failed writing to disk image.\n");
+                ret = -1;
+                break;
+            }
+            written += q[i].len;
+            q[i].state = 0;
+        }
+        if (q[i].state == 0 && next_pos < bytes) {
+            // 空闲 -> 提交下一块源文件读取
+            q[i].pos = next_pos;
+            q[i].len = (bytes - next_pos > AIO_COPY_CHUNK) ? AIO_COPY_CHUNK : (DWORD)(bytes - next_pos);
+            next_pos += q[i].len;
+            set_offset(&q[i].ov, q[i].pos);
+            if (!ReadFile(src, q[i].buf, q[i].len, NULL, &q[i].ov) && GetLastError() != ERROR_IO_PENDING) {
+                fprintf(stderr, "Error: Failed reading from PC file '%s'.\n", pc_path);
+                ret = -1;
+                break;
+            }
+            q[i].state = 1;
+        }
+    }
+
+    // 出错时也要等待所有在途操作结束，才能释放缓冲区
+    for (int i = 0; i < AIO_COPY_DEPTH; i++) {
+        DWORD done;
+        if (q[i].state != 0) {
+            GetOverlappedResult(q[i].state == 1 ? src : ab->h, &q[i].ov, &done, TRUE);
+        }
+        if (q[i].ov.hEvent) {
+            CloseHandle(q[i].ov.hEvent);
+        }
+        free(q[i].buf);
+    }
+    CloseHandle(src);
+    return ret;
+}
+
+/*
+=================================================================================
+ 3. 创建异步后端
+=================================================================================
+*/
+
+/**
+ * @brief Creates an image file opened for overlapped I/O, with a pool of AIO_SLOTS write buffers.
+ * @return New backend, or NULL on failure.
+ */
+fatimage_backend* async_backend_create(const char* path, uint64_t size) {
+    async_backend* ab = (async_backend*)calloc(1, sizeof(async_backend));
+    if (!ab) {
+        return NULL;
+    }
+    ab->pool = (BYTE*)malloc((size_t)AIO_SLOTS * AIO_SLOT_SIZE);
+    ab->read_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    for (int i = 0; i < AIO_SLOTS; i++) {
+        ab->slots[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        ab->slots[i].buf = ab->pool ? ab->pool + (size_t)i * AIO_SLOT_SIZE : NULL;
+    }
+    ab->h = create_image_file(path, size, FILE_FLAG_OVERLAPPED);
+    InitializeCriticalSection(&ab->lock);
+
+    int ok = (ab->pool && ab->read_event && ab->h != INVALID_HANDLE_VALUE);
+    for (int i = 0; ok && i < AIO_SLOTS; i++) {
+        ok = (ab->slots[i].ov.hEvent != NULL);
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to set up asynchronous I/O for '%s'.\n", path);
+        if (ab->h != INVALID_HANDLE_VALUE) {
+            CloseHandle(ab->h);
+        }
+        ab->h = INVALID_HANDLE_VALUE;
+        for (int i = 0; i < AIO_SLOTS; i++) {
+            if (ab->slots[i].ov.hEvent) CloseHandle(ab->slots[i].ov.hEvent);
+        }
+        if (ab->read_event) CloseHandle(ab->read_event);
+        DeleteCriticalSection(&ab->lock);
+        free(ab->pool);
+        free(ab);
+        return NULL;
+    }
+    ab->clone_unit = query_clone_unit(ab->h);
+
+    ab->ops.read = async_read;
+    ab->ops.write = async_write;
+    ab->ops.sync = async_sync;
+    ab->ops.close = async_close;
+    ab->ops.copy_file = async_copy_file;
+    return &ab->ops;
+}
@@ -0,0 +1,30 @@
+#ifndef __BACKENDS_H__
+#define __BACKENDS_H__
+#include <windows.h>
+#include <stdio.h>
+#include "fatimage.h"
+
+/* 镜像存储后端的构造函数，由 fatimage_open 按 io_mode 选择 */
+fatimage_backend* file_backend_create(const char* path, uint64_t size);
+fatimage_backend* async_backend_create(const char* path, uint64_t size);
+fatimage_backend* direct_backend_create(const char* path, uint64_t size);
+/* 只读打开已有的镜像文件（解包、校验，见 fatimage_open_existing） */
+fatimage_backend* file_backend_open(const char* path, uint64_t* size);
+/* 批量模式下包在上面的后端外面的元数据写回缓存（metacache.c） */
+fatimage_backend* cache_backend_create(fatimage_backend* inner);
+/* 块映射的块大小（字节） */
+#define MAP_BLOCK_SIZE 4096u
+/* 记录写入的块，关闭时生成 bmaptool 块映射，和/或把镜像按 out_format 格式写入文件或流（bmap.c） */
+fatimage_backend* bmap_backend_create(fatimage_backend* inner, uint64_t size, const char* bmap_path,
+                                      int out_format, const char* out_path, FILE* out_stream);
+/* 镜像生成失败：关闭时不再写出块映射和转换后的镜像（fatimage_abort） */
+void bmap_backend_discard(fatimage_backend* be);
+/* 按块映射转换镜像并顺序写入 f，map 每位对应 MAP_BLOCK_SIZE 字节：Android 稀疏镜像（simg.c）、BGZF 压缩镜像（gzimg.c） */
+int write_sparse_image(fatimage_backend* be, const BYTE* map, uint64_t size, FILE* f);
+int write_gzip_image(fatimage_backend* be, const BYTE* map, uint64_t size, FILE* f);
+
+/* 后端共用的辅助函数（filedisk.c） */
+HANDLE create_image_file(const char* path, uint64_t size, DWORD flags);
+BOOL device_control(HANDLE h, DWORD code, void* in, DWORD in_size, void* out, DWORD out_size);
+DWORD query_clone_unit(HANDLE h);
+#endif
@@ -0,0 +1,182 @@
+#include "fatimage.h"
+#include "check.h"
+#include "imgtree.h"
+#include <windows.h>    // 用于计时
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ 一致性检查的基准测试：生成一个大镜像（默认 4 GiB exFAT，2万个文件分布在100个目录中），
+ 一半文件两两交替扩展成碎片化的簇链，其余用 f_expand 分配连续簇（每个文件1-8簇，数据不写入，只有FAT和目录），
+ 然后分别计时 check_image 和逐个文件用 f_lseek 走完簇链的朴素遍历（每个簇一次 get_fat）。
+
+ 用法：bench_check [镜像大小(MiB)] [FAT|FAT32|EXFAT] [文件数] [镜像路径]
+*/
+
+#define BENCH_DIRS          100
+#define BENCH_MAX_CLUSTERS  8       // 每个文件最多的簇数（默认参数下约占用镜像的70%）
+
+static double now_ms(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+/*
+=================================================================================
+ 1. 生成测试镜像
+=================================================================================
+*/
+
+/**
+ * @brief Creates two files that grow one cluster at a time in turn, so both cluster chains are fragmented.
+ */
+static int make_fragmented_pair(const char* dir, int index, DWORD cluster, int n_clusters) {
+    char path[2][64];
+    FIL f[2];
+
+    for (int k = 0; k < 2; k++) {
+        snprintf(path[k], sizeof(path[k]), "%s/frag%05d.bin", dir, index + k);
+        if (f_open(&f[k], path[k], FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+            return -1;
+        }
+    }
+    int ret = 0;
+    for (int c = 1; c <= n_clusters && ret == 0; c++) {
+        for (int k = 0; k < 2; k++) {
+            // 写模式下定位到文件末尾之后会扩展文件并分配簇
+            if (f_lseek(&f[k], (FSIZE_t)c * cluster) != FR_OK || f_tell(&f[k]) != (FSIZE_t)c * cluster) {
+                ret = -1;
+            }
+        }
+    }
+    f_close(&f[0]);
+    f_close(&f[1]);
+    return ret;
+}
+
+static int make_contiguous(const char* dir, int index, FSIZE_t size) {
+    char path[64];
+    FIL f;
+
+    snprintf(path, sizeof(path), "%s/cont%05d.bin", dir, index);
+    if (f_open(&f, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        return -1;
+    }
+    FRESULT res = f_expand(&f, size, 1);
+    f_close(&f);
+    return res == FR_OK ? 0 : -1;
+}
+
+static int build_image(const char* path, uint64_t size, BYTE fmt, int n_files) {
+    fatimage_config cfg = { .path = path, .size = size, .fmt = fmt, .bulk = 1 };
+    fatimage* img = fatimage_open(&cfg);
+    if (!img || fatimage_format(img) != 0 || fatimage_mount(img) != 0) {
+        fatimage_abort(img);
+        return -1;
+    }
+    DWORD cluster = (DWORD)img->fs.csize * FF_MIN_SS;
+    int per_dir = (n_files + BENCH_DIRS - 1) / BENCH_DIRS;
+    int ret = 0, made = 0;
+
+    srand(1);
+    for (int d = 0; d < BENCH_DIRS && made < n_files && ret == 0; d++) {
+        char dir[32];
+        snprintf(dir, sizeof(dir), "%s/d%02d", fatimage_drive(img), d);
+        if (f_mkdir(dir) != FR_OK) {
+            ret = -1;
+            break;
+        }
+        for (int i = 0; i < per_dir && made < n_files && ret == 0; i += 2) {
+            if ((i / 2) % 2 == 0) {
+                ret = make_fragmented_pair(dir, i, cluster, 1 + rand() % BENCH_MAX_CLUSTERS);
+            } else {
+                ret = make_contiguous(dir, i, (FSIZE_t)(1 + rand() % BENCH_MAX_CLUSTERS) * cluster) |
+                      make_contiguous(dir, i + 1, (FSIZE_t)(1 + rand() % BENCH_MAX_CLUSTERS) * cluster);
+            }
+            made += 2;
+        }
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Error: The image is too small for %d files.\n", n_files);
+        fatimage_abort(img);
+        return -1;
+    }
+    return fatimage_close(img);
+}
+
+/*
+=================================================================================
+ 2. 朴素遍历：通过 FatFs 逐个文件走完簇链
+=================================================================================
+*/
+
+static int walk_dir(const char* path, uint64_t* n_files) {
+    DIR dir;
+    FILINFO fno;
+    char sub[FF_LFN_BUF + 64];
+
+    if (f_opendir(&dir, path) != FR_OK) {
+        return -1;
+    }
+    int ret = 0;
+    while (ret == 0 && f_readdir(&dir, &fno) == FR_OK && fno.fname[0]) {
+        snprintf(sub, sizeof(sub), "%s/%s", path, fno.fname);
+        if (fno.fattrib & AM_DIR) {
+            ret = walk_dir(sub, n_files);
+            continue;
+        }
+        FIL f;
+        // 定位到文件末尾时 FatFs 每个簇读一次FAT
+        if (f_open(&f, sub, FA_READ) != FR_OK || f_lseek(&f, f_size(&f)) != FR_OK) {
+            ret = -1;
+        }
+        f_close(&f);
+        (*n_files)++;
+    }
+    f_closedir(&dir);
+    return ret;
+}
+
+/*
+=================================================================================
+ 3. 主函数
+=================================================================================
+*/
+
+int main(int argc, char* argv[]) {
+    uint64_t size_mib = argc > 1 ? strtoull(argv[1], NULL, 10) : 4096;
+    const char* fmt_name = argc > 2 ? argv[2] : "EXFAT";
+    int n_files = argc > 3 ? atoi(argv[3]) : 20000;
+    const char* path = argc > 4 ? argv[4] : "bench_check.img";
+    BYTE fmt = (_stricmp(fmt_name, "FAT") == 0) ? FM_FAT : (_stricmp(fmt_name, "FAT32") == 0) ? FM_FAT32 : FM_EXFAT;
+
+    printf("Building a %llu MiB %s image with %d files in '%s'...\n", (unsigned long long)size_mib, fmt_name, n_files, path);
+    double t0 = now_ms();
+    if (size_mib == 0 || n_files < 2 || build_image(path, size_mib << 20, fmt, n_files) != 0) {
+        return 1;
+    }
+    printf("Built in %.0f ms.\n\n", now_ms() - t0);
+
+    double t1 = now_ms();
+    int rc = check_image(path);
+    double t_check = now_ms() - t1;
+
+    uint64_t walked = 0;
+    double t2 = now_ms();
+    fatimage* img = image_open_mounted(path);
+    int walk_rc = img ? walk_dir(fatimage_drive(img), &walked) : -1;
+    fatimage_close(img);
+    double t_walk = now_ms() - t2;
+
+    printf("\ncheck_image:                %8.1f ms (%s)\n", t_check, rc == 0 ? "clean" : "problems found");
+    printf("FatFs chain walk (f_lseek): %8.1f ms (%llu files%s)\n", t_walk, (unsigned long long)walked,
+           walk_rc == 0 ? "" : ", failed");
+    DeleteFile(path);
+    return (rc == 0 && walk_rc == 0) ? 0 : 1;
+}
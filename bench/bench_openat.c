@@ -0,0 +1,167 @@
+#include "fatimage.h"
+#include <windows.h>    // 用于计时
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ 目录相对打开（f_openat）的基准测试：在镜像中生成一棵深度为10的目录树，每层除了往下的目录还有
+ 若干个同级目录（排在前面，dir_find 要逐个跳过）。最深一层有两个结构相同的目录，分别用完整路径的
+ f_open 和在已打开的 DIR 上调用 f_openat 创建、重新打开同样数量的文件，比较两者的耗时。
+
+ 用法：bench_openat [每层同级目录数] [文件数] [FAT|FAT32|EXFAT] [镜像路径]
+*/
+
+#define BENCH_DEPTH         10
+#define BENCH_IMAGE_SIZE    ((uint64_t)1 << 30)
+
+static double now_ms(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+/*
+=================================================================================
+ 1. 生成目录树
+=================================================================================
+*/
+
+/**
+ * @brief Creates the depth-10 tree and returns the full path of its deepest directory in deep_path.
+ *
+ * The deepest directory holds the "Full" and "At" leaves, one for each way of opening files.
+ */
+static int build_tree(const char* drive, int siblings, char* deep_path, size_t deep_size) {
+    char path[64];
+
+    snprintf(deep_path, deep_size, "%s", drive);
+    for (int level = 0; level < BENCH_DEPTH; level++) {
+        for (int s = 0; s < siblings; s++) {
+            snprintf(path, sizeof(path), "/Sibling directory %03d", s);
+            char sub[FF_LFN_BUF];
+            snprintf(sub, sizeof(sub), "%s%s", deep_path, path);
+            if (f_mkdir(sub) != FR_OK) {
+                return -1;
+            }
+        }
+        size_t len = strlen(deep_path);
+        snprintf(deep_path + len, deep_size - len, "/Level %02d directory", level);
+        if (f_mkdir(deep_path) != FR_OK) {
+            return -1;
+        }
+    }
+    for (int k = 0; k < 2; k++) {
+        char leaf[FF_LFN_BUF];
+        snprintf(leaf, sizeof(leaf), "%s/%s", deep_path, k == 0 ? "Full" : "At");
+        if (f_mkdir(leaf) != FR_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 两种打开方式
+=================================================================================
+*/
+
+static int open_full(const char* deep_path, const char* leaf, int n_files, BYTE mode) {
+    char path[FF_LFN_BUF];
+    FIL f;
+
+    for (int i = 0; i < n_files; i++) {
+        snprintf(path, sizeof(path), "%s/%s/file %05d.txt", deep_path, leaf, i);
+        if (f_open(&f, path, mode) != FR_OK) {
+            return -1;
+        }
+        f_close(&f);
+    }
+    return 0;
+}
+
+static int open_at(const char* deep_path, const char* leaf, int n_files, BYTE mode) {
+    char path[FF_LFN_BUF], name[64];
+    DIR dir;
+    FIL f;
+
+    // 只解析一次目录路径
+    snprintf(path, sizeof(path), "%s/%s", deep_path, leaf);
+    if (f_opendir(&dir, path) != FR_OK) {
+        return -1;
+    }
+    int ret = 0;
+    for (int i = 0; i < n_files && ret == 0; i++) {
+        snprintf(name, sizeof(name), "file %05d.txt", i);
+        if (f_openat(&dir, &f, name, mode) != FR_OK) {
+            ret = -1;
+            break;
+        }
+        f_close(&f);
+    }
+    f_closedir(&dir);
+    return ret;
+}
+
+/*
+=================================================================================
+ 3. 主函数
+=================================================================================
+*/
+
+int main(int argc, char* argv[]) {
+    int siblings = argc > 1 ? atoi(argv[1]) : 50;
+    int n_files = argc > 2 ? atoi(argv[2]) : 2000;
+    const char* fmt_name = argc > 3 ? argv[3] : "EXFAT";
+    const char* path = argc > 4 ? argv[4] : "bench_openat.img";
+    BYTE fmt = (_stricmp(fmt_name, "FAT") == 0) ? FM_FAT : (_stricmp(fmt_name, "FAT32") == 0) ? FM_FAT32 : FM_EXFAT;
+    char deep_path[FF_LFN_BUF];
+
+    fatimage_config cfg = { .path = path, .size = BENCH_IMAGE_SIZE, .fmt = fmt, .bulk = 1 };
+    fatimage* img = fatimage_open(&cfg);
+    if (!img || fatimage_format(img) != 0 || fatimage_mount(img) != 0 ||
+        siblings < 0 || n_files <= 0 || build_tree(fatimage_drive(img), siblings, deep_path, sizeof(deep_path)) != 0) {
+        fprintf(stderr, "Error: Failed to build the depth-%d tree in '%s'.\n", BENCH_DEPTH, path);
+        fatimage_abort(img);
+        DeleteFile(path);
+        return 1;
+    }
+    printf("%s, depth %d, %d siblings per level, %d files in the deepest directory.\n\n",
+           fmt_name, BENCH_DEPTH, siblings, n_files);
+
+    // 两种方式各自在自己的目录中创建一组文件，再重新打开同一组文件
+    double t0 = now_ms();
+    int ret = open_full(deep_path, "Full", n_files, FA_CREATE_NEW | FA_WRITE);
+    double t_create_full = now_ms() - t0;
+
+    t0 = now_ms();
+    ret |= open_at(deep_path, "At", n_files, FA_CREATE_NEW | FA_WRITE);
+    double t_create_at = now_ms() - t0;
+
+    t0 = now_ms();
+    ret |= open_full(deep_path, "Full", n_files, FA_READ);
+    double t_open_full = now_ms() - t0;
+
+    t0 = now_ms();
+    ret |= open_at(deep_path, "At", n_files, FA_READ);
+    double t_open_at = now_ms() - t0;
+
+    if (ret != 0) {
+        fprintf(stderr, "Error: Failed to create or open the benchmark files.\n");
+        fatimage_abort(img);
+        DeleteFile(path);
+        return 1;
+    }
+    printf("               f_open (full path)   f_openat\n");
+    printf("create:        %12.1f ms   %8.1f ms\n", t_create_full, t_create_at);
+    printf("open (read):   %12.1f ms   %8.1f ms\n", t_open_full, t_open_at);
+
+    fatimage_abort(img);    // 只需要计时，不写出镜像
+    DeleteFile(path);
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "ff.h"
+#include <windows.h>    // 用于计时
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ Unicode 转换的微基准测试：生成一批以中文为主的文件名（CJK 统一汉字夹杂少量 ASCII 字母和数字），
+ 逐字符调用 ff_wtoupper（exFAT 文件名哈希和比较）、ff_uni2oem（生成短文件名）和 ff_oem2uni（读取短文件名），
+ 另外计时 f_mkfs 生成大写转换表时对全部 65536 个字符的 ff_wtoupper 调用。
+
+ 同一份源码生成两个程序：bench_unicode 使用 FF_FAST_UNICODE=1（查找表），
+ bench_unicode_base 使用 FF_FAST_UNICODE=0（原始的压缩表解码和二分查找），对比两者的输出。
+
+ 用法：bench_unicode [文件名个数] [轮数]
+*/
+
+#define BENCH_NAME_LEN      24      // 每个文件名的字符数
+
+static double now_ms(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+/**
+ * @brief Fills names with n_names UTF-16 names, about five of every six characters CJK ideographs.
+ */
+static void make_names(WCHAR* names, int n_names) {
+    static const char ascii[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+
+    srand(1);
+    for (int i = 0; i < n_names * BENCH_NAME_LEN; i++) {
+        if (rand() % 6) {
+            names[i] = (WCHAR)(0x4E00 + rand() % (0x9FA5 - 0x4E00 + 1));    // GBK 覆盖的 CJK 统一汉字
+        } else {
+            names[i] = (WCHAR)ascii[rand() % (sizeof(ascii) - 1)];
+        }
+    }
+}
+
+/**
+ * @brief Runs every conversion over every character once and adds the time of each to t[0..2].
+ *
+ * The OEM codes from ff_uni2oem are kept in oems and converted back by ff_oem2uni.
+ */
+static DWORD run_pass(const WCHAR* names, WCHAR* oems, int n_chars, double t[3]) {
+    DWORD sum = 0;
+    double t0 = now_ms();
+    for (int i = 0; i < n_chars; i++) {
+        sum += ff_wtoupper(names[i]);
+    }
+    double t1 = now_ms();
+    for (int i = 0; i < n_chars; i++) {
+        oems[i] = ff_uni2oem(names[i], FF_CODE_PAGE);
+    }
+    double t2 = now_ms();
+    for (int i = 0; i < n_chars; i++) {
+        // 读取短文件名时转换的是 OEM 编码
+        sum += oems[i] + ff_oem2uni(oems[i], FF_CODE_PAGE);
+    }
+    double t3 = now_ms();
+    t[0] += t1 - t0;
+    t[1] += t2 - t1;
+    t[2] += t3 - t2;
+    return sum;
+}
+
+int main(int argc, char* argv[]) {
+    int n_names = argc > 1 ? atoi(argv[1]) : 10000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    if (n_names <= 0 || rounds <= 0) {
+        fprintf(stderr, "Error: The name count and the round count must be positive.\n");
+        return 1;
+    }
+    int n_chars = n_names * BENCH_NAME_LEN;
+    WCHAR* names = malloc(sizeof(WCHAR) * n_chars);
+    WCHAR* oems = malloc(sizeof(WCHAR) * n_chars);
+    if (!names || !oems) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(names);
+        free(oems);
+        return 1;
+    }
+    make_names(names, n_names);
+    printf("FF_FAST_UNICODE=%d, code page %d, %d names of %d characters, %d rounds.\n\n",
+           FF_FAST_UNICODE, FF_CODE_PAGE, n_names, BENCH_NAME_LEN, rounds);
+
+    // f_mkfs 生成大写转换表：每个字符调用一次（第一次调用，包括生成查找表的时间）
+    DWORD sum = 0;
+    double t0 = now_ms();
+    for (DWORD c = 0; c < 0x10000; c++) {
+        sum += ff_wtoupper(c);
+    }
+    double t_upcase = now_ms() - t0;
+
+    double first[3] = { 0 }, steady[3] = { 0 };
+    sum += run_pass(names, oems, n_chars, first);
+    for (int r = 0; r < rounds; r++) {
+        sum += run_pass(names, oems, n_chars, steady);
+    }
+
+    printf("up-case table (65536 chars): %8.2f ms\n\n", t_upcase);
+    printf("ns per character   first pass   later passes\n");
+    static const char* const labels[3] = { "ff_wtoupper", "ff_uni2oem ", "ff_oem2uni " };
+    for (int k = 0; k < 3; k++) {
+        printf("%s        %8.2f       %8.2f\n", labels[k], first[k] * 1e6 / n_chars, steady[k] * 1e6 / ((double)n_chars * rounds));
+    }
+    printf("\n(checksum %08lX)\n", (unsigned long)sum);
+    free(names);
+    free(oems);
+    return 0;
+}
@@ -0,0 +1,421 @@
+#include "backends.h"
+#include "sha256.h"
+#include <windows.h>    // 用于临界区
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BMAP_BLOCK      MAP_BLOCK_SIZE
+// 计算范围校验和时单次读取的字节数
+#define BMAP_CHUNK      (1024 * 1024)
+
+/*
+ 块映射（bmap）后端：包在镜像后端外面，记录所有经过 write/copy_file 写入的块。
+ 关闭时把写入过的块合并成连续范围，按 bmaptool 2.0 格式写出 <镜像>.bmap，
+ 和/或按同一份块映射把镜像转换成 Android 稀疏镜像（simg.c）或 gzip 压缩镜像（gzimg.c），
+ 或者把原始镜像顺序写入输出流（标准输出、管道）。
+ 刷写工具只需拷贝这些块，其余块（从未写入、在新建的镜像文件中为0）可以跳过。
+ 格式化时清零的FAT、位图、目录簇同样经过 write，所以都计入映射，目标设备上的旧数据不会残留在这些区域。
+*/
+
+typedef struct {
+    fatimage_backend ops;
+    fatimage_backend* inner;    // 实际的镜像后端
+    CRITICAL_SECTION lock;      // 同一镜像的多个分区在不同线程中写入
+    char* bmap_path;            // 输出的 bmap 文件路径，NULL表示不生成
+    char* out_path;             // 转换输出的镜像路径，NULL表示不转换
+    FILE* out_stream;           // 转换输出的流，非NULL时代替 out_path
+    int out_format;             // 转换格式 FATIMAGE_OUT_xxx
+    uint64_t size;              // 镜像大小（字节）
+    uint64_t n_blocks;          // 块数（最后一块可能不满）
+    BYTE* map;                  // 每块一位：1表示写入过
+} bmap_backend;
+
+/*
+=================================================================================
+ 1. 记录写入的块
+=================================================================================
+*/
+
+static void mark_range(bmap_backend* bb, uint64_t offset, uint64_t bytes) {
+    if (bytes == 0 || offset >= bb->size) {
+        return;
+    }
+    uint64_t first = offset / BMAP_BLOCK;
+    uint64_t last = (offset + bytes - 1) / BMAP_BLOCK;
+    if (last >= bb->n_blocks) {
+        last = bb->n_blocks - 1;
+    }
+
+    EnterCriticalSection(&bb->lock);
+    for (uint64_t b = first; b <= last; b++) {
+        // 整字节的部分直接填满
+        if ((b & 7) == 0 && b + 7 <= last) {
+            uint64_t n = (last + 1 - b) / 8;
+            memset(bb->map + b / 8, 0xFF, (size_t)n);
+            b += n * 8 - 1;
+            continue;
+        }
+        bb->map[b / 8] |= (BYTE)(1u << (b & 7));
+    }
+    LeaveCriticalSection(&bb->lock);
+}
+
+static int is_mapped(const bmap_backend* bb, uint64_t b) {
+    return (bb->map[b / 8] >> (b & 7)) & 1;
+}
+
+/*
+=================================================================================
+ 2. 生成 bmap 文件
+=================================================================================
+*/
+
+/* 可增长的文本缓冲区 */
+typedef struct {
+    char* p;
+    size_t len, cap;
+    int failed;
+} text_buf;
+
+static void append(text_buf* t, const char* fmt, ...) {
+    va_list ap;
+    for (;;) {
+        size_t room = t->cap - t->len;
+        va_start(ap, fmt);
+        int n = t->failed ? 0 : vsnprintf(t->p + t->len, room, fmt, ap);
+        va_end(ap);
+        if (t->failed || n < 0) {
+            t->failed = 1;
+            return;
+        }
+        if ((size_t)n < room) {
+            t->len += n;
+            return;
+        }
+        size_t new_cap = t->cap * 2 + n + 1;
+        char* p = (char*)realloc(t->p, new_cap);
+        if (!p) {
+            t->failed = 1;
+            return;
+        }
+        t->p = p;
+        t->cap = new_cap;
+    }
+}
+
+static void hex_digest(const uint8_t digest[SHA256_DIGEST_SIZE], char out[2 * SHA256_DIGEST_SIZE + 1]) {
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        snprintf(out + 2 * i, 3, "%02x", digest[i]);
+    }
+}
+
+/**
+ * @brief Computes the SHA-256 of the image bytes of blocks [first, last] through the inner backend.
+ *        The blocks were just written, so they are normally still in the system file cache.
+ */
+static int hash_range(bmap_backend* bb, uint64_t first, uint64_t last, BYTE* buffer, char hex[2 * SHA256_DIGEST_SIZE + 1]) {
+    sha256_ctx ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint64_t offset = first * BMAP_BLOCK;
+    uint64_t end = (last + 1) * BMAP_BLOCK;
+
+    if (end > bb->size) {
+        end = bb->size;     // 最后一块只计算镜像内的部分
+    }
+    sha256_init(&ctx);
+    while (offset < end) {
+        size_t n = (end - offset > BMAP_CHUNK) ? BMAP_CHUNK : (size_t)(end - offset);
+        if (bb->inner->read(bb->inner, buffer, offset, n) != 0) {
+            return -1;
+        }
+        sha256_update(&ctx, buffer, n);
+        offset += n;
+    }
+    sha256_final(&ctx, digest);
+    hex_digest(digest, hex);
+    return 0;
+}
+
+/**
+ * @brief Writes the block map in bmaptool 2.0 format. BmapFileChecksum is the SHA-256 of the file
+ *        with that field set to 64 zeros, as bmaptool verifies it.
+ * @return 0 on success, -1 on failure.
+ */
+static int write_bmap(bmap_backend* bb) {
+    text_buf t = { 0 };
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    uint64_t mapped = 0;
+    size_t sum_pos;
+    BYTE* buffer = (BYTE*)malloc(BMAP_CHUNK);
+
+    for (uint64_t b = 0; b < bb->n_blocks; b++) {
+        mapped += is_mapped(bb, b);
+    }
+
+    t.cap = 4096;
+    t.p = (char*)malloc(t.cap);
+    t.failed = (t.p == NULL || buffer == NULL);
+    append(&t, "<?xml version=\"1.0\" ?>\n");
+    append(&t, "<!-- Generated by the FatFs image packer. Only the mapped block ranges\n");
+    append(&t, "     need to be written when flashing the image. -->\n");
+    append(&t, "<bmap version=\"2.0\">\n");
+    append(&t, "    <ImageSize> %llu </ImageSize>\n", (unsigned long long)bb->size);
+    append(&t, "    <BlockSize> %u </BlockSize>\n", BMAP_BLOCK);
+    append(&t, "    <BlocksCount> %llu </BlocksCount>\n", (unsigned long long)bb->n_blocks);
+    append(&t, "    <MappedBlocksCount> %llu </MappedBlocksCount>\n", (unsigned long long)mapped);
+    append(&t, "    <ChecksumType> sha256 </ChecksumType>\n");
+    append(&t, "    <BmapFileChecksum> ");
+    sum_pos = t.len;
+    append(&t, "%064d </BmapFileChecksum>\n", 0);
+    append(&t, "    <BlockMap>\n");
+
+    // 连续的已写入块合并成一个范围
+    for (uint64_t b = 0; b < bb->n_blocks && !t.failed; ) {
+        if (!is_mapped(bb, b)) {
+            b++;
+            continue;
+        }
+        uint64_t first = b;
+        while (b < bb->n_blocks && is_mapped(bb, b)) {
+            b++;
+        }
+        if (hash_range(bb, first, b - 1, buffer, hex) != 0) {
+            t.failed = 1;
+            break;
+        }
+        if (b - 1 == first) {
+            append(&t, "        <Range chksum=\"%s\"> %llu </Range>\n", hex, (unsigned long long)first);
+        } else {
+            append(&t, "        <Range chksum=\"%s\"> %llu-%llu </Range>\n", hex,
+                   (unsigned long long)first, (unsigned long long)(b - 1));
+        }
+    }
+    append(&t, "    </BlockMap>\n");
+    append(&t, "</bmap>\n");
+    free(buffer);
+
+    int ret = -1;
+    if (!t.failed) {
+        sha256_ctx ctx;
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_init(&ctx);
+        sha256_update(&ctx, t.p, t.len);
+        sha256_final(&ctx, digest);
+        hex_digest(digest, hex);
+        memcpy(t.p + sum_pos, hex, 2 * SHA256_DIGEST_SIZE);
+
+        FILE* f = fopen(bb->bmap_path, "wb");
+        if (f) {
+            ret = (fwrite(t.p, 1, t.len, f) == t.len) ? 0 : -1;
+            if (fclose(f) != 0) {
+                ret = -1;
+            }
+        }
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Error: Failed to write block map '%s'.\n", bb->bmap_path);
+        DeleteFile(bb->bmap_path); // 不留下与镜像不符的旧文件
+    }
+    free(t.p);
+    return ret;
+}
+
+/*
+=================================================================================
+ 3. 转换输出
+=================================================================================
+*/
+
+/**
+ * @brief Writes the raw image front to back. Blocks that were never written are zeros and are not read.
+ * @return 0 on success, -1 on failure.
+ */
+static int write_raw_image(bmap_backend* bb, FILE* f) {
+    BYTE* buffer = (BYTE*)calloc(1, BMAP_CHUNK);
+    int ret = buffer ? 0 : -1;
+
+    for (uint64_t offset = 0; offset < bb->size && ret == 0; ) {
+        uint64_t b = offset / BMAP_BLOCK;
+        int mapped = is_mapped(bb, b);
+        size_t n = 0;
+        // 一次处理同一状态的连续块，最多 BMAP_CHUNK 字节
+        while (n < BMAP_CHUNK && offset + n < bb->size && is_mapped(bb, (offset + n) / BMAP_BLOCK) == mapped) {
+            n += BMAP_BLOCK;
+        }
+        if (offset + n > bb->size) {
+            n = (size_t)(bb->size - offset);
+        }
+        if (mapped) {
+            ret = bb->inner->read(bb->inner, buffer, offset, n);
+        } else {
+            memset(buffer, 0, n);
+        }
+        if (ret == 0 && fwrite(buffer, 1, n, f) != n) {
+            ret = -1;
+        }
+        offset += n;
+    }
+    free(buffer);
+    return ret;
+}
+
+/**
+ * @brief Writes the converted image to the output file or stream. A partial output file is removed.
+ * @return 0 on success, -1 on failure.
+ */
+static int write_output(bmap_backend* bb) {
+    FILE* f = bb->out_stream ? bb->out_stream : fopen(bb->out_path, "wb");
+    int ret = -1;
+
+    if (f) {
+        switch (bb->out_format) {
+            case FATIMAGE_OUT_SPARSE:
+                ret = write_sparse_image(bb->inner, bb->map, bb->size, f);
+                break;
+            case FATIMAGE_OUT_GZIP:
+                ret = write_gzip_image(bb->inner, bb->map, bb->size, f);
+                break;
+            default:
+                ret = write_raw_image(bb, f);
+                break;
+        }
+        if (fflush(f) != 0 || (!bb->out_stream && fclose(f) != 0)) {
+            ret = -1;
+        }
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Error: Failed to write image to '%s'.\n", bb->out_stream ? "<stream>" : bb->out_path);
+        if (!bb->out_stream) {
+            DeleteFile(bb->out_path);
+        }
+    }
+    return ret;
+}
+
+/*
+=================================================================================
+ 4. 后端操作
+=================================================================================
+*/
+
+static int bmap_write(fatimage_backend* be, const void* buff, uint64_t offset, size_t bytes) {
+    bmap_backend* bb = (bmap_backend*)be;
+    int ret = bb->inner->write(bb->inner, buff, offset, bytes);
+    if (ret == 0) {
+        mark_range(bb, offset, bytes);
+    }
+    return ret;
+}
+
+static int bmap_read(fatimage_backend* be, void* buff, uint64_t offset, size_t bytes) {
+    bmap_backend* bb = (bmap_backend*)be;
+    return bb->inner->read(bb->inner, buff, offset, bytes);
+}
+
+static int bmap_sync(fatimage_backend* be) {
+    bmap_backend* bb = (bmap_backend*)be;
+    return bb->inner->sync(bb->inner);
+}
+
+static int bmap_close(fatimage_backend* be) {
+    bmap_backend* bb = (bmap_backend*)be;
+    int ret = 0;
+
+    // 先让内层后端写完排队中的数据，再读回计算校验和或转换
+    if (bb->inner->sync(bb->inner) == 0) {
+        // 刷写流程依赖块映射，写不出时整个镜像算作失败
+        if (bb->bmap_path && write_bmap(bb) != 0) {
+            ret = -1;
+        }
+        if ((bb->out_path || bb->out_stream) && write_output(bb) != 0) {
+            ret = -1;
+        }
+    } else {
+        fprintf(stderr, "Error: Failed to write back disk image before writing '%s'.\n",
+                bb->bmap_path ? bb->bmap_path : bb->out_path ? bb->out_path : "<stream>");
+        ret = -1;
+    }
+    if (bb->inner->close(bb->inner) != 0) {
+        ret = -1;
+    }
+    DeleteCriticalSection(&bb->lock);
+    free(bb->bmap_path);
+    free(bb->out_path);
+    free(bb->map);
+    free(bb);
+    return ret;
+}
+
+/**
+ * @brief Drops the outputs of a failed image: on close neither the block map nor the converted image
+ *        is written, so nothing that looks like a finished image reaches the file or the stream.
+ */
+void bmap_backend_discard(fatimage_backend* be) {
+    bmap_backend* bb = (bmap_backend*)be;
+
+    free(bb->bmap_path);
+    free(bb->out_path);
+    bb->bmap_path = NULL;
+    bb->out_path = NULL;
+    bb->out_stream = NULL;
+}
+
+static int bmap_copy_file(fatimage_backend* be, const char* pc_path, uint64_t offset, uint64_t bytes) {
+    bmap_backend* bb = (bmap_backend*)be;
+    int ret = bb->inner->copy_file(bb->inner, pc_path, offset, bytes);
+    if (ret == 0) {
+        mark_range(bb, offset, bytes);
+    }
+    return ret;
+}
+
+/*
+=================================================================================
+ 5. 创建 bmap 后端
+=================================================================================
+*/
+
+/**
+ * @brief Wraps a backend so that the written blocks are recorded. When the backend is closed they are
+ *        written as a bmaptool block map and/or used to convert the image to an Android sparse image or
+ *        a gzip image, or to copy it front to back into a stream. Takes ownership of inner.
+ * @param inner Image backend.
+ * @param size Image size in bytes.
+ * @param bmap_path Block map to write, or NULL.
+ * @param out_format FATIMAGE_OUT_xxx of the converted image.
+ * @param out_path Converted image to write, or NULL.
+ * @param out_stream Stream to write the converted image to instead of out_path (left open), or NULL.
+ * @return New backend, or NULL if out of memory (inner is left open).
+ */
+fatimage_backend* bmap_backend_create(fatimage_backend* inner, uint64_t size, const char* bmap_path,
+                                      int out_format, const char* out_path, FILE* out_stream) {
+    bmap_backend* bb = (bmap_backend*)calloc(1, sizeof(bmap_backend));
+    if (!bb) {
+        return NULL;
+    }
+    bb->size = size;
+    bb->n_blocks = (size + BMAP_BLOCK - 1) / BMAP_BLOCK;
+    bb->map = (BYTE*)calloc(1, (size_t)((bb->n_blocks + 7) / 8));
+    bb->bmap_path = bmap_path ? _strdup(bmap_path) : NULL;
+    bb->out_path = out_path ? _strdup(out_path) : NULL;
+    bb->out_stream = out_stream;
+    bb->out_format = out_format;
+    if (!bb->map || (bmap_path && !bb->bmap_path) || (out_path && !bb->out_path)) {
+        free(bb->map);
+        free(bb->bmap_path);
+        free(bb->out_path);
+        free(bb);
+        return NULL;
+    }
+    bb->inner = inner;
+    InitializeCriticalSection(&bb->lock);
+
+    bb->ops.read = bmap_read;
+    bb->ops.write = bmap_write;
+    bb->ops.sync = bmap_sync;
+    bb->ops.close = bmap_close;
+    bb->ops.copy_file = inner->copy_file ? bmap_copy_file : NULL;
+    return &bb->ops;
+}
@@ -0,0 +1,653 @@
+#include "check.h"
+#include "fatimage.h"
+#include "imgtree.h"
+#include "ff.h"         // FatFs库（只用挂载得到的卷参数）
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 最多逐条报告的问题，其余只计数
+#define CHK_MAX_REPORT  20
+// 报告中使用的路径的最大长度
+#define CHK_PATH_MAX    1024
+
+// 统一后的FAT项：簇链结束和坏簇（FAT12/16/32 的值在载入时换算成 exFAT 的值）
+#define CHK_EOC         0xFFFFFFFF
+#define CHK_BAD         0xFFFFFFF7
+
+/*
+ 一致性检查：不经过 FatFs 的目录和簇链函数（它们每一步 get_fat 都要换入一个FAT扇区），
+ 而是一次读入整个FAT（exFAT 还有分配位图），然后把所有目录直接从镜像读出、逐项解析，
+ 线性地为每个簇记录它的所有者（文件或目录）。一个簇被第二次认领即为交叉链接；
+ 遍历结束后，FAT 中已分配（exFAT 为位图中置位）却没有所有者的簇就是丢失的簇，
+ exFAT 中有所有者却在位图中空闲的簇说明位图与目录不一致。
+ 挂载只用于校验引导扇区并得到卷的几何参数（fatbase、database 等已包含分区的起始位置）。
+
+ 去重镜像（见 dedup.c）中内容相同的文件有意共用一条簇链：从同一个起始簇开始的文件算作共用，不算交叉链接。
+*/
+
+/* 拥有簇的对象：文件、目录或 exFAT 的系统对象（位图、大写表） */
+typedef struct {
+    char* path;
+    DWORD sclust;
+    int is_dir;
+} chk_obj;
+
+typedef struct {
+    fatimage* img;
+    FATFS* fs;
+    uint64_t csize_bytes;   // 簇大小（字节）
+    DWORD* fat;             // 每个簇的下一个簇（CHK_EOC/CHK_BAD/0）
+    BYTE* bitmap;           // exFAT 分配位图，其他格式为NULL
+    DWORD* owner;           // 每个簇的所有者（objs 下标+1），0为无主
+    chk_obj* objs;
+    int n_objs, cap_objs;
+    int n_files, n_dirs, n_shared;
+    uint64_t used;          // 有所有者的簇数
+    long problems;
+} chk_ctx;
+
+/**
+ * @brief Prints one problem, up to CHK_MAX_REPORT in total, and counts it.
+ */
+static void problem(chk_ctx* cx, const char* path, const char* fmt, ...) {
+    if (++cx->problems <= CHK_MAX_REPORT) {
+        va_list ap;
+        va_start(ap, fmt);
+        fprintf(stderr, "Problem: '%s': ", path);
+        vfprintf(stderr, fmt, ap);
+        fprintf(stderr, "\n");
+        va_end(ap);
+    }
+}
+
+static inline DWORD ld_dword(const BYTE* p) {
+    return (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+static inline uint64_t ld_qword(const BYTE* p) {
+    return (uint64_t)ld_dword(p) | ((uint64_t)ld_dword(p + 4) << 32);
+}
+
+/*
+=================================================================================
+ 1. 载入FAT和分配位图
+=================================================================================
+*/
+
+/**
+ * @brief Reads the first FAT once and decodes it into one DWORD per cluster. A second FAT copy, if
+ *        any, is compared with the first.
+ * @return 0 on success, -1 on a read error or out of memory.
+ */
+static int load_fat(chk_ctx* cx) {
+    FATFS* fs = cx->fs;
+    fatimage_backend* be = cx->img->be;
+    size_t fat_bytes = (size_t)fs->fsize * FF_MIN_SS;
+    BYTE* raw = (BYTE*)malloc(fat_bytes);
+
+    cx->fat = (DWORD*)calloc(fs->n_fatent, sizeof(DWORD));
+    if (!raw || !cx->fat) {
+        fprintf(stderr, "Error: Out of memory loading the FAT.\n");
+        free(raw);
+        return -1;
+    }
+    if (be->read(be, raw, (uint64_t)fs->fatbase * FF_MIN_SS, fat_bytes) != 0) {
+        fprintf(stderr, "Error: Failed to read the FAT.\n");
+        free(raw);
+        return -1;
+    }
+
+    for (DWORD c = 2; c < fs->n_fatent; c++) {
+        DWORD v;
+        switch (fs->fs_type) {
+        case FS_FAT12: {
+            UINT ofs = c + c / 2;
+            v = raw[ofs] | ((DWORD)raw[ofs + 1] << 8);
+            v = (c & 1) ? (v >> 4) : (v & 0xFFF);
+            v = (v >= 0xFF8) ? CHK_EOC : (v == 0xFF7) ? CHK_BAD : v;
+            break;
+        }
+        case FS_FAT16:
+            v = raw[c * 2] | ((DWORD)raw[c * 2 + 1] << 8);
+            v = (v >= 0xFFF8) ? CHK_EOC : (v == 0xFFF7) ? CHK_BAD : v;
+            break;
+        case FS_FAT32:
+            v = ld_dword(raw + c * 4) & 0x0FFFFFFF;
+            v = (v >= 0x0FFFFFF8) ? CHK_EOC : (v == 0x0FFFFFF7) ? CHK_BAD : v;
+            break;
+        default:    // exFAT
+            v = ld_dword(raw + c * 4);
+            break;
+        }
+        cx->fat[c] = v;
+    }
+
+    // 第二个FAT应与第一个完全相同，按1MiB分块比较
+    if (fs->n_fats == 2) {
+        size_t chunk_max = 1024 * 1024;
+        BYTE* copy = (BYTE*)malloc(chunk_max);
+        uint64_t diff_sectors = 0;
+        for (size_t done = 0; copy && done < fat_bytes; done += chunk_max) {
+            size_t chunk = (fat_bytes - done < chunk_max) ? fat_bytes - done : chunk_max;
+            if (be->read(be, copy, ((uint64_t)fs->fatbase + fs->fsize) * FF_MIN_SS + done, chunk) != 0) {
+                break;
+            }
+            for (size_t s = 0; s < chunk; s += FF_MIN_SS) {
+                if (memcmp(raw + done + s, copy + s, FF_MIN_SS) != 0) {
+                    diff_sectors++;
+                }
+            }
+        }
+        free(copy);
+        if (diff_sectors) {
+            problem(cx, "<FAT>", "the second FAT differs from the first in %llu sectors", (unsigned long long)diff_sectors);
+        }
+    }
+    free(raw);
+    return 0;
+}
+
+/**
+ * @brief Reads the exFAT allocation bitmap (one bit per cluster, from cluster 2).
+ * @return 0 on success, -1 on failure.
+ */
+static int load_bitmap(chk_ctx* cx) {
+    FATFS* fs = cx->fs;
+    size_t bytes = (size_t)(fs->n_fatent - 2 + 7) / 8;
+
+    cx->bitmap = (BYTE*)malloc(bytes);
+    if (!cx->bitmap) {
+        fprintf(stderr, "Error: Out of memory loading the allocation bitmap.\n");
+        return -1;
+    }
+    if (cx->img->be->read(cx->img->be, cx->bitmap, (uint64_t)fs->bitbase * FF_MIN_SS, bytes) != 0) {
+        fprintf(stderr, "Error: Failed to read the allocation bitmap.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 认领簇链
+=================================================================================
+*/
+
+static int add_obj(chk_ctx* cx, const char* path, DWORD sclust, int is_dir) {
+    if (cx->n_objs == cx->cap_objs) {
+        int new_cap = cx->cap_objs ? cx->cap_objs * 2 : 1024;
+        chk_obj* p = (chk_obj*)realloc(cx->objs, new_cap * sizeof(chk_obj));
+        if (!p) {
+            return -1;
+        }
+        cx->objs = p;
+        cx->cap_objs = new_cap;
+    }
+    chk_obj* o = &cx->objs[cx->n_objs];
+    if (!(o->path = _strdup(path))) {
+        return -1;
+    }
+    o->sclust = sclust;
+    o->is_dir = is_dir;
+    return cx->n_objs++;
+}
+
+/**
+ * @brief Marks the clusters of one object as owned by it: a FAT chain from sclust, or (exFAT "no FAT
+ *        chain" objects) n_contig clusters from sclust. Problems along the way are reported and end the
+ *        chain there.
+ * @param list If not NULL, receives the owned clusters in chain order (caller frees).
+ * @return Number of clusters owned, or -1 if the object shares its whole chain with an earlier file.
+ */
+static int64_t claim(chk_ctx* cx, int obj, DWORD sclust, int contig, DWORD n_contig, DWORD** list) {
+    FATFS* fs = cx->fs;
+    const char* path = cx->objs[obj].path;
+    DWORD cap = 0;
+    int64_t n = 0;
+    DWORD c = sclust;
+
+    if (list) {
+        *list = NULL;
+    }
+    if (sclust == 0) {
+        return 0;
+    }
+    // 去重镜像：与之前的文件从同一个簇开始，整条簇链共用
+    if (sclust >= 2 && sclust < fs->n_fatent && cx->owner[sclust] != 0 && !cx->objs[obj].is_dir) {
+        const chk_obj* o = &cx->objs[cx->owner[sclust] - 1];
+        if (!o->is_dir && o->sclust == sclust) {
+            cx->n_shared++;
+            return -1;
+        }
+    }
+
+    while (contig ? (DWORD)n < n_contig : c != CHK_EOC) {
+        if (c < 2 || c >= fs->n_fatent) {
+            problem(cx, path, "cluster chain points outside the volume (cluster %lu, after %lld clusters)", (unsigned long)c, (long long)n);
+            break;
+        }
+        if (cx->owner[c] != 0) {
+            if (cx->owner[c] == (DWORD)obj + 1) {
+                problem(cx, path, "cluster chain loops back to cluster %lu after %lld clusters", (unsigned long)c, (long long)n);
+            } else {
+                problem(cx, path, "cross-linked with '%s' at cluster %lu", cx->objs[cx->owner[c] - 1].path, (unsigned long)c);
+            }
+            break;
+        }
+        if (!contig && (cx->fat[c] == 0 || cx->fat[c] == CHK_BAD)) {
+            problem(cx, path, "cluster %lu of the chain is marked %s in the FAT", (unsigned long)c, cx->fat[c] ? "bad" : "free");
+            break;
+        }
+        cx->owner[c] = (DWORD)obj + 1;
+        cx->used++;
+        if (list) {
+            if ((DWORD)n == cap) {
+                cap = cap ? cap * 2 : 16;
+                DWORD* p = (DWORD*)realloc(*list, cap * sizeof(DWORD));
+                if (!p) {
+                    fprintf(stderr, "Error: Out of memory.\n");
+                    break;
+                }
+                *list = p;
+            }
+            (*list)[n] = c;
+        }
+        n++;
+        c = contig ? c + 1 : cx->fat[c];
+    }
+    return n;
+}
+
+/*
+=================================================================================
+ 3. 直接解析目录项
+=================================================================================
+*/
+
+/**
+ * @brief Appends UTF-16 text as UTF-8 (unpaired surrogates become '?').
+ * @return Number of bytes written (out is always NUL-terminated).
+ */
+static size_t utf16_to_utf8(const WCHAR* in, size_t n_in, char* out, size_t cap) {
+    size_t o = 0;
+
+    for (size_t i = 0; i < n_in && in[i] && in[i] != 0xFFFF; i++) {
+        DWORD u = in[i];
+        if (u >= 0xD800 && u <= 0xDBFF && i + 1 < n_in && in[i + 1] >= 0xDC00 && in[i + 1] <= 0xDFFF) {
+            u = 0x10000 + ((u - 0xD800) << 10) + (in[++i] - 0xDC00);
+        } else if (u >= 0xD800 && u <= 0xDFFF) {
+            u = '?';
+        }
+        BYTE b[4];
+        int len;
+        if (u < 0x80) { b[0] = (BYTE)u; len = 1; }
+        else if (u < 0x800) { b[0] = 0xC0 | (u >> 6); b[1] = 0x80 | (u & 0x3F); len = 2; }
+        else if (u < 0x10000) { b[0] = 0xE0 | (u >> 12); b[1] = 0x80 | ((u >> 6) & 0x3F); b[2] = 0x80 | (u & 0x3F); len = 3; }
+        else { b[0] = 0xF0 | (u >> 18); b[1] = 0x80 | ((u >> 12) & 0x3F); b[2] = 0x80 | ((u >> 6) & 0x3F); b[3] = 0x80 | (u & 0x3F); len = 4; }
+        if (o + len >= cap) {
+            break;
+        }
+        memcpy(out + o, b, len);
+        o += len;
+    }
+    out[o] = '\0';
+    return o;
+}
+
+static void check_dir(chk_ctx* cx, int obj, const BYTE* data, size_t bytes);
+
+/**
+ * @brief Builds the path of a directory entry for reports ("/" is the root).
+ */
+static void join_path(char* out, size_t cap, const char* parent, const char* name) {
+    snprintf(out, cap, "%s%s%s", parent, strcmp(parent, "/") == 0 ? "" : "/", name);
+}
+
+/**
+ * @brief Checks one directory entry: claims its clusters, compares the chain length with the size, and
+ *        descends into sub-directories.
+ * @param sized Whether size is known: files, and exFAT sub-directories (FAT directory entries and the root
+ *              directory have no size).
+ */
+static void check_entry(chk_ctx* cx, const char* path, int is_dir, DWORD sclust, int contig, int sized, uint64_t size) {
+    FATFS* fs = cx->fs;
+    DWORD* list = NULL;
+
+    int obj = add_obj(cx, path, sclust, is_dir);
+    if (obj < 0) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        cx->problems++;
+        return;
+    }
+    uint64_t need = (size + cx->csize_bytes - 1) / cx->csize_bytes;
+    if (contig && need > fs->n_fatent) {
+        need = fs->n_fatent; // 大小已损坏，越界的簇在认领时报告
+    }
+    int64_t n = claim(cx, obj, sclust, contig, (DWORD)need, is_dir ? &list : NULL);
+
+    if (!is_dir) {
+        cx->n_files++;
+        if (n >= 0 && (uint64_t)n != need) {
+            problem(cx, path, "size %llu needs %llu clusters but the cluster chain has %lld",
+                    (unsigned long long)size, (unsigned long long)need, (long long)n);
+        }
+        return;
+    }
+
+    cx->n_dirs++;
+    if (n <= 0) {
+        problem(cx, path, "directory has no clusters (start cluster %lu)", (unsigned long)sclust);
+        free(list);
+        return;
+    }
+    if (sized && (uint64_t)n != need) {
+        problem(cx, path, "directory size needs %llu clusters but the cluster chain has %lld",
+                (unsigned long long)need, (long long)n);
+    }
+    // 读入目录的全部簇，相邻的簇合并成一次读取
+    size_t dir_bytes = (size_t)n * cx->csize_bytes;
+    BYTE* data = (BYTE*)malloc(dir_bytes);
+    int ok = data != NULL;
+    for (int64_t i = 0; ok && i < n; ) {
+        int64_t j = i + 1;
+        while (j < n && list[j] == list[j - 1] + 1) {
+            j++;
+        }
+        uint64_t ofs = ((uint64_t)fs->database + (uint64_t)fs->csize * (list[i] - 2)) * FF_MIN_SS;
+        ok = cx->img->be->read(cx->img->be, data + i * cx->csize_bytes, ofs, (size_t)(j - i) * cx->csize_bytes) == 0;
+        i = j;
+    }
+    free(list);
+    if (!ok) {
+        fprintf(stderr, "Error: Failed to read directory '%s'.\n", path);
+        cx->problems++;
+    } else {
+        check_dir(cx, obj, data, dir_bytes);
+    }
+    free(data);
+}
+
+/**
+ * @brief Parses the entries of a FAT12/16/32 directory (long file names with their checksums).
+ */
+static void check_fat_dir(chk_ctx* cx, int obj, const BYTE* data, size_t bytes) {
+    WCHAR lfn[20 * 13 + 1];
+    int lfn_ord = 0;
+    BYTE lfn_sum = 0;
+    char name[CHK_PATH_MAX];
+    char parent[CHK_PATH_MAX];
+    char path[CHK_PATH_MAX];
+
+    // check_entry 会扩展 objs，先拷贝父目录路径
+    snprintf(parent, sizeof(parent), "%s", cx->objs[obj].path);
+    for (size_t ofs = 0; ofs + 32 <= bytes; ofs += 32) {
+        const BYTE* e = data + ofs;
+        BYTE attr = e[11];
+        if (e[0] == 0x00) {
+            break;      // 目录结束
+        }
+        if (e[0] == 0xE5) {
+            lfn_ord = 0; // 已删除
+            continue;
+        }
+        if ((attr & 0x3F) == 0x0F) {
+            // 长文件名项：序号从大到小排列，每项13个UTF-16字符
+            int ord = e[0] & 0x3F;
+            if (ord < 1 || ord > 20) {
+                lfn_ord = 0;
+            } else if (e[0] & 0x40) {
+                lfn_ord = ord;
+                lfn_sum = e[13];
+                memset(lfn, 0, sizeof(lfn));
+            } else if (ord != lfn_ord - 1 || e[13] != lfn_sum) {
+                lfn_ord = 0;
+                continue;
+            } else {
+                lfn_ord = ord;
+            }
+            if (lfn_ord) {
+                static const BYTE pos[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+                for (int k = 0; k < 13; k++) {
+                    lfn[(ord - 1) * 13 + k] = (WCHAR)(e[pos[k]] | (e[pos[k] + 1] << 8));
+                }
+            }
+            continue;
+        }
+        if ((attr & 0x08) || e[0] == '.') {
+            lfn_ord = 0; // 卷标、"." 和 ".."
+            continue;
+        }
+
+        BYTE sum = 0;
+        for (int k = 0; k < 11; k++) {
+            sum = (BYTE)(((sum & 1) << 7) + (sum >> 1) + e[k]);
+        }
+        if (lfn_ord == 1 && sum == lfn_sum) {
+            utf16_to_utf8(lfn, 20 * 13, name, sizeof(name));
+        } else {
+            // 短文件名，NT 保留字节的 0x08/0x10 表示主名/扩展名为小写
+            int n = 0;
+            for (int k = 0; k < 8 && e[k] != ' '; k++) {
+                char ch = (k == 0 && e[0] == 0x05) ? (char)0xE5 : (char)e[k];
+                name[n++] = (e[12] & 0x08 && ch >= 'A' && ch <= 'Z') ? ch + 32 : ch;
+            }
+            if (e[8] != ' ') {
+                name[n++] = '.';
+                for (int k = 8; k < 11 && e[k] != ' '; k++) {
+                    name[n++] = (e[12] & 0x10 && e[k] >= 'A' && e[k] <= 'Z') ? e[k] + 32 : e[k];
+                }
+            }
+            name[n] = '\0';
+        }
+        lfn_ord = 0;
+
+        DWORD sclust = e[26] | ((DWORD)e[27] << 8);
+        if (cx->fs->fs_type == FS_FAT32) {
+            sclust |= ((DWORD)e[20] << 16) | ((DWORD)e[21] << 24);
+        }
+        join_path(path, sizeof(path), parent, name);
+        check_entry(cx, path, (attr & AM_DIR) != 0, sclust, 0, !(attr & AM_DIR), ld_dword(e + 28));
+    }
+}
+
+/**
+ * @brief Parses the entry sets of an exFAT directory. In the root directory the allocation bitmap and
+ *        up-case table entries are claimed as system objects.
+ */
+static void check_exfat_dir(chk_ctx* cx, int obj, const BYTE* data, size_t bytes) {
+    WCHAR uname[256];
+    char name[CHK_PATH_MAX];
+    char parent[CHK_PATH_MAX];
+    char path[CHK_PATH_MAX];
+    size_t n_ent = bytes / 32;
+
+    snprintf(parent, sizeof(parent), "%s", cx->objs[obj].path);
+    for (size_t i = 0; i < n_ent; i++) {
+        const BYTE* e = data + i * 32;
+        BYTE type = e[0];
+        if (type == 0x00) {
+            break;
+        }
+        if (!(type & 0x80)) {
+            continue;   // 已删除
+        }
+
+        // 根目录中的分配位图和大写表，其簇链登记在FAT中
+        if ((type == 0x81 || type == 0x82) && obj == 0) {
+            const char* sys = (type == 0x81) ? "<allocation bitmap>" : "<up-case table>";
+            DWORD sclust = ld_dword(e + 20);
+            uint64_t need = (ld_qword(e + 24) + cx->csize_bytes - 1) / cx->csize_bytes;
+            int sobj = add_obj(cx, sys, sclust, 0);
+            int64_t n = (sobj < 0) ? 0 : claim(cx, sobj, sclust, 0, 0, NULL);
+            if (sobj >= 0 && (uint64_t)n != need) {
+                problem(cx, sys, "size needs %llu clusters but the cluster chain has %lld", (unsigned long long)need, (long long)n);
+            }
+            continue;
+        }
+        if (type != 0x85) {
+            continue;   // 卷标、GUID 等不占用簇
+        }
+
+        // 文件目录项集：0x85 + 0xC0（流扩展）+ 若干 0xC1（文件名）
+        size_t n_sec = e[1];
+        if (n_sec < 2 || i + n_sec >= n_ent || data[(i + 1) * 32] != 0xC0) {
+            problem(cx, parent, "broken directory entry set at entry %llu", (unsigned long long)i);
+            continue;
+        }
+        WORD sum = 0;
+        for (size_t k = 0; k < (n_sec + 1) * 32; k++) {
+            if (k == 2 || k == 3) {
+                continue;
+            }
+            sum = (WORD)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + e[k]);
+        }
+        const BYTE* st = e + 32;
+        int len = 0;
+        for (size_t k = 2; k <= n_sec && data[(i + k) * 32] == 0xC1; k++) {
+            for (int m = 0; m < 15 && len < 255; m++) {
+                const BYTE* p = data + (i + k) * 32 + 2 + m * 2;
+                uname[len++] = (WCHAR)(p[0] | (p[1] << 8));
+            }
+        }
+        if (len > st[3]) {
+            len = st[3];
+        }
+        utf16_to_utf8(uname, len, name, sizeof(name));
+        join_path(path, sizeof(path), parent, name);
+        if (sum != (WORD)(e[2] | (e[3] << 8))) {
+            problem(cx, path, "directory entry set checksum is %04X, expected %04X", (unsigned)(e[2] | (e[3] << 8)), (unsigned)sum);
+        }
+        WORD attr = (WORD)(e[4] | (e[5] << 8));
+        int contig = (st[1] & 0x02) != 0;   // NoFatChain：簇连续，FAT中没有簇链
+        check_entry(cx, path, (attr & AM_DIR) != 0, ld_dword(st + 20), contig, 1, ld_qword(st + 24));
+        i += n_sec;
+    }
+}
+
+static void check_dir(chk_ctx* cx, int obj, const BYTE* data, size_t bytes) {
+    if (cx->fs->fs_type == FS_EXFAT) {
+        check_exfat_dir(cx, obj, data, bytes);
+    } else {
+        check_fat_dir(cx, obj, data, bytes);
+    }
+}
+
+/*
+=================================================================================
+ 4. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Checks the allocation structures of an image (raw image, or the first FAT/exFAT partition of a
+ *        partitioned one) in one linear pass: the FAT (and exFAT bitmap) is loaded once, every directory
+ *        is parsed straight from the image, and each cluster gets one owner. Reports cross-linked and
+ *        looping chains, chains that run into free or bad clusters, file sizes that do not match their
+ *        chain length, lost clusters, a second FAT that differs from the first, and exFAT clusters in use
+ *        but free in the allocation bitmap. Problems go to stderr (the first CHK_MAX_REPORT of them).
+ * @return 0 if the image is consistent, -1 on problems or failure.
+ */
+int check_image(const char* image_path) {
+    chk_ctx cx;
+    int ret = -1;
+
+    memset(&cx, 0, sizeof(cx));
+    cx.img = image_open_mounted(image_path);
+    if (!cx.img) {
+        return -1;
+    }
+    cx.fs = &cx.img->fs;
+    FATFS* fs = cx.fs;
+    cx.csize_bytes = (uint64_t)fs->csize * FF_MIN_SS;
+    cx.owner = (DWORD*)calloc(fs->n_fatent, sizeof(DWORD));
+    if (!cx.owner) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        fatimage_close(cx.img);
+        return -1;
+    }
+    if (load_fat(&cx) != 0 || (fs->fs_type == FS_EXFAT && load_bitmap(&cx) != 0)) {
+        goto done;
+    }
+
+    // 1. 从根目录开始遍历：FAT12/16 的根目录在固定区域，FAT32/exFAT 的根目录是一条簇链
+    if (fs->fs_type == FS_FAT12 || fs->fs_type == FS_FAT16) {
+        size_t bytes = (size_t)fs->n_rootdir * 32;
+        BYTE* data = (BYTE*)malloc(bytes);
+        if (add_obj(&cx, "/", 0, 1) < 0 || !data ||
+            cx.img->be->read(cx.img->be, data, (uint64_t)fs->dirbase * FF_MIN_SS, bytes) != 0) {
+            fprintf(stderr, "Error: Failed to read the root directory.\n");
+            free(data);
+            goto done;
+        }
+        check_dir(&cx, 0, data, bytes);
+        free(data);
+    } else {
+        check_entry(&cx, "/", 1, (DWORD)fs->dirbase, 0, 0, 0);
+        cx.n_dirs--; // 只统计子目录
+    }
+
+    // 2. 丢失的簇：FAT中已分配（exFAT 为位图中置位）却不属于任何对象。
+    //    丢失的簇链数 = 丢失的簇数 - 丢失的簇之间的链接数（exFAT 按连续段计）
+    uint64_t lost = 0, links = 0, unmarked = 0;
+    for (DWORD c = 2; c < fs->n_fatent; c++) {
+        int allocated;
+        if (cx.bitmap) {
+            allocated = (cx.bitmap[(c - 2) / 8] >> ((c - 2) % 8)) & 1;
+        } else {
+            allocated = cx.fat[c] != 0 && cx.fat[c] != CHK_BAD;
+        }
+        if (cx.owner[c] != 0) {
+            if (!allocated) {
+                unmarked++; // 只有 exFAT 会出现：簇链上的空闲簇已在认领时报告
+            }
+            continue;
+        }
+        if (!allocated) {
+            continue;
+        }
+        lost++;
+        DWORD nx = cx.bitmap ? c + 1 : cx.fat[c];
+        if (nx >= 2 && nx < fs->n_fatent && cx.owner[nx] == 0 &&
+            (cx.bitmap ? (cx.bitmap[(nx - 2) / 8] >> ((nx - 2) % 8)) & 1 : cx.fat[nx] != 0 && cx.fat[nx] != CHK_BAD)) {
+            links++;
+        }
+    }
+    if (lost) {
+        problem(&cx, fs->fs_type == FS_EXFAT ? "<allocation bitmap>" : "<FAT>",
+                "%llu lost clusters in %llu chains (allocated but not used by any file or directory)",
+                (unsigned long long)lost, (unsigned long long)(lost > links ? lost - links : 1));
+    }
+    if (unmarked) {
+        problem(&cx, "<allocation bitmap>", "%llu clusters in use are marked free", (unsigned long long)unmarked);
+    }
+
+    static const char* const fs_names[] = { "", "FAT12", "FAT16", "FAT32", "exFAT" };
+    if (cx.problems) {
+        if (cx.problems > CHK_MAX_REPORT) {
+            fprintf(stderr, "... and %ld more.\n", cx.problems - CHK_MAX_REPORT);
+        }
+        fprintf(stderr, "Error: '%s' (%s) has %ld problems.\n", image_path, fs_names[fs->fs_type], cx.problems);
+    } else {
+        printf("Checked '%s' (%s): %d files, %d directories, %llu of %lu clusters in use", image_path,
+               fs_names[fs->fs_type], cx.n_files, cx.n_dirs, (unsigned long long)cx.used, (unsigned long)(fs->n_fatent - 2));
+        if (cx.n_shared) {
+            printf(", %d files share clusters with an identical file", cx.n_shared);
+        }
+        printf(". No problems found.\n");
+        ret = 0;
+    }
+
+done:
+    for (int i = 0; i < cx.n_objs; i++) {
+        free(cx.objs[i].path);
+    }
+    free(cx.objs);
+    free(cx.owner);
+    free(cx.fat);
+    free(cx.bitmap);
+    fatimage_close(cx.img);
+    return ret;
+}
@@ -0,0 +1,6 @@
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+/* 一致性检查：簇链交叉、丢失的簇链、文件大小与簇链长度不符、exFAT 分配位图与实际使用不一致 */
+int check_image(const char* image_path);
+#endif
@@ -0,0 +1,216 @@
+#include "dedup.h"
+#include "sha256.h"
+#include <windows.h>    // MAX_PATH
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ 重复文件检测：规划阶段先按大小分组，只对大小与其它文件相同的文件计算 SHA-256，
+ 大小和摘要都相同的文件归为一组。拷贝时组内第一个写入的文件正常分配簇，
+ 其余文件通过 f_sharechain 让目录项指向同一条簇链，不再占用空间。
+ 这样的镜像中存在交叉链接的文件，只能只读挂载。
+*/
+
+typedef struct {
+    char* path;                 // 源文件完整路径（与拷贝时拼出的路径相同）
+    src_node* node;             // 规划阶段对应的节点（之后不再使用）
+    size_t order;               // 遍历顺序，每组第一个文件不标记为重复
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    dedup_group* group;
+} dedup_file;
+
+struct dedup_table {
+    dedup_file* files;          // 按路径排序，供拷贝时查找
+    size_t n_files;
+    dedup_group* groups;
+    size_t n_groups;
+};
+
+/*
+=================================================================================
+ 1. 辅助函数：收集文件、排序
+=================================================================================
+*/
+
+/**
+ * @brief Appends every non-empty file below dir to the table (in walk order), recursively.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int collect_files(dedup_table* t, size_t* cap, const char* pc_dir_path, src_node* dir) {
+    char path[MAX_PATH];
+
+    for (size_t i = 0; i < dir->n_children; i++) {
+        src_node* child = &dir->children[i];
+        snprintf(path, sizeof(path), "%s/%s", pc_dir_path, child->name);
+        child->dup = 0;
+        if (child->is_dir) {
+            if (collect_files(t, cap, path, child) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (child->size == 0) {
+            continue; // 空文件不占用簇
+        }
+        if (t->n_files == *cap) {
+            size_t new_cap = (*cap == 0) ? 256 : *cap * 2;
+            dedup_file* p = (dedup_file*)realloc(t->files, new_cap * sizeof(dedup_file));
+            if (!p) {
+                return -1;
+            }
+            t->files = p;
+            *cap = new_cap;
+        }
+        dedup_file* f = &t->files[t->n_files];
+        memset(f, 0, sizeof(*f));
+        if (!(f->path = _strdup(path))) {
+            return -1;
+        }
+        f->node = child;
+        f->order = t->n_files++;
+    }
+    return 0;
+}
+
+static int cmp_size(const void* a, const void* b) {
+    uint64_t x = ((const dedup_file*)a)->node->size, y = ((const dedup_file*)b)->node->size;
+    return (x > y) - (x < y);
+}
+
+static int cmp_content(const void* a, const void* b) {
+    const dedup_file* x = (const dedup_file*)a;
+    const dedup_file* y = (const dedup_file*)b;
+    int c = cmp_size(a, b);
+    if (c == 0) {
+        c = memcmp(x->digest, y->digest, SHA256_DIGEST_SIZE);
+    }
+    if (c == 0) {
+        c = (x->order > y->order) - (x->order < y->order);
+    }
+    return c;
+}
+
+static int cmp_path(const void* a, const void* b) {
+    return strcmp(((const dedup_file*)a)->path, ((const dedup_file*)b)->path);
+}
+
+/*
+=================================================================================
+ 2. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Finds the files of a scanned source tree that have identical contents. Only files whose size
+ *        equals another file's are hashed. Every file but the first of each group (in walk order) gets
+ *        its dup flag set, so the planner does not count its clusters.
+ * @param pc_dir_path Source folder on the PC (the path root was scanned from).
+ * @param root Scanned source tree.
+ * @param cache Shared source cache, or NULL to read the files directly.
+ * @return New table, or NULL on failure.
+ */
+dedup_table* dedup_plan(const char* pc_dir_path, src_node* root, src_cache* cache) {
+    dedup_table* t = (dedup_table*)calloc(1, sizeof(dedup_table));
+    size_t cap = 0, n = 0;
+
+    if (!t || collect_files(t, &cap, pc_dir_path, root) != 0) {
+        fprintf(stderr, "Error: Out of memory while looking for duplicate files.\n");
+        dedup_free(t);
+        return NULL;
+    }
+
+    // 1. 按大小排序，大小唯一的文件不可能重复，直接丢弃；其余文件计算摘要并移到数组前部
+    qsort(t->files, t->n_files, sizeof(dedup_file), cmp_size);
+    for (size_t i = 0, j; i < t->n_files; i = j) {
+        for (j = i + 1; j < t->n_files && t->files[j].node->size == t->files[i].node->size; j++) ;
+        for (size_t k = i; k < j; k++) {
+            dedup_file f = t->files[k];
+            if (j - i < 2) {
+                free(f.path);
+                continue;
+            }
+            if (src_cache_digest(cache, f.path, f.digest) != 0) {
+                free(f.path);
+                for (k++; k < t->n_files; k++) {
+                    free(t->files[k].path);
+                }
+                t->n_files = n;
+                dedup_free(t);
+                return NULL;
+            }
+            t->files[n++] = f;
+        }
+    }
+    t->n_files = n;
+
+    // 2. 大小和摘要都相同的文件归为一组，组内按遍历顺序第一个文件之外的都标记为重复
+    t->groups = (dedup_group*)calloc(n / 2 + 1, sizeof(dedup_group));
+    if (!t->groups) {
+        fprintf(stderr, "Error: Out of memory while looking for duplicate files.\n");
+        dedup_free(t);
+        return NULL;
+    }
+    qsort(t->files, n, sizeof(dedup_file), cmp_content);
+    n = 0;
+    for (size_t i = 0, j; i < t->n_files; i = j) {
+        for (j = i + 1; j < t->n_files && cmp_size(&t->files[i], &t->files[j]) == 0 &&
+                        memcmp(t->files[i].digest, t->files[j].digest, SHA256_DIGEST_SIZE) == 0; j++) ;
+        if (j - i < 2) {
+            free(t->files[i].path);
+            continue;
+        }
+        dedup_group* g = &t->groups[t->n_groups++];
+        g->size = t->files[i].node->size;
+        g->members = j - i;
+        for (size_t k = i; k < j; k++) {
+            t->files[k].group = g;
+            t->files[k].node->dup = (k > i);
+            t->files[k].node = NULL;
+            t->files[n++] = t->files[k];
+        }
+    }
+    t->n_files = n;
+
+    // 3. 按路径排序，拷贝时用二分查找
+    qsort(t->files, n, sizeof(dedup_file), cmp_path);
+    return t;
+}
+
+/**
+ * @brief Returns the duplicate group of a source file, or NULL if its contents are unique.
+ * @param pc_path Full path of the source file, built the same way as during planning.
+ */
+dedup_group* dedup_find(dedup_table* table, const char* pc_path) {
+    dedup_file key;
+
+    key.path = (char*)pc_path;
+    dedup_file* f = (dedup_file*)bsearch(&key, table->files, table->n_files, sizeof(dedup_file), cmp_path);
+    return f ? f->group : NULL;
+}
+
+/**
+ * @brief Reports how many files share another file's clusters and the space they would otherwise take.
+ * @param cluster_bytes Cluster size of the image.
+ */
+void dedup_savings(const dedup_table* table, DWORD cluster_bytes, uint64_t* files, uint64_t* bytes) {
+    *files = 0;
+    *bytes = 0;
+    for (size_t i = 0; i < table->n_groups; i++) {
+        const dedup_group* g = &table->groups[i];
+        *files += g->members - 1;
+        *bytes += (g->members - 1) * ((g->size + cluster_bytes - 1) / cluster_bytes * cluster_bytes);
+    }
+}
+
+void dedup_free(dedup_table* table) {
+    if (!table) {
+        return;
+    }
+    for (size_t i = 0; i < table->n_files; i++) {
+        free(table->files[i].path);
+    }
+    free(table->files);
+    free(table->groups);
+    free(table);
+}
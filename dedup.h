@@ -0,0 +1,23 @@
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+#include <stdint.h>
+#include "ff.h"
+#include "scan.h"
+#include "srccache.h"
+
+/* 一组内容相同的文件：第一个写入镜像的文件分配簇，之后的文件共用它的簇链 */
+typedef struct {
+    uint64_t size;      // 文件大小（字节）
+    size_t members;     // 组内文件个数
+    DWORD sclust;       // 已写入文件的起始簇，0表示组内还没有文件写入
+    BYTE nofat;         // 簇链连续且不记录在FAT中（exFAT）
+} dedup_group;
+
+/* 源目录中的重复文件表（只包含至少与另一个文件内容相同的文件） */
+typedef struct dedup_table dedup_table;
+
+dedup_table* dedup_plan(const char* pc_dir_path, src_node* root, src_cache* cache);
+dedup_group* dedup_find(dedup_table* table, const char* pc_path);
+void dedup_savings(const dedup_table* table, DWORD cluster_bytes, uint64_t* files, uint64_t* bytes);
+void dedup_free(dedup_table* table);
+#endif
@@ -0,0 +1,445 @@
+#include "deflate.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_SIZE     32768
+#define HASH_BITS       15
+#define HASH_SIZE       (1 << HASH_BITS)
+// 每个位置最多比较的候选匹配数
+#define MAX_CHAIN       48
+#define MIN_MATCH       3
+#define MAX_MATCH       258
+#define LITLEN_CODES    286
+#define DIST_CODES      30
+#define CLEN_CODES      19
+#define MAX_BITS        15
+#define MAX_CLEN_BITS   7
+
+/* CRC-32（IEEE 802.3，反射多项式 0xedb88320），gzip 尾部使用 */
+static const uint32_t crc_table[256] = {
+    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
+    0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
+    0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
+    0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
+    0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
+    0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
+    0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
+    0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
+    0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
+    0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
+    0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
+    0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
+    0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
+    0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
+    0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
+    0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
+    0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
+    0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
+    0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
+    0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
+    0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
+    0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+/* 长度码 257-285 和距离码 0-29 的基值与附加位数（RFC 1951 3.2.5） */
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* 码长码的传输顺序 */
+static const uint8_t clen_order[CLEN_CODES] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+struct deflate_state {
+    int32_t head[HASH_SIZE];            // 哈希 -> 最近的位置，-1表示没有
+    int32_t prev[DEFLATE_MAX_INPUT];    // 位置 -> 同一哈希的上一个位置
+    uint16_t lit[DEFLATE_MAX_INPUT];    // 记号：字面量字节，或匹配长度
+    uint16_t dist[DEFLATE_MAX_INPUT];   // 记号：匹配距离，0表示字面量
+    uint8_t len_code[MAX_MATCH + 1];    // 匹配长度 -> 长度码下标
+    uint8_t dist_code[512];             // 距离-1 < 256 直接查表，否则查 256 + ((距离-1) >> 7)
+};
+
+/* 按位输出，低位在前 */
+typedef struct {
+    uint8_t* p;
+    size_t pos, cap;
+    uint32_t bits;
+    int n;
+    int overflow;
+} bit_writer;
+
+/*
+=================================================================================
+ 1. 辅助函数：CRC、位输出
+=================================================================================
+*/
+
+/**
+ * @brief Continues a CRC-32 over more data; start with crc = 0.
+ */
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+
+    crc = ~crc;
+    while (len--) {
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_bits(bit_writer* w, uint32_t v, int n) {
+    w->bits |= v << w->n;
+    w->n += n;
+    while (w->n >= 8) {
+        if (w->pos < w->cap) {
+            w->p[w->pos++] = (uint8_t)w->bits;
+        } else {
+            w->overflow = 1;
+        }
+        w->bits >>= 8;
+        w->n -= 8;
+    }
+}
+
+static void flush_bits(bit_writer* w) {
+    if (w->n > 0) {
+        put_bits(w, 0, 8 - w->n);
+    }
+}
+
+static uint16_t reverse_bits(uint16_t code, int n) {
+    uint16_t r = 0;
+    for (int i = 0; i < n; i++) {
+        r = (uint16_t)((r << 1) | (code & 1));
+        code >>= 1;
+    }
+    return r;
+}
+
+/*
+=================================================================================
+ 2. 哈夫曼编码
+=================================================================================
+*/
+
+/**
+ * @brief Computes Huffman code lengths no longer than limit for the given symbol frequencies.
+ *        At least two symbols get a code, so every decoder accepts the table. When the tree is
+ *        too deep the frequencies are flattened and the tree is built again.
+ */
+static void build_lengths(const uint32_t* freq, int n, int limit, uint8_t* lens) {
+    uint32_t f[LITLEN_CODES], w[2 * LITLEN_CODES];
+    uint16_t sym[LITLEN_CODES], parent[2 * LITLEN_CODES];
+    uint8_t depth[2 * LITLEN_CODES];
+
+    memcpy(f, freq, n * sizeof(uint32_t));
+    for (;;) {
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            if (f[i]) {
+                sym[m++] = (uint16_t)i;
+            }
+        }
+        for (int i = 0; m < 2; i++) {
+            if (!f[i]) {
+                f[i] = 1;
+                sym[m++] = (uint16_t)i;
+            }
+        }
+        // 按频率升序插入排序（符号数很少）
+        for (int i = 1; i < m; i++) {
+            uint16_t s = sym[i];
+            int j = i;
+            for (; j > 0 && f[sym[j - 1]] > f[s]; j--) {
+                sym[j] = sym[j - 1];
+            }
+            sym[j] = s;
+        }
+        // 两个队列：叶子按频率排序，内部节点按生成顺序，权值都不减
+        for (int i = 0; i < m; i++) {
+            w[i] = f[sym[i]];
+        }
+        int li = 0, ii = m, next = m;
+        while (next < 2 * m - 1) {
+            int a = (li < m && (ii >= next || w[li] <= w[ii])) ? li++ : ii++;
+            int b = (li < m && (ii >= next || w[li] <= w[ii])) ? li++ : ii++;
+            w[next] = w[a] + w[b];
+            parent[a] = parent[b] = (uint16_t)next;
+            next++;
+        }
+        depth[2 * m - 2] = 0;
+        for (int i = 2 * m - 3; i >= 0; i--) {
+            depth[i] = depth[parent[i]] + 1;
+        }
+
+        int max_depth = 0;
+        memset(lens, 0, n);
+        for (int i = 0; i < m; i++) {
+            lens[sym[i]] = depth[i];
+            if (depth[i] > max_depth) {
+                max_depth = depth[i];
+            }
+        }
+        if (max_depth <= limit) {
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (f[i]) {
+                f[i] = (f[i] >> 1) | 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Assigns canonical codes for the code lengths, bit-reversed for the LSB-first output.
+ */
+static void build_codes(const uint8_t* lens, int n, uint16_t* codes) {
+    uint16_t bl_count[MAX_BITS + 1] = { 0 }, next[MAX_BITS + 1];
+    uint16_t code = 0;
+
+    for (int i = 0; i < n; i++) {
+        bl_count[lens[i]]++;
+    }
+    bl_count[0] = 0;
+    for (int bits = 1; bits <= MAX_BITS; bits++) {
+        code = (uint16_t)((code + bl_count[bits - 1]) << 1);
+        next[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        codes[i] = lens[i] ? reverse_bits(next[lens[i]]++, lens[i]) : 0;
+    }
+}
+
+/*
+=================================================================================
+ 3. LZ77 匹配
+=================================================================================
+*/
+
+#define HASH(p) ((((uint32_t)(p)[0] | (uint32_t)(p)[1] << 8 | (uint32_t)(p)[2] << 16) * 2654435761u) >> (32 - HASH_BITS))
+
+static void insert_pos(deflate_state* st, const uint8_t* in, size_t i) {
+    uint32_t h = HASH(in + i);
+    st->prev[i] = st->head[h];
+    st->head[h] = (int32_t)i;
+}
+
+/**
+ * @brief Splits the input into literals and (length, distance) matches with greedy hash-chain matching.
+ * @return Number of tokens.
+ */
+static size_t find_matches(deflate_state* st, const uint8_t* in, size_t n) {
+    size_t nt = 0;
+
+    memset(st->head, 0xff, sizeof(st->head));
+    for (size_t i = 0; i < n; ) {
+        size_t best_len = 0, best_dist = 0;
+
+        if (i + MIN_MATCH <= n) {
+            size_t max_len = (n - i < MAX_MATCH) ? n - i : MAX_MATCH;
+            int32_t cand = st->head[HASH(in + i)];
+            for (int chain = MAX_CHAIN; cand >= 0 && i - cand <= WINDOW_SIZE && chain > 0; chain--) {
+                const uint8_t* a = in + cand;
+                const uint8_t* b = in + i;
+                if (a[best_len] == b[best_len]) {
+                    size_t len = 0;
+                    while (len < max_len && a[len] == b[len]) {
+                        len++;
+                    }
+                    if (len > best_len) {
+                        best_len = len;
+                        best_dist = i - cand;
+                        if (len == max_len) {
+                            break;
+                        }
+                    }
+                }
+                cand = st->prev[cand];
+            }
+            insert_pos(st, in, i);
+        }
+
+        if (best_len >= MIN_MATCH) {
+            st->lit[nt] = (uint16_t)best_len;
+            st->dist[nt++] = (uint16_t)best_dist;
+            // 匹配覆盖的位置也加入哈希链，供后面的匹配使用
+            for (size_t k = i + 1; k < i + best_len && k + MIN_MATCH <= n; k++) {
+                insert_pos(st, in, k);
+            }
+            i += best_len;
+        } else {
+            st->lit[nt] = in[i++];
+            st->dist[nt++] = 0;
+        }
+    }
+    return nt;
+}
+
+static int dist_index(size_t d) {
+    return (d - 1 < 256) ? (int)(d - 1) : 256 + (int)((d - 1) >> 7);
+}
+
+/*
+=================================================================================
+ 4. 对外接口
+=================================================================================
+*/
+
+deflate_state* deflate_create(void) {
+    deflate_state* st = (deflate_state*)malloc(sizeof(deflate_state));
+    if (!st) {
+        return NULL;
+    }
+    for (int c = 0; c < 29; c++) {
+        for (int l = len_base[c]; l < len_base[c] + (1 << len_extra[c]) && l <= MAX_MATCH; l++) {
+            st->len_code[l] = (uint8_t)c;
+        }
+    }
+    for (int c = 0; c < DIST_CODES; c++) {
+        for (int d = dist_base[c]; d < dist_base[c] + (1 << dist_extra[c]); d++) {
+            st->dist_code[dist_index(d)] = (uint8_t)c;
+        }
+    }
+    return st;
+}
+
+void deflate_free(deflate_state* st) {
+    free(st);
+}
+
+/**
+ * @brief Compresses the input as one final DEFLATE block with dynamic Huffman codes, or as a stored
+ *        block when that is not smaller.
+ * @param n Input size, at most DEFLATE_MAX_INPUT.
+ * @param cap Size of the output buffer.
+ * @return Compressed size, or 0 if it does not fit in cap.
+ */
+size_t deflate_compress(deflate_state* st, const uint8_t* in, size_t n, uint8_t* out, size_t cap) {
+    uint32_t lf[LITLEN_CODES] = { 0 }, df[DIST_CODES] = { 0 }, cf[CLEN_CODES] = { 0 };
+    uint8_t ll[LITLEN_CODES], dl[DIST_CODES], cl[CLEN_CODES];
+    uint16_t lc[LITLEN_CODES], dc[DIST_CODES], cc[CLEN_CODES];
+    uint8_t all[LITLEN_CODES + DIST_CODES], rle_sym[LITLEN_CODES + DIST_CODES], rle_extra[LITLEN_CODES + DIST_CODES];
+    int nr = 0;
+
+    if (n > DEFLATE_MAX_INPUT) {
+        return 0;
+    }
+    size_t nt = find_matches(st, in, n);
+
+    // 1. 统计频率，生成字面量/长度和距离的码表
+    for (size_t t = 0; t < nt; t++) {
+        if (st->dist[t] == 0) {
+            lf[st->lit[t]]++;
+        } else {
+            lf[257 + st->len_code[st->lit[t]]]++;
+            df[st->dist_code[dist_index(st->dist[t])]]++;
+        }
+    }
+    lf[256] = 1;    // 块结束
+    build_lengths(lf, LITLEN_CODES, MAX_BITS, ll);
+    build_lengths(df, DIST_CODES, MAX_BITS, dl);
+    int hlit = LITLEN_CODES, hdist = DIST_CODES;
+    while (hlit > 257 && !ll[hlit - 1]) hlit--;
+    while (hdist > 1 && !dl[hdist - 1]) hdist--;
+
+    // 2. 码长序列按游程压缩（16 重复前一个，17/18 重复0），再为它生成码长码
+    memcpy(all, ll, hlit);
+    memcpy(all + hlit, dl, hdist);
+    for (int i = 0, total = hlit + hdist; i < total; ) {
+        int run = 1;
+        while (i + run < total && all[i + run] == all[i]) {
+            run++;
+        }
+        if (all[i] == 0 && run >= 3) {
+            int r = (run > 138) ? 138 : run;
+            rle_sym[nr] = (r >= 11) ? 18 : 17;
+            rle_extra[nr++] = (uint8_t)((r >= 11) ? r - 11 : r - 3);
+            i += r;
+        } else if (all[i] != 0 && run >= 4) {
+            int r = (run - 1 > 6) ? 6 : run - 1;
+            rle_sym[nr] = all[i];
+            rle_extra[nr++] = 0;
+            rle_sym[nr] = 16;
+            rle_extra[nr++] = (uint8_t)(r - 3);
+            i += 1 + r;
+        } else {
+            rle_sym[nr] = all[i++];
+            rle_extra[nr++] = 0;
+        }
+    }
+    for (int i = 0; i < nr; i++) {
+        cf[rle_sym[i]]++;
+    }
+    build_lengths(cf, CLEN_CODES, MAX_CLEN_BITS, cl);
+    int hclen = CLEN_CODES;
+    while (hclen > 4 && !cl[clen_order[hclen - 1]]) hclen--;
+    build_codes(ll, LITLEN_CODES, lc);
+    build_codes(dl, DIST_CODES, dc);
+    build_codes(cl, CLEN_CODES, cc);
+
+    // 3. 输出块头、码表和记号
+    bit_writer w = { out, 0, cap, 0, 0, 0 };
+    put_bits(&w, 1, 1);     // BFINAL
+    put_bits(&w, 2, 2);     // BTYPE = 动态哈夫曼
+    put_bits(&w, hlit - 257, 5);
+    put_bits(&w, hdist - 1, 5);
+    put_bits(&w, hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) {
+        put_bits(&w, cl[clen_order[i]], 3);
+    }
+    for (int i = 0; i < nr; i++) {
+        int s = rle_sym[i];
+        put_bits(&w, cc[s], cl[s]);
+        if (s >= 16) {
+            put_bits(&w, rle_extra[i], s == 16 ? 2 : s == 17 ? 3 : 7);
+        }
+    }
+    for (size_t t = 0; t < nt && !w.overflow; t++) {
+        if (st->dist[t] == 0) {
+            put_bits(&w, lc[st->lit[t]], ll[st->lit[t]]);
+            continue;
+        }
+        int lcode = st->len_code[st->lit[t]];
+        int dcode = st->dist_code[dist_index(st->dist[t])];
+        put_bits(&w, lc[257 + lcode], ll[257 + lcode]);
+        put_bits(&w, st->lit[t] - len_base[lcode], len_extra[lcode]);
+        put_bits(&w, dc[dcode], dl[dcode]);
+        put_bits(&w, st->dist[t] - dist_base[dcode], dist_extra[dcode]);
+    }
+    put_bits(&w, lc[256], ll[256]);
+    flush_bits(&w);
+    if (!w.overflow && w.pos < n + 5) {
+        return w.pos;
+    }
+
+    // 4. 压缩后不更小（随机数据、已压缩的文件）：存储块
+    if (n + 5 > cap) {
+        return 0;
+    }
+    out[0] = 1;     // BFINAL，BTYPE = 存储
+    out[1] = (uint8_t)n;
+    out[2] = (uint8_t)(n >> 8);
+    out[3] = (uint8_t)~n;
+    out[4] = (uint8_t)(~n >> 8);
+    memcpy(out + 5, in, n);
+    return n + 5;
+}
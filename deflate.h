@@ -0,0 +1,17 @@
+#ifndef __DEFLATE_H__
+#define __DEFLATE_H__
+#include <stdint.h>
+#include <stddef.h>
+
+/* 单次压缩的最大输入字节数（一个 deflate 块，窗口覆盖整个输入） */
+#define DEFLATE_MAX_INPUT   65535
+
+/* DEFLATE（RFC 1951）压缩器：LZ77 + 动态哈夫曼编码，用于生成 gzip 压缩镜像。
+   每个线程使用自己的状态 */
+typedef struct deflate_state deflate_state;
+
+deflate_state* deflate_create(void);
+size_t deflate_compress(deflate_state* st, const uint8_t* in, size_t n, uint8_t* out, size_t cap);
+void deflate_free(deflate_state* st);
+uint32_t crc32_update(uint32_t crc, const void* data, size_t len);
+#endif
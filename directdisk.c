@@ -0,0 +1,276 @@
+#include "backends.h"
+#include <windows.h>    // 用于无缓冲I/O和页对齐内存
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 无缓冲I/O的对齐单位：覆盖512字节和4K扇区的磁盘，也是内存页的大小
+#define DIO_ALIGN   4096u
+// 合并写入窗口和读取中转缓冲区的大小
+#define DIO_WINDOW  (1024u * 1024u)
+
+/*
+ 直写后端：镜像文件以 FILE_FLAG_NO_BUFFERING 打开，数据不经过系统缓存。
+ 无缓冲I/O要求偏移、长度和内存地址都按扇区对齐，而 FatFs 大多一次只写一个扇区，
+ 因此所有写入先合并到一个对齐的窗口中：连续（或重叠）的写入追加到窗口，
+ 窗口写满或遇到不连续的写入时才整体写出。窗口首尾不满一个对齐单位的部分先从镜像中读出（读-改-写）。
+*/
+
+typedef struct {
+    fatimage_backend ops;
+    HANDLE h;
+    CRITICAL_SECTION lock;      // 同一镜像的多个分区可能在不同线程中同时读写
+    BYTE* win;                  // 合并写入窗口（页对齐）
+    uint64_t win_off;           // 窗口在镜像中的起始偏移（按 DIO_ALIGN 对齐）
+    DWORD win_lo, win_hi;       // 窗口中待写出的数据范围 [lo, hi)，lo == hi 表示窗口为空
+    BYTE* rbuf;                 // 读取中转缓冲区（页对齐）
+    BYTE* page;                 // 读-改-写时读取首尾页的缓冲区（页对齐）
+} direct_backend;
+
+/*
+=================================================================================
+ 1. 辅助函数：对齐的读写和窗口写出
+=================================================================================
+*/
+
+static int aligned_read(direct_backend* db, void* buff, uint64_t offset, DWORD bytes) {
+    OVERLAPPED ov = { 0 };
+    DWORD done;
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    return (ReadFile(db->h, buff, bytes, &done, &ov) && done == bytes) ? 0 : -1;
+}
+
+static int aligned_write(direct_backend* db, const void* buff, uint64_t offset, DWORD bytes) {
+    OVERLAPPED ov = { 0 };
+    DWORD done;
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    return (WriteFile(db->h, buff, bytes, &done, &ov) && done == bytes) ? 0 : -1;
+}
+
+/**
+ * @brief Writes the pending range of the window, extended to DIO_ALIGN boundaries.
+ *        The bytes between those boundaries and the pending range are read back from the image first.
+ * @return 0 on success (or an empty window), -1 on failure.
+ */
+static int flush_window(direct_backend* db) {
+    DWORD a = db->win_lo & ~(DIO_ALIGN - 1);
+    DWORD b = (db->win_hi + DIO_ALIGN - 1) & ~(DIO_ALIGN - 1);
+
+    if (db->win_lo == db->win_hi) {
+        return 0;
+    }
+    // 首页不完整：补齐 [a, lo)
+    if (db->win_lo > a) {
+        if (aligned_read(db, db->page, db->win_off + a, DIO_ALIGN) != 0) {
+            return -1;
+        }
+        memcpy(db->win + a, db->page, db->win_lo - a);
+    }
+    // 尾页不完整：补齐 [hi, b)，与首页是同一页时不必再读
+    if (db->win_hi < b) {
+        DWORD tail = b - DIO_ALIGN;
+        if (tail != a || db->win_lo == a) {
+            if (aligned_read(db, db->page, db->win_off + tail, DIO_ALIGN) != 0) {
+                return -1;
+            }
+        }
+        memcpy(db->win + db->win_hi, db->page + (db->win_hi - tail), b - db->win_hi);
+    }
+    if (aligned_write(db, db->win + a, db->win_off + a, b - a) != 0) {
+        return -1;
+    }
+    db->win_lo = db->win_hi = 0;
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 后端操作
+=================================================================================
+*/
+
+static int direct_write(fatimage_backend* be, const void* buff, uint64_t offset, size_t bytes) {
+    direct_backend* db = (direct_backend*)be;
+    const BYTE* p = (const BYTE*)buff;
+    int ret = 0;
+
+    EnterCriticalSection(&db->lock);
+    while (bytes > 0) {
+        // 与窗口中的数据不连续时先写出窗口，再以新的对齐位置开始
+        if (db->win_lo != db->win_hi &&
+            (offset < db->win_off + db->win_lo || offset > db->win_off + db->win_hi)) {
+            if (flush_window(db) != 0) {
+                ret = -1;
+                break;
+            }
+        }
+        if (db->win_lo == db->win_hi) {
+            db->win_off = offset & ~(uint64_t)(DIO_ALIGN - 1);
+            db->win_lo = db->win_hi = (DWORD)(offset - db->win_off);
+        }
+
+        DWORD pos = (DWORD)(offset - db->win_off);
+        DWORD n = (bytes > DIO_WINDOW - pos) ? DIO_WINDOW - pos : (DWORD)bytes;
+        memcpy(db->win + pos, p, n);
+        if (pos + n > db->win_hi) {
+            db->win_hi = pos + n;
+        }
+        if (db->win_hi == DIO_WINDOW && flush_window(db) != 0) {
+            ret = -1;
+            break;
+        }
+        p += n;
+        offset += n;
+        bytes -= n;
+    }
+    LeaveCriticalSection(&db->lock);
+    return ret;
+}
+
+static int direct_read(fatimage_backend* be, void* buff, uint64_t offset, size_t bytes) {
+    direct_backend* db = (direct_backend*)be;
+    BYTE* p = (BYTE*)buff;
+    int ret = 0;
+
+    EnterCriticalSection(&db->lock);
+    // 读取范围与窗口中未写出的数据重叠时先写出窗口
+    if (db->win_lo != db->win_hi &&
+        offset < db->win_off + db->win_hi && db->win_off + db->win_lo < offset + bytes) {
+        ret = flush_window(db);
+    }
+    while (ret == 0 && bytes > 0) {
+        uint64_t a = offset & ~(uint64_t)(DIO_ALIGN - 1);
+        DWORD skip = (DWORD)(offset - a);
+        DWORD span = (bytes + skip > DIO_WINDOW) ? DIO_WINDOW : (DWORD)((bytes + skip + DIO_ALIGN - 1) & ~(uint64_t)(DIO_ALIGN - 1));
+        DWORD n = (bytes > span - skip) ? span - skip : (DWORD)bytes;
+
+        // 调用者的缓冲区恰好对齐时直接读入，否则经过中转缓冲区
+        if (skip == 0 && n == span && ((ULONG_PTR)p & (DIO_ALIGN - 1)) == 0) {
+            ret = aligned_read(db, p, a, span);
+        } else if ((ret = aligned_read(db, db->rbuf, a, span)) == 0) {
+            memcpy(p, db->rbuf + skip, n);
+        }
+        p += n;
+        offset += n;
+        bytes -= n;
+    }
+    LeaveCriticalSection(&db->lock);
+    return ret;
+}
+
+static int direct_sync(fatimage_backend* be) {
+    direct_backend* db = (direct_backend*)be;
+    int ret;
+
+    EnterCriticalSection(&db->lock);
+    ret = flush_window(db);
+    LeaveCriticalSection(&db->lock);
+    return ret;
+}
+
+static int direct_close(fatimage_backend* be) {
+    direct_backend* db = (direct_backend*)be;
+
+    int ret = flush_window(db);
+    if (!CloseHandle(db->h)) {
+        ret = -1;
+    }
+    DeleteCriticalSection(&db->lock);
+    VirtualFree(db->win, 0, MEM_RELEASE);
+    free(db);
+    return ret;
+}
+
+/**
+ * @brief Copies the first bytes of a PC file into the image at offset. The source is read without
+ *        buffering too, so large files pass through neither cache; the image side goes through the
+ *        write window, which turns the copy into DIO_WINDOW-sized aligned writes.
+ * @return 0 on success, -1 on failure.
+ */
+static int direct_copy_file(fatimage_backend* be, const char* pc_path, uint64_t offset, uint64_t bytes) {
+    uint64_t done = 0;
+    BYTE* buffer;
+
+    HANDLE src = CreateFile(pc_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (src == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Cannot open PC file '%s'.\n", pc_path);
+        return -1;
+    }
+    buffer = (BYTE*)VirtualAlloc(NULL, DIO_WINDOW, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buffer) {
+        CloseHandle(src);
+        return -1;
+    }
+
+    while (done < bytes) {
+        OVERLAPPED ov = { 0 };
+        DWORD chunk = (bytes - done > DIO_WINDOW) ? DIO_WINDOW : (DWORD)(bytes - done);
+        DWORD want = (chunk + DIO_ALIGN - 1) & ~(DIO_ALIGN - 1); // 最后一块按对齐长度读取，返回实际长度
+        DWORD got;
+        ov.Offset = (DWORD)done;
+        ov.OffsetHigh = (DWORD)(done >> 32);
+        if (!ReadFile(src, buffer, want, &got, &ov) || got < chunk) {
+            fprintf(stderr, "Error: Failed reading from PC file '%s'.\n", pc_path);
+            break;
+        }
+        if (direct_write(be, buffer, offset + done, chunk) != 0) {
+            fprintf(stderr, "Error: Failed writing to disk image.\n");
+            break;
+        }
+        done += chunk;
+    }
+
+    VirtualFree(buffer, 0, MEM_RELEASE);
+    CloseHandle(src);
+    return (done == bytes) ? 0 : -1;
+}
+
+/*
+=================================================================================
+ 3. 创建直写后端
+=================================================================================
+*/
+
+/**
+ * @brief Creates an image file opened with FILE_FLAG_NO_BUFFERING.
+ *        Unbuffered I/O cannot write a partial last sector, so an image whose size is not a multiple
+ *        of DIO_ALIGN falls back to the buffered file backend (a note is printed).
+ * @return New backend, or NULL on failure.
+ */
+fatimage_backend* direct_backend_create(const char* path, uint64_t size) {
+    if (size % DIO_ALIGN != 0) {
+        printf("Note: Image size is not a multiple of %u bytes; using buffered I/O for '%s'.\n", DIO_ALIGN, path);
+        return file_backend_create(path, size);
+    }
+
+    direct_backend* db = (direct_backend*)calloc(1, sizeof(direct_backend));
+    if (!db) {
+        return NULL;
+    }
+    // 窗口、读取中转区和首尾页在一次分配的页对齐内存中
+    db->win = (BYTE*)VirtualAlloc(NULL, 2 * DIO_WINDOW + DIO_ALIGN, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!db->win) {
+        free(db);
+        return NULL;
+    }
+    db->rbuf = db->win + DIO_WINDOW;
+    db->page = db->rbuf + DIO_WINDOW;
+
+    db->h = create_image_file(path, size, FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH);
+    if (db->h == INVALID_HANDLE_VALUE) {
+        VirtualFree(db->win, 0, MEM_RELEASE);
+        free(db);
+        return NULL;
+    }
+    InitializeCriticalSection(&db->lock);
+
+    db->ops.read = direct_read;
+    db->ops.write = direct_write;
+    db->ops.sync = direct_sync;
+    db->ops.close = direct_close;
+    db->ops.copy_file = direct_copy_file;
+    return &db->ops;
+}
@@ -0,0 +1,194 @@
+#include "extmap.h"
+#include "imgtree.h"
+#include <windows.h>    // 用于 MAX_PATH
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+=================================================================================
+ 1. 辅助函数
+=================================================================================
+*/
+
+/**
+ * @brief Writes prefix and s as one JSON string literal (UTF-8 passes through, control characters are escaped).
+ */
+static void json_string(FILE* f, const char* prefix, const char* s) {
+    fputc('"', f);
+    for (int part = 0; part < 2; part++) {
+        for (const unsigned char* p = (const unsigned char*)(part ? s : prefix); *p; p++) {
+            if (*p == '"' || *p == '\\') {
+                fprintf(f, "\\%c", *p);
+            } else if (*p < 0x20) {
+                fprintf(f, "\\u%04x", *p);
+            } else {
+                fputc(*p, f);
+            }
+        }
+    }
+    fputc('"', f);
+}
+
+static void put_u32(FILE* f, uint32_t v) {
+    BYTE b[4] = { (BYTE)v, (BYTE)(v >> 8), (BYTE)(v >> 16), (BYTE)(v >> 24) };
+    fwrite(b, 1, sizeof(b), f);
+}
+
+static void put_u64(FILE* f, uint64_t v) {
+    put_u32(f, (uint32_t)v);
+    put_u32(f, (uint32_t)(v >> 32));
+}
+
+static uint64_t run_sectors(const img_run* r) {
+    return (r->len + FF_MIN_SS - 1) / FF_MIN_SS;
+}
+
+/*
+=================================================================================
+ 2. 写出 JSON 和二进制区段表
+=================================================================================
+*/
+
+static int write_json(const char* path, const fatimage* img, const img_tree* tree) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create extent map '%s'.\n", path);
+        return -1;
+    }
+    fprintf(f, "{\n  \"image\": ");
+    json_string(f, "", img->cfg.path);
+    fprintf(f, ",\n  \"sector_size\": %d,\n  \"partition\": %d,\n  \"cluster_size\": %lu,\n  \"files\": [",
+            FF_MIN_SS, img->part, (unsigned long)img->fs.csize * FF_MIN_SS);
+
+    int first = 1;
+    for (int i = 0; i < tree->n; i++) {
+        const img_entry* e = &tree->entries[i];
+        if (e->is_dir) {
+            continue;
+        }
+        fprintf(f, "%s\n    { \"path\": ", first ? "" : ",");
+        json_string(f, "/", e->path);
+        fprintf(f, ", \"size\": %llu, \"lba\": %llu, \"extents\": [", (unsigned long long)e->size,
+                (unsigned long long)(e->n_runs ? e->runs[0].offset / FF_MIN_SS : 0));
+        for (int k = 0; k < e->n_runs; k++) {
+            fprintf(f, "%s{ \"lba\": %llu, \"sectors\": %llu }", k ? ", " : " ",
+                    (unsigned long long)(e->runs[k].offset / FF_MIN_SS), (unsigned long long)run_sectors(&e->runs[k]));
+        }
+        fprintf(f, "%s] }", e->n_runs ? " " : "");
+        first = 0;
+    }
+    fprintf(f, "\n  ]\n}\n");
+
+    if (ferror(f) | fclose(f)) {
+        fprintf(stderr, "Error: Failed writing extent map '%s'.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_bin(const char* path, const fatimage* img, const img_tree* tree) {
+    uint32_t n_files = 0, n_extents = 0, strtab = 0;
+
+    for (int i = 0; i < tree->n; i++) {
+        if (!tree->entries[i].is_dir) {
+            n_files++;
+            n_extents += tree->entries[i].n_runs;
+            strtab += (uint32_t)strlen(tree->entries[i].path) + 2; // '/' 和结尾的NUL
+        }
+    }
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot create extent map '%s'.\n", path);
+        return -1;
+    }
+
+    // 头部
+    fwrite("FATXMAP", 1, 8, f);
+    put_u32(f, EXTMAP_VERSION);
+    put_u32(f, FF_MIN_SS);
+    put_u32(f, n_files);
+    put_u32(f, n_extents);
+    put_u32(f, strtab);
+    put_u32(f, img->part);
+
+    // 文件项
+    uint32_t ext_index = 0, str_ofs = 0;
+    for (int i = 0; i < tree->n; i++) {
+        const img_entry* e = &tree->entries[i];
+        if (e->is_dir) {
+            continue;
+        }
+        uint32_t len = (uint32_t)strlen(e->path) + 1;
+        put_u64(f, e->size);
+        put_u64(f, e->n_runs ? e->runs[0].offset / FF_MIN_SS : 0);
+        put_u32(f, ext_index);
+        put_u32(f, (uint32_t)e->n_runs);
+        put_u32(f, str_ofs);
+        put_u32(f, len);
+        ext_index += e->n_runs;
+        str_ofs += len + 1;
+    }
+    // 区段项
+    for (int i = 0; i < tree->n; i++) {
+        const img_entry* e = &tree->entries[i];
+        for (int k = 0; !e->is_dir && k < e->n_runs; k++) {
+            put_u64(f, e->runs[k].offset / FF_MIN_SS);
+            put_u64(f, run_sectors(&e->runs[k]));
+        }
+    }
+    // 字符串表
+    for (int i = 0; i < tree->n; i++) {
+        if (!tree->entries[i].is_dir) {
+            fputc('/', f);
+            fwrite(tree->entries[i].path, 1, strlen(tree->entries[i].path) + 1, f);
+        }
+    }
+
+    if (ferror(f) | fclose(f)) {
+        fprintf(stderr, "Error: Failed writing extent map '%s'.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 3. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Writes the extent map of a mounted image (see extmap.h): for every file its size and the
+ *        sector runs it occupies, read from its cluster chain. Called by fatimage_close after the
+ *        metadata has been written, so the map describes the final image.
+ * @return 0 on success, -1 on failure (neither file is left behind).
+ */
+int extmap_write(fatimage* img) {
+    char base[MAX_PATH], json_path[MAX_PATH], bin_path[MAX_PATH];
+    img_tree tree;
+
+    if (img->part) {
+        snprintf(base, sizeof(base), "%s.p%d.extents", img->cfg.path, img->part);
+    } else {
+        snprintf(base, sizeof(base), "%s.extents", img->cfg.path);
+    }
+    snprintf(json_path, sizeof(json_path), "%s.json", base);
+    snprintf(bin_path, sizeof(bin_path), "%s.bin", base);
+
+    int ret = image_tree_load(img, &tree);
+    if (ret == 0) {
+        ret = (write_json(json_path, img, &tree) == 0 && write_bin(bin_path, img, &tree) == 0) ? 0 : -1;
+    }
+    if (ret == 0) {
+        printf("Extent map written to '%s' and '%s'.\n", json_path, bin_path);
+    } else {
+        fprintf(stderr, "Error: Failed to write the extent map of '%s'.\n", img->cfg.path);
+        // 不留下与镜像不符的旧文件
+        DeleteFile(json_path);
+        DeleteFile(bin_path);
+    }
+    image_tree_free(&tree);
+    return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef __EXTMAP_H__
+#define __EXTMAP_H__
+#include "fatimage.h"
+
+/*
+ 区段表：每个文件在镜像中占用的扇区（LBA 从镜像文件开头算起，分区镜像已包含分区的起始扇区），
+ 供不带FAT驱动的引导程序按 LBA 直接读取文件。关闭镜像时写出两份：
+
+ <镜像>.extents.json
+   { "image": ..., "sector_size": 512, "partition": 0, "cluster_size": ...,
+     "files": [ { "path": "/boot/kernel.img", "size": ..., "lba": ..., "extents": [ { "lba": ..., "sectors": ... } ] } ] }
+
+ <镜像>.extents.bin（小端，无填充）
+   头部 32 字节：  char magic[8] = "FATXMAP\0"; u32 version = 1; u32 sector_size;
+                  u32 n_files; u32 n_extents; u32 strtab_size; u32 partition
+   文件项 32 字节 × n_files：  u64 size; u64 lba（第一个区段，空文件为0）;
+                  u32 first_extent; u32 n_extents; u32 path_offset; u32 path_len
+   区段项 16 字节 × n_extents：u64 lba; u64 sectors
+   字符串表 strtab_size 字节：以NUL结尾的 UTF-8 路径（以 '/' 开头）
+ 分区镜像的文件名为 <镜像>.p<N>.extents.json / .bin。
+*/
+
+#define EXTMAP_VERSION  1
+
+int extmap_write(fatimage* img);
+#endif
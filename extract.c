@@ -0,0 +1,210 @@
+#include "extract.h"
+#include "fatimage.h"
+#include "imgtree.h"
+#include <windows.h>    // 用于线程和PC文件写入
+#include "ff.h"         // FatFs库
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 每个线程的读取缓冲区大小
+#define EXT_BUFFER_SIZE (1024 * 1024)
+// 最多的解包线程数
+#define EXT_MAX_THREADS 32
+
+/*
+ 解包：先用 image_tree_load 遍历一次镜像的目录树（FatFs，单线程），得到全部目录和每个文件在镜像中的
+ 连续区段（见 imgtree.c），按先序在PC上创建目录。之后文件内容不再经过 FatFs：多个线程按区段的镜像偏移
+ 直接用定位读（后端 read，相当于 pread）取出数据写入PC文件。
+ 文件按第一个区段的偏移排序后分发，各线程大致沿镜像从前到后读取。
+*/
+
+typedef struct {
+    fatimage* img;
+    const char* pc_dir;     // 解包到的PC目录
+    const img_entry** files; // 待拷贝的文件，按第一个区段的偏移排序
+    int n_files;
+    volatile LONG next;     // 下一个待拷贝的文件
+    volatile LONG failed;   // 拷贝失败的文件数
+} ext_pool;
+
+/*
+=================================================================================
+ 1. 并行拷贝文件内容
+=================================================================================
+*/
+
+/**
+ * @brief Writes one file to the PC: reads its extents straight from the image and keeps its FAT time.
+ * @return 0 on success, -1 on failure.
+ */
+static int extract_file(fatimage_backend* be, const char* pc_dir, const img_entry* e, BYTE* buffer) {
+    char pc_path[MAX_PATH];
+
+    if (snprintf(pc_path, sizeof(pc_path), "%s/%s", pc_dir, e->path) >= (int)sizeof(pc_path)) {
+        fprintf(stderr, "Error: Path too long: '%s/%s'.\n", pc_dir, e->path);
+        return -1;
+    }
+    HANDLE h = CreateFile(pc_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Cannot create PC file '%s'. Error code: %lu\n", pc_path, GetLastError());
+        return -1;
+    }
+
+    int ret = 0;
+    for (uint64_t done = 0; done < e->size; ) {
+        DWORD chunk = (e->size - done > EXT_BUFFER_SIZE) ? EXT_BUFFER_SIZE : (DWORD)(e->size - done);
+        DWORD written;
+        if (image_read_runs(be, e, done, buffer, chunk) != 0) {
+            fprintf(stderr, "Error: Failed reading the image for '%s'.\n", pc_path);
+            ret = -1;
+            break;
+        }
+        if (!WriteFile(h, buffer, chunk, &written, NULL) || written != chunk) {
+            fprintf(stderr, "Error: Failed writing PC file '%s'. Error code: %lu\n", pc_path, GetLastError());
+            ret = -1;
+            break;
+        }
+        done += chunk;
+    }
+
+    // 修改时间：FAT中保存的是本地时间
+    FILETIME local, ft;
+    if (ret == 0 && DosDateTimeToFileTime(e->fdate, e->ftime, &local) && LocalFileTimeToFileTime(&local, &ft)) {
+        SetFileTime(h, NULL, NULL, &ft);
+    }
+    CloseHandle(h);
+    return ret;
+}
+
+static DWORD WINAPI extract_worker(LPVOID arg) {
+    ext_pool* pool = (ext_pool*)arg;
+    BYTE* buffer = (BYTE*)malloc(EXT_BUFFER_SIZE);
+
+    for (;;) {
+        LONG i = InterlockedIncrement(&pool->next) - 1;
+        if (i >= pool->n_files) {
+            break;
+        }
+        if (!buffer || extract_file(pool->img->be, pool->pc_dir, pool->files[i], buffer) != 0) {
+            InterlockedIncrement(&pool->failed);
+        }
+    }
+    free(buffer);
+    return 0;
+}
+
+static int cmp_first_offset(const void* a, const void* b) {
+    const img_entry* x = *(const img_entry* const*)a;
+    const img_entry* y = *(const img_entry* const*)b;
+    uint64_t ox = x->n_runs ? x->runs[0].offset : 0;
+    uint64_t oy = y->n_runs ? y->runs[0].offset : 0;
+    return (ox < oy) ? -1 : (ox > oy) ? 1 : 0;
+}
+
+/*
+=================================================================================
+ 2. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Extracts every directory and file of an image (raw image, or the first FAT/exFAT partition of a
+ *        partitioned one) into a PC directory. The tree is walked once; file contents are then copied on
+ *        n_workers threads that read the files' cluster extents straight from the image file.
+ * @param image_path Raw image file (sparse and gzip images must be converted back first).
+ * @param pc_dir_path Destination directory on the PC, created if missing.
+ * @param n_workers Copy threads, 0 for one per CPU core.
+ * @return 0 on success, -1 on failure.
+ */
+int extract_image(const char* image_path, const char* pc_dir_path, int n_workers) {
+    ext_pool pool;
+    img_tree tree;
+    char pc_path[MAX_PATH];
+    int n_dirs = 0;
+    int ret = -1;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.pc_dir = pc_dir_path;
+    pool.img = image_open_mounted(image_path);
+    if (!pool.img) {
+        return -1;
+    }
+    if (!CreateDirectory(pc_dir_path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        fprintf(stderr, "Error: Cannot create directory '%s'. Error code: %lu\n", pc_dir_path, GetLastError());
+        fatimage_close(pool.img);
+        return -1;
+    }
+
+    // 1. 单线程遍历目录树，按先序创建PC目录（父目录总在子目录之前）
+    if (image_tree_load(pool.img, &tree) == 0) {
+        pool.files = (const img_entry**)malloc((tree.n > 0 ? tree.n : 1) * sizeof(img_entry*));
+        ret = pool.files ? 0 : -1;
+        if (!pool.files) {
+            fprintf(stderr, "Error: Out of memory.\n");
+        }
+        for (int i = 0; i < tree.n && ret == 0; i++) {
+            const img_entry* e = &tree.entries[i];
+            if (!e->is_dir) {
+                pool.files[pool.n_files++] = e;
+                continue;
+            }
+            if (snprintf(pc_path, sizeof(pc_path), "%s/%s", pc_dir_path, e->path) >= (int)sizeof(pc_path)) {
+                fprintf(stderr, "Error: Path too long: '%s/%s'.\n", pc_dir_path, e->path);
+                ret = -1;
+            } else if (!CreateDirectory(pc_path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+                fprintf(stderr, "Error: Cannot create directory '%s'. Error code: %lu\n", pc_path, GetLastError());
+                ret = -1;
+            }
+            n_dirs++;
+        }
+    }
+
+    // 2. 多线程拷贝文件内容
+    if (ret == 0) {
+        if (n_workers <= 0) {
+            SYSTEM_INFO si;
+            GetSystemInfo(&si);
+            n_workers = (int)si.dwNumberOfProcessors;
+        }
+        if (n_workers > EXT_MAX_THREADS) n_workers = EXT_MAX_THREADS;
+        if (n_workers > pool.n_files) n_workers = pool.n_files;
+        if (n_workers < 1) n_workers = 1;
+
+        qsort(pool.files, pool.n_files, sizeof(img_entry*), cmp_first_offset);
+        HANDLE threads[EXT_MAX_THREADS];
+        int started = 0;
+        for (int i = 1; i < n_workers; i++) {
+            threads[started] = CreateThread(NULL, 0, extract_worker, &pool, 0, NULL);
+            if (!threads[started]) {
+                break; // 剩下的文件由当前线程拷贝
+            }
+            started++;
+        }
+        extract_worker(&pool);
+        if (started > 0) {
+            WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+        }
+        for (int i = 0; i < started; i++) {
+            CloseHandle(threads[i]);
+        }
+
+        uint64_t bytes = 0;
+        for (int i = 0; i < pool.n_files; i++) {
+            bytes += pool.files[i]->size;
+        }
+        if (pool.failed) {
+            fprintf(stderr, "Error: %ld of %d files could not be extracted.\n", (long)pool.failed, pool.n_files);
+            ret = -1;
+        } else {
+            printf("Extracted %d files (%llu bytes) and %d directories from '%s' to '%s' using %d threads.\n",
+                   pool.n_files, (unsigned long long)bytes, n_dirs, image_path, pc_dir_path, started + 1);
+        }
+    }
+
+    free(pool.files);
+    image_tree_free(&tree);
+    fatimage_close(pool.img);
+    return ret;
+}
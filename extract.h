@@ -0,0 +1,6 @@
+#ifndef __EXTRACT_H__
+#define __EXTRACT_H__
+
+/* 解包：把镜像中的全部目录和文件拷贝到PC上的目录，文件内容由多个线程按簇区段直接从镜像读取 */
+int extract_image(const char* image_path, const char* pc_dir_path, int n_workers);
+#endif
@@ -0,0 +1,618 @@
+#include "fatimage.h"
+#include "tools.h"
+#include "backends.h"
+#include "skelcache.h"
+#include "scan.h"
+#include "archive.h"
+#include "manifest.h"
+#include "extmap.h"
+#include <windows.h>    // 用于驱动器号表的原子操作
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <io.h>       // 标准输入切换为二进制模式
+#include <fcntl.h>
+
+// 大于等于该大小的文件先用 f_expand 分配连续簇，再直接写入镜像
+#define EXTENT_MIN_SIZE (1024 * 1024)
+
+/* 驱动器号 -> 镜像上下文，通过原子比较交换来占用/释放 */
+static fatimage* volatile Images[FF_VOLUMES];
+
+/* 逻辑卷 -> 物理驱动器/分区，在占用卷号时设置。普通镜像的卷号与驱动器号相同(pt=0 自动检测)，
+   分区上下文的卷号指向所在镜像的驱动器号和分区序号 */
+PARTITION VolToPart[FF_VOLUMES];
+
+/**
+ * @brief Claims a free drive/volume number for img and sets img->drive. Returns -1 when all are in use.
+ */
+static int claim_slot(fatimage* img) {
+    for (int slot = 0; slot < FF_VOLUMES; slot++) {
+        if (InterlockedCompareExchangePointer((PVOID volatile*)&Images[slot], img, NULL) == NULL) {
+            img->slot = (BYTE)slot;
+            img->drive[0] = (char)('0' + slot);
+            img->drive[1] = ':';
+            img->drive[2] = '\0';
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: Too many images open at once (max %d).\n", FF_VOLUMES);
+    return -1;
+}
+
+/*
+=================================================================================
+ 1. 镜像上下文的创建与销毁
+=================================================================================
+*/
+
+/**
+ * @brief Returns whether the image is built in a temporary raw file and converted or streamed on close.
+ */
+static int converts_output(const fatimage_config* cfg) {
+    return cfg->out_format != FATIMAGE_OUT_RAW || cfg->stream != NULL;
+}
+
+/**
+ * @brief Creates an image file and binds it to a free FatFs drive number.
+ * @param cfg Image configuration; the path string is copied.
+ * @return New image context, or NULL if the file cannot be created or all FF_VOLUMES drives are in use.
+ */
+fatimage* fatimage_open(const fatimage_config* cfg) {
+    if (cfg->size < FF_MIN_SS) {
+        fprintf(stderr, "Error: Image size %llu is too small.\n", (unsigned long long)cfg->size);
+        return NULL;
+    }
+
+    fatimage* img = (fatimage*)calloc(1, sizeof(fatimage));
+    if (!img) {
+        return NULL;
+    }
+    img->cfg = *cfg;
+    img->stat = STA_NOINIT;
+    img->cfg.path = _strdup(cfg->path);
+    img->cfg.skel_dir = cfg->skel_dir ? _strdup(cfg->skel_dir) : NULL;
+    img->contig_found = cfg->n_contig > 0 ? (BYTE*)calloc(cfg->n_contig, 1) : NULL;
+    if (!img->cfg.path || (cfg->skel_dir && !img->cfg.skel_dir) || (cfg->n_contig > 0 && !img->contig_found)) {
+        free((char*)img->cfg.path);
+        free((char*)img->cfg.skel_dir);
+        free(img->contig_found);
+        free(img);
+        return NULL;
+    }
+
+    // 占用一个空闲的驱动器号，卷号与驱动器号相同
+    if (claim_slot(img) != 0) {
+        free((char*)img->cfg.path);
+        free((char*)img->cfg.skel_dir);
+        free(img->contig_found);
+        free(img);
+        return NULL;
+    }
+    // 可重现模式：所有目录项和卷序列号使用固定的生成时间
+    if (img->cfg.deterministic) {
+        fatimage_set_build_time(fatimage_reproducible_time());
+    }
+    img->pdrv = img->slot;
+    VolToPart[img->slot].pd = img->pdrv;
+    VolToPart[img->slot].pt = 0;
+
+    // 稀疏/压缩镜像和流输出：FatFs 需要随机读写，先生成临时的原始镜像，关闭时再转换并顺序写出
+    char raw_path[MAX_PATH], bmap_path[MAX_PATH];
+    int convert = converts_output(&img->cfg);
+    snprintf(raw_path, sizeof(raw_path), convert ? "%s.raw.tmp" : "%s", img->cfg.path);
+    snprintf(bmap_path, sizeof(bmap_path), "%s.bmap", img->cfg.path);
+
+    // 按I/O方式创建存储后端
+    switch (img->cfg.io_mode) {
+        case FATIMAGE_IO_ASYNC:
+            img->be = async_backend_create(raw_path, img->cfg.size);
+            break;
+        case FATIMAGE_IO_DIRECT:
+            img->be = direct_backend_create(raw_path, img->cfg.size);
+            break;
+        default:
+            img->be = file_backend_create(raw_path, img->cfg.size);
+            break;
+    }
+    if (!img->be) {
+        fatimage_close(img);
+        return NULL;
+    }
+    // 块映射：记录实际写入的块（在元数据缓存之内，只记录最终写到镜像的数据），用于 bmap 和格式转换
+    if (img->cfg.bmap || convert) {
+        fatimage_backend* mapped = bmap_backend_create(img->be, img->cfg.size, img->cfg.bmap ? bmap_path : NULL,
+                                                       img->cfg.out_format, convert && !img->cfg.stream ? img->cfg.path : NULL,
+                                                       img->cfg.stream);
+        if (!mapped) {
+            fatimage_close(img);
+            return NULL;
+        }
+        img->be = mapped;
+        img->mapped = mapped;
+    }
+    // 批量模式：元数据扇区先写入内存缓存
+    if (img->cfg.bulk) {
+        fatimage_backend* cached = cache_backend_create(img->be);
+        if (!cached) {
+            fatimage_abort(img);
+            return NULL;
+        }
+        img->be = cached;
+    }
+    return img;
+}
+
+/**
+ * @brief Opens an existing image file read-only and binds it to a free FatFs drive number, so that it
+ *        can be mounted with fatimage_mount and read with FatFs or through img->be.
+ *        On a partitioned image FatFs mounts the first FAT/exFAT partition.
+ * @return New image context, or NULL if the file cannot be opened or all FF_VOLUMES drives are in use.
+ */
+fatimage* fatimage_open_existing(const char* path) {
+    fatimage* img = (fatimage*)calloc(1, sizeof(fatimage));
+    if (!img) {
+        return NULL;
+    }
+    img->stat = STA_NOINIT | STA_PROTECT; // FatFs 拒绝写入
+    img->cfg.path = _strdup(path);
+    if (!img->cfg.path || claim_slot(img) != 0) {
+        free((char*)img->cfg.path);
+        free(img);
+        return NULL;
+    }
+    img->pdrv = img->slot;
+    VolToPart[img->slot].pd = img->pdrv;
+    VolToPart[img->slot].pt = 0;
+
+    img->be = file_backend_open(path, &img->cfg.size);
+    if (!img->be) {
+        fatimage_close(img);
+        return NULL;
+    }
+    return img;
+}
+
+/**
+ * @brief Opens one partition of a partitioned image (see fatimage_fdisk) as its own volume.
+ *        The partition shares the image's backend; partitions of one image can be formatted,
+ *        mounted and written from different threads at the same time.
+ * @param disk Image that holds the partition table.
+ * @param part Partition number (1-4).
+ * @param fmt Filesystem format for fatimage_format (FM_SFD is not allowed).
+ * @param au_size Cluster size in bytes, 0 for the f_mkfs default.
+ * @return New partition context, or NULL on failure. Close it before closing the image.
+ */
+fatimage* fatimage_open_partition(fatimage* disk, int part, BYTE fmt, DWORD au_size) {
+    if (part < 1 || part > 4 || disk->parent) {
+        return NULL;
+    }
+    fatimage* img = (fatimage*)calloc(1, sizeof(fatimage));
+    if (!img) {
+        return NULL;
+    }
+    img->cfg = disk->cfg;
+    img->cfg.fmt = fmt & ~FM_SFD;
+    img->cfg.au_size = au_size;
+    img->cfg.path = _strdup(disk->cfg.path);
+    img->cfg.skel_dir = NULL; // 分区不使用骨架缓存
+    img->parent = disk;
+    img->part = (BYTE)part;
+    img->stat = STA_NOINIT;
+    if (!img->cfg.path) {
+        free(img);
+        return NULL;
+    }
+
+    // 占用一个卷号，映射到镜像的驱动器号和分区
+    if (claim_slot(img) != 0) {
+        free((char*)img->cfg.path);
+        free(img);
+        return NULL;
+    }
+    img->pdrv = disk->pdrv;
+    VolToPart[img->slot].pd = disk->pdrv;
+    VolToPart[img->slot].pt = (BYTE)part;
+    return img;
+}
+
+/**
+ * @brief Writes an MBR partition table to the image with f_fdisk.
+ * @param ptbl Partition sizes in sectors (values <= 100 are percentages of the image), terminated by 0. At most 4.
+ * @return 0 on success, -1 on failure.
+ */
+int fatimage_fdisk(fatimage* img, const LBA_t ptbl[]) {
+    BYTE work[FF_MAX_SS];
+
+    FRESULT res = f_fdisk(img->pdrv, ptbl, work);
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: f_fdisk failed on '%s'. FRESULT: %d\n", img->cfg.path, res);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Unmounts the volume, closes the backend and releases the drive number. The context is freed
+ *        even when writing fails.
+ * @return 0 on success, -1 if the metadata, the image data or an output derived from it on close
+ *         (extent map, block map, converted image, stream) could not be written completely.
+ */
+int fatimage_close(fatimage* img) {
+    int ret = 0;
+
+    if (!img) {
+        return 0;
+    }
+    if (img->mounted) {
+        if (img->cfg.bulk && f_defersync(img->drive, 0) != FR_OK) {
+            fprintf(stderr, "Error: Failed to write metadata of '%s'.\n", img->cfg.path);
+            ret = -1;
+        }
+        // 区段表取自最终的簇链，在元数据写出之后、卸载之前生成
+        if (img->cfg.extent_map && !img->aborted && extmap_write(img) != 0) {
+            ret = -1;
+        }
+        f_mount(NULL, img->drive, 0);
+        img->mounted = 0;
+    }
+    if (img->be) {
+        if (img->aborted && img->mapped) {
+            bmap_backend_discard(img->mapped);
+        }
+        if (img->be->sync(img->be) != 0) {
+            ret = -1;
+        }
+        if (img->be->close(img->be) != 0) {
+            ret = -1;
+        }
+        img->be = NULL;
+        // 转换后的镜像已经在关闭后端时写出，删除临时的原始镜像
+        if (converts_output(&img->cfg) && !img->parent) {
+            char raw_path[MAX_PATH];
+            snprintf(raw_path, sizeof(raw_path), "%s.raw.tmp", img->cfg.path);
+            DeleteFile(raw_path);
+        }
+    }
+    img->stat = STA_NOINIT;
+    VolToPart[img->slot].pd = img->slot;
+    VolToPart[img->slot].pt = 0;
+    InterlockedCompareExchangePointer((PVOID volatile*)&Images[img->slot], NULL, img);
+    dedup_free(img->dedup);
+    free((char*)img->cfg.path);
+    free((char*)img->cfg.skel_dir);
+    free(img->contig_found);
+    free(img);
+    return ret;
+}
+
+/**
+ * @brief Closes an image whose build failed. Nothing derived from it is written: no extent map, no
+ *        block map, and no converted image or stream output (the temporary raw image is removed).
+ *        A raw image file is left as it is.
+ */
+void fatimage_abort(fatimage* img) {
+    if (img) {
+        img->aborted = 1;
+        fatimage_close(img);
+    }
+}
+
+/**
+ * @brief Returns the fixed build time of reproducible images: SOURCE_DATE_EPOCH (seconds since
+ *        1970-01-01 UTC) when set, otherwise 1980-01-01 00:00:00, the earliest FAT time.
+ */
+DWORD fatimage_reproducible_time(void) {
+    const DWORD fat_epoch = (1u << 21) | (1u << 16); // 1980-01-01 00:00:00
+    const char* env = getenv("SOURCE_DATE_EPOCH");
+    struct tm tm_buf;
+    char* end;
+
+    if (!env || !*env) {
+        return fat_epoch;
+    }
+    time_t t = (time_t)_strtoi64(env, &end, 10);
+    if (*end != '\0' || gmtime_s(&tm_buf, &t) != 0 || tm_buf.tm_year < 80 || tm_buf.tm_year > 207) {
+        return fat_epoch;
+    }
+    return ((DWORD)(tm_buf.tm_year - 80) << 25) | ((DWORD)(tm_buf.tm_mon + 1) << 21) | ((DWORD)tm_buf.tm_mday << 16) |
+           ((DWORD)tm_buf.tm_hour << 11) | ((DWORD)tm_buf.tm_min << 5) | ((DWORD)tm_buf.tm_sec >> 1);
+}
+
+/**
+ * @brief Returns the image context bound to a physical drive number, or NULL.
+ */
+fatimage* fatimage_from_pdrv(BYTE pdrv) {
+    if (pdrv >= FF_VOLUMES) {
+        return NULL;
+    }
+    // 分区上下文只占用卷号，不会作为物理驱动器被访问
+    fatimage* img = Images[pdrv];
+    return (img && !img->parent) ? img : NULL;
+}
+
+/**
+ * @brief Returns the FatFs path of the image's root, e.g. "3:".
+ */
+const char* fatimage_drive(const fatimage* img) {
+    return img->drive;
+}
+
+/*
+=================================================================================
+ 2. 格式化、挂载和拷贝
+=================================================================================
+*/
+
+/**
+ * @brief Formats the image with the configured filesystem type and cluster size.
+ *        With cfg.skel_dir set, a cached skeleton of the same size/format/cluster size is copied
+ *        into the image instead of running f_mkfs; on a miss the new skeleton is saved at mount.
+ * @return 0 on success, -1 on failure.
+ */
+int fatimage_format(fatimage* img) {
+    BYTE work[FF_MAX_SS]; // 格式化用的工作缓冲区，每个调用者一份
+    MKFS_PARM opt = { .fmt = img->cfg.fmt, .au_size = img->cfg.au_size };
+
+    int rc = skel_restore(img);
+    if (rc <= 0) {
+        return rc;
+    }
+
+    FRESULT res = f_mkfs(img->drive, &opt, work, sizeof(work));
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: f_mkfs failed on '%s'. FRESULT: %d\n", img->cfg.path, res);
+        return -1;
+    }
+    img->skel_pending = (img->cfg.skel_dir != NULL && !img->parent);
+    return 0;
+}
+
+/**
+ * @brief Mounts the formatted image on its drive.
+ * @return 0 on success, -1 on failure.
+ */
+int fatimage_mount(fatimage* img) {
+    FRESULT res = f_mount(&img->fs, img->drive, 1);
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: f_mount failed on '%s'. FRESULT: %d\n", img->cfg.path, res);
+        return -1;
+    }
+    // 批量模式：关闭文件时不再更新 FSInfo 和发出 CTRL_SYNC
+    if (img->cfg.bulk) {
+        res = f_defersync(img->drive, 1);
+        if (res != FR_OK) {
+            fprintf(stderr, "Error: f_defersync failed on '%s'. FRESULT: %d\n", img->cfg.path, res);
+            f_mount(NULL, img->drive, 0); // 没有进入批量模式，关闭时也不再退出
+            return -1;
+        }
+    }
+    img->mounted = 1;
+    // 骨架在挂载后保存，此时可以用 f_getfree 得到 f_mkfs 已分配的簇数。保存失败不影响镜像本身
+    if (img->skel_pending) {
+        img->skel_pending = 0;
+        skel_store(img);
+    }
+    return 0;
+}
+
+/**
+ * @brief Hands the duplicate files found while planning the image to the next fatimage_copy_dir
+ *        (dedup mode), so the source files are not hashed twice. The image takes ownership of table.
+ */
+void fatimage_set_dedup(fatimage* img, dedup_table* table) {
+    dedup_free(img->dedup);
+    img->dedup = table;
+}
+
+/**
+ * @brief In bulk mode, writes out the deferred metadata (directory entries, FAT, FSInfo) after a copy.
+ * @return 0 on success, -1 on failure.
+ */
+static int flush_metadata(fatimage* img) {
+    if (img->cfg.bulk) {
+        FRESULT res = f_defersync(img->drive, 1); // 之后仍为批量模式
+        if (res != FR_OK) {
+            fprintf(stderr, "Error: Failed to write metadata of '%s'. FRESULT: %d\n", img->cfg.path, res);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Recursively copies a PC directory into the root of the mounted image.
+ *        In bulk mode the deferred metadata is written out before returning.
+ *        In dedup mode identical files share one cluster chain; the table comes from fatimage_set_dedup,
+ *        or is built here by scanning and hashing the source folder.
+ * @param cache Source cache shared between images, or NULL to read PC files directly.
+ * @return 0 on success, -1 on failure.
+ */
+int fatimage_copy_dir(fatimage* img, const char* pc_dir_path, src_cache* cache) {
+    int flags = (img->cfg.keep_times ? COPY_KEEP_TIMES : 0) | (img->cfg.deterministic ? COPY_SORTED : 0);
+    dedup_table* dedup = img->dedup;
+    img->dedup = NULL;
+
+    if (img->cfg.dedup && !dedup) {
+        src_node tree;
+        if (scan_source_tree(pc_dir_path, &tree) == 0) {
+            dedup = dedup_plan(pc_dir_path, &tree, cache);
+        }
+        free_source_tree(&tree);
+        if (!dedup) {
+            return -1;
+        }
+    }
+    int ret = copy_directory_to_fatfs(pc_dir_path, img->drive, cache, img->cfg.dedup ? dedup : NULL, flags);
+
+    if (flush_metadata(img) != 0) {
+        ret = -1;
+    }
+    if (ret == 0 && !img->parent && fatimage_check_contiguous(img) != 0) {
+        ret = -1;
+    }
+
+    if (img->cfg.dedup && ret == 0) {
+        uint64_t files, bytes;
+        dedup_savings(dedup, (DWORD)img->fs.csize * FF_MIN_SS, &files, &bytes);
+        if (files > 0) {
+            printf("Dedup: %llu duplicate files share clusters with identical files, saving %llu bytes (%.2f MiB).\n",
+                   (unsigned long long)files, (unsigned long long)bytes, (double)bytes / (1024.0 * 1024.0));
+            // 交叉链接的文件在设备上写入或删除任意一个都会破坏其它文件
+            fprintf(stderr, "Warning: '%s' contains files that share clusters (--dedup). Mount it read-only: "
+                            "writing to, truncating or deleting any of them on the device corrupts the others, "
+                            "and disk checkers report them as cross-linked.\n", img->cfg.path);
+        }
+    }
+    dedup_free(dedup);
+    return ret;
+}
+
+/**
+ * @brief Creates the contents of a tar or newc cpio archive in the root of the mounted image, reading the
+ *        archive once as a stream (nothing is extracted to disk). In bulk mode the deferred metadata is
+ *        written out before returning.
+ * @param archive_path Archive file, or "-" for standard input.
+ * @return 0 on success, -1 on failure.
+ */
+int fatimage_copy_archive(fatimage* img, const char* archive_path) {
+    int flags = (img->cfg.keep_times ? COPY_KEEP_TIMES : 0) | (img->cfg.deterministic ? COPY_SORTED : 0);
+    int from_stdin = (strcmp(archive_path, "-") == 0);
+    FILE* in = from_stdin ? stdin : fopen(archive_path, "rb");
+
+    if (!in) {
+        fprintf(stderr, "Error: Cannot open archive '%s'.\n", archive_path);
+        return -1;
+    }
+    if (from_stdin) {
+        _setmode(_fileno(stdin), _O_BINARY);
+    }
+    int ret = copy_archive_to_fatfs(in, from_stdin ? "<stdin>" : archive_path, img->drive, flags);
+    if (!from_stdin) {
+        fclose(in);
+    }
+    if (flush_metadata(img) != 0) {
+        ret = -1;
+    }
+    if (ret == 0 && !img->parent && fatimage_check_contiguous(img) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief Copies the files and directories listed in a manifest into the mounted image (see manifest.c).
+ *        In bulk mode the deferred metadata is written out before returning.
+ * @return 0 on success, -1 on failure.
+ */
+int fatimage_copy_manifest(fatimage* img, const char* manifest_path) {
+    int flags = (img->cfg.keep_times ? COPY_KEEP_TIMES : 0) | (img->cfg.deterministic ? COPY_SORTED : 0);
+    int ret = copy_manifest_to_fatfs(manifest_path, img->drive, flags);
+
+    if (flush_metadata(img) != 0) {
+        ret = -1;
+    }
+    if (ret == 0 && !img->parent && fatimage_check_contiguous(img) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/*
+=================================================================================
+ 3. 连续簇直写：绕过 f_write，把文件数据直接写到镜像中的字节偏移
+=================================================================================
+*/
+
+/**
+ * @brief Allocates a contiguous cluster run for an empty, newly created file with f_expand and writes
+ *        its data straight to the image at the run's byte offset, bypassing f_write.
+ * @param fp File opened with FA_CREATE_ALWAYS | FA_WRITE and still empty.
+ * @param pc_path Source file on the PC (used when data is NULL).
+ * @param data File contents already in memory, or NULL to copy from pc_path.
+ * @param size File size in bytes.
+ * @return 0 when written (the size is recorded at f_close), 1 when not applicable (small file or
+ *         no contiguous free space; fp is unchanged), -1 on I/O error.
+ */
+int fatimage_write_extent(FIL* fp, const char* pc_path, const void* data, uint64_t size) {
+    FATFS* fs = fp->obj.fs;
+    fatimage* img = fatimage_from_pdrv(fs->pdrv);
+
+    if (!img || size < EXTENT_MIN_SIZE) {
+        return 1;
+    }
+    if (f_expand(fp, (FSIZE_t)size, 1) != FR_OK) {
+        return 1; // 没有足够大的连续空闲区域时按普通方式写入
+    }
+
+    // 数据区起始扇区 + 簇号偏移，database 已包含分区的起始位置
+    uint64_t offset = ((uint64_t)fs->database + (uint64_t)fs->csize * (fp->obj.sclust - 2)) * FF_MIN_SS;
+    fatimage_backend* be = img->be;
+    int rc;
+    if (data) {
+        rc = be->write(be, data, offset, (size_t)size);
+    } else if (be->copy_file) {
+        rc = be->copy_file(be, pc_path, offset, size);
+    } else {
+        rc = -1;
+    }
+    return (rc == 0) ? 0 : -1;
+}
+
+/**
+ * @brief Returns whether a file must be stored in one contiguous cluster run because its image path is
+ *        listed in the image's cfg.contig (compared case-insensitively, '\\' and '/' alike, leading
+ *        separators ignored). The matched entry is recorded for fatimage_check_contiguous.
+ * @param fatfs_path Full FatFs path of the file, starting with the image's drive, e.g. "3:/boot/kernel.img".
+ */
+int fatimage_wants_contiguous(const char* fatfs_path) {
+    char* end;
+    unsigned long slot = strtoul(fatfs_path, &end, 10);
+
+    if (end == fatfs_path || *end != ':' || slot >= FF_VOLUMES) {
+        return 0;
+    }
+    fatimage* img = Images[slot];
+    if (!img) {
+        return 0;
+    }
+    const char* rel = end + 1;
+    while (*rel == '/' || *rel == '\\') {
+        rel++;
+    }
+    for (int i = 0; i < img->cfg.n_contig; i++) {
+        const char* b = img->cfg.contig[i];
+        while (*b == '/' || *b == '\\') {
+            b++;
+        }
+        if (compare_image_paths(rel, b) == 0) {
+            // 分区的文件记在所在的镜像上，任一分区中有这个文件即可
+            fatimage* owner = img->parent ? img->parent : img;
+            if (owner->contig_found) {
+                owner->contig_found[i] = 1;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reports the cfg.contig entries that matched no copied file (for example a mistyped path), which
+ *        would otherwise be missing from the extent map without notice. Call it after the copy; for a
+ *        partitioned image call it on the image after all partitions are filled.
+ * @return 0 if every entry was matched, -1 otherwise.
+ */
+int fatimage_check_contiguous(const fatimage* img) {
+    int ret = 0;
+
+    for (int i = 0; i < img->cfg.n_contig; i++) {
+        if (!img->contig_found || !img->contig_found[i]) {
+            fprintf(stderr, "Error: No file '%s' was packed into '%s', so it cannot be stored contiguously.\n",
+                    img->cfg.contig[i], img->cfg.path);
+            ret = -1;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,105 @@
+#ifndef __FATIMAGE_H__
+#define __FATIMAGE_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "ff.h"
+#include "diskio.h"
+#include "srccache.h"
+#include "dedup.h"
+
+/*
+ libfatimage：每个镜像一个上下文句柄，句柄独占一个物理驱动器号(pdrv)、
+ 自己的存储后端、配置和 FATFS 对象。不同句柄之间没有共享状态，
+ 可以在同一进程的多个线程里并行生成多个镜像（最多 FF_VOLUMES 个同时打开）。
+*/
+
+/* 镜像的存储后端：按字节偏移读写，扇区换算由 diskio 完成 */
+typedef struct fatimage_backend {
+    int  (*read)(struct fatimage_backend* be, void* buff, uint64_t offset, size_t bytes);
+    int  (*write)(struct fatimage_backend* be, const void* buff, uint64_t offset, size_t bytes);
+    int  (*sync)(struct fatimage_backend* be);
+    int  (*close)(struct fatimage_backend* be);   // 返回-1表示数据或转换输出没有完整写出
+    /* 可选：把PC文件的前 bytes 字节直接拷贝到镜像的 offset 处（NULL时用 read/write 实现） */
+    int  (*copy_file)(struct fatimage_backend* be, const char* pc_path, uint64_t offset, uint64_t bytes);
+} fatimage_backend;
+
+/* 镜像文件的I/O方式 */
+enum {
+    FATIMAGE_IO_SYNC = 0,   // 同步定位读写（默认）
+    FATIMAGE_IO_ASYNC,      // 重叠I/O：写入复制到缓冲池后立即返回，由系统排队完成
+    FATIMAGE_IO_DIRECT      // 无缓冲I/O：绕过系统缓存，写入合并成对齐的大块
+};
+
+/* 输出文件格式 */
+enum {
+    FATIMAGE_OUT_RAW = 0,   // 原始镜像（默认）
+    FATIMAGE_OUT_SPARSE,    // Android 稀疏镜像（见 simg.c）
+    FATIMAGE_OUT_GZIP       // BGZF 压缩镜像（见 gzimg.c）
+};
+/* 除原始镜像外（以及输出到流时），都先在 <镜像>.raw.tmp 中生成原始镜像，关闭时转换 */
+
+/* 创建镜像时的配置 */
+typedef struct {
+    const char* path;   // 镜像文件路径
+    uint64_t size;      // 镜像大小（字节）
+    BYTE fmt;           // FM_FAT / FM_FAT32 / FM_EXFAT
+    DWORD au_size;      // 簇大小（字节），0表示由 f_mkfs 自动选择
+    int io_mode;        // FATIMAGE_IO_xxx
+    const char* skel_dir; // 格式化骨架缓存目录，NULL表示不使用（见 skelcache.c）
+    int bulk;           // 批量模式：文件关闭时不同步元数据，单扇区写入留在内存中，拷贝结束时统一写出
+    int keep_times;     // 文件和目录使用源文件的修改时间，而不是生成时间
+    int deterministic;  // 可重现模式：按名称排序拷贝，固定生成时间（SOURCE_DATE_EPOCH 或1980-01-01）和卷序列号
+    const char* image_cache; // 镜像产物缓存目录（见 imgcache.c），NULL表示不使用；需要 deterministic
+    int dedup;          // 去重模式：内容相同的文件共用一条簇链（见 dedup.c），生成的镜像只能只读挂载
+    int bmap;           // 关闭镜像时在旁边生成 bmaptool 块映射 <镜像>.bmap（见 bmap.c）
+    int out_format;     // FATIMAGE_OUT_xxx
+    FILE* stream;       // 非NULL时关闭镜像后把它顺序写入该流（标准输出、管道），path 只用于命名临时文件
+    int extent_map;     // 关闭镜像时生成每个文件的扇区区段表 <镜像>.extents.json/.bin（见 extmap.h）
+    const char* const* contig; // 必须占用连续簇的文件（镜像内路径，不区分大小写），共 n_contig 个；
+    int n_contig;              // 没有足够大的连续空闲区域时拷贝失败
+} fatimage_config;
+
+/* 镜像上下文（字段只供 diskio 和本库内部使用，调用者只读） */
+typedef struct fatimage {
+    BYTE slot;                  // 占用的卷号（驱动器号表下标）
+    BYTE pdrv;                  // 物理驱动器号（分区为所在镜像的驱动器号）
+    char drive[3];              // 对应的FatFs卷路径，例如 "3:"
+    struct fatimage* parent;    // 分区所在的镜像，整盘镜像为NULL
+    BYTE part;                  // 分区序号(1-4)，整盘镜像为0
+    fatimage_config cfg;        // 配置（path 为内部拷贝）
+    fatimage_backend* be;       // 存储后端
+    DSTATUS stat;               // 磁盘状态
+    int mounted;                // 是否已挂载
+    int skel_pending;           // 刚执行过 f_mkfs，挂载后把元数据保存为骨架
+    int aborted;                // 生成失败（fatimage_abort），关闭时不写出区段表、块映射和转换输出
+    fatimage_backend* mapped;   // 块映射后端（img->be 或它的内层），没有时为NULL
+    BYTE* contig_found;         // cfg.contig 中每一项是否匹配到了拷贝的文件（分区记录在所在镜像中）
+    dedup_table* dedup;         // 规划阶段得到的重复文件表（fatimage_set_dedup），NULL时拷贝前自行检测
+    FATFS fs;                   // 文件系统对象
+} fatimage;
+
+fatimage* fatimage_open(const fatimage_config* cfg);
+fatimage* fatimage_open_existing(const char* path);
+fatimage* fatimage_open_partition(fatimage* disk, int part, BYTE fmt, DWORD au_size);
+int fatimage_fdisk(fatimage* img, const LBA_t ptbl[]);
+int fatimage_format(fatimage* img);
+int fatimage_mount(fatimage* img);
+int fatimage_copy_dir(fatimage* img, const char* pc_dir_path, src_cache* cache);
+int fatimage_copy_archive(fatimage* img, const char* archive_path);
+int fatimage_copy_manifest(fatimage* img, const char* manifest_path);
+void fatimage_set_dedup(fatimage* img, dedup_table* table);
+int fatimage_close(fatimage* img);
+void fatimage_abort(fatimage* img);
+const char* fatimage_drive(const fatimage* img);
+
+int fatimage_write_extent(FIL* fp, const char* pc_path, const void* data, uint64_t size);
+int fatimage_wants_contiguous(const char* fatfs_path);
+int fatimage_check_contiguous(const fatimage* img);
+void fatimage_set_time(DWORD fattime);
+void fatimage_set_build_time(DWORD fattime);
+DWORD fatimage_reproducible_time(void);
+
+/* 供 diskio.c 使用：按驱动器号找到镜像上下文，未占用时返回NULL */
+fatimage* fatimage_from_pdrv(BYTE pdrv);
+#endif
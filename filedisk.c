@@ -0,0 +1,273 @@
+#include "backends.h"
+#include <windows.h>    // 用于镜像文件的定位I/O
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+=================================================================================
+ 1. 公共函数：创建镜像文件
+=================================================================================
+*/
+
+/**
+ * @brief Creates (or truncates) an image file and extends it to the requested size.
+ * @param path Path of the image file.
+ * @param size Image size in bytes.
+ * @param flags Extra CreateFile flags (e.g. FILE_FLAG_OVERLAPPED).
+ * @return File handle, or INVALID_HANDLE_VALUE on failure (an error is printed).
+ */
+HANDLE create_image_file(const char* path, uint64_t size, DWORD flags) {
+    // CREATE_ALWAYS 会截断旧的镜像文件，确保每次都是新的开始
+    HANDLE h = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                          CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | flags, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Failed to create disk image file '%s'. Error code: %lu\n", path, GetLastError());
+        return INVALID_HANDLE_VALUE;
+    }
+
+    // 将文件扩展到预定义的大小
+    LARGE_INTEGER end;
+    end.QuadPart = (LONGLONG)size;
+    if (!SetFilePointerEx(h, end, NULL, FILE_BEGIN) || !SetEndOfFile(h)) {
+        fprintf(stderr, "Error: Failed to set the size of disk image '%s'. Error code: %lu\n", path, GetLastError());
+        CloseHandle(h);
+        return INVALID_HANDLE_VALUE;
+    }
+    return h;
+}
+
+/**
+ * @brief Sends an FSCTL and waits for it to finish. The request carries its own OVERLAPPED and
+ *        event, so it is also well-defined on handles opened with FILE_FLAG_OVERLAPPED.
+ * @return Nonzero on success.
+ */
+BOOL device_control(HANDLE h, DWORD code, void* in, DWORD in_size, void* out, DWORD out_size) {
+    OVERLAPPED ov = { 0 };
+    DWORD ret_bytes;
+    BOOL ok = FALSE;
+
+    ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!ov.hEvent) {
+        return FALSE;
+    }
+    if (DeviceIoControl(h, code, in, in_size, out, out_size, &ret_bytes, &ov) || GetLastError() == ERROR_IO_PENDING) {
+        ok = GetOverlappedResult(h, &ov, &ret_bytes, TRUE);
+    }
+    CloseHandle(ov.hEvent);
+    return ok;
+}
+
+/**
+ * @brief Returns the cluster size to align block clones to when the image's volume supports
+ *        FSCTL_DUPLICATE_EXTENTS_TO_FILE (ReFS), or 0 when it does not.
+ */
+DWORD query_clone_unit(HANDLE h) {
+    // ReFS 等支持完整性流的卷可以块克隆，记录其簇大小作为克隆的对齐单位
+    FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity;
+    if (device_control(h, FSCTL_GET_INTEGRITY_INFORMATION, NULL, 0, &integrity, sizeof(integrity))) {
+        return integrity.ClusterSizeInBytes;
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 同步文件后端：定位读写
+=================================================================================
+*/
+
+typedef struct {
+    fatimage_backend ops;
+    HANDLE h;
+    volatile LONG clone_unit;   // 所在卷支持块克隆(ReFS)时为其簇大小，否则为0；同一镜像的多个分区可能同时读写
+} file_backend;
+
+// 单次 ReadFile/WriteFile 的最大字节数
+#define FILE_IO_CHUNK 0x40000000u
+// 直接拷贝PC文件时的缓冲区大小
+#define COPY_IO_BUFFER (1024 * 1024)
+
+/*
+ 读写都使用 OVERLAPPED 中的偏移（定位I/O），不依赖文件指针，
+ 因此多个线程可以同时读写同一个镜像文件中互不重叠的区域（例如不同分区）。
+*/
+static int file_read(fatimage_backend* be, void* buff, uint64_t offset, size_t bytes) {
+    HANDLE h = ((file_backend*)be)->h;
+    BYTE* p = (BYTE*)buff;
+    while (bytes > 0) {
+        OVERLAPPED ov = { 0 };
+        DWORD chunk = (bytes > FILE_IO_CHUNK) ? FILE_IO_CHUNK : (DWORD)bytes;
+        DWORD done;
+        ov.Offset = (DWORD)offset;
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        if (!ReadFile(h, p, chunk, &done, &ov) || done != chunk) {
+            return -1;
+        }
+        p += chunk;
+        offset += chunk;
+        bytes -= chunk;
+    }
+    return 0;
+}
+
+static int file_write(fatimage_backend* be, const void* buff, uint64_t offset, size_t bytes) {
+    HANDLE h = ((file_backend*)be)->h;
+    const BYTE* p = (const BYTE*)buff;
+    while (bytes > 0) {
+        OVERLAPPED ov = { 0 };
+        DWORD chunk = (bytes > FILE_IO_CHUNK) ? FILE_IO_CHUNK : (DWORD)bytes;
+        DWORD done;
+        ov.Offset = (DWORD)offset;
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        if (!WriteFile(h, p, chunk, &done, &ov) || done != chunk) {
+            return -1;
+        }
+        p += chunk;
+        offset += chunk;
+        bytes -= chunk;
+    }
+    return 0;
+}
+
+static int file_sync(fatimage_backend* be) {
+    // WriteFile 已直接交给系统缓存，与原来的 fflush 等价，这里无需再做什么
+    (void)be;
+    return 0;
+}
+
+static int file_close(fatimage_backend* be) {
+    int ret = CloseHandle(((file_backend*)be)->h) ? 0 : -1;
+    free(be);
+    return ret;
+}
+
+/**
+ * @brief Copies the first bytes of a PC file into the image at offset.
+ *        On a volume with block cloning (ReFS) the cluster-aligned part is cloned with
+ *        FSCTL_DUPLICATE_EXTENTS_TO_FILE, so the data is shared instead of copied; the rest
+ *        (or everything, on other filesystems) is copied with positional ReadFile/WriteFile.
+ * @return 0 on success, -1 on failure.
+ */
+static int file_copy_file(fatimage_backend* be, const char* pc_path, uint64_t offset, uint64_t bytes) {
+    file_backend* fb = (file_backend*)be;
+    uint64_t done = 0;
+    int ret = -1;
+
+    HANDLE src = CreateFile(pc_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (src == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Cannot open PC file '%s'.\n", pc_path);
+        return -1;
+    }
+
+    // 1. 块克隆：源和目标的起止位置都必须按卷的簇大小对齐
+    DWORD clone_unit = (DWORD)fb->clone_unit;
+    if (clone_unit && offset % clone_unit == 0) {
+        DUPLICATE_EXTENTS_DATA dup;
+        DWORD ret_bytes;
+        dup.FileHandle = src;
+        dup.SourceFileOffset.QuadPart = 0;
+        dup.TargetFileOffset.QuadPart = (LONGLONG)offset;
+        dup.ByteCount.QuadPart = (LONGLONG)(bytes / clone_unit * clone_unit);
+        if (dup.ByteCount.QuadPart > 0 &&
+            DeviceIoControl(fb->h, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &dup, sizeof(dup), NULL, 0, &ret_bytes, NULL)) {
+            done = (uint64_t)dup.ByteCount.QuadPart;
+        } else {
+            InterlockedExchange(&fb->clone_unit, 0); // 例如源文件在其它卷上，之后不再尝试
+        }
+    }
+
+    // 2. 剩余部分用定位读写拷贝
+    if (done < bytes) {
+        BYTE* buffer = (BYTE*)malloc(COPY_IO_BUFFER);
+        if (!buffer) {
+            CloseHandle(src);
+            return -1;
+        }
+        while (done < bytes) {
+            OVERLAPPED ov = { 0 };
+            DWORD chunk = (bytes - done > COPY_IO_BUFFER) ? COPY_IO_BUFFER : (DWORD)(bytes - done);
+            DWORD got;
+            ov.Offset = (DWORD)done;
+            ov.OffsetHigh = (DWORD)(done >> 32);
+            if (!ReadFile(src, buffer, chunk, &got, &ov) || got != chunk) {
+                fprintf(stderr, "Error: Failed reading from PC file '%s'.\n", pc_path);
+                break;
+            }
+            if (file_write(be, buffer, offset + done, chunk) != 0) {
+                fprintf(stderr, "Error: Failed writing to disk image.\n");
+                break;
+            }
+            done += chunk;
+        }
+        free(buffer);
+    }
+    if (done == bytes) {
+        ret = 0;
+    }
+
+    CloseHandle(src);
+    return ret;
+}
+
+/**
+ * @brief Creates (or truncates) an image file and extends it to the requested size.
+ * @param path Path of the image file.
+ * @param size Image size in bytes.
+ * @return New backend, or NULL on failure.
+ */
+fatimage_backend* file_backend_create(const char* path, uint64_t size) {
+    file_backend* fb = (file_backend*)calloc(1, sizeof(file_backend));
+    if (!fb) {
+        return NULL;
+    }
+
+    fb->h = create_image_file(path, size, 0);
+    if (fb->h == INVALID_HANDLE_VALUE) {
+        free(fb);
+        return NULL;
+    }
+    fb->clone_unit = (LONG)query_clone_unit(fb->h);
+
+    fb->ops.read = file_read;
+    fb->ops.write = file_write;
+    fb->ops.sync = file_sync;
+    fb->ops.close = file_close;
+    fb->ops.copy_file = file_copy_file;
+    return &fb->ops;
+}
+
+/**
+ * @brief Opens an existing image file read-only, e.g. to extract or verify it.
+ *        Writes through the returned backend fail.
+ * @param path Path of the image file.
+ * @param size Receives the image size in bytes.
+ * @return New backend, or NULL on failure (an error is printed).
+ */
+fatimage_backend* file_backend_open(const char* path, uint64_t* size) {
+    file_backend* fb = (file_backend*)calloc(1, sizeof(file_backend));
+    LARGE_INTEGER file_size;
+    if (!fb) {
+        return NULL;
+    }
+
+    fb->h = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fb->h == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Cannot open disk image '%s'. Error code: %lu\n", path, GetLastError());
+        free(fb);
+        return NULL;
+    }
+    if (!GetFileSizeEx(fb->h, &file_size)) {
+        fprintf(stderr, "Error: Cannot get the size of disk image '%s'. Error code: %lu\n", path, GetLastError());
+        CloseHandle(fb->h);
+        free(fb);
+        return NULL;
+    }
+    *size = (uint64_t)file_size.QuadPart;
+
+    fb->ops.read = file_read;
+    fb->ops.write = file_write;
+    fb->ops.sync = file_sync;
+    fb->ops.close = file_close;
+    return &fb->ops;
+}
@@ -0,0 +1,253 @@
+#include "backends.h"
+#include "deflate.h"
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* BGZF（blocked gzip，SAM/BAM 规范）：每个 gzip 成员最多64KiB，头部扩展字段 "BC" 记录成员大小 */
+#define BGZF_BLOCK          0xff00u     // 每个成员的输入字节数，压缩不了时存储块也放得下
+#define BGZF_HDR_SZ         18
+#define BGZF_TAIL_SZ        8           // CRC32 + 输入大小
+#define BGZF_MAX_MEMBER     65536u
+// 每个线程每批压缩的成员数
+#define GZ_BATCH_PER_THREAD 16
+#define GZ_MAX_THREADS      32
+
+/* BGZF 文件结尾的空成员 */
+static const BYTE bgzf_eof[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/*
+ gzip 压缩镜像：把镜像切成 0xff00 字节的块，每块压缩成一个独立的 gzip 成员（BGZF 格式）。
+ 成员之间没有依赖，一批块由多个线程并行压缩，再按顺序写出；任何 gzip 解压工具都能解开，
+ bgzip/bmaptool 等工具还可以按成员随机访问。
+ 整块都是0的成员内容固定，只压缩一次；块映射中从未写入的块不从镜像读取。
+*/
+
+typedef struct {
+    BYTE* in;               // 输入数据
+    size_t n;               // 输入字节数
+    int unmapped;           // 整块从未写入（输入已清零，不必再检查）
+    BYTE* out;              // 压缩结果缓冲区
+    const BYTE* result;     // 压缩结果（out 或共用的全零成员）
+    size_t result_len;      // 0表示压缩失败
+} gz_member;
+
+typedef struct {
+    gz_member* members;
+    LONG n;
+    volatile LONG next;     // 下一个待压缩的成员
+    const BYTE* zero_member;
+    size_t zero_len;
+    volatile LONG failed;   // 有成员压缩失败
+} gz_batch;
+
+typedef struct {
+    gz_batch* batch;
+    deflate_state* st;      // 每个线程自己的压缩状态
+} gz_worker;
+
+/*
+=================================================================================
+ 1. 辅助函数：生成成员
+=================================================================================
+*/
+
+static void put16(BYTE* p, uint32_t v) {
+    p[0] = (BYTE)v;
+    p[1] = (BYTE)(v >> 8);
+}
+
+static void put32(BYTE* p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static int is_zero(const BYTE* p, size_t n) {
+    return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);
+}
+
+static int range_mapped(const BYTE* map, uint64_t offset, size_t n) {
+    for (uint64_t b = offset / MAP_BLOCK_SIZE; b <= (offset + n - 1) / MAP_BLOCK_SIZE; b++) {
+        if ((map[b / 8] >> (b & 7)) & 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Compresses one block into a BGZF member: gzip header with the "BC" extra field, raw DEFLATE data,
+ *        CRC-32 and input size.
+ * @param out Buffer of BGZF_MAX_MEMBER bytes.
+ * @return Member size, or 0 if the compressed data does not fit in the member.
+ */
+static size_t build_member(deflate_state* st, const BYTE* in, size_t n, BYTE* out) {
+    // 输入不超过 BGZF_BLOCK，存储块也放得下，正常情况下不会失败
+    size_t clen = deflate_compress(st, in, n, out + BGZF_HDR_SZ, BGZF_MAX_MEMBER - BGZF_HDR_SZ - BGZF_TAIL_SZ);
+    if (clen == 0) {
+        return 0;
+    }
+    size_t total = BGZF_HDR_SZ + clen + BGZF_TAIL_SZ;
+
+    memset(out, 0, BGZF_HDR_SZ);
+    out[0] = 0x1f;
+    out[1] = 0x8b;
+    out[2] = 8;         // CM = deflate
+    out[3] = 4;         // FLG = FEXTRA
+    out[9] = 0xff;      // OS = 未知
+    put16(out + 10, 6); // XLEN
+    out[12] = 'B';
+    out[13] = 'C';
+    put16(out + 14, 2);
+    put16(out + 16, (uint32_t)(total - 1));
+    put32(out + BGZF_HDR_SZ + clen, crc32_update(0, in, n));
+    put32(out + BGZF_HDR_SZ + clen + 4, (uint32_t)n);
+    return total;
+}
+
+static DWORD WINAPI gz_worker_main(LPVOID arg) {
+    gz_worker* w = (gz_worker*)arg;
+    gz_batch* b = w->batch;
+
+    for (;;) {
+        LONG i = InterlockedIncrement(&b->next) - 1;
+        if (i >= b->n) {
+            break;
+        }
+        gz_member* m = &b->members[i];
+        if (m->n == BGZF_BLOCK && (m->unmapped || is_zero(m->in, m->n))) {
+            m->result = b->zero_member;
+            m->result_len = b->zero_len;
+        } else {
+            m->result = m->out;
+            m->result_len = build_member(w->st, m->in, m->n, m->out);
+            if (m->result_len == 0) {
+                InterlockedExchange(&b->failed, 1);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Compresses a batch on n_threads threads (the current one included).
+ */
+static void run_batch(gz_batch* batch, gz_worker* workers, int n_threads, HANDLE* threads) {
+    int started = 0;
+
+    for (int i = 1; i < n_threads && i < batch->n; i++) {
+        workers[i].batch = batch;
+        threads[started] = CreateThread(NULL, 0, gz_worker_main, &workers[i], 0, NULL);
+        if (!threads[started]) {
+            break; // 剩下的成员由当前线程压缩
+        }
+        started++;
+    }
+    workers[0].batch = batch;
+    gz_worker_main(&workers[0]);
+    for (int i = 0; i < started; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+}
+
+/*
+=================================================================================
+ 2. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Compresses an image to a BGZF (blocked gzip) file. The blocks are compressed in parallel,
+ *        one thread per CPU core, and written in order. Blocks the map marks as never written are not read.
+ * @param be Backend of the finished image (already synced).
+ * @param map One bit per MAP_BLOCK_SIZE block, set for blocks that were written.
+ * @param size Image size in bytes.
+ * @param f Output file or stream, written sequentially.
+ * @return 0 on success, -1 on failure.
+ */
+int write_gzip_image(fatimage_backend* be, const BYTE* map, uint64_t size, FILE* f) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int n_threads = (int)si.dwNumberOfProcessors;
+    if (n_threads > GZ_MAX_THREADS) n_threads = GZ_MAX_THREADS;
+    if (n_threads < 1) n_threads = 1;
+    int per_batch = n_threads * GZ_BATCH_PER_THREAD;
+
+    BYTE* in = (BYTE*)malloc((size_t)per_batch * BGZF_BLOCK);
+    BYTE* out = (BYTE*)malloc((size_t)per_batch * BGZF_MAX_MEMBER);
+    BYTE* zero_member = (BYTE*)malloc(BGZF_MAX_MEMBER);
+    gz_member* members = (gz_member*)calloc(per_batch, sizeof(gz_member));
+    gz_worker* workers = (gz_worker*)calloc(n_threads, sizeof(gz_worker));
+    HANDLE* threads = (HANDLE*)calloc(n_threads, sizeof(HANDLE));
+    int ret = -1;
+
+    if (!in || !out || !zero_member || !members || !workers || !threads) {
+        goto done;
+    }
+    for (int i = 0; i < n_threads; i++) {
+        if (!(workers[i].st = deflate_create())) {
+            goto done;
+        }
+    }
+    memset(in, 0, BGZF_BLOCK);
+    size_t zero_len = build_member(workers[0].st, in, BGZF_BLOCK, zero_member);
+    if (zero_len == 0) {
+        fprintf(stderr, "Error: Failed to compress a gzip member.\n");
+        goto done;
+    }
+
+    for (uint64_t offset = 0; offset < size; ) {
+        gz_batch batch = { members, 0, 0, zero_member, zero_len, 0 };
+        uint64_t batch_offset = offset;
+
+        // 读入一批块（当前线程），再并行压缩
+        for (; batch.n < per_batch && offset < size; batch.n++) {
+            gz_member* m = &members[batch.n];
+            m->in = in + (size_t)batch.n * BGZF_BLOCK;
+            m->out = out + (size_t)batch.n * BGZF_MAX_MEMBER;
+            m->n = (size - offset < BGZF_BLOCK) ? (size_t)(size - offset) : BGZF_BLOCK;
+            m->unmapped = !range_mapped(map, offset, m->n);
+            if (m->unmapped) {
+                memset(m->in, 0, m->n);
+            } else if (be->read(be, m->in, offset, m->n) != 0) {
+                fprintf(stderr, "Error: Failed to read image at offset %llu for compression.\n", (unsigned long long)offset);
+                goto done;
+            }
+            offset += m->n;
+        }
+        run_batch(&batch, workers, n_threads, threads);
+        // 压缩失败的批次不写出，否则输出的是缺了成员、却看不出损坏的 gzip 文件
+        if (batch.failed) {
+            fprintf(stderr, "Error: Failed to compress image data at offset %llu.\n", (unsigned long long)batch_offset);
+            goto done;
+        }
+        for (LONG i = 0; i < batch.n; i++) {
+            if (fwrite(members[i].result, 1, members[i].result_len, f) != members[i].result_len) {
+                fprintf(stderr, "Error: Failed to write compressed image data.\n");
+                goto done;
+            }
+        }
+    }
+    if (fwrite(bgzf_eof, 1, sizeof(bgzf_eof), f) != sizeof(bgzf_eof)) {
+        fprintf(stderr, "Error: Failed to write compressed image data.\n");
+        goto done;
+    }
+    ret = 0;
+
+done:
+    for (int i = 0; workers && i < n_threads; i++) {
+        deflate_free(workers[i].st);
+    }
+    free(threads);
+    free(workers);
+    free(members);
+    free(zero_member);
+    free(out);
+    free(in);
+    return ret;
+}
@@ -0,0 +1,214 @@
+#include "imgcache.h"
+#include "backends.h"
+#include "imgtree.h"
+#include "extmap.h"
+#include "scan.h"
+#include "sha256.h"
+#include <windows.h>    // 用于文件读取和原子替换
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 打包器的输出格式变化（目录项顺序、分配策略等）时递增，使旧的缓存失效
+#define IMGCACHE_VERSION    1
+
+/*
+ 缓存键 = SHA-256(版本、FatFs 配置、镜像大小/格式/簇大小、生成时间、时间戳和去重选项、必须连续存放的文件、源目录树)。
+ 源目录树按名称排序后逐项摘要：类型、名称、文件大小和内容的 SHA-256，保留时间戳时再加上修改时间。
+ 只有可重现模式生成的镜像才能缓存：相同的键一定得到逐字节相同的镜像。
+*/
+
+/*
+=================================================================================
+ 1. 辅助函数：摘要
+=================================================================================
+*/
+
+static void hash_u64(sha256_ctx* ctx, uint64_t v) {
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++) {
+        b[i] = (uint8_t)(v >> (8 * i));
+    }
+    sha256_update(ctx, b, sizeof(b));
+}
+
+/**
+ * @brief Adds a sorted source directory to the digest, recursively.
+ * @return 0 on success, -1 on failure.
+ */
+static int hash_tree(sha256_ctx* ctx, const char* pc_dir_path, const src_node* dir, src_cache* cache, int keep_times) {
+    char path[MAX_PATH];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+
+    for (size_t i = 0; i < dir->n_children; i++) {
+        const src_node* child = &dir->children[i];
+        snprintf(path, sizeof(path), "%s/%s", pc_dir_path, child->name);
+
+        sha256_update(ctx, child->is_dir ? "D" : "F", 1);
+        sha256_update(ctx, child->name, strlen(child->name) + 1);
+        if (keep_times) {
+            hash_u64(ctx, child->mtime);
+        }
+        if (child->is_dir) {
+            if (hash_tree(ctx, path, child, cache, keep_times) != 0) {
+                return -1;
+            }
+            sha256_update(ctx, "E", 1); // 目录结束
+        } else {
+            if (src_cache_digest(cache, path, digest) != 0) {
+                return -1;
+            }
+            hash_u64(ctx, child->size);
+            sha256_update(ctx, digest, sizeof(digest));
+        }
+    }
+    return 0;
+}
+
+static void cache_path(const fatimage_config* cfg, const char* key, const char* ext, char* buf, size_t len) {
+    snprintf(buf, len, "%s\\%s%s", cfg->image_cache, key, ext);
+}
+
+/**
+ * @brief Copies src to dst under a temporary name and renames it, so concurrent builds never see a partial file.
+ */
+static int store_file(const char* src, const char* dst) {
+    char tmp[MAX_PATH];
+
+    snprintf(tmp, sizeof(tmp), "%s.%lu-%lu.tmp", dst, (unsigned long)GetCurrentProcessId(), (unsigned long)GetCurrentThreadId());
+    if (!CopyFile(src, tmp, FALSE) || !MoveFileEx(tmp, dst, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFile(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Computes the cache key of an image: the SHA-256 of the source tree (names, sizes, contents,
+ *        and times with keep_times) and of every option that changes the image bytes.
+ * @param cfg Image configuration with the final size (after auto sizing); must be deterministic.
+ * @param source Source folder on the PC.
+ * @param cache Shared source cache, or NULL to read the files directly.
+ * @param key Receives the key as 64 hex digits.
+ * @return 0 on success, -1 on failure.
+ */
+int imgcache_key(const fatimage_config* cfg, const char* source, src_cache* cache, char key[IMGCACHE_KEY_LEN + 1]) {
+    sha256_ctx ctx;
+    src_node tree;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+
+    if (!cfg->deterministic) {
+        fprintf(stderr, "Error: Only reproducible images can be cached.\n");
+        return -1;
+    }
+    if (scan_source_tree(source, &tree) != 0) {
+        free_source_tree(&tree);
+        return -1;
+    }
+    sort_source_tree(&tree);
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, "fatimage", 8);
+    hash_u64(&ctx, IMGCACHE_VERSION);
+    hash_u64(&ctx, FF_DEFINED);
+    hash_u64(&ctx, FF_CODE_PAGE);       // 短文件名的生成取决于代码页
+    hash_u64(&ctx, cfg->size);
+    hash_u64(&ctx, cfg->fmt);
+    hash_u64(&ctx, cfg->au_size);
+    hash_u64(&ctx, fatimage_reproducible_time());
+    hash_u64(&ctx, cfg->keep_times ? 1 : 0);
+    hash_u64(&ctx, cfg->dedup ? 1 : 0);
+    // 必须连续存放的文件改变簇的分配；没有时不参与摘要，已有的缓存键保持不变
+    for (int i = 0; i < cfg->n_contig; i++) {
+        sha256_update(&ctx, "C", 1);
+        sha256_update(&ctx, cfg->contig[i], strlen(cfg->contig[i]) + 1);
+    }
+    int ret = hash_tree(&ctx, source, &tree, cache, cfg->keep_times);
+    free_source_tree(&tree);
+    if (ret != 0) {
+        return -1;
+    }
+    sha256_final(&ctx, digest);
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        snprintf(key + 2 * i, 3, "%02x", digest[i]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates cfg->path from the cached image with the given key. The copy goes through the file
+ *        backend, so on ReFS it is a block clone that shares the cached image's clusters.
+ *        Hard links are not used: the output would alias the cache entry. With cfg->bmap the cached
+ *        block map is restored too, and an entry without one counts as a miss. With cfg->extent_map the
+ *        extent map is written again from the restored image.
+ * @return 0 when the image was restored, 1 when it is not cached, -1 on an I/O error.
+ */
+int imgcache_fetch(const fatimage_config* cfg, const char* key) {
+    char path[MAX_PATH], bmap[MAX_PATH], out_bmap[MAX_PATH];
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    cache_path(cfg, key, ".img", path, sizeof(path));
+    cache_path(cfg, key, ".bmap", bmap, sizeof(bmap));
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attr) ||
+        (((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow) != cfg->size ||
+        (cfg->bmap && GetFileAttributes(bmap) == INVALID_FILE_ATTRIBUTES)) {
+        return 1;
+    }
+
+    fatimage_backend* be = file_backend_create(cfg->path, cfg->size);
+    if (!be) {
+        return -1;
+    }
+    int rc = be->copy_file(be, path, 0, cfg->size);
+    if (rc == 0) {
+        rc = be->sync(be);
+    }
+    if (be->close(be) != 0) {
+        rc = -1;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "Error: Failed to copy cached image '%s' to '%s'.\n", path, cfg->path);
+        return -1;
+    }
+    snprintf(out_bmap, sizeof(out_bmap), "%s.bmap", cfg->path);
+    if (cfg->bmap && !CopyFile(bmap, out_bmap, FALSE)) {
+        fprintf(stderr, "Error: Failed to copy cached block map '%s' to '%s'.\n", bmap, out_bmap);
+        return -1;
+    }
+    // 区段表中有镜像的路径，不缓存，从取回的镜像重新生成
+    if (cfg->extent_map) {
+        fatimage* img = image_open_mounted(cfg->path);
+        int ok = img && extmap_write(img) == 0;
+        fatimage_close(img);
+        if (!ok) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds a finished image (and its block map with cfg->bmap) to the cache under its key.
+ *        The files are written under temporary names and renamed, so concurrent builds never
+ *        see a partial entry; the block map goes first, so an entry whose image is present is complete.
+ * @return 0 on success, -1 on failure (a warning is printed; the image itself is not affected).
+ */
+int imgcache_store(const fatimage_config* cfg, const char* key) {
+    char path[MAX_PATH], bmap[MAX_PATH], out_bmap[MAX_PATH];
+
+    cache_path(cfg, key, ".img", path, sizeof(path));
+    cache_path(cfg, key, ".bmap", bmap, sizeof(bmap));
+    snprintf(out_bmap, sizeof(out_bmap), "%s.bmap", cfg->path);
+    if ((cfg->bmap && store_file(out_bmap, bmap) != 0) || store_file(cfg->path, path) != 0) {
+        fprintf(stderr, "Warning: Cannot add '%s' to the image cache.\n", cfg->path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef __IMGCACHE_H__
+#define __IMGCACHE_H__
+#include "fatimage.h"
+#include "srccache.h"
+
+// 缓存键：SHA-256 的十六进制字符串长度
+#define IMGCACHE_KEY_LEN 64
+
+/* 镜像产物缓存：以源目录内容和生成选项的摘要为键保存整个镜像，输入不变时直接取回，不再生成 */
+int imgcache_key(const fatimage_config* cfg, const char* source, src_cache* cache, char key[IMGCACHE_KEY_LEN + 1]);
+int imgcache_fetch(const fatimage_config* cfg, const char* key);
+int imgcache_store(const fatimage_config* cfg, const char* key);
+#endif
@@ -0,0 +1,247 @@
+#include "imgtree.h"
+#include "ff.h"         // FatFs库
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 簇链映射表（CLMT）的初始大小，碎片多的文件按 f_lseek 返回的所需大小重新分配
+#define TREE_CLMT_INIT  64
+// 镜像内路径的最大长度
+#define TREE_PATH_MAX   1024
+
+/*
+ 镜像目录树：用 FatFs 遍历一次已挂载的镜像，记录每个目录和文件；文件用快速定位的簇链映射表
+ （f_lseek CREATE_LINKMAP）换算成镜像文件中的连续区段。之后的读取（解包、校验、区段表）
+ 都可以按区段直接定位读取镜像，不再经过 FatFs，也就可以多线程进行。
+*/
+
+/*
+=================================================================================
+ 1. 辅助函数：簇链映射表 -> 区段
+=================================================================================
+*/
+
+/**
+ * @brief Builds the list of contiguous byte ranges of an open file from its cluster link map table.
+ * @return 0 on success, -1 on failure.
+ */
+static int map_runs(FIL* fp, img_entry* e) {
+    FATFS* fs = fp->obj.fs;
+    uint64_t csize_bytes = (uint64_t)fs->csize * FF_MIN_SS;
+    DWORD n_tbl = TREE_CLMT_INIT;
+    DWORD* tbl = NULL;
+    FRESULT res;
+
+    if (e->size == 0) {
+        return 0;
+    }
+    // 表不够大时 f_lseek 返回 FR_NOT_ENOUGH_CORE，tbl[0] 为所需的大小
+    for (;;) {
+        DWORD* p = (DWORD*)realloc(tbl, n_tbl * sizeof(DWORD));
+        if (!p) {
+            free(tbl);
+            return -1;
+        }
+        tbl = p;
+        tbl[0] = n_tbl;
+        fp->cltbl = tbl;
+        res = f_lseek(fp, CREATE_LINKMAP);
+        if (res != FR_NOT_ENOUGH_CORE) {
+            break;
+        }
+        n_tbl = tbl[0];
+    }
+    fp->cltbl = NULL;
+    if (res != FR_OK) {
+        free(tbl);
+        return -1;
+    }
+
+    // 表的格式：总长度，之后每个片段为 (簇数, 起始簇)，以0结束
+    int n_frags = (int)((tbl[0] - 1) / 2);
+    e->runs = (img_run*)malloc((n_frags > 0 ? n_frags : 1) * sizeof(img_run));
+    if (!e->runs) {
+        free(tbl);
+        return -1;
+    }
+    uint64_t left = e->size;
+    for (int i = 0; i < n_frags && left > 0; i++) {
+        uint64_t len = (uint64_t)tbl[1 + i * 2] * csize_bytes;
+        DWORD clst = tbl[2 + i * 2];
+        // 数据区起始扇区 + 簇号偏移，database 已包含分区的起始位置
+        e->runs[e->n_runs].offset = ((uint64_t)fs->database + (uint64_t)fs->csize * (clst - 2)) * FF_MIN_SS;
+        e->runs[e->n_runs].len = (len < left) ? len : left;
+        left -= e->runs[e->n_runs].len;
+        e->n_runs++;
+    }
+    free(tbl);
+    return (left == 0) ? 0 : -1;
+}
+
+static img_entry* add_entry(img_tree* tree, const char* path, const FILINFO* fno) {
+    if (tree->n == tree->cap) {
+        int new_cap = tree->cap ? tree->cap * 2 : 256;
+        img_entry* p = (img_entry*)realloc(tree->entries, new_cap * sizeof(img_entry));
+        if (!p) {
+            return NULL;
+        }
+        tree->entries = p;
+        tree->cap = new_cap;
+    }
+    img_entry* e = &tree->entries[tree->n];
+    memset(e, 0, sizeof(*e));
+    if (!(e->path = _strdup(path))) {
+        return NULL;
+    }
+    e->is_dir = (fno->fattrib & AM_DIR) != 0;
+    e->size = e->is_dir ? 0 : fno->fsize;
+    e->fdate = fno->fdate;
+    e->ftime = fno->ftime;
+    e->attr = fno->fattrib;
+    tree->n++;
+    return e;
+}
+
+/**
+ * @brief Walks an open image directory recursively. Every level keeps its own DIR; files and
+ *        sub-directories are opened relative to it.
+ * @param rel Path of dir relative to the root ("" for the root).
+ * @return 0 on success, -1 on failure.
+ */
+static int walk_dir(img_tree* tree, DIR* dir, const char* rel) {
+    FILINFO fno;
+    char path[TREE_PATH_MAX];
+    FRESULT res;
+
+    while ((res = f_readdir(dir, &fno)) == FR_OK && fno.fname[0]) {
+        if (snprintf(path, sizeof(path), "%s%s%s", rel, rel[0] ? "/" : "", fno.fname) >= (int)sizeof(path)) {
+            fprintf(stderr, "Error: Path too long in image: '%s/%s'.\n", rel, fno.fname);
+            return -1;
+        }
+        img_entry* e = add_entry(tree, path, &fno);
+        if (!e) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return -1;
+        }
+
+        if (e->is_dir) {
+            DIR sub;
+            res = f_opendirat(dir, &sub, fno.fname);
+            if (res != FR_OK) {
+                fprintf(stderr, "Error: Cannot open FatFs directory '/%s'. FRESULT: %d\n", path, res);
+                return -1;
+            }
+            int ret = walk_dir(tree, &sub, path);
+            f_closedir(&sub);
+            if (ret != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        FIL fil;
+        res = f_openat(dir, &fil, fno.fname, FA_READ);
+        if (res != FR_OK) {
+            fprintf(stderr, "Error: Cannot open FatFs file '/%s'. FRESULT: %d\n", path, res);
+            return -1;
+        }
+        // e 可能因 realloc 移动，按下标重新取
+        int ret = map_runs(&fil, &tree->entries[tree->n - 1]);
+        f_close(&fil);
+        if (ret != 0) {
+            fprintf(stderr, "Error: Cannot map the clusters of '/%s' (damaged cluster chain?).\n", path);
+            return -1;
+        }
+    }
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: Failed to read FatFs directory '/%s'. FRESULT: %d\n", rel, res);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Opens an existing raw image (or the first FAT/exFAT partition of a partitioned one) read-only
+ *        and mounts it.
+ * @return The mounted image, or NULL on failure (sparse and gzip images are rejected).
+ */
+fatimage* image_open_mounted(const char* image_path) {
+    BYTE magic[4];
+
+    fatimage* img = fatimage_open_existing(image_path);
+    if (!img) {
+        return NULL;
+    }
+    // 稀疏镜像和 gzip 镜像不能直接挂载
+    if (img->cfg.size >= sizeof(magic) && img->be->read(img->be, magic, 0, sizeof(magic)) == 0 &&
+        ((magic[0] == 0x3a && magic[1] == 0xff && magic[2] == 0x26 && magic[3] == 0xed) ||
+         (magic[0] == 0x1f && magic[1] == 0x8b))) {
+        fprintf(stderr, "Error: '%s' is a sparse or gzip image. Convert it to a raw image first.\n", image_path);
+        fatimage_close(img);
+        return NULL;
+    }
+    if (fatimage_mount(img) != 0) {
+        fatimage_close(img);
+        return NULL;
+    }
+    return img;
+}
+
+/**
+ * @brief Lists every directory and file of a mounted image, parents before their contents, with the
+ *        byte ranges each file occupies in the image file.
+ * @param tree Receives the list; free it with image_tree_free (also on failure).
+ * @return 0 on success, -1 on failure.
+ */
+int image_tree_load(fatimage* img, img_tree* tree) {
+    DIR root;
+
+    memset(tree, 0, sizeof(*tree));
+    FRESULT res = f_opendir(&root, img->drive);
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: Cannot open the root directory of '%s'. FRESULT: %d\n", img->cfg.path, res);
+        return -1;
+    }
+    int ret = walk_dir(tree, &root, "");
+    f_closedir(&root);
+    return ret;
+}
+
+void image_tree_free(img_tree* tree) {
+    for (int i = 0; i < tree->n; i++) {
+        free(tree->entries[i].path);
+        free(tree->entries[i].runs);
+    }
+    free(tree->entries);
+    memset(tree, 0, sizeof(*tree));
+}
+
+/**
+ * @brief Reads bytes of a file's data starting at file position pos straight from the image,
+ *        following its runs. Thread-safe as far as the backend's read is (positioned reads).
+ * @return 0 on success, -1 on a read error or a range beyond the end of the file.
+ */
+int image_read_runs(fatimage_backend* be, const img_entry* e, uint64_t pos, void* buff, size_t bytes) {
+    BYTE* p = (BYTE*)buff;
+
+    for (int i = 0; i < e->n_runs && bytes > 0; i++) {
+        if (pos >= e->runs[i].len) {
+            pos -= e->runs[i].len;
+            continue;
+        }
+        size_t chunk = (e->runs[i].len - pos < bytes) ? (size_t)(e->runs[i].len - pos) : bytes;
+        if (be->read(be, p, e->runs[i].offset + pos, chunk) != 0) {
+            return -1;
+        }
+        p += chunk;
+        bytes -= chunk;
+        pos = 0;
+    }
+    return (bytes == 0) ? 0 : -1;
+}
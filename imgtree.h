@@ -0,0 +1,33 @@
+#ifndef __IMGTREE_H__
+#define __IMGTREE_H__
+#include <stdint.h>
+#include "fatimage.h"
+
+/* 文件数据在镜像文件中的一个连续区段 */
+typedef struct {
+    uint64_t offset;        // 在镜像文件中的字节偏移（已包含分区的起始位置）
+    uint64_t len;           // 字节数（最后一个区段截断到文件大小）
+} img_run;
+
+/* 镜像目录树中的一项 */
+typedef struct {
+    char* path;             // 相对于根目录的路径，以 '/' 分隔
+    int is_dir;
+    uint64_t size;          // 文件大小，目录为0
+    img_run* runs;          // 文件数据所在的区段，按文件内的顺序
+    int n_runs;
+    WORD fdate, ftime;      // 修改时间
+    BYTE attr;              // AM_xxx
+} img_entry;
+
+/* 已挂载镜像的全部目录和文件（先序：父目录在其内容之前） */
+typedef struct {
+    img_entry* entries;
+    int n, cap;
+} img_tree;
+
+fatimage* image_open_mounted(const char* image_path);
+int image_tree_load(fatimage* img, img_tree* tree);
+void image_tree_free(img_tree* tree);
+int image_read_runs(fatimage_backend* be, const img_entry* e, uint64_t pos, void* buff, size_t bytes);
+#endif
@@ -0,0 +1,385 @@
+#include "jobs.h"
+#include "fatimage.h"
+#include "imgcache.h"
+#include "planner.h"
+#include "scan.h"
+#include "srccache.h"
+#include "tools.h"
+#include <windows.h>    // 用于线程和计时
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 任务文件中一行的最大长度
+#define JOB_LINE_MAX    4096
+// 每行最多的字段数
+#define JOB_MAX_FIELDS  5
+// 所有任务共享的源文件缓存上限
+#define JOB_CACHE_BYTES (1024ull * 1024 * 1024)
+
+/* 一个镜像任务 */
+typedef struct {
+    int line;               // 在任务文件中的行号
+    char* output;           // 输出镜像路径
+    char* source;           // 源文件夹（绝对路径，便于共享缓存）
+    uint64_t size;          // 镜像大小（字节）
+    int size_auto;          // 是否自动计算大小
+    double headroom;        // 自动大小的预留百分比
+    BYTE fmt;               // FM_FAT / FM_FAT32 / FM_EXFAT
+    DWORD au_size;          // 簇大小，0表示默认
+    int status;             // 0:成功 -1:失败
+    double t_plan, t_format, t_copy, t_total; // 各阶段耗时（毫秒）
+} image_job;
+
+/* 工作线程共享的任务队列 */
+typedef struct {
+    image_job* jobs;
+    LONG n_jobs;
+    volatile LONG next;     // 下一个待领取的任务下标
+    volatile LONG done;     // 已完成的任务数
+    src_cache* cache;
+    fatimage_config base;   // 所有镜像共用的选项（I/O方式、骨架缓存目录、批量模式、时间戳）
+} job_pool;
+
+/*
+=================================================================================
+ 1. 辅助函数：计时与字段解析
+=================================================================================
+*/
+
+static double now_ms(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+/**
+ * @brief Splits a line into whitespace-separated fields in place; double quotes group a field with spaces.
+ * @return Number of fields (max_fields + 1 if there are more), or -1 on an unterminated quote. Stops at '#'.
+ */
+int split_fields(char* line, char* fields[], int max_fields) {
+    int n = 0;
+    char* p = line;
+
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (*p == '\0' || *p == '#') break;
+        if (n == max_fields) return max_fields + 1;
+        if (*p == '"') {
+            fields[n++] = ++p;
+            while (*p && *p != '"') p++;
+            if (*p != '"') return -1;
+            *p++ = '\0';
+        } else {
+            fields[n++] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+            if (*p) *p++ = '\0';
+        }
+    }
+    return n;
+}
+
+static int parse_format(const char* s, BYTE* fmt) {
+    if (stricmp(s, "FAT") == 0) {
+        *fmt = FM_FAT;
+    } else if (stricmp(s, "FAT32") == 0) {
+        *fmt = FM_FAT32;
+    } else if (stricmp(s, "EXFAT") == 0) {
+        *fmt = FM_EXFAT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static const char* format_name(BYTE fmt) {
+    return (fmt == FM_FAT) ? "FAT" : (fmt == FM_FAT32) ? "FAT32" : "EXFAT";
+}
+
+/*
+=================================================================================
+ 2. 读取任务文件
+=================================================================================
+*/
+
+/**
+ * @brief Parses a job file. Each non-empty line is
+ *        "<output> <size|auto[+N%]> <FAT|FAT32|EXFAT> <source_folder> [cluster_size]", '#' starts a comment.
+ * @param spec_path Path to the job file.
+ * @param jobs Receives a malloc'ed job array.
+ * @return Number of jobs, or -1 on error.
+ */
+static int load_jobs(const char* spec_path, image_job** jobs) {
+    FILE* fp = fopen(spec_path, "r");
+    char line[JOB_LINE_MAX];
+    char* f[JOB_MAX_FIELDS];
+    int n_jobs = 0, cap = 0, line_no = 0;
+    image_job* list = NULL;
+
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open job file '%s'.\n", spec_path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        int n = split_fields(line, f, JOB_MAX_FIELDS);
+        if (n == 0) {
+            continue;
+        }
+        if (n < 4 || n > JOB_MAX_FIELDS) {
+            fprintf(stderr, "Error: %s:%d: expected '<output> <size> <format> <source> [cluster]'.\n", spec_path, line_no);
+            goto fail;
+        }
+
+        if (n_jobs == cap) {
+            cap = cap ? cap * 2 : 16;
+            image_job* p = (image_job*)realloc(list, cap * sizeof(image_job));
+            if (!p) goto fail;
+            list = p;
+        }
+        image_job* job = &list[n_jobs];
+        memset(job, 0, sizeof(*job));
+        job->line = line_no;
+
+        if (strcmp(f[0], "-") == 0) {
+            fprintf(stderr, "Error: %s:%d: jobs cannot be written to standard output.\n", spec_path, line_no);
+            goto fail;
+        }
+        if (parse_size_spec(f[1], &job->size, &job->size_auto, &job->headroom) != 0) {
+            fprintf(stderr, "Error: %s:%d: invalid size.\n", spec_path, line_no);
+            goto fail;
+        }
+        if (parse_format(f[2], &job->fmt) != 0) {
+            fprintf(stderr, "Error: %s:%d: invalid format type '%s'. Use 'FAT', 'FAT32', or 'EXFAT'.\n", spec_path, line_no, f[2]);
+            goto fail;
+        }
+        if (n == 5) {
+            char* endptr;
+            unsigned long cluster = strtoul(f[4], &endptr, 10);
+            if (*endptr != '\0' || cluster < 512 || (cluster & (cluster - 1)) != 0) {
+                fprintf(stderr, "Error: %s:%d: invalid cluster size '%s'. Use a power of two >= 512.\n", spec_path, line_no, f[4]);
+                goto fail;
+            }
+            job->au_size = (DWORD)cluster;
+        }
+
+        // 源文件夹统一为绝对路径，使不同任务对同一文件的缓存键一致
+        char full[MAX_PATH];
+        DWORD len = GetFullPathName(f[3], sizeof(full), full, NULL);
+        job->output = _strdup(f[0]);
+        job->source = _strdup((len > 0 && len < sizeof(full)) ? full : f[3]);
+        n_jobs++;
+        if (!job->output || !job->source) goto fail;
+    }
+    fclose(fp);
+
+    if (n_jobs == 0) {
+        fprintf(stderr, "Error: Job file '%s' contains no jobs.\n", spec_path);
+        free(list);
+        return -1;
+    }
+    *jobs = list;
+    return n_jobs;
+
+fail:
+    fclose(fp);
+    for (int i = 0; i < n_jobs; i++) {
+        free(list[i].output);
+        free(list[i].source);
+    }
+    free(list);
+    return -1;
+}
+
+/*
+=================================================================================
+ 3. 执行单个任务与工作线程
+=================================================================================
+*/
+
+static int run_one(image_job* job, src_cache* cache, const fatimage_config* base) {
+    double t0 = now_ms();
+    fatimage* img;
+    dedup_table* dedup = NULL;
+
+    // 扫描源目录：查找重复文件，自动大小时精确计算
+    if (job->size_auto || base->dedup) {
+        src_node tree;
+        uint64_t min_size = 0;
+        int ok = (scan_source_tree(job->source, &tree) == 0);
+        if (ok && base->dedup) {
+            ok = ((dedup = dedup_plan(job->source, &tree, cache)) != NULL);
+        }
+        if (ok && job->size_auto) {
+            min_size = plan_auto_size(&tree, job->fmt, &job->au_size);
+        }
+        free_source_tree(&tree);
+        if (!ok || (job->size_auto && min_size == 0)) {
+            fprintf(stderr, "Error: Cannot plan image '%s' for source '%s'.\n", job->output, job->source);
+            dedup_free(dedup);
+            return -1;
+        }
+        if (job->size_auto) {
+            job->size = plan_add_headroom(min_size, job->headroom);
+        }
+    }
+
+    fatimage_config cfg = *base;
+    cfg.path = job->output;
+    cfg.size = job->size;
+    cfg.fmt = job->fmt;
+    cfg.au_size = job->au_size;
+
+    // 镜像缓存命中时不再生成；摘要计算读入的源文件留在共享缓存中，未命中时拷贝直接复用
+    char cache_key[IMGCACHE_KEY_LEN + 1];
+    if (cfg.image_cache) {
+        int rc = imgcache_key(&cfg, job->source, cache, cache_key);
+        if (rc == 0) {
+            rc = imgcache_fetch(&cfg, cache_key);
+        }
+        if (rc <= 0) {
+            job->t_plan = now_ms() - t0;
+            dedup_free(dedup);
+            return rc;
+        }
+    }
+    double t1 = now_ms();
+    job->t_plan = t1 - t0;
+
+    img = fatimage_open(&cfg);
+    if (!img) {
+        dedup_free(dedup);
+        return -1;
+    }
+    fatimage_set_dedup(img, dedup);
+    if (fatimage_format(img) != 0 || fatimage_mount(img) != 0) {
+        fatimage_abort(img);
+        return -1;
+    }
+    double t2 = now_ms();
+    job->t_format = t2 - t1;
+
+    int ret = fatimage_copy_dir(img, job->source, cache);
+    if (ret != 0) {
+        fatimage_abort(img);
+    } else if (fatimage_close(img) != 0) {
+        ret = -1;
+    }
+    if (ret == 0 && cfg.image_cache) {
+        imgcache_store(&cfg, cache_key);
+    }
+    job->t_copy = now_ms() - t2;
+    return ret;
+}
+
+static DWORD WINAPI job_worker(LPVOID arg) {
+    job_pool* pool = (job_pool*)arg;
+
+    for (;;) {
+        LONG i = InterlockedIncrement(&pool->next) - 1;
+        if (i >= pool->n_jobs) {
+            break;
+        }
+        image_job* job = &pool->jobs[i];
+        double t0 = now_ms();
+        job->status = run_one(job, pool->cache, &pool->base);
+        job->t_total = now_ms() - t0;
+
+        LONG done = InterlockedIncrement(&pool->done);
+        printf("[%ld/%ld] %s '%s' (%.0f ms)\n", (long)done, (long)pool->n_jobs,
+               job->status == 0 ? "Built" : "FAILED", job->output, job->t_total);
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 4. 对外接口：并行执行任务文件中的所有镜像
+=================================================================================
+*/
+
+/**
+ * @brief Builds every image listed in a job file on a pool of worker threads, sharing one source file cache,
+ *        then prints a per-job timing summary.
+ * @param spec_path Path to the job file (see load_jobs for the line format).
+ * @param n_workers Number of worker threads; 0 means one per CPU core. Capped at FF_VOLUMES.
+ * @param base Options shared by every image (io_mode, skel_dir, bulk, keep_times); path, size, fmt and au_size come from the job.
+ * @return 0 if every job succeeded, -1 otherwise.
+ */
+int run_jobs(const char* spec_path, int n_workers, const fatimage_config* base) {
+    image_job* jobs;
+    int n_jobs = load_jobs(spec_path, &jobs);
+    if (n_jobs < 0) {
+        return -1;
+    }
+
+    if (n_workers <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        n_workers = (int)si.dwNumberOfProcessors;
+    }
+    // 每个并行的镜像占用一个FatFs卷
+    if (n_workers > FF_VOLUMES) n_workers = FF_VOLUMES;
+    if (n_workers > n_jobs) n_workers = n_jobs;
+    if (n_workers < 1) n_workers = 1;
+
+    job_pool pool = { .jobs = jobs, .n_jobs = n_jobs, .next = 0, .done = 0, .base = *base };
+    pool.cache = src_cache_create(JOB_CACHE_BYTES);
+    if (!pool.cache) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+
+    printf("Building %d images with %d worker threads...\n", n_jobs, n_workers);
+    copy_verbose = 0; // 并行时不逐个打印文件
+
+    double t0 = now_ms();
+    HANDLE* threads = (HANDLE*)calloc(n_workers, sizeof(HANDLE));
+    int started = 0;
+    for (int i = 0; threads && i < n_workers; i++) {
+        threads[i] = CreateThread(NULL, 0, job_worker, &pool, 0, NULL);
+        if (!threads[i]) break;
+        started++;
+    }
+    if (started == 0) {
+        job_worker(&pool); // 无法创建线程时在当前线程中顺序执行
+    }
+    for (int i = 0; i < started; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    free(threads);
+    double wall = now_ms() - t0;
+
+    // --- 汇总 ---
+    int failed = 0;
+    double serial = 0;
+    printf("\n%-5s %-6s %-6s %12s %9s %10s %9s %10s  %s\n",
+           "Line", "Status", "Format", "Size", "Plan(ms)", "Format(ms)", "Copy(ms)", "Total(ms)", "Output");
+    for (int i = 0; i < n_jobs; i++) {
+        image_job* job = &jobs[i];
+        printf("%-5d %-6s %-6s %12llu %9.1f %10.1f %9.1f %10.1f  %s\n",
+               job->line, job->status == 0 ? "OK" : "FAILED", format_name(job->fmt),
+               (unsigned long long)job->size, job->t_plan, job->t_format, job->t_copy, job->t_total, job->output);
+        serial += job->t_total;
+        if (job->status != 0) failed++;
+    }
+    uint64_t hits, misses, bytes;
+    src_cache_stats(pool.cache, &hits, &misses, &bytes);
+    printf("\nSource cache: %llu files read from disk, %llu reused from memory (%.2f MiB cached).\n",
+           (unsigned long long)misses, (unsigned long long)hits, (double)bytes / (1024.0 * 1024.0));
+    printf("%d of %d images built in %.0f ms (sum of job times %.0f ms).\n", n_jobs - failed, n_jobs, wall, serial);
+
+    src_cache_destroy(pool.cache);
+    for (int i = 0; i < n_jobs; i++) {
+        free(jobs[i].output);
+        free(jobs[i].source);
+    }
+    free(jobs);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+#include "fatimage.h"
+
+int run_jobs(const char* spec_path, int n_workers, const fatimage_config* base);
+/* 把一行按空白拆分为字段（双引号括起含空格的字段，'#' 开始注释），清单文件（manifest.c）也使用 */
+int split_fields(char* line, char* fields[], int max_fields);
+#endif
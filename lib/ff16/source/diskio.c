@@ -2,8 +2,8 @@
 /* Low level disk I/O module for FatFs (C)ChaN, 2019+                    */
 /*-----------------------------------------------------------------------*/
 /* This is a simple implementation of the disk I/O layer for             */
-/* running FatFs on a PC/Windows environment. It uses a local file       */
-/* as the physical disk drive.                                           */
+/* running FatFs on a PC/Windows environment. Each drive number maps to  */
+/* an image context (fatimage.c) that owns its storage backend.          */
 /*-----------------------------------------------------------------------*/
 
 #include <stdio.h>
@@ -11,23 +11,15 @@
 #include "ff.h"			/* Basic definitions of FatFs */
 #include "diskio.h"		/* Declarations FatFs MAI */
 #include <time.h>
-#include "main.h"
+#include <windows.h>	/* 用于原子操作 */
+#include "fatimage.h"	/* 每个驱动器号对应一个镜像上下文 */
 /*-----------------------------------------------------------------------*/
 /* Definitions                                                           */
 /*-----------------------------------------------------------------------*/
 
-#define DEV_IMAGE_FILE	0	/* We only support one drive, which is our image file */
-
-
-
 /* For this example, we'll use a fixed sector size of 512 bytes */
 #define SECTOR_SIZE 512
 
-
-
-static FILE* fp_image = NULL;	/* File pointer for the disk image */
-static DSTATUS Stat = STA_NOINIT;	/* Disk status */
-
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -36,10 +28,12 @@ DSTATUS disk_status (
 	BYTE pdrv		/* Physical drive number to identify the drive */
 )
 {
-	if (pdrv != DEV_IMAGE_FILE) {
-		return STA_NODISK;
+	fatimage* img = fatimage_from_pdrv(pdrv);
+
+	if (!img) {
+		return STA_NOINIT | STA_NODISK;
 	}
-	return Stat;
+	return img->stat;
 }
 
 /*-----------------------------------------------------------------------*/
@@ -50,44 +44,16 @@ DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive number to identify the drive */
 )
 {
-	if (pdrv != DEV_IMAGE_FILE) {
-		return STA_NODISK;
-	}
-
-	if (Stat == 0) {
-		return Stat;
-	}
-	remove(disk_image_path); /* 删除旧的镜像文件，确保每次都是新的开始 */
-	printf("Creating a new one...\n", disk_image_path);
-	fp_image = fopen(disk_image_path, "w+b"); /* 以写+更新模式创建 */
-	if (!fp_image) {
-		fprintf(stderr, "Error: Failed to create disk image file.\n");
-		return STA_NOINIT;
-	}
+	fatimage* img = fatimage_from_pdrv(pdrv);
 
-	/* --- 将文件扩展到预定义的大小 --- */
-	// 1. 移动文件指针到目标大小的前一个字节
-	if (fseek(fp_image, disk_image_size - 1, SEEK_SET) != 0) {
-		fprintf(stderr, "Error: fseek failed while setting image size.\n");
-		fclose(fp_image);
-		fp_image = NULL;
-		return STA_NOINIT;
+	if (!img) {
+		return STA_NOINIT | STA_NODISK;
 	}
-	// 2. 在该位置写入一个字节，这会强制操作系统将文件扩展到该大小
-	if (fputc(0, fp_image) == EOF) {
-		fprintf(stderr, "Error: fputc failed while setting image size.\n");
-		fclose(fp_image);
-		fp_image = NULL;
-		return STA_NOINIT;
+	/* 镜像文件已在 fatimage_open 中创建好，这里只需标记为可用 */
+	if (img->be) {
+		img->stat &= ~STA_NOINIT; /* 清除未初始化标志 */
 	}
-	// 3. (可选但推荐) 将文件指针移回文件开头
-	rewind(fp_image);
-
-	printf("Successfully created a %.2f MB disk image.\n", (double)disk_image_size / (1024.0 * 1024.0));
-	
-
-	Stat &= ~STA_NOINIT; /* 清除未初始化标志 */
-	return Stat;
+	return img->stat;
 }
 
 /*-----------------------------------------------------------------------*/
@@ -101,20 +67,15 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
-	if (pdrv != DEV_IMAGE_FILE || Stat & STA_NOINIT) {
-		return RES_NOTRDY;
-	}
+	fatimage* img = fatimage_from_pdrv(pdrv);
 
-	/* Move file pointer to the correct sector */
-	if (fseek(fp_image, (long)sector * SECTOR_SIZE, SEEK_SET) != 0) {
-		return RES_ERROR;
+	if (!img || img->stat & STA_NOINIT) {
+		return RES_NOTRDY;
 	}
 
-	/* Read data from the file */
-	size_t read_count = fread(buff, SECTOR_SIZE, count, fp_image);
-	if (read_count != count) {
-		// This can happen if trying to read past the end of the file.
-		// For a simple tool, we can treat it as an error.
+	/* Read data from the backend */
+	if (img->be->read(img->be, buff, (uint64_t)sector * SECTOR_SIZE, (size_t)count * SECTOR_SIZE) != 0) {
+		// This can happen if trying to read past the end of the image.
 		return RES_ERROR;
 	}
 
@@ -134,18 +95,14 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
-	if (pdrv != DEV_IMAGE_FILE || Stat & STA_NOINIT) {
-		return RES_NOTRDY;
-	}
+	fatimage* img = fatimage_from_pdrv(pdrv);
 
-	/* Move file pointer to the correct sector */
-	if (fseek(fp_image, (long)sector * SECTOR_SIZE, SEEK_SET) != 0) {
-		return RES_ERROR;
+	if (!img || img->stat & STA_NOINIT) {
+		return RES_NOTRDY;
 	}
 
-	/* Write data to the file */
-	size_t write_count = fwrite(buff, SECTOR_SIZE, count, fp_image);
-	if (write_count != count) {
+	/* Write data to the backend */
+	if (img->be->write(img->be, buff, (uint64_t)sector * SECTOR_SIZE, (size_t)count * SECTOR_SIZE) != 0) {
 		return RES_ERROR;
 	}
 
@@ -164,25 +121,26 @@ DRESULT disk_ioctl (
 	void *buff		/* Buffer to send/receive control data */
 )
 {
-	if (pdrv != DEV_IMAGE_FILE || Stat & STA_NOINIT) {
+	fatimage* img = fatimage_from_pdrv(pdrv);
+
+	if (!img || img->stat & STA_NOINIT) {
 		return RES_NOTRDY;
 	}
 
 	DRESULT res = RES_ERROR;
-	long file_size;
 
 	switch (cmd) {
 		/* Make sure that no pending write process */
 		case CTRL_SYNC:
-			if (fflush(fp_image) == 0) {
+			if (img->be->sync(img->be) == 0) {
 				res = RES_OK;
 			}
 			break;
 
 		/* Get number of sectors on the disk (LBA_t) */
 		case GET_SECTOR_COUNT:
-			if (disk_image_size > 0) {
-                *(LBA_t*)buff = disk_image_size / SECTOR_SIZE;
+			if (img->cfg.size > 0) {
+                *(LBA_t*)buff = (LBA_t)(img->cfg.size / SECTOR_SIZE);
                 res = RES_OK;
             } else {
                 res = RES_ERROR; // 如果大小为0，则报告错误
@@ -209,23 +167,70 @@ DRESULT disk_ioctl (
 	return res;
 }
 
+/*-----------------------------------------------------------------------*/
+/* Timestamps                                                            */
+/*-----------------------------------------------------------------------*/
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/* 本线程接下来创建/修改的目录项使用的时间，0表示使用生成时间。每个镜像（分区）在自己的线程中拷贝 */
+static THREAD_LOCAL DWORD entry_time;
+/* 生成时间：本次运行第一次需要时换算一次（或由 fatimage_set_build_time 固定），之后所有目录项和卷序列号都用它 */
+static volatile LONG build_time;
+
+/**
+ * @brief Sets the timestamp that GET_FATTIME() returns on the calling thread, so a file or directory
+ *        gets it in the same directory update that creates (f_open/f_mkdir) or closes (f_sync) it.
+ * @param fattime FAT packed date/time, or 0 to go back to the build time.
+ */
+void fatimage_set_time (DWORD fattime)
+{
+	entry_time = fattime;
+}
+
+/**
+ * @brief Fixes the build time used for every entry without its own timestamp and for the volume
+ *        serial numbers, instead of the current time (reproducible images).
+ * @param fattime FAT packed date/time.
+ */
+void fatimage_set_build_time (DWORD fattime)
+{
+	InterlockedExchange(&build_time, (LONG)fattime);
+}
+
 DWORD get_fattime (void)
 {
     time_t raw_time;
-    struct tm* time_info;
+    struct tm tm_buf;
+    struct tm* time_info = &tm_buf;
+
+    if (entry_time) {
+        return entry_time;
+    }
+    if (build_time) {
+        return (DWORD)build_time;
+    }
 
     // 获取当前日历时间
     time(&raw_time);
-    // 转换为本地时间
-    time_info = localtime(&raw_time);
+    // 转换为本地时间（localtime_s 是线程安全的，多个镜像可能同时调用）
+    localtime_s(&tm_buf, &raw_time);
 
     // 将时间信息打包成FAT文件系统要求的DWORD格式
     // bit31:25=Year from 1980 (0..127), bit24:21=Month (1..12), bit20:16=Day (1..31)
     // bit15:11=Hour (0..23), bit10:5=Minute (0..59), bit4:0=Second/2 (0..29)
-    return    ((DWORD)(time_info->tm_year - 80) << 25)  /* Year since 1980 */
+    DWORD t = ((DWORD)(time_info->tm_year - 80) << 25)  /* Year since 1980 */
             | ((DWORD)(time_info->tm_mon + 1) << 21)    /* Month */
             | ((DWORD)time_info->tm_mday << 16)         /* Day */
             | ((DWORD)time_info->tm_hour << 11)         /* Hour */
             | ((DWORD)time_info->tm_min << 5)           /* Minute */
             | ((DWORD)time_info->tm_sec >> 1);          /* Second / 2 */
-}
\ No newline at end of file
+
+    // 多个线程同时换算时以第一个为准
+    InterlockedCompareExchange(&build_time, (LONG)t, 0);
+    return (DWORD)build_time;
+}
@@ -1115,6 +1115,9 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	res = sync_window(fs);
+#if FF_FS_DEFERSYNC
+	if (fs->defsync) return res;	/* Deferred sync mode: FSInfo and CTRL_SYNC are left to f_defersync() */
+#endif
 	if (res == FR_OK) {
 		if (fs->fsi_flag == 1) {	/* Allocation changed? */
 			fs->fsi_flag = 0;
@@ -3098,8 +3101,9 @@ static FRESULT create_name (	/* FR_OK: successful, FR_INVALID_NAME: could not cr
 /* Follow a file path                                                    */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
+static FRESULT follow_path_at (	/* FR_OK(0): successful, !=0: error code */
 	DIR* dp,					/* Directory object to return last directory and found object */
+	const DIR* base,			/* Open directory object to start at (null: start at the root or current directory) */
 	const TCHAR* path			/* Full-path string to find a file or directory */
 )
 {
@@ -3108,7 +3112,11 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 	FATFS *fs = dp->obj.fs;
 
 
-	/* Determins the start directory (current directory or forced root directory) */
+	/* Determins the start directory (given directory, current directory or forced root directory) */
+	if (base) {								/* Relative to an open directory */
+		while (IsSeparator(*path)) path++;	/* Strip heading separators */
+		dp->obj = base->obj;				/* Start at the directory with its allocation info */
+	} else
 #if FF_FS_RPATH
 	if (!IsSeparator(*path) && (FF_STR_VOLUME_ID != 2 || !IsTerminator(*path))) {	/* Without heading separator */
 		dp->obj.sclust = fs->cdir;			/* Start at the current directory */
@@ -3122,7 +3130,7 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 #if FF_FS_EXFAT
 	dp->obj.n_frag = 0;	/* Invalidate last fragment counter of the object */
 #if FF_FS_RPATH
-	if (fs->fs_type == FS_EXFAT) {	/* exFAT: Retrieve the start-directory's status */
+	if (fs->fs_type == FS_EXFAT && !base) {	/* exFAT: Retrieve the start-directory's status */
 		if (dp->obj.sclust) {	/* Start directory is a sub-directory */
 			/* Load the current directory chain into working buffer and initialize directory object as current dir */
 			memcpy(&fs->xcwds2, &fs->xcwds, sizeof fs->xcwds2);
@@ -3211,6 +3219,15 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 }
 
 
+static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
+	DIR* dp,					/* Directory object to return last directory and found object */
+	const TCHAR* path			/* Full-path string to find a file or directory */
+)
+{
+	return follow_path_at(dp, 0, path);
+}
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -3724,6 +3741,53 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Get the volume of a path given as drive path or relative to a dir     */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT enter_volume (	/* FR_OK(0): successful, !=0: an error occurred */
+	DIR* base,				/* Open directory the path is relative to (null: path has the drive) */
+	const TCHAR** path,		/* Pointer to pointer to the path name (drive number) */
+	FATFS** rfs,			/* Pointer to pointer to the found filesystem object */
+	BYTE mode				/* Desired access mode to check write protection */
+)
+{
+	FRESULT res;
+
+
+	if (base) {		/* The volume is the one holding the directory, it has been mounted */
+		res = validate(&base->obj, rfs);
+		mode &= (BYTE)~FA_READ;
+		if (res == FR_OK && !FF_FS_READONLY && mode && (disk_status((*rfs)->pdrv) & STA_PROTECT)) {	/* Check write protection as mount_volume does */
+			res = FR_WRITE_PROTECTED;
+		}
+		return res;
+	}
+	return mount_volume(path, rfs, mode);
+}
+
+
+#if !FF_FS_READONLY
+/* Reflect a stretch of the directory table to the open directory the path started at */
+static void update_base (
+	DIR* base,				/* Open directory the path is relative to (null: none) */
+	const DIR* dp			/* Directory object a new entry has been registered to */
+)
+{
+	if (base && base->obj.sclust == dp->obj.sclust) {	/* New entry is in the base directory itself? */
+		base->obj.stat = dp->obj.stat;
+		base->obj.objsize = dp->obj.objsize;
+#if FF_FS_EXFAT
+		base->obj.n_cont = dp->obj.n_cont;
+		base->obj.n_frag = dp->obj.n_frag;
+#endif
+	}
+}
+#endif
+
+
+
+
 /*---------------------------------------------------------------------------
 
    Public Functions (FatFs API)
@@ -3780,6 +3844,9 @@ FRESULT f_mount (
 #endif
 #endif
 		fs->fs_type = 0;		/* Invalidate the new filesystem object */
+#if FF_FS_DEFERSYNC
+		fs->defsync = 0;		/* Deferred sync mode is off until f_defersync() */
+#endif
 		FatFs[vol] = fs;		/* Register it */
 	}
 
@@ -3796,7 +3863,8 @@ FRESULT f_mount (
 /* API: Open or Create a File                                            */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_open (
+static FRESULT open_file (
+	DIR* base,			/* Open directory the path is relative to (null: path from the drive) */
 	FIL* fp,			/* Pointer to the blank file object */
 	const TCHAR* path,	/* Pointer to the file name */
 	BYTE mode			/* Access mode and open mode flags */
@@ -3812,13 +3880,13 @@ FRESULT f_open (
 
 	/* Get logical drive number and mount the volume if needed */
 	mode &= FF_FS_READONLY ? FA_READ : FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_OPEN_ALWAYS | FA_OPEN_APPEND;
-	res = mount_volume(&path, &fs, mode);
+	res = enter_volume(base, &path, &fs, mode);
 
 	if (res == FR_OK) {
 		fp->obj.fs = fs;
 		dj.obj.fs = fs;
 		INIT_NAMEBUFF(fs);
-		res = follow_path(&dj, path);	/* Follow the file path */
+		res = follow_path_at(&dj, base, path);	/* Follow the file path */
 #if !FF_FS_READONLY	/* Read/Write configuration */
 		if (res == FR_OK) {
 			if (dj.fn[NSFLAG] & NS_NONAME) {	/* Origin directory itself? */
@@ -3839,6 +3907,7 @@ FRESULT f_open (
 #else
 					res = dir_register(&dj);
 #endif
+					if (res == FR_OK) update_base(base, &dj);
 				}
 				mode |= FA_CREATE_ALWAYS;		/* File is created */
 			}
@@ -3987,6 +4056,30 @@ FRESULT f_open (
 }
 
 
+FRESULT f_open (
+	FIL* fp,			/* Pointer to the blank file object */
+	const TCHAR* path,	/* Pointer to the file name */
+	BYTE mode			/* Access mode and open mode flags */
+)
+{
+	return open_file(0, fp, path, mode);
+}
+
+
+#if FF_USE_OPENAT
+FRESULT f_openat (
+	DIR* dp,			/* Pointer to the open directory the path is relative to */
+	FIL* fp,			/* Pointer to the blank file object */
+	const TCHAR* path,	/* Pointer to the file name relative to the directory (without drive) */
+	BYTE mode			/* Access mode and open mode flags */
+)
+{
+	if (!dp) return FR_INVALID_OBJECT;	/* Reject null pointer */
+	return open_file(dp, fp, path, mode);
+}
+#endif
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -4716,7 +4809,8 @@ FRESULT f_lseek (
 /* API: Create a Directory Object                                        */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_opendir (
+static FRESULT open_dir (
+	DIR* base,			/* Open directory the path is relative to (null: path from the drive) */
 	DIR* dp,			/* Pointer to directory object to create */
 	const TCHAR* path	/* Pointer to the directory path */
 )
@@ -4728,11 +4822,11 @@ FRESULT f_opendir (
 
 	if (!dp) return FR_INVALID_OBJECT;	/* Reject null pointer */
 
-	res = mount_volume(&path, &fs, 0);	/* Get logical drive and mount the volume if needed */
+	res = enter_volume(base, &path, &fs, 0);	/* Get logical drive and mount the volume if needed */
 	if (res == FR_OK) {
 		dp->obj.fs = fs;
 		INIT_NAMEBUFF(fs);
-		res = follow_path(dp, path);			/* Follow the path to the directory */
+		res = follow_path_at(dp, base, path);	/* Follow the path to the directory */
 		if (res == FR_OK) {						/* Follow completed */
 			if (!(dp->fn[NSFLAG] & NS_NONAME)) {	/* It is neither the origin directory itself nor dot name in exFAT */
 				if (dp->obj.attr & AM_DIR) {		/* This object is a sub-directory */
@@ -4772,6 +4866,28 @@ FRESULT f_opendir (
 }
 
 
+FRESULT f_opendir (
+	DIR* dp,			/* Pointer to directory object to create */
+	const TCHAR* path	/* Pointer to the directory path */
+)
+{
+	return open_dir(0, dp, path);
+}
+
+
+#if FF_USE_OPENAT
+FRESULT f_opendirat (
+	DIR* dp,			/* Pointer to the open directory the path is relative to */
+	DIR* sdp,			/* Pointer to directory object to create */
+	const TCHAR* path	/* Pointer to the directory path relative to the directory (without drive) */
+)
+{
+	if (!dp) return FR_INVALID_OBJECT;	/* Reject null pointer */
+	return open_dir(dp, sdp, path);
+}
+#endif
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -5028,6 +5144,72 @@ FRESULT f_getfree (
 
 
 
+#if FF_FS_DEFERSYNC
+/*-----------------------------------------------------------------------*/
+/* API: Flush Volume and Set Deferred Sync Mode                          */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_defersync (
+	const TCHAR* path,	/* Logical drive number */
+	BYTE defer			/* 1:Defer FSInfo update and CTRL_SYNC in sync_fs(), 0:Sync on every file close (default) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = mount_volume(&path, &fs, FA_WRITE);	/* Get logical drive */
+	if (res == FR_OK) {
+		fs->defsync = 0;		/* Write back the window, FSInfo and issue CTRL_SYNC regardless of the current mode */
+		res = sync_fs(fs);
+		fs->defsync = defer ? 1 : 0;
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+#if FF_USE_SHARECHAIN
+/*-----------------------------------------------------------------------*/
+/* API: Point an Empty File at an Existing Cluster Chain                 */
+/*-----------------------------------------------------------------------*/
+/* The chain is not copied: both directory entries refer to the same
+/  clusters (cross-linked). The volume must be used read-only afterwards;
+/  writing, truncating or removing either file corrupts the other one. */
+
+FRESULT f_sharechain (
+	FIL* fp,		/* Pointer to the file object, opened for write and still empty */
+	DWORD sclust,	/* Top cluster of the chain of a closed file with the same content */
+	FSIZE_t fsz,	/* File size of that file */
+	BYTE nofat		/* 1:The chain is contiguous and not recorded on the FAT (exFAT NoFatChain), 0:Follow the FAT */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (fsz == 0 || fp->obj.objsize != 0 || fp->obj.sclust != 0 || !(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);
+	if (sclust < 2 || sclust >= fs->n_fatent) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+	if (fs->fs_type != FS_EXFAT && (fsz >= 0x100000000 || nofat)) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+
+	fp->obj.sclust = sclust;			/* Attach the chain; the directory entry is updated on f_sync/f_close */
+	fp->obj.objsize = fsz;
+#if FF_FS_EXFAT
+	fp->obj.stat = nofat ? 2 : 0;
+#endif
+	fp->clust = 0;						/* File pointer stays at the top of the file */
+	fp->flag |= FA_MODIFIED;
+
+	LEAVE_FF(fs, FR_OK);
+}
+#endif
+
+
+
 
 /*-----------------------------------------------------------------------*/
 /* API: Truncate File                                                    */
@@ -5173,7 +5355,8 @@ FRESULT f_unlink (
 /* API: Create a Directory                                               */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_mkdir (
+static FRESULT make_dir (
+	DIR* base,				/* Open directory the path is relative to (null: path from the drive) */
 	const TCHAR* path		/* Pointer to the directory path */
 )
 {
@@ -5185,11 +5368,11 @@ FRESULT f_mkdir (
 	DEF_NAMEBUFF
 
 
-	res = mount_volume(&path, &fs, FA_WRITE);	/* Get logical drive and mount the volume if needed */
+	res = enter_volume(base, &path, &fs, FA_WRITE);	/* Get logical drive and mount the volume if needed */
 	if (res == FR_OK) {
 		dj.obj.fs = fs;
 		INIT_NAMEBUFF(fs);
-		res = follow_path(&dj, path);			/* Follow the file path */
+		res = follow_path_at(&dj, base, path);	/* Follow the file path */
 		if (res == FR_OK) {						/* Invalid name or name collision */
 			res = (dj.fn[NSFLAG] & (NS_DOT | NS_NONAME)) ? FR_INVALID_NAME : FR_EXIST;
 		}
@@ -5216,6 +5399,7 @@ FRESULT f_mkdir (
 						fs->wflag = 1;
 					}
 					res = dir_register(&dj);	/* Register the object to the parent directory */
+					if (res == FR_OK) update_base(base, &dj);
 				}
 			}
 			if (res == FR_OK) {
@@ -5252,6 +5436,26 @@ FRESULT f_mkdir (
 }
 
 
+FRESULT f_mkdir (
+	const TCHAR* path		/* Pointer to the directory path */
+)
+{
+	return make_dir(0, path);
+}
+
+
+#if FF_USE_OPENAT
+FRESULT f_mkdirat (
+	DIR* dp,				/* Pointer to the open directory the path is relative to */
+	const TCHAR* path		/* Pointer to the directory path relative to the directory (without drive) */
+)
+{
+	if (!dp) return FR_INVALID_OBJECT;	/* Reject null pointer */
+	return make_dir(dp, path);
+}
+#endif
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -154,6 +154,9 @@ typedef struct {
 	BYTE	n_fats;		/* Number of FATs (1 or 2) */
 	BYTE	wflag;		/* win[] status (b0:dirty) */
 	BYTE	fsi_flag;	/* Allocation information control (b7:disabled, b0:dirty) */
+#if FF_FS_DEFERSYNC
+	BYTE	defsync;	/* Deferred sync mode (1:sync_fs() does not update FSInfo or issue CTRL_SYNC) */
+#endif
 	WORD	id;			/* Volume mount ID */
 	WORD	n_rootdir;	/* Number of root directory entries (FAT12/16) */
 	WORD	csize;		/* Cluster size [sectors] */
@@ -350,6 +353,17 @@ FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a l
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const LBA_t ptbl[], void* work);		/* Divide a physical drive into some partitions */
 FRESULT f_setcp (WORD cp);											/* Set current code page */
+#if FF_USE_OPENAT
+FRESULT f_openat (DIR* dp, FIL* fp, const TCHAR* path, BYTE mode);	/* Open or create a file relative to an open directory */
+FRESULT f_opendirat (DIR* dp, DIR* sdp, const TCHAR* path);			/* Open a directory relative to an open directory */
+FRESULT f_mkdirat (DIR* dp, const TCHAR* path);						/* Create a sub directory relative to an open directory */
+#endif
+#if FF_FS_DEFERSYNC
+FRESULT f_defersync (const TCHAR* path, BYTE defer);				/* Flush the volume and set deferred sync mode */
+#endif
+#if FF_USE_SHARECHAIN
+FRESULT f_sharechain (FIL* fp, DWORD sclust, FSIZE_t fsz, BYTE nofat);	/* Point an empty file at an existing cluster chain */
+#endif
 int f_putc (TCHAR c, FIL* fp);										/* Put a character to the file */
 int f_puts (const TCHAR* str, FIL* cp);								/* Put a string to the file */
 int f_printf (FIL* fp, const TCHAR* str, ...);						/* Put a formatted string to the file */
@@ -38,11 +38,29 @@
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1   //使能 f_expand，大文件预先分配连续簇后直接写入镜像
 /* This option switches f_expand(). (0:Disable or 1:Enable) */
 
 
-#define FF_USE_CHMOD	0
+#define FF_USE_OPENAT	1   //使能 f_openat/f_opendirat/f_mkdirat，以已打开的目录为起点解析路径，拷贝时不必每个文件都从根目录查找
+/* This option switches directory-relative API functions, f_openat(), f_opendirat()
+/  and f_mkdirat(). (0:Disable or 1:Enable) */
+
+
+#define FF_FS_DEFERSYNC	1   //使能 f_defersync，批量写入时文件关闭不再更新FSInfo、不发出 CTRL_SYNC，改为统一同步
+/* This option switches f_defersync(). (0:Disable or 1:Enable)
+/  While deferred sync is enabled on a volume, sync_fs() only writes back the window, so
+/  the FSInfo/PercInUse update and CTRL_SYNC are skipped until the next f_defersync()
+/  call flushes the volume. */
+
+
+#define FF_USE_SHARECHAIN	1   //使能 f_sharechain，内容相同的文件共用一条簇链（只读镜像的去重模式）
+/* This option switches f_sharechain(). (0:Disable or 1:Enable)
+/  f_sharechain() makes an empty file refer to the cluster chain of another file. The
+/  files are cross-linked, so the volume must not be modified afterwards. */
+
+
+#define FF_USE_CHMOD	1   //使能 f_chmod，清单文件（--manifest）中指定的只读、隐藏、系统等属性
 /* This option switches attribute control API functions, f_chmod() and f_utime().
 /  (0:Disable or 1:Enable) Also FF_FS_READONLY needs to be 0 to enable this option. */
 
@@ -153,6 +171,15 @@
 /  on character encoding. When LFN is not enabled, these options have no effect. */
 
 
+#ifndef FF_FAST_UNICODE
+#define FF_FAST_UNICODE	1   //大小写转换和GBK编码转换改为查表（每个函数128KB查找表，第一次调用时一次生成），exFAT文件名哈希、比较和格式化时不必反复查压缩表
+#endif
+/* This option switches table-driven code conversions in ffunicode.c. (0:Disable or 1:Enable)
+/  When enabled, ff_wtoupper(), and ff_uni2oem()/ff_oem2uni() for DBCS code pages,
+/  look up a direct-indexed table of 64K entries in the BSS, built once on first use.
+/  When LFN is not enabled, this option has no effect. */
+
+
 #define FF_FS_RPATH		0
 /* This option configures support for relative path feature.
 /
@@ -178,7 +205,7 @@
 / Drive/Volume Configurations
 /---------------------------------------------------------------------------*/
 
-#define FF_VOLUMES		1   //设置FATFS支持的逻辑设备数目，我们设置为3的话，即支持3个设备（磁盘）。
+#define FF_VOLUMES		10  //设置FATFS支持的逻辑设备数目。每个打开的镜像占用一个，最多可同时生成10个镜像。
 /* Number of volumes (logical drives) to be used. (1-10) */
 
 
@@ -196,7 +223,7 @@
 */
 
 
-#define FF_MULTI_PARTITION	0
+#define FF_MULTI_PARTITION	1   //使能多分区，逻辑卷到分区的映射表 VolToPart 定义在 fatimage.c
 /* This option switches support for multiple volumes on the physical drive.
 /  By default (0), each logical drive number is bound to the same physical drive
 /  number and only an FAT volume found on the physical drive will be mounted.
@@ -292,7 +319,7 @@
 /      lock control is independent of re-entrancy. */
 
 
-#define FF_FS_REENTRANT	0
+#define FF_FS_REENTRANT	1   //使能同一卷上的线程安全，互斥量使用 ffsystem.c 中的Win32实现
 #define FF_FS_TIMEOUT	1000
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
 /  module itself. Note that regardless of this option, file access to different
@@ -5,6 +5,11 @@
 /* FatFs is configured for LFN with DBCS. If the system has a Unicode     */
 /* library for the code conversion, this module should be modified to use */
 /* it to avoid silly memory consumption.                                  */
+/*                                                                        */
+/* With FF_FAST_UNICODE, each conversion function looks the character up */
+/* in a direct-indexed 64K-entry table in .bss (128KB each). The first    */
+/* call builds the whole table under InitOnceExecuteOnce, so concurrent   */
+/* callers wait for it and afterwards only read the table.                */
 /*------------------------------------------------------------------------*/
 /*
 / Copyright (C) 2022, ChaN, all right reserved.
@@ -24,6 +29,9 @@
 
 
 #include "ff.h"
+#if FF_FAST_UNICODE
+#include <windows.h>	/* 查找表只生成一次（InitOnceExecuteOnce） */
+#endif
 
 #if FF_USE_LFN != 0	/* This module will be blanked if in non-LFN configuration */
 
@@ -15272,14 +15280,83 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 /*------------------------------------------------------------------------*/
 
 #if FF_CODE_PAGE >= 900
+static WCHAR uni2oem_dbcs (	/* Returns OEM code character, zero on error */
+	WCHAR	uc		/* Non-ASCII UTF-16 character to be converted */
+)
+{
+	const WCHAR* p;
+	WCHAR c = 0;
+	UINT i = 0, n, li, hi;
+
+
+	p = CVTBL(uni2oem, FF_CODE_PAGE);
+	hi = sizeof CVTBL(uni2oem, FF_CODE_PAGE) / 4 - 1;
+	li = 0;
+	for (n = 16; n; n--) {
+		i = li + (hi - li) / 2;
+		if (uc == p[i * 2]) break;
+		if (uc > p[i * 2]) {
+			li = i;
+		} else {
+			hi = i;
+		}
+	}
+	if (n != 0) c = p[i * 2 + 1];
+
+	return c;
+}
+
+static WCHAR oem2uni_dbcs (	/* Returns Unicode character in UTF-16, zero on error */
+	WCHAR	oem		/* Extended OEM code to be converted */
+)
+{
+	const WCHAR* p;
+	WCHAR c = 0;
+	UINT i = 0, n, li, hi;
+
+
+	p = CVTBL(oem2uni, FF_CODE_PAGE);
+	hi = sizeof CVTBL(oem2uni, FF_CODE_PAGE) / 4 - 1;
+	li = 0;
+	for (n = 16; n; n--) {
+		i = li + (hi - li) / 2;
+		if (oem == p[i * 2]) break;
+		if (oem > p[i * 2]) {
+			li = i;
+		} else {
+			hi = i;
+		}
+	}
+	if (n != 0) c = p[i * 2 + 1];
+
+	return c;
+}
+
+#if FF_FAST_UNICODE
+static WCHAR uni2oem_tbl[0x10000];	/* Results of uni2oem_dbcs() for every BMP character */
+static WCHAR oem2uni_tbl[0x10000];	/* Results of oem2uni_dbcs() for every 16-bit OEM code */
+static INIT_ONCE dbcs_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK build_dbcs_tables (PINIT_ONCE once, PVOID param, PVOID* ctx)
+{
+	UINT c;
+
+
+	(void)once; (void)param; (void)ctx;
+	for (c = 0x80; c < 0x10000; c++) {
+		uni2oem_tbl[c] = uni2oem_dbcs((WCHAR)c);
+		oem2uni_tbl[c] = oem2uni_dbcs((WCHAR)c);
+	}
+	return TRUE;
+}
+#endif
+
 WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
 	DWORD	uni,	/* UTF-16 encoded character to be converted */
 	WORD	cp		/* Code page for the conversion */
 )
 {
-	const WCHAR* p;
-	WCHAR c = 0, uc;
-	UINT i = 0, n, li, hi;
+	WCHAR c = 0;
 
 
 	if (uni < 0x80) {	/* ASCII? */
@@ -15287,20 +15364,12 @@ WCHAR ff_uni2oem (	/* Returns OEM code character, zero on error */
 
 	} else {			/* Non-ASCII */
 		if (uni < 0x10000 && cp == FF_CODE_PAGE) {	/* Is it in BMP and valid code page? */
-			uc = (WCHAR)uni;
-			p = CVTBL(uni2oem, FF_CODE_PAGE);
-			hi = sizeof CVTBL(uni2oem, FF_CODE_PAGE) / 4 - 1;
-			li = 0;
-			for (n = 16; n; n--) {
-				i = li + (hi - li) / 2;
-				if (uc == p[i * 2]) break;
-				if (uc > p[i * 2]) {
-					li = i;
-				} else {
-					hi = i;
-				}
-			}
-			if (n != 0) c = p[i * 2 + 1];
+#if FF_FAST_UNICODE
+			InitOnceExecuteOnce(&dbcs_once, build_dbcs_tables, NULL, NULL);	/* The first caller builds the tables, others wait for it */
+			c = uni2oem_tbl[uni];
+#else
+			c = uni2oem_dbcs((WCHAR)uni);
+#endif
 		}
 	}
 
@@ -15313,9 +15382,7 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 	WORD	cp		/* Code page for the conversion */
 )
 {
-	const WCHAR* p;
 	WCHAR c = 0;
-	UINT i = 0, n, li, hi;
 
 
 	if (oem < 0x80) {	/* ASCII? */
@@ -15323,19 +15390,12 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 
 	} else {			/* Extended char */
 		if (cp == FF_CODE_PAGE) {	/* Is it valid code page? */
-			p = CVTBL(oem2uni, FF_CODE_PAGE);
-			hi = sizeof CVTBL(oem2uni, FF_CODE_PAGE) / 4 - 1;
-			li = 0;
-			for (n = 16; n; n--) {
-				i = li + (hi - li) / 2;
-				if (oem == p[i * 2]) break;
-				if (oem > p[i * 2]) {
-					li = i;
-				} else {
-					hi = i;
-				}
-			}
-			if (n != 0) c = p[i * 2 + 1];
+#if FF_FAST_UNICODE
+			InitOnceExecuteOnce(&dbcs_once, build_dbcs_tables, NULL, NULL);
+			c = oem2uni_tbl[oem];
+#else
+			c = oem2uni_dbcs(oem);
+#endif
 		}
 	}
 
@@ -15461,12 +15521,12 @@ WCHAR ff_oem2uni (	/* Returns Unicode character in UTF-16, zero on error */
 /* Unicode Up-case Conversion                                             */
 /*------------------------------------------------------------------------*/
 
-DWORD ff_wtoupper (	/* Returns up-converted code point */
-	DWORD uni		/* Unicode code point to be up-converted */
+static WORD wtoupper_bmp (	/* Returns up-converted character */
+	WORD uc			/* BMP character to be up-converted */
 )
 {
 	const WORD* p;
-	WORD uc, bc, nc, cmd;
+	WORD bc, nc, cmd;
 	static const WORD cvt1[] = {	/* Compressed up conversion table for U+0000 - U+0FFF */
 		/* Basic Latin */
 		0x0061,0x031A,
@@ -15560,30 +15620,60 @@ DWORD ff_wtoupper (	/* Returns up-converted code point */
 	};
 
 
-	if (uni < 0x10000) {	/* Is it in BMP? */
-		uc = (WORD)uni;
-		p = uc < 0x1000 ? cvt1 : cvt2;
-		for (;;) {
-			bc = *p++;								/* Get the block base */
-			if (bc == 0 || uc < bc) break;			/* Not matched? */
-			nc = *p++; cmd = nc >> 8; nc &= 0xFF;	/* Get processing command and block size */
-			if (uc < bc + nc) {	/* In the block? */
-				switch (cmd) {
-				case 0:	uc = p[uc - bc]; break;		/* Table conversion */
-				case 1:	uc -= (uc - bc) & 1; break;	/* Case pairs */
-				case 2: uc -= 16; break;			/* Shift -16 */
-				case 3:	uc -= 32; break;			/* Shift -32 */
-				case 4:	uc -= 48; break;			/* Shift -48 */
-				case 5:	uc -= 26; break;			/* Shift -26 */
-				case 6:	uc += 8; break;				/* Shift +8 */
-				case 7: uc -= 80; break;			/* Shift -80 */
-				case 8:	uc -= 0x1C60; break;		/* Shift -0x1C60 */
-				}
-				break;
+	p = uc < 0x1000 ? cvt1 : cvt2;
+	for (;;) {
+		bc = *p++;								/* Get the block base */
+		if (bc == 0 || uc < bc) break;			/* Not matched? */
+		nc = *p++; cmd = nc >> 8; nc &= 0xFF;	/* Get processing command and block size */
+		if (uc < bc + nc) {	/* In the block? */
+			switch (cmd) {
+			case 0:	uc = p[uc - bc]; break;		/* Table conversion */
+			case 1:	uc -= (uc - bc) & 1; break;	/* Case pairs */
+			case 2: uc -= 16; break;			/* Shift -16 */
+			case 3:	uc -= 32; break;			/* Shift -32 */
+			case 4:	uc -= 48; break;			/* Shift -48 */
+			case 5:	uc -= 26; break;			/* Shift -26 */
+			case 6:	uc += 8; break;				/* Shift +8 */
+			case 7: uc -= 80; break;			/* Shift -80 */
+			case 8:	uc -= 0x1C60; break;		/* Shift -0x1C60 */
 			}
-			if (cmd == 0) p += nc;	/* Skip table if needed */
+			break;
 		}
-		uni = uc;
+		if (cmd == 0) p += nc;	/* Skip table if needed */
+	}
+
+	return uc;
+}
+
+
+#if FF_FAST_UNICODE
+static WORD wtoupper_tbl[0x10000];	/* Results of wtoupper_bmp() for every BMP character */
+static INIT_ONCE wtoupper_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK build_wtoupper_table (PINIT_ONCE once, PVOID param, PVOID* ctx)
+{
+	UINT c;
+
+
+	(void)once; (void)param; (void)ctx;
+	for (c = 0; c < 0x10000; c++) {
+		wtoupper_tbl[c] = wtoupper_bmp((WORD)c);
+	}
+	return TRUE;
+}
+#endif
+
+DWORD ff_wtoupper (	/* Returns up-converted code point */
+	DWORD uni		/* Unicode code point to be up-converted */
+)
+{
+	if (uni < 0x10000) {	/* Is it in BMP? */
+#if FF_FAST_UNICODE
+		InitOnceExecuteOnce(&wtoupper_once, build_wtoupper_table, NULL, NULL);	/* The first caller builds the table, others wait for it */
+		uni = wtoupper_tbl[uni];
+#else
+		uni = wtoupper_bmp((WORD)uni);
+#endif
 	}
 
 	return uni;
@@ -1,9 +1,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>     // 用于 strtoull
+#include <io.h>         // 用于把标准输出改为镜像流
+#include <fcntl.h>
 #include "tools.h"
 #include "ff.h"         // FatFs库
-#include "main.h"
+#include "fatimage.h"
+#include "scan.h"
+#include "planner.h"
+#include "jobs.h"
+#include "partition.h"
+#include "imgcache.h"
+#include "extract.h"
+#include "verify.h"
+#include "check.h"
 
 /* 默认的镜像文件名 */
 char *disk_image_path="fatfs.img";
@@ -11,8 +21,63 @@ char *disk_image_path="fatfs.img";
 uint64_t disk_image_size=(32 * 1024 * 1024);
 /* 默认要打包的文件夹名 */
 char* source_folder = "assets_to_pack";
+/* tar/cpio 归档（"-" 表示标准输入），指定时代替源文件夹 */
+char* archive_path = NULL;
+/* 清单文件，指定时代替源文件夹 */
+char* manifest_path = NULL;
+/* 解包模式：要解包的镜像和PC上的目标目录（NULL表示生成镜像） */
+char* extract_image_path = NULL;
+char* extract_dir = NULL;
+/* 检查模式：要检查一致性的镜像（NULL表示生成镜像） */
+char* check_image_path = NULL;
+/* 生成后是否与源文件夹逐文件校验镜像 */
+int verify_mode = 0;
 /* 默认的文件系统格式 */
 BYTE fs_format_type = FM_EXFAT;
+/* 簇大小（字节），0表示由 f_mkfs 根据卷大小自动选择 */
+DWORD fs_cluster_size = 0;
+/* 是否根据源文件大小分布自动选择簇大小 */
+int cluster_auto = 0;
+/* 簇大小调优时每个簇的读性能代价（字节） */
+double perf_weight = 16.0;
+/* 是否根据源目录自动计算镜像大小，以及额外预留的百分比 */
+int size_auto = 0;
+double size_headroom = 0.0;
+/* 是否已经通过参数指定了镜像大小 */
+static int size_given = 0;
+/* 批量任务文件（NULL表示只生成一个镜像），以及并行的工作线程数（0表示按CPU核数） */
+char* jobs_path = NULL;
+int job_workers = 0;
+/* 分区列表（为空时生成单个卷的镜像） */
+part_spec partitions[MAX_PARTITIONS];
+int n_partitions = 0;
+/* 磁盘I/O方式：同步写入，或异步排队写入 */
+int io_mode = FATIMAGE_IO_SYNC;
+/* 格式化骨架缓存目录（NULL表示每次都执行 f_mkfs） */
+char* skel_dir = NULL;
+/* 批量模式：延迟元数据同步，拷贝结束时统一写出 */
+int bulk_mode = 0;
+/* 是否保留源文件的修改时间 */
+int keep_times = 0;
+/* 可重现模式：相同输入生成逐字节相同的镜像 */
+int deterministic = 0;
+/* 镜像产物缓存目录（NULL表示不使用，使用时隐含可重现模式） */
+char* image_cache = NULL;
+/* 去重模式：内容相同的文件共用簇（只读镜像） */
+int dedup_mode = 0;
+/* 是否在镜像旁生成 bmaptool 块映射 */
+int bmap_mode = 0;
+/* 是否在镜像旁生成每个文件的扇区区段表（JSON 和二进制） */
+int extent_map = 0;
+/* 必须占用连续簇的文件（镜像内路径） */
+#define MAX_CONTIG_FILES 64
+const char* contig_paths[MAX_CONTIG_FILES];
+int n_contig = 0;
+/* 输出文件格式：原始镜像、Android 稀疏镜像或 gzip 压缩镜像 */
+int out_format = FATIMAGE_OUT_RAW;
+/* 镜像路径为 "-" 时的输出流（原来的标准输出），以及临时镜像文件的路径 */
+FILE* out_stream = NULL;
+static char stream_tmp_path[MAX_PATH];
 
 /*
 =================================================================================
@@ -23,8 +88,74 @@ void print_usage(const char* prog_name) {
     printf("Usage: %s [options] [output_image.img] [size_in_bytes] [source_folder]\n", prog_name);
     printf("Options:\n");
     printf("  -h, --help        Show this help message.\n");
+    printf("  -o <path>         Output image, same as the output_image.img argument. '-' writes\n");
+    printf("                    the image to standard output in one forward pass (logs go to\n");
+    printf("                    standard error), e.g. to pipe it into a compressor or uploader.\n");
     printf("  -f <format>       Specify the filesystem format. Options are:\n");
     printf("                    'FAT', 'FAT32', 'EXFAT' (default: EXFAT).\n");
+    printf("  -c <size|auto>    Cluster size in bytes, or 'auto' to pick it from the\n");
+    printf("                    source file size distribution (default: chosen by f_mkfs).\n");
+    printf("  --archive <file>  Pack the contents of a tar (ustar/pax) or newc cpio archive\n");
+    printf("                    instead of source_folder, reading it once as a stream; '-'\n");
+    printf("                    reads standard input, e.g. 'tar c dir | packer --archive -'.\n");
+    printf("  --manifest <file> Pack the files listed in <file> instead of source_folder. Each\n");
+    printf("                    line is '<pc_path> <image_path> [ro|hidden|system|contig|first]';\n");
+    printf("                    an image path ending in '/' keeps the PC file name, and a\n");
+    printf("                    pc_path that is a folder is copied with all its contents.\n");
+    printf("  --extract <image> <dir>\n");
+    printf("                    Unpack every file and folder of an existing raw image into\n");
+    printf("                    <dir> instead of building one. File contents are read straight\n");
+    printf("                    from the image on --workers threads (default: one per core).\n");
+    printf("  --check <image>   Check an existing raw image instead of building one: cross-linked\n");
+    printf("                    and lost cluster chains, file sizes that do not match their\n");
+    printf("                    chains, and exFAT bitmap errors. The exit code is 1 on problems.\n");
+    printf("  --verify          After building, compare the image with source_folder: names,\n");
+    printf("                    sizes and contents, read back on --workers threads. Mismatches\n");
+    printf("                    are reported and the exit code is 1.\n");
+    printf("  --perf-weight <n> Bytes charged per cluster when tuning with '-c auto'\n");
+    printf("                    (default: %.0f). Larger values favour bigger clusters.\n", perf_weight);
+    printf("  --size <size>     Image size in bytes, or 'auto[+N%%]' to compute the smallest\n");
+    printf("                    image that holds the source folder, plus N%% headroom.\n");
+    printf("                    Same as the size_in_bytes argument.\n");
+    printf("  --jobs <file>     Build every image listed in <file> concurrently. Each line is\n");
+    printf("                    '<output> <size|auto[+N%%]> <format> <source_folder> [cluster]'.\n");
+    printf("  --workers <n>     Worker threads for --jobs, --extract and --verify (default: one per\n");
+    printf("                    CPU core; --jobs uses at most %d).\n", FF_VOLUMES);
+    printf("  --part <spec>     Add an MBR partition (up to %d, in disk order). <spec> is\n", MAX_PARTITIONS);
+    printf("                    '<size>:<format>[@<cluster>]:<source_folder>', where size is\n");
+    printf("                    bytes (K/M/G suffix allowed), a percentage, or 'rest'.\n");
+    printf("                    Partitions are formatted and filled in parallel; -f, -c and\n");
+    printf("                    source_folder are ignored.\n");
+    printf("  --io <mode>       Disk I/O mode: 'sync' (default), 'async' to queue image writes\n");
+    printf("                    as overlapped I/O, or 'direct' to bypass the system file cache.\n");
+    printf("  --skel-cache <dir>\n");
+    printf("                    Keep freshly formatted filesystem skeletons in <dir> and copy\n");
+    printf("                    them into later images of the same size, format and cluster\n");
+    printf("                    size instead of formatting again.\n");
+    printf("  --bulk            Bulk mode: keep directory, FAT and FSInfo updates in memory\n");
+    printf("                    and write them once after the copy instead of on every file.\n");
+    printf("  --keep-times      Give files and directories the modification time of their\n");
+    printf("                    source instead of the build time.\n");
+    printf("  --deterministic   Reproducible output: copy entries in name order and use a fixed\n");
+    printf("                    build time (SOURCE_DATE_EPOCH, or 1980-01-01) and volume serial.\n");
+    printf("  --image-cache <dir>\n");
+    printf("                    Keep finished images in <dir>, keyed by a hash of the source\n");
+    printf("                    folder and the options, and reuse them when nothing changed.\n");
+    printf("                    Implies --deterministic.\n");
+    printf("  --dedup           Store files with identical contents once: their directory\n");
+    printf("                    entries share one cluster chain. The image must only be\n");
+    printf("                    mounted read-only; writing to it corrupts the shared files.\n");
+    printf("  --bmap            Also write '<image>.bmap', a bmaptool block map of the blocks\n");
+    printf("                    the packer wrote, so flashing can skip the unused ones.\n");
+    printf("  --extent-map      Also write '<image>.extents.json' and '<image>.extents.bin' listing\n");
+    printf("                    the sector runs (LBA from the start of the image) of every file,\n");
+    printf("                    for bootloaders that read files without a FAT driver.\n");
+    printf("  --contig <path>   Store the file at this image path (e.g. '/boot/kernel.img') in one\n");
+    printf("                    contiguous cluster run, or fail. Repeat for up to %d files.\n", MAX_CONTIG_FILES);
+    printf("  --output-format <raw|sparse|gzip>\n");
+    printf("                    Write a raw image (default), an Android sparse image for\n");
+    printf("                    'fastboot flash' (blocks the packer never wrote are left out),\n");
+    printf("                    or a gzip image (BGZF) compressed on all CPU cores.\n");
     printf("\nArguments default to:\n");
     printf("  - output_image.img: %s\n", disk_image_path);
     printf("  - size_in_bytes:    %llu\n", (unsigned long long)disk_image_size);
@@ -32,15 +163,69 @@ void print_usage(const char* prog_name) {
 }
 
 
+/*
+=================================================================================
+ 解析镜像大小参数：字节数，或 auto[+N%]
+=================================================================================
+*/
+static int parse_size_arg(const char* arg) {
+    if (parse_size_spec(arg, &disk_image_size, &size_auto, &size_headroom) != 0) {
+        return -1;
+    }
+    size_given = 1;
+    return 0;
+}
+
+
+/*
+=================================================================================
+ 流输出：镜像写入原来的标准输出，日志改写到标准错误
+=================================================================================
+*/
+static int open_output_stream(void) {
+    char dir[MAX_PATH];
+
+    fflush(stdout);
+    int fd = _dup(_fileno(stdout));
+    if (fd < 0 || _dup2(_fileno(stderr), _fileno(stdout)) < 0) {
+        fprintf(stderr, "Error: Cannot redirect standard output.\n");
+        return -1;
+    }
+    setvbuf(stdout, NULL, _IONBF, 0); // 日志与标准错误的输出保持顺序
+    _setmode(fd, _O_BINARY);
+    out_stream = _fdopen(fd, "wb");
+    if (!out_stream) {
+        fprintf(stderr, "Error: Cannot open standard output for writing.\n");
+        return -1;
+    }
+    // FatFs 需要随机读写，镜像先在临时目录中生成
+    if (!GetTempPath(sizeof(dir), dir)) {
+        strcpy(dir, ".\\");
+    }
+    snprintf(stream_tmp_path, sizeof(stream_tmp_path), "%sfatimage-%lu.img", dir, (unsigned long)GetCurrentProcessId());
+    disk_image_path = stream_tmp_path;
+    return 0;
+}
+
+/**
+ * @brief Flushes and closes the output stream. Returns the exit code: 1 if anything failed to reach it.
+ */
+static int close_output_stream(int exit_code) {
+    if (out_stream && (fflush(out_stream) != 0 || ferror(out_stream) || fclose(out_stream) != 0)) {
+        fprintf(stderr, "Error: Failed to write the image to standard output.\n");
+        return 1;
+    }
+    return exit_code;
+}
+
+
 /*
 =================================================================================
  主函数
 =================================================================================
 */
 int main(int argc, char *argv[]) {
-    FATFS fs;
-    FRESULT res;
-    BYTE work[FF_MAX_SS];
+    fatimage* img;
     char* format_str = "EXFAT"; // 用于打印日志
 
     // --- 从命令行参数解析配置 ---
@@ -50,6 +235,17 @@ int main(int argc, char *argv[]) {
             print_usage(argv[0]);
             return 0;
         }
+        // 检查输出路径选项
+        else if (strcmp(argv[arg_index], "-o") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                disk_image_path = argv[arg_index];
+            } else {
+                fprintf(stderr, "Error: Missing value for -o option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
         // 检查文件系统格式选项
         else if (strcmp(argv[arg_index], "-f") == 0) {
             if (arg_index + 1 < argc) {
@@ -73,6 +269,245 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
         }
+        // 检查簇大小选项
+        else if (strcmp(argv[arg_index], "-c") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++; // 移动到簇大小值
+                if (stricmp(argv[arg_index], "auto") == 0) {
+                    cluster_auto = 1;
+                } else {
+                    char* endptr;
+                    unsigned long cluster = strtoul(argv[arg_index], &endptr, 10);
+                    if (*endptr != '\0' || cluster < 512 || (cluster & (cluster - 1)) != 0) {
+                        fprintf(stderr, "Error: Invalid cluster size '%s'. Use a power of two >= 512, or 'auto'.\n", argv[arg_index]);
+                        return 1;
+                    }
+                    fs_cluster_size = (DWORD)cluster;
+                }
+            } else {
+                fprintf(stderr, "Error: Missing value for -c option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查调优权重选项
+        else if (strcmp(argv[arg_index], "--perf-weight") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                char* endptr;
+                perf_weight = strtod(argv[arg_index], &endptr);
+                if (*endptr != '\0' || perf_weight < 0) {
+                    fprintf(stderr, "Error: Invalid perf weight '%s'.\n", argv[arg_index]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "Error: Missing value for --perf-weight option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查镜像大小选项
+        else if (strcmp(argv[arg_index], "--size") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                if (parse_size_arg(argv[arg_index]) != 0) {
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "Error: Missing value for --size option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查批量任务选项
+        else if (strcmp(argv[arg_index], "--jobs") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                jobs_path = argv[arg_index];
+            } else {
+                fprintf(stderr, "Error: Missing value for --jobs option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg_index], "--workers") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                char* endptr;
+                long workers = strtol(argv[arg_index], &endptr, 10);
+                if (*endptr != '\0' || workers < 1) {
+                    fprintf(stderr, "Error: Invalid worker count '%s'.\n", argv[arg_index]);
+                    return 1;
+                }
+                job_workers = (int)workers;
+            } else {
+                fprintf(stderr, "Error: Missing value for --workers option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查分区选项
+        else if (strcmp(argv[arg_index], "--part") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                if (n_partitions == MAX_PARTITIONS) {
+                    fprintf(stderr, "Error: At most %d partitions are supported.\n", MAX_PARTITIONS);
+                    return 1;
+                }
+                if (parse_part_spec(argv[arg_index], &partitions[n_partitions]) != 0) {
+                    return 1;
+                }
+                n_partitions++;
+            } else {
+                fprintf(stderr, "Error: Missing value for --part option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查I/O方式选项
+        else if (strcmp(argv[arg_index], "--io") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                if (stricmp(argv[arg_index], "sync") == 0) {
+                    io_mode = FATIMAGE_IO_SYNC;
+                } else if (stricmp(argv[arg_index], "async") == 0) {
+                    io_mode = FATIMAGE_IO_ASYNC;
+                } else if (stricmp(argv[arg_index], "direct") == 0) {
+                    io_mode = FATIMAGE_IO_DIRECT;
+                } else {
+                    fprintf(stderr, "Error: Invalid I/O mode '%s'. Use 'sync', 'async' or 'direct'.\n", argv[arg_index]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "Error: Missing value for --io option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查批量模式选项
+        else if (strcmp(argv[arg_index], "--bulk") == 0) {
+            bulk_mode = 1;
+        }
+        // 检查时间戳选项
+        else if (strcmp(argv[arg_index], "--keep-times") == 0) {
+            keep_times = 1;
+        }
+        // 检查可重现模式选项
+        else if (strcmp(argv[arg_index], "--deterministic") == 0) {
+            deterministic = 1;
+        }
+        // 检查镜像缓存选项
+        else if (strcmp(argv[arg_index], "--image-cache") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                image_cache = argv[arg_index];
+                deterministic = 1;
+            } else {
+                fprintf(stderr, "Error: Missing value for --image-cache option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查归档输入选项
+        else if (strcmp(argv[arg_index], "--archive") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                archive_path = argv[arg_index];
+            } else {
+                fprintf(stderr, "Error: --archive option requires an argument.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查清单文件选项
+        else if (strcmp(argv[arg_index], "--manifest") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                manifest_path = argv[arg_index];
+            } else {
+                fprintf(stderr, "Error: --manifest option requires an argument.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查解包选项
+        else if (strcmp(argv[arg_index], "--extract") == 0) {
+            if (arg_index + 2 < argc) {
+                extract_image_path = argv[++arg_index];
+                extract_dir = argv[++arg_index];
+            } else {
+                fprintf(stderr, "Error: --extract option requires an image and a destination folder.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查一致性检查选项
+        else if (strcmp(argv[arg_index], "--check") == 0) {
+            if (arg_index + 1 < argc) {
+                check_image_path = argv[++arg_index];
+            } else {
+                fprintf(stderr, "Error: --check option requires an image.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查校验选项
+        else if (strcmp(argv[arg_index], "--verify") == 0) {
+            verify_mode = 1;
+        }
+        // 检查去重选项
+        else if (strcmp(argv[arg_index], "--dedup") == 0) {
+            dedup_mode = 1;
+        }
+        // 检查块映射选项
+        else if (strcmp(argv[arg_index], "--bmap") == 0) {
+            bmap_mode = 1;
+        }
+        // 检查区段表选项
+        else if (strcmp(argv[arg_index], "--extent-map") == 0) {
+            extent_map = 1;
+        }
+        // 检查连续存放选项
+        else if (strcmp(argv[arg_index], "--contig") == 0) {
+            if (arg_index + 1 < argc && n_contig < MAX_CONTIG_FILES) {
+                contig_paths[n_contig++] = argv[++arg_index];
+            } else {
+                fprintf(stderr, "Error: --contig option requires an image path (at most %d files).\n", MAX_CONTIG_FILES);
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查输出格式选项
+        else if (strcmp(argv[arg_index], "--output-format") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                if (stricmp(argv[arg_index], "raw") == 0) {
+                    out_format = FATIMAGE_OUT_RAW;
+                } else if (stricmp(argv[arg_index], "sparse") == 0) {
+                    out_format = FATIMAGE_OUT_SPARSE;
+                } else if (stricmp(argv[arg_index], "gzip") == 0) {
+                    out_format = FATIMAGE_OUT_GZIP;
+                } else {
+                    fprintf(stderr, "Error: Invalid output format '%s'. Use 'raw', 'sparse' or 'gzip'.\n", argv[arg_index]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "Error: Missing value for --output-format option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        // 检查骨架缓存选项
+        else if (strcmp(argv[arg_index], "--skel-cache") == 0) {
+            if (arg_index + 1 < argc) {
+                arg_index++;
+                skel_dir = argv[arg_index];
+            } else {
+                fprintf(stderr, "Error: Missing value for --skel-cache option.\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
         // 非选项参数按顺序解析
         else {
             // 第一个非选项参数是镜像路径
@@ -80,14 +515,10 @@ int main(int argc, char *argv[]) {
                  disk_image_path = argv[arg_index];
             }
             // 第二个是大小
-            else if (disk_image_size == (32 * 1024 * 1024)) {
-                char* endptr;
-                unsigned long long size_bytes = strtoull(argv[arg_index], &endptr, 10);
-                if (*endptr != '\0' || argv[arg_index][0] == '\0' || size_bytes == 0) {
-                    fprintf(stderr, "Error: Invalid size '%s'. Please provide a positive integer for bytes.\n", argv[arg_index]);
+            else if (!size_given) {
+                if (parse_size_arg(argv[arg_index]) != 0) {
                     return 1;
                 }
-                disk_image_size = size_bytes;
             }
             // 第三个是源文件夹
             else if (source_folder == NULL || strcmp(source_folder, "assets_to_pack") == 0) {
@@ -103,52 +534,337 @@ int main(int argc, char *argv[]) {
         arg_index++;
     }
 
+    // --- 解包模式：不生成镜像 ---
+    if (extract_image_path) {
+        return (extract_image(extract_image_path, extract_dir, job_workers) == 0) ? 0 : 1;
+    }
+    // --- 检查模式：只读检查已有镜像 ---
+    if (check_image_path) {
+        return (check_image(check_image_path) == 0) ? 0 : 1;
+    }
+
+    // 稀疏镜像本身就只包含写入过的块，块映射没有意义；镜像缓存只保存原始镜像
+    if (out_format == FATIMAGE_OUT_SPARSE && bmap_mode) {
+        fprintf(stderr, "Error: '--bmap' cannot be used with '--output-format sparse'.\n");
+        return 1;
+    }
+    if (out_format != FATIMAGE_OUT_RAW && image_cache) {
+        printf("Note: The image cache is only used for raw images.\n");
+        image_cache = NULL;
+    }
+
+    // 归档只能顺序读取一次，清单不是一个源文件夹：都不能事先扫描源文件，镜像缓存也无法计算输入的摘要
+    if (archive_path || manifest_path) {
+        const char* opt = archive_path ? "--archive" : "--manifest";
+        if (archive_path && manifest_path) {
+            fprintf(stderr, "Error: '--archive' and '--manifest' cannot be used together.\n");
+            return 1;
+        }
+        if (jobs_path || n_partitions > 0) {
+            fprintf(stderr, "Error: '%s' cannot be used with --jobs or --part.\n", opt);
+            return 1;
+        }
+        if (size_auto || cluster_auto || dedup_mode) {
+            fprintf(stderr, "Error: '%s' cannot be used with '--size auto', '-c auto' or --dedup.\n", opt);
+            return 1;
+        }
+        if (image_cache) {
+            printf("Note: The image cache is not used with %s.\n", opt);
+            image_cache = NULL;
+        }
+    }
+
+    // 校验读回原始镜像并与源文件夹比较：只适用于从源文件夹生成的单个原始镜像文件
+    if (verify_mode) {
+        if (jobs_path || n_partitions > 0 || archive_path || manifest_path) {
+            fprintf(stderr, "Error: '--verify' cannot be used with --jobs, --part, --archive or --manifest.\n");
+            return 1;
+        }
+        if (out_format != FATIMAGE_OUT_RAW || strcmp(disk_image_path, "-") == 0) {
+            fprintf(stderr, "Error: '--verify' needs a raw image file (no --output-format or '-o -').\n");
+            return 1;
+        }
+    }
+
+    // 输出到标准输出：只适用于单个镜像，块映射和镜像缓存都需要镜像文件
+    if (strcmp(disk_image_path, "-") == 0) {
+        if (jobs_path) {
+            fprintf(stderr, "Error: '-o -' cannot be used with --jobs.\n");
+            return 1;
+        }
+        if (bmap_mode || extent_map) {
+            fprintf(stderr, "Error: '%s' cannot be used when writing to standard output.\n", bmap_mode ? "--bmap" : "--extent-map");
+            return 1;
+        }
+        if (open_output_stream() != 0) {
+            return 1;
+        }
+        if (image_cache) {
+            printf("Note: The image cache is not used when writing to standard output.\n");
+            image_cache = NULL;
+        }
+    }
+
+    // 骨架缓存目录不存在时创建
+    if (skel_dir) {
+        CreateDirectory(skel_dir, NULL);
+    }
+    if (image_cache) {
+        CreateDirectory(image_cache, NULL);
+    }
+
+    // --- 批量模式：按任务文件并行生成多个镜像 ---
+    if (jobs_path) {
+        fatimage_config base = { .io_mode = io_mode, .skel_dir = skel_dir, .bulk = bulk_mode,
+                                  .keep_times = keep_times, .deterministic = deterministic,
+                                  .image_cache = image_cache, .dedup = dedup_mode,
+                                  .bmap = bmap_mode, .out_format = out_format,
+                                  .extent_map = extent_map, .contig = contig_paths, .n_contig = n_contig };
+        return (run_jobs(jobs_path, job_workers, &base) == 0) ? 0 : 1;
+    }
+
+    // --- 多分区模式：每个分区一个线程 ---
+    if (n_partitions > 0) {
+        if (size_auto) {
+            fprintf(stderr, "Error: '--size auto' cannot be used with --part.\n");
+            return 1;
+        }
+        if (image_cache) {
+            printf("Note: The image cache is not used for partitioned images.\n");
+        }
+        printf("Building partitioned image '%s' (%llu bytes, %d partitions)...\n",
+               out_stream ? "<stdout>" : disk_image_path, (unsigned long long)disk_image_size, n_partitions);
+        fatimage_config disk_cfg = { .path = disk_image_path, .size = disk_image_size, .io_mode = io_mode, .bulk = bulk_mode,
+                                      .keep_times = keep_times, .deterministic = deterministic, .dedup = dedup_mode,
+                                      .bmap = bmap_mode, .out_format = out_format, .stream = out_stream,
+                                      .extent_map = extent_map, .contig = contig_paths, .n_contig = n_contig };
+        return close_output_stream((build_partitioned_image(&disk_cfg, partitions, n_partitions) == 0) ? 0 : 1);
+    }
+
     printf("----------------------------------------\n");
     printf("FatFs Image Packer Configuration:\n");
-    printf("  - Image Path:    %s\n", disk_image_path);
-    printf("  - Image Size:    %llu bytes (%.2f MiB)\n", 
-           (unsigned long long)disk_image_size, 
-           (double)disk_image_size / (1024.0 * 1024.0));
-    printf("  - Source Folder: %s\n", source_folder);
+    printf("  - Image Path:    %s\n", out_stream ? "<stdout>" : disk_image_path);
+    if (size_auto) {
+        printf("  - Image Size:    auto (+%.1f%% headroom)\n", size_headroom);
+    } else {
+        printf("  - Image Size:    %llu bytes (%.2f MiB)\n", 
+               (unsigned long long)disk_image_size, 
+               (double)disk_image_size / (1024.0 * 1024.0));
+    }
+    if (archive_path) {
+        printf("  - Archive:       %s\n", strcmp(archive_path, "-") == 0 ? "<stdin>" : archive_path);
+    } else if (manifest_path) {
+        printf("  - Manifest:      %s\n", manifest_path);
+    } else {
+        printf("  - Source Folder: %s\n", source_folder);
+    }
     printf("  - FS Format:     %s\n", format_str);
+    if (cluster_auto) {
+        printf("  - Cluster Size:  auto\n");
+    } else if (fs_cluster_size) {
+        printf("  - Cluster Size:  %lu bytes\n", (unsigned long)fs_cluster_size);
+    } else {
+        printf("  - Cluster Size:  default\n");
+    }
+    printf("  - Disk I/O:      %s\n", io_mode == FATIMAGE_IO_ASYNC ? "async" :
+                                         io_mode == FATIMAGE_IO_DIRECT ? "direct" : "sync");
+    if (skel_dir) {
+        printf("  - Skeleton Cache: %s\n", skel_dir);
+    }
+    if (bulk_mode) {
+        printf("  - Bulk Mode:     on\n");
+    }
+    printf("  - Timestamps:    %s\n", keep_times ? "source files" : deterministic ? "fixed" : "build time");
+    if (deterministic) {
+        printf("  - Reproducible:  on\n");
+    }
+    if (image_cache) {
+        printf("  - Image Cache:   %s\n", image_cache);
+    }
+    if (dedup_mode) {
+        printf("  - Dedup:         on (read-only image)\n");
+    }
+    if (bmap_mode) {
+        printf("  - Block Map:     %s.bmap\n", disk_image_path);
+    }
+    if (extent_map) {
+        printf("  - Extent Map:    %s.extents.json, .bin\n", disk_image_path);
+    }
+    if (n_contig > 0) {
+        printf("  - Contiguous:    %d files\n", n_contig);
+    }
+    if (out_format != FATIMAGE_OUT_RAW) {
+        printf("  - Output Format: %s\n", out_format == FATIMAGE_OUT_SPARSE ? "Android sparse" : "gzip (BGZF)");
+    }
     printf("----------------------------------------\n\n");
 
-    // --- 准备工作：格式化和挂载 ---
-    printf("Formatting the disk image with %s...\n", format_str);
-    // 使用 MKFS_PARM 结构体来指定格式
-    MKFS_PARM opt = { .fmt = fs_format_type };
-    res = f_mkfs("0:", &opt, work, sizeof(work));
-    if (res != FR_OK) {
-        fprintf(stderr, "ERROR: f_mkfs failed. FRESULT: %d\n", res);
+    // 首先在PC上创建源目录，以便程序能找到它
+    if (!archive_path && !manifest_path) {
+        CreateDirectory(source_folder, NULL);
+    }
+
+    // --- 分析源目录：查找重复文件，选择簇大小，计算镜像大小 ---
+    dedup_table* dedup = NULL;
+    if (cluster_auto || size_auto || dedup_mode) {
+        src_node tree;
+        printf("Analyzing source folder '%s'...\n", source_folder);
+        if (scan_source_tree(source_folder, &tree) != 0) {
+            free_source_tree(&tree);
+            fprintf(stderr, "ERROR: Failed to scan source folder.\n");
+            return -1;
+        }
+        if (dedup_mode) {
+            uint64_t dup_files, dup_bytes;
+            dedup = dedup_plan(source_folder, &tree, NULL);
+            if (!dedup) {
+                free_source_tree(&tree);
+                return -1;
+            }
+            dedup_savings(dedup, 1, &dup_files, &dup_bytes);
+            printf("Found %llu duplicate files (%llu bytes) that will share clusters.\n",
+                   (unsigned long long)dup_files, (unsigned long long)dup_bytes);
+        }
+        if (cluster_auto) {
+            // 自动大小时传入0，按每个簇大小对应的最小镜像来比较
+            fs_cluster_size = tune_cluster_size(&tree, fs_format_type, size_auto ? 0 : disk_image_size, perf_weight);
+            if (fs_cluster_size == 0) {
+                free_source_tree(&tree);
+                fprintf(stderr, "ERROR: No cluster size can hold the source folder in a %s image.\n", format_str);
+                dedup_free(dedup);
+                return -1;
+            }
+        }
+        if (size_auto) {
+            uint64_t min_size = plan_auto_size(&tree, fs_format_type, &fs_cluster_size);
+            if (min_size == 0) {
+                free_source_tree(&tree);
+                fprintf(stderr, "ERROR: The source folder cannot be stored in a %s image.\n", format_str);
+                dedup_free(dedup);
+                return -1;
+            }
+            // 预留空间按扇区向上取整
+            disk_image_size = plan_add_headroom(min_size, size_headroom);
+            printf("Minimal image size: %llu bytes, cluster size %lu bytes; with headroom: %llu bytes (%.2f MiB)\n\n",
+                   (unsigned long long)min_size, (unsigned long)fs_cluster_size,
+                   (unsigned long long)disk_image_size, (double)disk_image_size / (1024.0 * 1024.0));
+        }
+        free_source_tree(&tree);
+    }
+
+    // --- 准备工作：创建镜像、格式化和挂载 ---
+    fatimage_config cfg = {
+        .path = disk_image_path,
+        .size = disk_image_size,
+        .fmt = fs_format_type,
+        .au_size = fs_cluster_size,
+        .io_mode = io_mode,
+        .skel_dir = skel_dir,
+        .bulk = bulk_mode,
+        .keep_times = keep_times,
+        .deterministic = deterministic,
+        .image_cache = image_cache,
+        .dedup = dedup_mode,
+        .bmap = bmap_mode,
+        .out_format = out_format,
+        .stream = out_stream,
+        .extent_map = extent_map,
+        .contig = contig_paths,
+        .n_contig = n_contig,
+    };
+
+    // --- 镜像缓存：输入不变时直接取回上次生成的镜像 ---
+    char cache_key[IMGCACHE_KEY_LEN + 1];
+    if (image_cache) {
+        if (imgcache_key(&cfg, source_folder, NULL, cache_key) != 0) {
+            fprintf(stderr, "ERROR: Failed to hash source folder '%s'.\n", source_folder);
+            dedup_free(dedup);
+            return -1;
+        }
+        int rc = imgcache_fetch(&cfg, cache_key);
+        if (rc <= 0) {
+            dedup_free(dedup);
+        }
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc == 0) {
+            printf("Image cache hit (%.16s...): '%s' is up to date.\n", cache_key, disk_image_path);
+            if (verify_mode) {
+                printf("\nVerifying '%s' against '%s'...\n", disk_image_path, source_folder);
+                return (verify_image(disk_image_path, source_folder, job_workers) == 0) ? 0 : 1;
+            }
+            return 0;
+        }
+        printf("Image cache miss (%.16s...), building.\n\n", cache_key);
+    }
+
+    img = fatimage_open(&cfg);
+    if (!img) {
+        fprintf(stderr, "ERROR: Failed to create disk image '%s'.\n", disk_image_path);
+        dedup_free(dedup);
         return -1;
     }
+    // 规划阶段已找到的重复文件交给拷贝使用，不再计算一次摘要
+    fatimage_set_dedup(img, dedup);
+    printf("Successfully created a %.2f MB disk image.\n", (double)disk_image_size / (1024.0 * 1024.0));
+
+    printf("Formatting the disk image with %s...\n", format_str);
+    if (fatimage_format(img) != 0) {
+        fatimage_abort(img);
+        return close_output_stream(1);
+    }
     printf("Format successful.\n");
 
-    res = f_mount(&fs, "0:", 1);
-    if (res != FR_OK) {
-        fprintf(stderr, "ERROR: f_mount failed. FRESULT: %d\n", res);
-        return -1;
+    if (fatimage_mount(img) != 0) {
+        fatimage_abort(img);
+        return close_output_stream(1);
     }
     printf("Mount successful.\n");
 
-    // --- 核心操作：拷贝整个文件夹 ---
-    const char* dest_root = "0:";                // <-- FatFs的根目录
-
+    // --- 核心操作：拷贝整个文件夹到镜像根目录 ---
     // 在运行程序前，请确保源文件夹存在
-    printf("\nStarting to copy directory '%s' to the root of the image...\n", source_folder);
-
-    // 首先在PC上创建这个目录，以便程序能找到它
-    CreateDirectory(source_folder, NULL); 
-
-    if (copy_directory_to_fatfs(source_folder, dest_root) == 0) {
-        printf("\nSuccessfully copied all contents from '%s'!\n", source_folder);
+    int copied;
+    if (archive_path) {
+        printf("\nStarting to unpack archive '%s' into the root of the image...\n", archive_path);
+        copied = fatimage_copy_archive(img, archive_path);
+    } else if (manifest_path) {
+        printf("\nStarting to copy the files listed in '%s' into the image...\n", manifest_path);
+        copied = fatimage_copy_manifest(img, manifest_path);
     } else {
-        fprintf(stderr, "\nERROR: Directory copy failed.\n");
+        printf("\nStarting to copy directory '%s' to the root of the image...\n", source_folder);
+        copied = fatimage_copy_dir(img, source_folder, NULL);
+    }
+    const char* input = archive_path ? archive_path : manifest_path ? manifest_path : source_folder;
+    if (copied == 0) {
+        printf("\nSuccessfully copied all contents from '%s'!\n", input);
+    } else {
+        fprintf(stderr, "\nERROR: %s copy failed.\n", archive_path ? "Archive" : manifest_path ? "Manifest" : "Directory");
     }
 
-    // --- 清理工作：卸载 ---
-    f_mount(NULL, "0:", 0);
+    // --- 清理工作：卸载并关闭镜像 ---
+    // 拷贝失败的镜像不完整：不转换、不写到输出流，也不缓存、不校验，退出码非0
+    if (copied != 0) {
+        fatimage_abort(img);
+        printf("Unmounted the disk image.\n");
+        return close_output_stream(1);
+    }
+    if (fatimage_close(img) != 0) {
+        fprintf(stderr, "ERROR: Failed to finish writing '%s'.\n", out_stream ? "<stdout>" : disk_image_path);
+        return close_output_stream(1);
+    }
     printf("Unmounted the disk image.\n");
 
-    return 0;
+    if (image_cache) {
+        imgcache_store(&cfg, cache_key);
+    }
+
+    // --- 校验：重新读取镜像，与源文件夹比较 ---
+    if (verify_mode) {
+        printf("\nVerifying '%s' against '%s'...\n", disk_image_path, source_folder);
+        if (verify_image(disk_image_path, source_folder, job_workers) != 0) {
+            return close_output_stream(1);
+        }
+    }
+
+    return close_output_stream(0);
 }
\ No newline at end of file
@@ -1,8 +0,0 @@
-#ifndef __MAIN_H__
-#define __MAIN_H__
-#include <stdint.h>
-
-extern char *disk_image_path;
-extern uint64_t disk_image_size;
-
-#endif
\ No newline at end of file
@@ -0,0 +1,335 @@
+#include "manifest.h"
+#include "tools.h"
+#include "jobs.h"       // split_fields
+#include "fatimage.h"
+#include <windows.h>
+#include "ff.h"         // FatFs库
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 清单文件中一行的最大长度
+#define MAN_LINE_MAX    4096
+// 每行最多的字段数：源路径、镜像路径和选项
+#define MAN_MAX_FIELDS  8
+
+/*
+ 清单输入：每行 "<PC路径> <镜像路径> [选项...]"，把精选的文件（可以来自多个源目录）放到镜像中的指定位置，
+ 不遍历整个源目录。镜像路径以 '/' 结尾时表示目录，文件名沿用PC文件名；PC路径是目录时拷贝其全部内容。
+ 全部条目先读入并排序再拷贝：先按镜像中的父目录分组，同一目录的条目连续创建，父目录保持打开；
+ 同一目录内按源文件所在卷和文件ID（NTFS 的 inode）排序，读取源文件时磁盘寻道更少。
+ 标记为 first 的条目按清单顺序最先写入，占用数据区开头的簇。
+*/
+
+typedef struct {
+    int line;               // 在清单文件中的行号
+    char* src;              // PC上的源路径
+    char* dst;              // 镜像中的路径（相对于根目录，已规范化，目录可以为空串表示根目录）
+    size_t dir_len;         // dst 中父目录部分的长度
+    int is_dir;             // 源路径是目录
+    int first;              // 最先写入
+    int contig;             // 必须占用连续的簇
+    BYTE attr;              // AM_RDO / AM_HID / AM_SYS
+    DWORD volume;           // 源文件所在卷的序列号
+    uint64_t file_id;       // 源文件在卷内的文件ID
+    FILETIME mtime;         // 源文件的修改时间
+} man_entry;
+
+/*
+=================================================================================
+ 1. 读取清单文件
+=================================================================================
+*/
+
+static void free_entries(man_entry* list, int n) {
+    for (int i = 0; i < n; i++) {
+        free(list[i].src);
+        free(list[i].dst);
+    }
+    free(list);
+}
+
+/**
+ * @brief Parses the options after the two paths of a manifest line.
+ * @return 0 on success, -1 on an unknown option.
+ */
+static int parse_options(man_entry* e, char* f[], int n, const char* manifest_path) {
+    for (int i = 2; i < n; i++) {
+        if (stricmp(f[i], "ro") == 0 || stricmp(f[i], "readonly") == 0) {
+            e->attr |= AM_RDO;
+        } else if (stricmp(f[i], "hidden") == 0) {
+            e->attr |= AM_HID;
+        } else if (stricmp(f[i], "system") == 0) {
+            e->attr |= AM_SYS;
+        } else if (stricmp(f[i], "contig") == 0) {
+            e->contig = 1;
+        } else if (stricmp(f[i], "first") == 0) {
+            e->first = 1;
+        } else {
+            fprintf(stderr, "Error: %s:%d: unknown option '%s' (use ro, hidden, system, contig or first).\n",
+                    manifest_path, e->line, f[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Looks up a source path: whether it is a directory, its modification time, and for files
+ *        the volume and file ID used to order the copy.
+ * @return 0 on success, -1 if the source does not exist or cannot be opened.
+ */
+static int stat_source(man_entry* e, const char* manifest_path) {
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesEx(e->src, GetFileExInfoStandard, &attr)) {
+        fprintf(stderr, "Error: %s:%d: source '%s' not found.\n", manifest_path, e->line, e->src);
+        return -1;
+    }
+    e->is_dir = (attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    e->mtime = attr.ftLastWriteTime;
+    if (e->is_dir) {
+        return 0;
+    }
+
+    BY_HANDLE_FILE_INFORMATION info;
+    HANDLE h = CreateFile(e->src, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: %s:%d: cannot open source '%s'. Error code: %lu\n", manifest_path, e->line, e->src,
+                GetLastError());
+        return -1;
+    }
+    int ok = GetFileInformationByHandle(h, &info);
+    CloseHandle(h);
+    if (ok) {
+        e->volume = info.dwVolumeSerialNumber;
+        e->file_id = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses a manifest file. Each non-empty line is "<pc_path> <image_path> [option...]", '#' starts a comment.
+ *        An image path ending in '/' names a directory; a file keeps its PC file name there.
+ * @param entries Receives a malloc'ed entry array.
+ * @return Number of entries, or -1 on error.
+ */
+static int load_manifest(const char* manifest_path, man_entry** entries) {
+    FILE* fp = fopen(manifest_path, "r");
+    char line[MAN_LINE_MAX];
+    char rel[FAT_PATH_MAX];
+    char* f[MAN_MAX_FIELDS];
+    int n_entries = 0, cap = 0, line_no = 0;
+    man_entry* list = NULL;
+
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open manifest '%s'.\n", manifest_path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        int n = split_fields(line, f, MAN_MAX_FIELDS);
+        if (n == 0) {
+            continue;
+        }
+        if (n < 2 || n > MAN_MAX_FIELDS) {
+            fprintf(stderr, "Error: %s:%d: expected '<pc_path> <image_path> [option...]'.\n", manifest_path, line_no);
+            goto fail;
+        }
+        if (n_entries == cap) {
+            cap = cap ? cap * 2 : 64;
+            man_entry* p = (man_entry*)realloc(list, cap * sizeof(man_entry));
+            if (!p) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                goto fail;
+            }
+            list = p;
+        }
+        man_entry* e = &list[n_entries];
+        memset(e, 0, sizeof(*e));
+        e->line = line_no;
+        if (!(e->src = _strdup(f[0]))) {
+            goto fail;
+        }
+        n_entries++;
+
+        // 镜像路径以 '/' 结尾：放到该目录中，沿用PC文件名
+        if (normalize_image_path(f[1], rel, sizeof(rel)) != 0) {
+            fprintf(stderr, "Error: %s:%d: unsafe or too long image path '%s'.\n", manifest_path, line_no, f[1]);
+            goto fail;
+        }
+        if (parse_options(e, f, n, manifest_path) != 0 || stat_source(e, manifest_path) != 0) {
+            goto fail;
+        }
+        size_t len = strlen(f[1]);
+        if (!e->is_dir && (rel[0] == '\0' || f[1][len - 1] == '/' || f[1][len - 1] == '\\')) {
+            const char* base = e->src + strlen(e->src);
+            while (base > e->src && base[-1] != '/' && base[-1] != '\\' && base[-1] != ':') base--;
+            size_t rlen = strlen(rel);
+            if (rlen + strlen(base) + 2 > sizeof(rel)) {
+                fprintf(stderr, "Error: %s:%d: image path too long.\n", manifest_path, line_no);
+                goto fail;
+            }
+            snprintf(rel + rlen, sizeof(rel) - rlen, "%s%s", rlen ? "/" : "", base);
+        }
+        if (!(e->dst = _strdup(rel))) {
+            goto fail;
+        }
+        const char* slash = strrchr(e->dst, '/');
+        e->dir_len = slash ? (size_t)(slash - e->dst) : 0;
+    }
+    fclose(fp);
+    *entries = list;
+    return n_entries;
+
+fail:
+    fclose(fp);
+    free_entries(list, n_entries);
+    return -1;
+}
+
+/*
+=================================================================================
+ 2. 排序：按镜像中的父目录分组，目录内按源文件ID
+=================================================================================
+*/
+
+static int cmp_dst(const void* a, const void* b) {
+    const man_entry* x = (const man_entry*)a;
+    const man_entry* y = (const man_entry*)b;
+    int c = compare_image_paths(x->dst, y->dst);
+    return c ? c : x->line - y->line;
+}
+
+static int cmp_copy_order(const void* a, const void* b) {
+    const man_entry* x = (const man_entry*)a;
+    const man_entry* y = (const man_entry*)b;
+
+    // first 条目按清单顺序排在最前面
+    if (x->first != y->first) {
+        return y->first - x->first;
+    }
+    if (x->first) {
+        return x->line - y->line;
+    }
+    size_t n = (x->dir_len < y->dir_len) ? x->dir_len : y->dir_len;
+    int c = memcmp(x->dst, y->dst, n);
+    if (c == 0 && x->dir_len != y->dir_len) {
+        c = (x->dir_len < y->dir_len) ? -1 : 1;
+    }
+    if (c != 0) {
+        return c;
+    }
+    if (x->volume != y->volume) {
+        return (x->volume < y->volume) ? -1 : 1;
+    }
+    if (x->file_id != y->file_id) {
+        return (x->file_id < y->file_id) ? -1 : 1;
+    }
+    return x->line - y->line;
+}
+
+/**
+ * @brief Rejects manifests that write two files to the same image path. FAT names are case-insensitive,
+ *        so 'A.TXT' and 'a.txt' are the same file.
+ * @return 0 if all file destinations are distinct, -1 otherwise.
+ */
+static int check_duplicates(man_entry* list, int n, const char* manifest_path) {
+    qsort(list, n, sizeof(man_entry), cmp_dst);
+    for (int i = 1; i < n; i++) {
+        if (!list[i].is_dir && !list[i - 1].is_dir && compare_image_paths(list[i].dst, list[i - 1].dst) == 0) {
+            fprintf(stderr, "Error: %s:%d: '/%s' is already written by line %d.\n", manifest_path, list[i].line,
+                    list[i].dst, list[i - 1].line);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 3. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Copies the files and directories listed in a manifest into the image, grouped by destination
+ *        directory and, within a directory, in source file ID order. Missing image directories are created.
+ * @param manifest_path Manifest file, one "<pc_path> <image_path> [ro|hidden|system|contig|first...]" per line.
+ * @param fatfs_dir_path Image root in FatFs (e.g., "0:").
+ * @param flags COPY_KEEP_TIMES, COPY_SORTED as for copy_directory_to_fatfs.
+ * @return 0 on success, -1 on failure.
+ */
+int copy_manifest_to_fatfs(const char* manifest_path, const char* fatfs_dir_path, int flags) {
+    man_entry* list = NULL;
+    parent_dir parent = { 0 };
+    char dst_full[FAT_PATH_MAX + 8];
+    uint64_t n_dirs = 0;
+    int n_files = 0, ret = 0;
+
+    int n = load_manifest(manifest_path, &list);
+    if (n < 0) {
+        return -1;
+    }
+    if (check_duplicates(list, n, manifest_path) != 0) {
+        free_entries(list, n);
+        return -1;
+    }
+    qsort(list, n, sizeof(man_entry), cmp_copy_order);
+
+    for (int i = 0; i < n && ret == 0; i++) {
+        man_entry* e = &list[i];
+        int copy_flags = flags | (e->contig ? COPY_CONTIGUOUS : 0);
+        const char* name;
+
+        snprintf(dst_full, sizeof(dst_full), "%s/%s", fatfs_dir_path, e->dst);
+        if (flags & COPY_KEEP_TIMES) {
+            fatimage_set_time(fat_time_of(&e->mtime, flags & COPY_SORTED));
+        }
+
+        if (e->is_dir) {
+            // 目录：先创建镜像中的目标目录，再拷贝其全部内容
+            if (e->dst[0] != '\0') {
+                if (open_parent_dir(&parent, fatfs_dir_path, e->dst, &name, &n_dirs) != 0) {
+                    ret = -1;
+                    break;
+                }
+                FRESULT res = f_mkdirat(&parent.dir, name);
+                if (res != FR_OK && res != FR_EXIST) {
+                    fprintf(stderr, "Error: Failed to create FatFs directory '%s'. FRESULT: %d\n", dst_full, res);
+                    ret = -1;
+                    break;
+                }
+                n_dirs += (res == FR_OK);
+            }
+            ret = copy_directory_to_fatfs(e->src, dst_full, NULL, NULL, copy_flags);
+        } else {
+            ret = open_parent_dir(&parent, fatfs_dir_path, e->dst, &name, &n_dirs);
+            if (ret == 0) {
+                ret = copy_file_to_fatfs(e->src, &parent.dir, name, dst_full, NULL, NULL, copy_flags);
+                n_files++;
+            }
+        }
+
+        if (ret == 0 && e->attr && e->dst[0] != '\0') {
+            FRESULT res = f_chmod(dst_full, e->attr, AM_RDO | AM_HID | AM_SYS);
+            if (res != FR_OK) {
+                fprintf(stderr, "Error: Failed to set attributes of '%s'. FRESULT: %d\n", dst_full, res);
+                ret = -1;
+            }
+        }
+        if (ret != 0) {
+            fprintf(stderr, "Error: %s:%d: failed to copy '%s'.\n", manifest_path, e->line, e->src);
+        }
+    }
+
+    close_parent_dir(&parent);
+    fatimage_set_time(0);
+    if (ret == 0) {
+        printf("Manifest '%s': %d entries, %d files, %llu directories created.\n", manifest_path, n, n_files,
+               (unsigned long long)n_dirs);
+    }
+    free_entries(list, n);
+    return ret;
+}
@@ -0,0 +1,6 @@
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+/* 按清单文件把指定的PC文件/目录拷贝到镜像中的指定路径，可以来自多个源目录 */
+int copy_manifest_to_fatfs(const char* manifest_path, const char* fatfs_dir_path, int flags);
+#endif
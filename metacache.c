@@ -0,0 +1,283 @@
+#include "backends.h"
+#include <windows.h>    // 用于临界区
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MC_SECTOR       512u
+// 最多缓存的扇区数（2MiB）
+#define MC_ENTRIES      4096u
+// 哈希表槽位数（2的幂），装载率不超过一半
+#define MC_SLOT_BITS    13
+#define MC_SLOTS        (1u << MC_SLOT_BITS)
+// 写出时合并的最大连续扇区数
+#define MC_RUN          128u
+
+/*
+ 元数据写回缓存：批量模式下包在镜像后端外面。
+ FatFs 的目录项、FAT、位图和小文件尾部都是单扇区写入，同一扇区在拷贝过程中会被反复改写
+ （每关闭一个文件就更新一次所在的目录扇区）。这些写入先留在内存中，同一扇区只保留最新内容，
+ 到 CTRL_SYNC（卸载前由 f_defersync 发出）或缓存写满时才按扇区号排序、把连续扇区合并后写出。
+ 多扇区的写入（大文件数据）直接交给内层后端，与其重叠的缓存扇区同步更新。
+*/
+
+typedef struct {
+    fatimage_backend ops;
+    fatimage_backend* inner;    // 实际的镜像后端
+    CRITICAL_SECTION lock;      // 同一镜像的多个分区可能在不同线程中同时读写
+    uint64_t* keys;             // 每个槽位缓存的扇区号+1，0表示空
+    BYTE* data;                 // 每个槽位一个扇区的数据
+    DWORD used;                 // 已缓存的扇区数
+    uint64_t lo, hi;            // 已缓存扇区号的范围，用于快速排除不重叠的大块读写
+    uint64_t* order;            // 写出时排序用：(扇区号 << MC_SLOT_BITS) | 槽位
+    BYTE* run;                  // 写出时合并连续扇区的缓冲区
+} meta_cache;
+
+/*
+=================================================================================
+ 1. 哈希表
+=================================================================================
+*/
+
+static DWORD slot_of(uint64_t sector) {
+    return (DWORD)((sector * 0x9E3779B97F4A7C15ull) >> (64 - MC_SLOT_BITS));
+}
+
+/**
+ * @brief Returns the slot holding sector, or -1 if it is not cached.
+ */
+static int find_sector(const meta_cache* mc, uint64_t sector) {
+    for (DWORD i = slot_of(sector); mc->keys[i] != 0; i = (i + 1) & (MC_SLOTS - 1)) {
+        if (mc->keys[i] == sector + 1) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Adds sector to the table (it must not be cached and the table must not be full).
+ */
+static int add_sector(meta_cache* mc, uint64_t sector) {
+    DWORD i = slot_of(sector);
+    while (mc->keys[i] != 0) {
+        i = (i + 1) & (MC_SLOTS - 1);
+    }
+    mc->keys[i] = sector + 1;
+    if (mc->used++ == 0 || sector < mc->lo) mc->lo = sector;
+    if (mc->used == 1 || sector > mc->hi) mc->hi = sector;
+    return (int)i;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Writes every cached sector to the inner backend in sector order, merging consecutive
+ *        sectors into one write, then empties the cache.
+ * @return 0 on success, -1 on failure (the cache is kept).
+ */
+static int flush_cache(meta_cache* mc) {
+    DWORD n = 0;
+
+    if (mc->used == 0) {
+        return 0;
+    }
+    for (DWORD i = 0; i < MC_SLOTS; i++) {
+        if (mc->keys[i] != 0) {
+            mc->order[n++] = ((mc->keys[i] - 1) << MC_SLOT_BITS) | i;
+        }
+    }
+    qsort(mc->order, n, sizeof(uint64_t), cmp_u64);
+
+    for (DWORD k = 0; k < n; ) {
+        uint64_t first = mc->order[k] >> MC_SLOT_BITS;
+        DWORD len = 0;
+        // 收集从 first 开始的连续扇区
+        while (k < n && len < MC_RUN && (mc->order[k] >> MC_SLOT_BITS) == first + len) {
+            DWORD slot = (DWORD)(mc->order[k] & (MC_SLOTS - 1));
+            memcpy(mc->run + (size_t)len * MC_SECTOR, mc->data + (size_t)slot * MC_SECTOR, MC_SECTOR);
+            len++;
+            k++;
+        }
+        if (mc->inner->write(mc->inner, mc->run, first * MC_SECTOR, (size_t)len * MC_SECTOR) != 0) {
+            return -1;
+        }
+    }
+    memset(mc->keys, 0, MC_SLOTS * sizeof(uint64_t));
+    mc->used = 0;
+    return 0;
+}
+
+/**
+ * @brief Copies the part of [offset, offset + bytes) that overlaps cached sectors between buff and
+ *        the cache: into the cache when to_cache is set (a write), otherwise into buff (a read).
+ */
+static void overlay(meta_cache* mc, BYTE* buff, uint64_t offset, size_t bytes, int to_cache) {
+    uint64_t first = offset / MC_SECTOR, last = (offset + bytes - 1) / MC_SECTOR;
+
+    if (mc->used == 0 || bytes == 0 || last < mc->lo || first > mc->hi) {
+        return;
+    }
+    if (first < mc->lo) first = mc->lo;
+    if (last > mc->hi) last = mc->hi;
+
+    // 范围内的扇区比缓存的扇区多时遍历缓存，否则逐个扇区查找
+    int scan = (last - first + 1 > mc->used);
+    for (uint64_t pos = scan ? 0 : first; scan ? pos < MC_SLOTS : pos <= last; pos++) {
+        uint64_t sector;
+        int slot;
+        if (scan) {
+            if (mc->keys[pos] == 0 || mc->keys[pos] - 1 < first || mc->keys[pos] - 1 > last) {
+                continue;
+            }
+            sector = mc->keys[pos] - 1;
+            slot = (int)pos;
+        } else {
+            sector = pos;
+            if ((slot = find_sector(mc, sector)) < 0) {
+                continue;
+            }
+        }
+        uint64_t a = sector * MC_SECTOR, b = a + MC_SECTOR;
+        if (a < offset) a = offset;
+        if (b > offset + bytes) b = offset + bytes;
+        BYTE* cached = mc->data + (size_t)slot * MC_SECTOR + (a - sector * MC_SECTOR);
+        if (to_cache) {
+            memcpy(cached, buff + (a - offset), (size_t)(b - a));
+        } else {
+            memcpy(buff + (a - offset), cached, (size_t)(b - a));
+        }
+    }
+}
+
+/*
+=================================================================================
+ 2. 后端操作
+=================================================================================
+*/
+
+static int cache_write(fatimage_backend* be, const void* buff, uint64_t offset, size_t bytes) {
+    meta_cache* mc = (meta_cache*)be;
+    int ret = 0;
+
+    EnterCriticalSection(&mc->lock);
+    if (bytes == MC_SECTOR && offset % MC_SECTOR == 0) {
+        // 单扇区写入留在缓存中，缓存满时先全部写出
+        uint64_t sector = offset / MC_SECTOR;
+        int slot = find_sector(mc, sector);
+        if (slot < 0) {
+            if (mc->used == MC_ENTRIES && flush_cache(mc) != 0) {
+                ret = -1;
+            } else {
+                slot = add_sector(mc, sector);
+            }
+        }
+        if (slot >= 0) {
+            memcpy(mc->data + (size_t)slot * MC_SECTOR, buff, MC_SECTOR);
+        }
+    } else {
+        ret = mc->inner->write(mc->inner, buff, offset, bytes);
+        overlay(mc, (BYTE*)buff, offset, bytes, 1);
+    }
+    LeaveCriticalSection(&mc->lock);
+    return ret;
+}
+
+static int cache_read(fatimage_backend* be, void* buff, uint64_t offset, size_t bytes) {
+    meta_cache* mc = (meta_cache*)be;
+    int ret = 0;
+
+    EnterCriticalSection(&mc->lock);
+    int slot = (bytes == MC_SECTOR && offset % MC_SECTOR == 0) ? find_sector(mc, offset / MC_SECTOR) : -1;
+    if (slot >= 0) {
+        memcpy(buff, mc->data + (size_t)slot * MC_SECTOR, MC_SECTOR);
+    } else if ((ret = mc->inner->read(mc->inner, buff, offset, bytes)) == 0) {
+        overlay(mc, (BYTE*)buff, offset, bytes, 0);
+    }
+    LeaveCriticalSection(&mc->lock);
+    return ret;
+}
+
+static int cache_sync(fatimage_backend* be) {
+    meta_cache* mc = (meta_cache*)be;
+    int ret;
+
+    EnterCriticalSection(&mc->lock);
+    ret = flush_cache(mc);
+    LeaveCriticalSection(&mc->lock);
+    return (mc->inner->sync(mc->inner) == 0) ? ret : -1;
+}
+
+static int cache_close(fatimage_backend* be) {
+    meta_cache* mc = (meta_cache*)be;
+    int ret = 0;
+
+    if (flush_cache(mc) != 0) {
+        fprintf(stderr, "Error: Failed to write cached metadata to disk image.\n");
+        ret = -1;
+    }
+    if (mc->inner->close(mc->inner) != 0) {
+        ret = -1;
+    }
+    DeleteCriticalSection(&mc->lock);
+    free(mc->keys);
+    free(mc);
+    return ret;
+}
+
+/**
+ * @brief Copies a PC file into the image through the inner backend. Cached sectors inside the
+ *        target range would be stale afterwards, so they are written out first.
+ */
+static int cache_copy_file(fatimage_backend* be, const char* pc_path, uint64_t offset, uint64_t bytes) {
+    meta_cache* mc = (meta_cache*)be;
+    int ret = 0;
+
+    EnterCriticalSection(&mc->lock);
+    if (mc->used && bytes > 0 && offset / MC_SECTOR <= mc->hi && (offset + bytes - 1) / MC_SECTOR >= mc->lo) {
+        ret = flush_cache(mc);
+    }
+    LeaveCriticalSection(&mc->lock);
+    // 拷贝不持有缓存的锁，其它分区的元数据写入不必等待
+    return (ret == 0) ? mc->inner->copy_file(mc->inner, pc_path, offset, bytes) : -1;
+}
+
+/*
+=================================================================================
+ 3. 创建缓存后端
+=================================================================================
+*/
+
+/**
+ * @brief Wraps a backend with the metadata write-back cache. The cache owns inner from now on
+ *        and closes it on close.
+ * @return New backend, or NULL if out of memory (inner is left open).
+ */
+fatimage_backend* cache_backend_create(fatimage_backend* inner) {
+    meta_cache* mc = (meta_cache*)calloc(1, sizeof(meta_cache));
+    if (!mc) {
+        return NULL;
+    }
+    // 哈希键、排序数组、扇区数据和合并缓冲区在一次分配中
+    mc->keys = (uint64_t*)calloc(1, MC_SLOTS * sizeof(uint64_t) + MC_ENTRIES * sizeof(uint64_t) +
+                                    ((size_t)MC_SLOTS + MC_RUN) * MC_SECTOR);
+    if (!mc->keys) {
+        free(mc);
+        return NULL;
+    }
+    mc->order = mc->keys + MC_SLOTS;
+    mc->data = (BYTE*)(mc->order + MC_ENTRIES);
+    mc->run = mc->data + (size_t)MC_SLOTS * MC_SECTOR;
+    mc->inner = inner;
+    InitializeCriticalSection(&mc->lock);
+
+    mc->ops.read = cache_read;
+    mc->ops.write = cache_write;
+    mc->ops.sync = cache_sync;
+    mc->ops.close = cache_close;
+    mc->ops.copy_file = inner->copy_file ? cache_copy_file : NULL;
+    return &mc->ops;
+}
@@ -0,0 +1,290 @@
+#include "partition.h"
+#include "fatimage.h"
+#include "tools.h"
+#include <windows.h>    // 用于线程和计时
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* 每个分区线程的工作数据 */
+typedef struct {
+    const part_spec* spec;
+    fatimage* vol;          // 分区上下文
+    int index;              // 分区序号(1-4)
+    BYTE fs_type;           // 格式化后的FAT类型
+    int status;             // 0:成功 -1:失败
+    double t_format, t_copy;
+} part_job;
+
+/*
+=================================================================================
+ 1. 解析分区参数：<size>:<format>[@<cluster>]:<source>
+=================================================================================
+*/
+
+/**
+ * @brief Parses a partition argument such as "16M:FAT:boot", "60%:EXFAT@65536:assets" or "rest:FAT32:data".
+ *        size is a byte count with optional K/M/G suffix, a percentage of the image, or "rest".
+ *        The source folder is everything after the second ':' so Windows drive letters work.
+ * @return 0 on success, -1 on a malformed argument (an error is printed).
+ */
+int parse_part_spec(const char* arg, part_spec* spec) {
+    char buf[64];
+    const char* c1 = strchr(arg, ':');
+    const char* c2 = c1 ? strchr(c1 + 1, ':') : NULL;
+    char* endptr;
+
+    if (!c1 || !c2 || c2[1] == '\0' || (size_t)(c2 - arg) >= sizeof(buf)) {
+        fprintf(stderr, "Error: Invalid partition '%s'. Use '<size>:<format>[@<cluster>]:<source_folder>'.\n", arg);
+        return -1;
+    }
+    memset(spec, 0, sizeof(*spec));
+    spec->source = c2 + 1;
+
+    // 大小
+    memcpy(buf, arg, c1 - arg);
+    buf[c1 - arg] = '\0';
+    if (stricmp(buf, "rest") == 0) {
+        spec->size = 100;
+    } else {
+        unsigned long long v = strtoull(buf, &endptr, 10);
+        if (endptr == buf || v == 0) {
+            fprintf(stderr, "Error: Invalid partition size '%s'.\n", buf);
+            return -1;
+        }
+        if (strcmp(endptr, "%") == 0) {
+            if (v > 100) {
+                fprintf(stderr, "Error: Invalid partition size '%s'.\n", buf);
+                return -1;
+            }
+            spec->size = (LBA_t)v;
+        } else {
+            if (*endptr == 'K' || *endptr == 'k') { v <<= 10; endptr++; }
+            else if (*endptr == 'M' || *endptr == 'm') { v <<= 20; endptr++; }
+            else if (*endptr == 'G' || *endptr == 'g') { v <<= 30; endptr++; }
+            // 小于等于100个扇区的值会被 f_fdisk 当作百分比
+            if (*endptr != '\0' || v / FF_MIN_SS <= 100 || v / FF_MIN_SS != (LBA_t)(v / FF_MIN_SS)) {
+                fprintf(stderr, "Error: Invalid partition size '%s'.\n", buf);
+                return -1;
+            }
+            spec->size = (LBA_t)(v / FF_MIN_SS);
+        }
+    }
+
+    // 格式和可选的簇大小
+    memcpy(buf, c1 + 1, c2 - c1 - 1);
+    buf[c2 - c1 - 1] = '\0';
+    char* at = strchr(buf, '@');
+    if (at) {
+        *at = '\0';
+        unsigned long cluster = strtoul(at + 1, &endptr, 10);
+        if (*endptr != '\0' || cluster < 512 || (cluster & (cluster - 1)) != 0) {
+            fprintf(stderr, "Error: Invalid cluster size '%s'. Use a power of two >= 512.\n", at + 1);
+            return -1;
+        }
+        spec->au_size = (DWORD)cluster;
+    }
+    if (stricmp(buf, "FAT") == 0) {
+        spec->fmt = FM_FAT;
+    } else if (stricmp(buf, "FAT32") == 0) {
+        spec->fmt = FM_FAT32;
+    } else if (stricmp(buf, "EXFAT") == 0) {
+        spec->fmt = FM_EXFAT;
+    } else {
+        fprintf(stderr, "Error: Invalid format type '%s'. Use 'FAT', 'FAT32', or 'EXFAT'.\n", buf);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 分区线程：格式化并拷贝一个分区
+=================================================================================
+*/
+
+static double now_ms(void) {
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+static DWORD WINAPI part_worker(LPVOID arg) {
+    part_job* job = (part_job*)arg;
+    double t0 = now_ms();
+
+    job->status = -1;
+    if (fatimage_format(job->vol) != 0 || fatimage_mount(job->vol) != 0) {
+        return 0;
+    }
+    job->fs_type = job->vol->fs.fs_type;
+    double t1 = now_ms();
+    job->t_format = t1 - t0;
+
+    job->status = fatimage_copy_dir(job->vol, job->spec->source, NULL);
+    job->t_copy = now_ms() - t1;
+    return 0;
+}
+
+/*
+=================================================================================
+ 3. 修正分区表中的系统ID
+=================================================================================
+*/
+
+/**
+ * @brief Rewrites the MBR system IDs from the formatted filesystem types.
+ *        f_mkfs updates the ID of its own partition with a read-modify-write of the MBR; when the
+ *        partitions are formatted concurrently those updates can overwrite each other, so the final
+ *        IDs are written once here after all threads finished (same rules as f_mkfs).
+ */
+static int fix_partition_types(fatimage* disk, const part_job* jobs, int n_parts) {
+    BYTE mbr[FF_MIN_SS];
+
+    if (disk->be->read(disk->be, mbr, 0, sizeof(mbr)) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < n_parts; i++) {
+        BYTE* pte = mbr + 446 + 16 * i;
+        DWORD sz_vol = (DWORD)pte[12] | (DWORD)pte[13] << 8 | (DWORD)pte[14] << 16 | (DWORD)pte[15] << 24;
+        BYTE sys;
+        if (jobs[i].fs_type == FS_EXFAT) {
+            sys = 0x07;
+        } else if (jobs[i].fs_type == FS_FAT32) {
+            sys = 0x0C;
+        } else if (sz_vol >= 0x10000) {
+            sys = 0x06;
+        } else if (jobs[i].fs_type == FS_FAT16) {
+            sys = 0x04;
+        } else {
+            sys = 0x01;
+        }
+        pte[4] = sys;
+    }
+    return disk->be->write(disk->be, mbr, 0, sizeof(mbr));
+}
+
+/*
+=================================================================================
+ 4. 对外接口：生成多分区镜像
+=================================================================================
+*/
+
+/**
+ * @brief Creates an image with an MBR partition table, then formats and fills every partition
+ *        in its own thread. All threads write disjoint LBA ranges of the same file.
+ * @param disk_cfg Output image path and size, plus the options shared by all partitions (io_mode, bulk, keep_times,
+ *        deterministic, dedup, bmap, out_format); fmt, au_size, skel_dir and image_cache are ignored.
+ * @param parts Partition specs, in on-disk order.
+ * @param n_parts Number of partitions (1-4).
+ * @return 0 on success, -1 on failure.
+ */
+int build_partitioned_image(const fatimage_config* disk_cfg, const part_spec* parts, int n_parts) {
+    static const char* fs_names[] = { "?", "FAT12", "FAT16", "FAT32", "EXFAT" };
+    LBA_t ptbl[MAX_PARTITIONS + 1];
+    part_job jobs[MAX_PARTITIONS];
+    HANDLE threads[MAX_PARTITIONS];
+    int ret = 0;
+
+    if (n_parts < 1 || n_parts > MAX_PARTITIONS) {
+        fprintf(stderr, "Error: An MBR image holds 1 to %d partitions.\n", MAX_PARTITIONS);
+        return -1;
+    }
+
+    fatimage_config cfg = *disk_cfg;
+    cfg.fmt = 0;
+    cfg.au_size = 0;
+    cfg.skel_dir = NULL;
+    cfg.image_cache = NULL;
+    fatimage* disk = fatimage_open(&cfg);
+    if (!disk) {
+        return -1;
+    }
+    printf("Successfully created a %.2f MB disk image.\n", (double)cfg.size / (1024.0 * 1024.0));
+
+    // --- 写入分区表 ---
+    for (int i = 0; i < n_parts; i++) {
+        ptbl[i] = parts[i].size;
+    }
+    ptbl[n_parts] = 0;
+    if (fatimage_fdisk(disk, ptbl) != 0) {
+        fatimage_abort(disk);
+        return -1;
+    }
+
+    // --- 每个分区一个线程：格式化并拷贝 ---
+    memset(jobs, 0, sizeof(jobs));
+    copy_verbose = 0; // 并行时不逐个打印文件
+    for (int i = 0; i < n_parts; i++) {
+        jobs[i].spec = &parts[i];
+        jobs[i].index = i + 1;
+        jobs[i].status = -1;
+        jobs[i].vol = fatimage_open_partition(disk, i + 1, parts[i].fmt, parts[i].au_size);
+        threads[i] = NULL;
+        if (jobs[i].vol) {
+            threads[i] = CreateThread(NULL, 0, part_worker, &jobs[i], 0, NULL);
+            if (!threads[i]) {
+                part_worker(&jobs[i]); // 无法创建线程时直接在当前线程中执行
+            }
+        }
+    }
+    for (int i = 0; i < n_parts; i++) {
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+
+    // --- 汇总并关闭分区 ---
+    // 任一分区失败时整个镜像不完整，其他分区也不写出区段表
+    int failed = 0;
+    for (int i = 0; i < n_parts; i++) {
+        failed |= (jobs[i].status != 0);
+    }
+    // 必须连续存放的文件可以在任一分区中
+    if (!failed && fatimage_check_contiguous(disk) != 0) {
+        failed = 1;
+        ret = -1;
+    }
+    for (int i = 0; i < n_parts; i++) {
+        part_job* job = &jobs[i];
+        if (job->vol) {
+            DWORD start = 0, count = 0;
+            if (job->status == 0) {
+                start = (DWORD)job->vol->fs.volbase;
+                count = (DWORD)(job->vol->fs.n_fatent - 2) * job->vol->fs.csize;
+            }
+            // 关闭时才写出批量模式的元数据和区段表，失败也算作分区失败
+            if (failed) {
+                fatimage_abort(job->vol);
+            } else if (fatimage_close(job->vol) != 0) {
+                job->status = -1;
+            }
+            printf("Partition %d: %-6s LBA %-10lu %8.2f MiB data  '%s'  %s (format %.0f ms, copy %.0f ms)\n",
+                   job->index, fs_names[job->fs_type <= FS_EXFAT ? job->fs_type : 0], (unsigned long)start,
+                   (double)count * FF_MIN_SS / (1024.0 * 1024.0), job->spec->source,
+                   job->status == 0 ? "OK" : "FAILED", job->t_format, job->t_copy);
+        } else {
+            fprintf(stderr, "Error: Cannot open partition %d.\n", job->index);
+        }
+        if (job->status != 0) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && fix_partition_types(disk, jobs, n_parts) != 0) {
+        fprintf(stderr, "Error: Failed to update the partition table.\n");
+        ret = -1;
+    }
+    // 镜像不完整时不写出块映射和转换输出
+    if (ret != 0) {
+        fatimage_abort(disk);
+    } else if (fatimage_close(disk) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
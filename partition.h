@@ -0,0 +1,20 @@
+#ifndef __PARTITION_H__
+#define __PARTITION_H__
+#include <stdint.h>
+#include "ff.h"
+#include "fatimage.h"
+
+// MBR 最多4个主分区
+#define MAX_PARTITIONS 4
+
+/* 一个分区的规格 */
+typedef struct {
+    LBA_t size;             // 扇区数；1-100 表示占整个镜像的百分比，100 表示剩余全部空间
+    BYTE fmt;               // FM_FAT / FM_FAT32 / FM_EXFAT
+    DWORD au_size;          // 簇大小（字节），0表示默认
+    const char* source;     // 拷贝到该分区的源文件夹
+} part_spec;
+
+int parse_part_spec(const char* arg, part_spec* spec);
+int build_partitioned_image(const fatimage_config* disk_cfg, const part_spec* parts, int n_parts);
+#endif
@@ -0,0 +1,599 @@
+#include "planner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* 与 ff.c 保持一致的常量 */
+#define PLAN_SS         512         // 扇区大小（FF_MAX_SS）
+#define PLAN_N_SEC_TRACK 63         // 非SFD格式时 f_mkfs 在卷前预留的MBR区域
+#define PLAN_N_ROOT     512         // FAT12/16 默认根目录项数
+#define PLAN_SZDIRE     32          // 目录项大小
+#define PLAN_MAX_FAT12  0xFF5
+#define PLAN_MAX_FAT16  0xFFF5
+#define PLAN_MAX_FAT32  0x0FFFFFF5
+#define PLAN_MAX_EXFAT  0x7FFFFFFD
+#define PLAN_MAX_DIR    0x200000    // FAT 目录最大字节数
+#define PLAN_MAX_DIR_EX 0x10000000  // exFAT 目录最大字节数
+
+/*
+=================================================================================
+ 1. 卷布局：复刻 f_mkfs 的参数推算（不访问磁盘）
+=================================================================================
+*/
+
+/**
+ * @brief Returns the size in bytes of the compressed exFAT up-case table f_mkfs writes.
+ *        The value only depends on ff_wtoupper(), so it is computed once and cached.
+ */
+static DWORD exfat_upcase_size(void) {
+    static DWORD cached = 0;
+    DWORD szb_case = 0;
+    WCHAR ch, si = 0;
+    UINT j = 0, st = 0;
+
+    if (cached) {
+        return cached;
+    }
+    do {    // 与 f_mkfs 中的压缩算法相同，只统计长度
+        switch (st) {
+        case 0:
+            ch = (WCHAR)ff_wtoupper(si);
+            if (ch != si) {
+                si++; break;
+            }
+            for (j = 1; (WCHAR)(si + j) && (WCHAR)(si + j) == ff_wtoupper((WCHAR)(si + j)); j++) ;
+            if (j >= 128) {
+                st = 2; break;
+            }
+            st = 1;
+            /* FALLTHROUGH */
+        case 1:
+            si++;
+            if (--j == 0) st = 0;
+            break;
+        default:
+            si += (WCHAR)j;
+            st = 0;
+        }
+        szb_case += 2;
+    } while (si);
+    cached = szb_case;
+    return cached;
+}
+
+/**
+ * @brief Predicts the volume layout f_mkfs would create, using the same rules as ff.c.
+ * @param fmt Format option passed to f_mkfs (FM_FAT, FM_FAT32, FM_EXFAT, optionally FM_SFD).
+ * @param image_size Size of the image file in bytes.
+ * @param au_size Cluster size in bytes (0: let f_mkfs choose).
+ * @param lay Receives the layout.
+ * @return 0 when f_mkfs would succeed, -1 when it would abort.
+ */
+int plan_layout(BYTE fmt, uint64_t image_size, DWORD au_size, fs_layout* lay) {
+    static const WORD cst[] = {1, 4, 16, 64, 256, 512, 0};   // 与 f_mkfs 相同的自动簇大小表
+    static const WORD cst32[] = {1, 2, 4, 8, 16, 32, 0};
+    BYTE fsopt = fmt & (FM_ANY | FM_SFD);
+    BYTE fsty;
+    DWORD sz_vol, b_vol = 0, sz_au, pau, n_clst, sz_fat, sz_rsv, sz_dir, n, i;
+
+    memset(lay, 0, sizeof(*lay));
+    if (image_size / PLAN_SS > 0xFFFFFFFF) {
+        return -1;  // 未启用 FF_LBA64，超出32位LBA
+    }
+    sz_vol = (DWORD)(image_size / PLAN_SS);
+    if (!(fsopt & FM_SFD) && sz_vol > PLAN_N_SEC_TRACK) {
+        b_vol = PLAN_N_SEC_TRACK; sz_vol -= b_vol;
+    }
+    if (sz_vol < 128) {
+        return -1;
+    }
+    sz_au = (au_size <= 0x1000000 && (au_size & (au_size - 1)) == 0) ? au_size / PLAN_SS : 0;
+
+    // 预先确定FAT类型
+    if ((fsopt & FM_EXFAT) && ((fsopt & FM_ANY) == FM_EXFAT || sz_vol >= 0x4000000 || sz_au > 128)) {
+        fsty = FS_EXFAT;
+    } else {
+        if (sz_au > 128) sz_au = 128;
+        if ((fsopt & FM_FAT32) && !(fsopt & FM_FAT)) {
+            fsty = FS_FAT32;
+        } else if (fsopt & FM_FAT) {
+            fsty = FS_FAT16;
+        } else {
+            return -1;
+        }
+    }
+
+    lay->vol_base = b_vol;
+    lay->vol_sect = sz_vol;
+    lay->n_fat = 1;
+
+    if (fsty == FS_EXFAT) {
+        DWORD szb_bit, au_bytes, b_data;
+
+        if (sz_vol < 0x1000) return -1;
+        if (sz_au == 0) {
+            sz_au = 8;
+            if (sz_vol >= 0x80000) sz_au = 64;
+            if (sz_vol >= 0x4000000) sz_au = 256;
+        }
+        sz_fat = (DWORD)(((uint64_t)sz_vol / sz_au + 2) * 4 + PLAN_SS - 1) / PLAN_SS;
+        b_data = 32 + sz_fat;
+        if (b_data >= sz_vol / 2) return -1;
+        n_clst = (sz_vol - b_data) / sz_au;
+        if (n_clst < 16 || n_clst > PLAN_MAX_EXFAT) return -1;
+
+        au_bytes = sz_au * PLAN_SS;
+        szb_bit = (n_clst + 7) / 8;
+        lay->fs_type = FS_EXFAT;
+        lay->au_sect = sz_au;
+        lay->fat_sect = sz_fat;
+        lay->data_base = b_data;
+        lay->n_clst = n_clst;
+        lay->sys_clst = (szb_bit + au_bytes - 1) / au_bytes                     // 位图
+                      + (exfat_upcase_size() + au_bytes - 1) / au_bytes         // 大写表
+                      + 1;                                                      // 根目录
+        return 0;
+    }
+
+    for (;;) {
+        pau = sz_au;
+        if (fsty == FS_FAT32) {
+            if (pau == 0) {
+                n = sz_vol / 0x20000;
+                for (i = 0, pau = 1; cst32[i] && cst32[i] <= n; i++, pau <<= 1) ;
+            }
+            n_clst = sz_vol / pau;
+            sz_fat = (n_clst * 4 + 8 + PLAN_SS - 1) / PLAN_SS;
+            sz_rsv = 32;
+            sz_dir = 0;
+            if (n_clst <= PLAN_MAX_FAT16 || n_clst > PLAN_MAX_FAT32) return -1;
+        } else {
+            if (pau == 0) {
+                n = sz_vol / 0x1000;
+                for (i = 0, pau = 1; cst[i] && cst[i] <= n; i++, pau <<= 1) ;
+            }
+            n_clst = sz_vol / pau;
+            if (n_clst > PLAN_MAX_FAT12) {
+                n = n_clst * 2 + 4;
+            } else {
+                fsty = FS_FAT12;
+                n = (n_clst * 3 + 1) / 2 + 3;
+            }
+            sz_fat = (n + PLAN_SS - 1) / PLAN_SS;
+            sz_rsv = 1;
+            sz_dir = PLAN_N_ROOT * PLAN_SZDIRE / PLAN_SS;
+        }
+        // GET_BLOCK_SIZE 返回1，数据区无需对齐
+        if (sz_vol < sz_rsv + sz_fat + sz_dir + pau * 16) return -1;
+        n_clst = (sz_vol - sz_rsv - sz_fat - sz_dir) / pau;
+        if (fsty == FS_FAT32 && n_clst <= PLAN_MAX_FAT16) {
+            if (sz_au == 0 && (sz_au = pau / 2) != 0) continue;
+            return -1;
+        }
+        if (fsty == FS_FAT16) {
+            if (n_clst > PLAN_MAX_FAT16) {
+                if (sz_au == 0 && (pau * 2) <= 64) {
+                    sz_au = pau * 2; continue;
+                }
+                if (fsopt & FM_FAT32) {
+                    fsty = FS_FAT32; continue;
+                }
+                if (sz_au == 0 && (sz_au = pau * 2) <= 128) continue;
+                return -1;
+            }
+            if (n_clst <= PLAN_MAX_FAT12) {
+                if (sz_au == 0 && (sz_au = pau * 2) <= 128) continue;
+                return -1;
+            }
+        }
+        if (fsty == FS_FAT12 && n_clst > PLAN_MAX_FAT12) return -1;
+        break;
+    }
+
+    lay->fs_type = fsty;
+    lay->au_sect = pau;
+    lay->fat_sect = sz_fat;
+    lay->data_base = sz_rsv + sz_fat + sz_dir;
+    lay->n_clst = n_clst;
+    lay->sys_clst = (fsty == FS_FAT32) ? 1 : 0;
+    lay->n_root = (fsty == FS_FAT32) ? 0 : PLAN_N_ROOT;
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 目录树需求：统计数据簇与目录簇
+=================================================================================
+*/
+
+/**
+ * @brief Counts the UTF-16 code units FatFs stores for a name, after it strips trailing dots and spaces.
+ * @param sfn_ok Set to 1 when the name fits 8.3 without an LFN entry (same rules as create_name()).
+ */
+static DWORD name_units(const char* name, int* sfn_ok) {
+    const unsigned char* p = (const unsigned char*)name;
+    size_t len = strlen(name);
+    DWORD units = 0;
+    size_t i, dot, body_len, ext_len;
+    int ok = 1, up, lo;
+
+    while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '.')) len--;
+
+    for (i = 0; i < len; ) {    // UTF-8 (FF_LFN_UNICODE == 2) 解码，只统计长度
+        unsigned char c = p[i];
+        if (c < 0x80) { units += 1; i += 1; }
+        else if ((c & 0xE0) == 0xC0) { units += 1; i += 2; }
+        else if ((c & 0xF0) == 0xE0) { units += 1; i += 3; }
+        else if ((c & 0xF8) == 0xF0) { units += 2; i += 4; }
+        else { units += 1; i += 1; }
+        if (c >= 0x80) ok = 0;  // 扩展字符总是需要LFN
+    }
+
+    // 8.3 判定：无前导空格/点，至多一个点，主名<=8，扩展名<=3，无非法字符，主名/扩展名大小写不混合
+    if (len == 0 || p[0] == ' ' || p[0] == '.') ok = 0;
+    for (dot = len; dot > 0 && p[dot - 1] != '.'; dot--) ;
+    body_len = dot ? dot - 1 : len;
+    ext_len = dot ? len - dot : 0;
+    if (body_len > 8 || ext_len > 3) ok = 0;
+    for (up = lo = 0, i = 0; ok && i < len; i++) {
+        if (i == body_len) {
+            if (up && lo) ok = 0;
+            up = lo = 0;
+            continue;
+        }
+        if (p[i] == ' ' || p[i] == '.' || strchr("+,;=[]", p[i])) ok = 0;
+        if (p[i] >= 'A' && p[i] <= 'Z') up = 1;
+        if (p[i] >= 'a' && p[i] <= 'z') lo = 1;
+    }
+    if (up && lo) ok = 0;
+
+    *sfn_ok = ok;
+    return units;
+}
+
+/**
+ * @brief Returns the number of 32-byte directory entries a name occupies on the given filesystem type.
+ */
+static DWORD name_entries(const char* name, BYTE fs_type) {
+    int sfn_ok;
+    DWORD units = name_units(name, &sfn_ok);
+
+    if (fs_type == FS_EXFAT) {
+        return 2 + (units + 14) / 15;   // 文件项 + 流扩展项 + 文件名项
+    }
+    return sfn_ok ? 1 : 1 + (units + 12) / 13;  // SFN项 + LFN项
+}
+
+static uint64_t div_ceil(uint64_t a, uint64_t b) {
+    return (a + b - 1) / b;
+}
+
+static void demand_walk(const src_node* dir, int is_root, BYTE fs_type, DWORD cluster_bytes, tree_demand* d) {
+    uint64_t ents = 0, bytes, clst;
+
+    for (size_t i = 0; i < dir->n_children; i++) {
+        const src_node* child = &dir->children[i];
+        ents += name_entries(child->name, fs_type);
+        if (child->is_dir) {
+            demand_walk(child, 0, fs_type, cluster_bytes, d);
+        } else {
+            d->files++;
+            if (!child->dup) {
+                d->bytes += child->size;
+                d->data_clst += div_ceil(child->size, cluster_bytes);   // 0字节文件不分配簇；重复文件共用簇
+            }
+            if (child->size > d->max_file) d->max_file = child->size;
+        }
+    }
+
+    if (is_root) {
+        d->root_ent = ents;
+        if (fs_type == FS_EXFAT) {
+            bytes = (ents + 3) * PLAN_SZDIRE;   // 卷标、位图、大写表三个系统项
+        } else if (fs_type == FS_FAT32) {
+            bytes = ents * PLAN_SZDIRE;
+        } else {
+            return;                             // FAT12/16 根目录在固定区域
+        }
+        clst = div_ceil(bytes, cluster_bytes);
+        if (clst > 1) d->dir_clst += clst - 1;  // 格式化时已分配1个簇
+    } else {
+        if (fs_type != FS_EXFAT) ents += 2;     // "." 和 ".." 项
+        bytes = ents * PLAN_SZDIRE;
+        clst = div_ceil(bytes, cluster_bytes);
+        d->dir_clst += clst ? clst : 1;         // f_mkdir 至少分配1个簇
+    }
+    if (bytes > d->max_dir) d->max_dir = bytes;
+}
+
+/**
+ * @brief Computes how many clusters the source tree needs for a given filesystem type and cluster size.
+ */
+void plan_demand(const src_node* root, BYTE fs_type, DWORD cluster_bytes, tree_demand* d) {
+    memset(d, 0, sizeof(*d));
+    demand_walk(root, 1, fs_type, cluster_bytes, d);
+}
+
+/**
+ * @brief Checks whether a demand fits into a layout.
+ * @return 1 if it fits, 0 otherwise.
+ */
+int plan_fits(const fs_layout* lay, const tree_demand* d) {
+    if (lay->fs_type != FS_EXFAT) {
+        if (d->max_file > 0xFFFFFFFF || d->max_dir > PLAN_MAX_DIR) return 0;
+        if (lay->n_root && d->root_ent > lay->n_root) return 0;
+    } else if (d->max_dir > PLAN_MAX_DIR_EX) {
+        return 0;
+    }
+    return d->data_clst + d->dir_clst <= (uint64_t)(lay->n_clst - lay->sys_clst);
+}
+
+/*
+=================================================================================
+ 3. 最小镜像大小：在每种FAT类型的合法区间内二分查找
+=================================================================================
+*/
+
+/**
+ * @brief Finds the smallest drive size (in sectors) within [lo, hi] where the tree fits.
+ *        Within one FAT type the cluster count never decreases as the volume grows, so the
+ *        predicate "layout valid and demand fits" is monotonic inside the interval.
+ * @return Drive size in sectors, or 0 if even hi is not enough.
+ */
+static uint64_t min_sectors_in(BYTE fmt, DWORD au_size, BYTE fs_type, const tree_demand* d, uint64_t lo, uint64_t hi) {
+    fs_layout lay;
+
+    if (hi > 0xFFFFFFFF) hi = 0xFFFFFFFF;
+    if (lo > hi) return 0;
+    if (plan_layout(fmt, hi * PLAN_SS, au_size, &lay) != 0 || lay.fs_type != fs_type || !plan_fits(&lay, d)) {
+        return 0;
+    }
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (plan_layout(fmt, mid * PLAN_SS, au_size, &lay) == 0 && lay.fs_type == fs_type && plan_fits(&lay, d)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return hi;
+}
+
+/**
+ * @brief Computes the smallest image size that holds the source tree with the given format and cluster size.
+ *        Pure arithmetic on the f_mkfs geometry (no trial formatting), so it completes in microseconds.
+ * @param root Scanned source tree.
+ * @param fmt Format option (FM_FAT, FM_FAT32 or FM_EXFAT, optionally FM_SFD).
+ * @param au_size Cluster size in bytes (must not be 0).
+ * @return Image size in bytes (a multiple of the sector size), or 0 if no size works.
+ */
+uint64_t plan_min_size(const src_node* root, BYTE fmt, DWORD au_size) {
+    uint64_t au = au_size / PLAN_SS, b_vol = (fmt & FM_SFD) ? 0 : PLAN_N_SEC_TRACK;
+    uint64_t best = 0;
+    tree_demand d;
+
+    if (au == 0 || (au_size & (au_size - 1)) != 0) {
+        return 0;
+    }
+    if (fmt & FM_EXFAT) {
+        plan_demand(root, FS_EXFAT, au_size, &d);
+        best = min_sectors_in(fmt, au_size, FS_EXFAT, &d, 128, b_vol + (uint64_t)PLAN_MAX_EXFAT * au);
+    } else if (fmt & FM_FAT32) {
+        plan_demand(root, FS_FAT32, au_size, &d);
+        best = min_sectors_in(fmt, au_size, FS_FAT32, &d, 128, b_vol + (uint64_t)PLAN_MAX_FAT32 * au);
+    } else if (fmt & FM_FAT) {
+        // FAT12 与 FAT16 的合法区间之间存在 f_mkfs 会拒绝的空隙，分别查找
+        plan_demand(root, FS_FAT16, au_size, &d);
+        best = min_sectors_in(fmt, au_size, FS_FAT12, &d, 128, b_vol + (PLAN_MAX_FAT12 + 1) * au - 1);
+        if (best == 0) {
+            best = min_sectors_in(fmt, au_size, FS_FAT16, &d, b_vol + (PLAN_MAX_FAT12 + 1) * au, b_vol + (PLAN_MAX_FAT16 + 1) * au - 1);
+        }
+    }
+    return best * PLAN_SS;
+}
+
+/**
+ * @brief Computes the smallest image size for the tree. When *au_size is 0 the cluster size is picked the
+ *        way f_mkfs would pick it for the resulting volume size, and written back to *au_size.
+ * @return Image size in bytes, or 0 if the tree cannot be stored in this format.
+ */
+uint64_t plan_auto_size(const src_node* root, BYTE fmt, DWORD* au_size) {
+    DWORD max_au = (fmt & FM_EXFAT) ? 0x2000000 : 0x8000;
+    uint64_t best = 0, any_best = 0;
+    DWORD best_au = 0, any_au = 0;
+
+    if (*au_size) {
+        return plan_min_size(root, fmt, *au_size);
+    }
+    for (DWORD au = PLAN_SS; au <= max_au; au <<= 1) {
+        fs_layout lay;
+        uint64_t size = plan_min_size(root, fmt, au);
+        if (size == 0) continue;
+        if (any_best == 0 || size < any_best) {
+            any_best = size; any_au = au;
+        }
+        // 只接受与 f_mkfs 默认选择一致的簇大小，保持与手动指定大小时相同的行为
+        if (plan_layout(fmt, size, 0, &lay) == 0 && lay.au_sect * PLAN_SS == au && (best == 0 || size < best)) {
+            best = size; best_au = au;
+        }
+    }
+    if (best == 0) {
+        best = any_best; best_au = any_au;
+    }
+    *au_size = best_au;
+    return best;
+}
+
+/*
+=================================================================================
+ 4. 簇大小调优：直方图与代价表
+=================================================================================
+*/
+
+static const char* fs_type_name(BYTE fs_type) {
+    switch (fs_type) {
+    case FS_FAT12: return "FAT12";
+    case FS_FAT16: return "FAT16";
+    case FS_FAT32: return "FAT32";
+    case FS_EXFAT: return "exFAT";
+    default:       return "?";
+    }
+}
+
+static const char* format_size(uint64_t v, char* buf, size_t len) {
+    static const char* unit[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double d = (double)v;
+    int u = 0;
+
+    while (d >= 1024.0 && u < 4) {
+        d /= 1024.0; u++;
+    }
+    if (u == 0) snprintf(buf, len, "%llu B", (unsigned long long)v);
+    else snprintf(buf, len, "%.1f %s", d, unit[u]);
+    return buf;
+}
+
+static void histogram_walk(const src_node* dir, uint64_t count[], uint64_t bytes[]) {
+    for (size_t i = 0; i < dir->n_children; i++) {
+        const src_node* child = &dir->children[i];
+        if (child->is_dir) {
+            histogram_walk(child, count, bytes);
+        } else if (!child->dup) {   // 重复文件不占用簇，不影响簇大小的选择
+            int k = 0;  // 桶0:空文件，桶k:(2^(k+8), 2^(k+9)]，桶1包含<=512B
+            if (child->size > 0) {
+                for (k = 1; k < 40 && child->size > (1ULL << (k + 8)); k++) ;
+            }
+            count[k]++;
+            bytes[k] += child->size;
+        }
+    }
+}
+
+/**
+ * @brief Picks the cluster size that minimises occupied space + FAT/bitmap size + perf_weight * clusters.
+ *        Prints the file size histogram and the trade-off table for every valid candidate.
+ * @param root Scanned source tree.
+ * @param fmt Format option (FM_FAT, FM_FAT32 or FM_EXFAT).
+ * @param image_size Image size in bytes, or 0 when the image is sized automatically; the cost is
+ *        then the minimal image size for each cluster size.
+ * @param perf_weight Bytes charged per data cluster the device has to step through when reading.
+ * @return Chosen cluster size in bytes, or 0 if no candidate can hold the tree.
+ */
+DWORD tune_cluster_size(const src_node* root, BYTE fmt, uint64_t image_size, double perf_weight) {
+    uint64_t count[41] = {0}, bytes[41] = {0};
+    char s1[32], s2[32], s3[32], s4[32];
+    DWORD best_au = 0, max_au;
+    double best_cost = 0;
+    int k;
+
+    printf("Source file size histogram:\n");
+    histogram_walk(root, count, bytes);
+    for (k = 0; k <= 40; k++) {
+        if (count[k] == 0) continue;
+        if (k == 0) printf("  %-14s", "empty");
+        else printf("  <= %-11s", format_size(1ULL << (k + 8), s1, sizeof(s1)));
+        printf(" %10llu files  %12s\n", (unsigned long long)count[k], format_size(bytes[k], s2, sizeof(s2)));
+    }
+
+    printf("\nCluster size trade-off (perf weight %.1f bytes/cluster):\n", perf_weight);
+    printf("  %-10s %-6s %12s %12s %12s %12s %14s\n", "Cluster", "Type", "Clusters", "Slack", "FAT+Meta",
+           image_size ? "Free" : "Image", "Cost");
+
+    max_au = (fmt & FM_EXFAT) ? 0x2000000 : 0x8000;   // exFAT 最大32MiB，FAT/FAT32 最大32KiB
+    for (DWORD au = PLAN_SS; au <= max_au; au <<= 1) {
+        fs_layout lay;
+        tree_demand d;
+        uint64_t used, slack, meta, free_clst, img;
+        double cost;
+
+        img = image_size ? image_size : plan_min_size(root, fmt, au);
+        if (img == 0 || plan_layout(fmt, img, au, &lay) != 0 || lay.au_sect * PLAN_SS != au) {
+            printf("  %-10s %-6s %12s\n", format_size(au, s1, sizeof(s1)), "-", "invalid for this volume size");
+            continue;
+        }
+        plan_demand(root, lay.fs_type, au, &d);
+        if (!plan_fits(&lay, &d)) {
+            printf("  %-10s %-6s %12s\n", format_size(au, s1, sizeof(s1)), fs_type_name(lay.fs_type), "does not fit");
+            continue;
+        }
+        used = d.data_clst + d.dir_clst;
+        slack = d.data_clst * au - d.bytes;
+        meta = (uint64_t)lay.fat_sect * lay.n_fat * PLAN_SS + (uint64_t)lay.sys_clst * au;
+        free_clst = lay.n_clst - lay.sys_clst - used;
+        if (image_size) {
+            cost = (double)(used * au) + (double)meta;
+        } else {
+            cost = (double)img;     // 自动大小时，占用空间与元数据都体现在镜像大小上
+        }
+        cost += perf_weight * (double)d.data_clst;
+
+        printf("  %-10s %-6s %12llu %12s %12s %12s %14.0f", format_size(au, s1, sizeof(s1)), fs_type_name(lay.fs_type),
+               (unsigned long long)used, format_size(slack, s2, sizeof(s2)), format_size(meta, s3, sizeof(s3)),
+               format_size(image_size ? free_clst * au : img, s4, sizeof(s4)), cost);
+        if (best_au == 0 || cost < best_cost) {
+            best_au = au;
+            best_cost = cost;
+        }
+        printf("\n");
+    }
+
+    if (best_au) {
+        printf("Chosen cluster size: %s\n\n", format_size(best_au, s1, sizeof(s1)));
+    }
+    return best_au;
+}
+
+
+/*
+=================================================================================
+ 5. 镜像大小参数：字节数，或 auto[+N%]
+=================================================================================
+*/
+
+/**
+ * @brief Parses an image size argument: a byte count, "auto" or "auto+N%".
+ * @param arg Argument text.
+ * @param bytes Receives the byte count (untouched for auto).
+ * @param is_auto Receives 1 for auto, 0 for a byte count.
+ * @param headroom Receives the auto headroom in percent (0 when not given).
+ * @return 0 on success, -1 on a malformed argument (an error is printed).
+ */
+int parse_size_spec(const char* arg, uint64_t* bytes, int* is_auto, double* headroom) {
+    char* endptr;
+
+    if (strnicmp(arg, "auto", 4) == 0) {
+        const char* p = arg + 4;
+        double pct = 0.0;
+        if (*p == '+') {
+            pct = strtod(p + 1, &endptr);
+            if (endptr == p + 1 || pct < 0 || (*endptr != '\0' && strcmp(endptr, "%") != 0)) {
+                fprintf(stderr, "Error: Invalid size '%s'. Use 'auto' or 'auto+<headroom>%%'.\n", arg);
+                return -1;
+            }
+        } else if (*p != '\0') {
+            fprintf(stderr, "Error: Invalid size '%s'. Use 'auto' or 'auto+<headroom>%%'.\n", arg);
+            return -1;
+        }
+        *is_auto = 1;
+        *headroom = pct;
+        return 0;
+    }
+
+    unsigned long long size_bytes = strtoull(arg, &endptr, 10);
+    if (*endptr != '\0' || arg[0] == '\0' || size_bytes == 0) {
+        fprintf(stderr, "Error: Invalid size '%s'. Please provide a positive integer for bytes.\n", arg);
+        return -1;
+    }
+    *bytes = size_bytes;
+    *is_auto = 0;
+    *headroom = 0.0;
+    return 0;
+}
+
+/**
+ * @brief Adds a percentage of headroom to a minimal image size, rounded up to whole sectors.
+ */
+uint64_t plan_add_headroom(uint64_t min_size, double headroom) {
+    uint64_t size = (uint64_t)((double)min_size * (1.0 + headroom / 100.0));
+    return (size + PLAN_SS - 1) / PLAN_SS * PLAN_SS;
+}
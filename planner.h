@@ -0,0 +1,40 @@
+#ifndef __PLANNER_H__
+#define __PLANNER_H__
+#include <stdint.h>
+#include "ff.h"
+#include "scan.h"
+
+/* 按照 f_mkfs 的算法推算出的卷布局（扇区单位均为512字节） */
+typedef struct {
+    BYTE  fs_type;      // FS_FAT12 / FS_FAT16 / FS_FAT32 / FS_EXFAT
+    BYTE  n_fat;        // FAT 份数
+    DWORD au_sect;      // 簇大小 [扇区]
+    DWORD vol_base;     // 卷起始扇区（MBR分区表占用的前导扇区）
+    DWORD vol_sect;     // 卷大小 [扇区]
+    DWORD fat_sect;     // 单份FAT大小 [扇区]
+    DWORD data_base;    // 数据区相对卷起始的偏移 [扇区]
+    DWORD n_clst;       // 数据区簇总数
+    DWORD sys_clst;     // 格式化后已被占用的簇（exFAT位图/大写表/根目录，FAT32根目录）
+    DWORD n_root;       // FAT12/16 固定根目录项数，其它格式为0
+} fs_layout;
+
+/* 源目录树在某个簇大小下的空间需求 */
+typedef struct {
+    uint64_t files;     // 文件个数
+    uint64_t bytes;     // 文件数据总字节数（重复文件只计一次）
+    uint64_t data_clst; // 文件数据占用的簇数
+    uint64_t dir_clst;  // 目录占用的簇数（不含格式化时已分配的根目录簇）
+    uint64_t root_ent;  // 根目录项数（FAT12/16 需放入固定根目录区）
+    uint64_t max_dir;   // 最大目录的字节数
+    uint64_t max_file;  // 最大文件的字节数
+} tree_demand;
+
+int plan_layout(BYTE fmt, uint64_t image_size, DWORD au_size, fs_layout* lay);
+void plan_demand(const src_node* root, BYTE fs_type, DWORD cluster_bytes, tree_demand* d);
+int plan_fits(const fs_layout* lay, const tree_demand* d);
+uint64_t plan_min_size(const src_node* root, BYTE fmt, DWORD au_size);
+uint64_t plan_auto_size(const src_node* root, BYTE fmt, DWORD* au_size);
+DWORD tune_cluster_size(const src_node* root, BYTE fmt, uint64_t image_size, double perf_weight);
+int parse_size_spec(const char* arg, uint64_t* bytes, int* is_auto, double* headroom);
+uint64_t plan_add_headroom(uint64_t min_size, double headroom);
+#endif
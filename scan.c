@@ -0,0 +1,128 @@
+#include "scan.h"
+#include <windows.h>    // 用于Windows文件和目录遍历
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+=================================================================================
+ 1. 辅助函数：向目录节点追加一个子项
+=================================================================================
+*/
+
+/**
+ * @brief Appends a new, zero-initialised child to a directory node.
+ * @param dir Directory node that receives the child.
+ * @param cap In/out capacity of dir->children.
+ * @return Pointer to the new child, or NULL when out of memory.
+ */
+static src_node* append_child(src_node* dir, size_t* cap) {
+    if (dir->n_children == *cap) {
+        size_t new_cap = (*cap == 0) ? 16 : *cap * 2;
+        src_node* p = (src_node*)realloc(dir->children, new_cap * sizeof(src_node));
+        if (!p) {
+            return NULL;
+        }
+        dir->children = p;
+        *cap = new_cap;
+    }
+    src_node* child = &dir->children[dir->n_children++];
+    memset(child, 0, sizeof(*child));
+    return child;
+}
+
+/*
+=================================================================================
+ 2. 核心函数：递归扫描PC文件夹，建立内存中的目录树
+=================================================================================
+*/
+
+static int scan_dir(const char* pc_dir_path, src_node* dir) {
+    WIN32_FIND_DATA find_data;
+    HANDLE h_find = INVALID_HANDLE_VALUE;
+    char search_path[MAX_PATH];
+    char sub_path[MAX_PATH];
+    size_t cap = 0;
+
+    snprintf(search_path, sizeof(search_path), "%s\\*", pc_dir_path);
+
+    h_find = FindFirstFile(search_path, &find_data);
+    if (h_find == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Error: Cannot scan directory '%s'. Error code: %lu\n", pc_dir_path, GetLastError());
+        return -1;
+    }
+
+    do {
+        // 忽略特殊的 "." 和 ".." 目录
+        if (strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0) {
+            continue;
+        }
+
+        src_node* child = append_child(dir, &cap);
+        if (!child || !(child->name = _strdup(find_data.cFileName))) {
+            fprintf(stderr, "Error: Out of memory while scanning '%s'.\n", pc_dir_path);
+            FindClose(h_find);
+            return -1;
+        }
+
+        child->mtime = ((uint64_t)find_data.ftLastWriteTime.dwHighDateTime << 32) | find_data.ftLastWriteTime.dwLowDateTime;
+        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            child->is_dir = 1;
+            snprintf(sub_path, sizeof(sub_path), "%s/%s", pc_dir_path, find_data.cFileName);
+            if (scan_dir(sub_path, child) != 0) {
+                FindClose(h_find);
+                return -1;
+            }
+        } else {
+            child->size = ((uint64_t)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+        }
+    } while (FindNextFile(h_find, &find_data) != 0);
+
+    FindClose(h_find);
+    return 0;
+}
+
+/**
+ * @brief Scans a PC directory recursively into an in-memory tree (names and sizes only, no file data).
+ * @param pc_dir_path Path to the source directory on the PC.
+ * @param root Node to fill; root->name is set to a copy of pc_dir_path.
+ * @return 0 on success, -1 on failure (the partial tree must still be freed).
+ */
+int scan_source_tree(const char* pc_dir_path, src_node* root) {
+    memset(root, 0, sizeof(*root));
+    root->is_dir = 1;
+    root->name = _strdup(pc_dir_path);
+    if (!root->name) {
+        return -1;
+    }
+    return scan_dir(pc_dir_path, root);
+}
+
+static int cmp_node_name(const void* a, const void* b) {
+    return strcmp(((const src_node*)a)->name, ((const src_node*)b)->name);
+}
+
+/**
+ * @brief Sorts the children of every directory by name (byte order, independent of the filesystem
+ *        and locale), so a walk of the tree visits entries in a reproducible order.
+ */
+void sort_source_tree(src_node* root) {
+    qsort(root->children, root->n_children, sizeof(src_node), cmp_node_name);
+    for (size_t i = 0; i < root->n_children; i++) {
+        if (root->children[i].is_dir) {
+            sort_source_tree(&root->children[i]);
+        }
+    }
+}
+
+/**
+ * @brief Frees every node allocated by scan_source_tree (the root node itself is caller-owned).
+ */
+void free_source_tree(src_node* root) {
+    for (size_t i = 0; i < root->n_children; i++) {
+        free_source_tree(&root->children[i]);
+    }
+    free(root->children);
+    free(root->name);
+    memset(root, 0, sizeof(*root));
+}
@@ -0,0 +1,20 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+#include <stdint.h>
+#include <stddef.h>
+
+/* 源目录树中的一个节点（文件或目录） */
+typedef struct src_node {
+    char* name;                 // 文件名（不含路径），根节点为源文件夹路径
+    int is_dir;                 // 1:目录 0:文件
+    uint64_t size;              // 文件大小（字节），目录为0
+    uint64_t mtime;             // 修改时间（FILETIME，UTC）
+    int dup;                    // 1:内容与之前的某个文件相同（去重模式下共用其簇，见 dedup.c）
+    struct src_node* children;  // 子项数组（仅目录有效）
+    size_t n_children;          // 子项个数
+} src_node;
+
+int scan_source_tree(const char* pc_dir_path, src_node* root);
+void sort_source_tree(src_node* root);
+void free_source_tree(src_node* root);
+#endif
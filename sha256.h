@@ -0,0 +1,19 @@
+#ifndef __SHA256_H__
+#define __SHA256_H__
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+/* SHA-256（FIPS 180-4），用于镜像产物缓存的键和重复文件检测 */
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;        // 已输入的字节数
+    uint8_t block[64];      // 未满一个分组的输入
+    size_t used;
+} sha256_ctx;
+
+void sha256_init(sha256_ctx* ctx);
+void sha256_update(sha256_ctx* ctx, const void* data, size_t len);
+void sha256_final(sha256_ctx* ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+#endif
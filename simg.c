@@ -0,0 +1,217 @@
+#include "backends.h"
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Android 稀疏镜像格式（system/core/libsparse/sparse_format.h） */
+#define SIMG_MAGIC          0xED26FF3Au
+#define SIMG_FILE_HDR_SZ    28
+#define SIMG_CHUNK_HDR_SZ   12
+#define CHUNK_TYPE_RAW       0xCAC1
+#define CHUNK_TYPE_FILL      0xCAC2
+#define CHUNK_TYPE_DONT_CARE 0xCAC3
+
+#define SIMG_BLOCK          MAP_BLOCK_SIZE
+// 单次读取的块数
+#define SIMG_BATCH          256u
+// 单个 RAW 块的最大块数（16MiB），fastboot 按块分段下载时不必拆分
+#define SIMG_RAW_MAX        4096u
+
+/*
+ 稀疏镜像：按块映射把镜像分成三种块。从未写入的块为 DONT_CARE（刷写时跳过）；
+ 写入过且整块都是同一个32位值的块（f_mkfs 清零的FAT、位图、目录簇等）为 FILL，只保存这个值；
+ 其余为 RAW，保存原始数据。相邻的同类块合并。
+ 先扫描一遍得到块列表，再写出文件头和各个块，输出文件只顺序写入。
+ 镜像大小不是4KiB的整数倍时，最后一块按0补齐。
+*/
+
+typedef struct {
+    WORD type;          // CHUNK_TYPE_xxx
+    uint32_t fill;      // FILL 的填充值
+    uint64_t start;     // 起始块号
+    uint32_t count;     // 块数
+} simg_chunk;
+
+typedef struct {
+    simg_chunk* chunks;
+    size_t n, cap;
+} chunk_list;
+
+/*
+=================================================================================
+ 1. 辅助函数
+=================================================================================
+*/
+
+static void put16(BYTE* p, WORD v) {
+    p[0] = (BYTE)v;
+    p[1] = (BYTE)(v >> 8);
+}
+
+static void put32(BYTE* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (BYTE)(v >> (8 * i));
+    }
+}
+
+static int block_mapped(const BYTE* map, uint64_t b) {
+    return (map[b / 8] >> (b & 7)) & 1;
+}
+
+/**
+ * @brief Extends the last chunk with block b, or appends a new chunk if b cannot join it.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int add_block(chunk_list* l, WORD type, uint32_t fill, uint64_t b) {
+    simg_chunk* last = l->n ? &l->chunks[l->n - 1] : NULL;
+
+    if (last && last->type == type && last->start + last->count == b &&
+        (type != CHUNK_TYPE_FILL || last->fill == fill) &&
+        (type != CHUNK_TYPE_RAW || last->count < SIMG_RAW_MAX) && last->count < 0xFFFFFFFFu) {
+        last->count++;
+        return 0;
+    }
+    if (l->n == l->cap) {
+        size_t new_cap = l->cap ? l->cap * 2 : 256;
+        simg_chunk* p = (simg_chunk*)realloc(l->chunks, new_cap * sizeof(simg_chunk));
+        if (!p) {
+            return -1;
+        }
+        l->chunks = p;
+        l->cap = new_cap;
+    }
+    simg_chunk* c = &l->chunks[l->n++];
+    c->type = type;
+    c->fill = fill;
+    c->start = b;
+    c->count = 1;
+    return 0;
+}
+
+/**
+ * @brief Reads n blocks starting at block first; the part past the end of the image reads as zeros.
+ */
+static int read_blocks(fatimage_backend* be, uint64_t size, uint64_t first, uint32_t n, BYTE* buffer) {
+    uint64_t offset = first * SIMG_BLOCK;
+    uint64_t bytes = (uint64_t)n * SIMG_BLOCK;
+
+    if (offset + bytes > size) {
+        memset(buffer, 0, (size_t)bytes);
+        bytes = size - offset;
+    }
+    return be->read(be, buffer, offset, (size_t)bytes);
+}
+
+/**
+ * @brief Classifies every block of the image: unmapped blocks are DONT_CARE, mapped blocks that repeat
+ *        one 32-bit word are FILL, the rest RAW.
+ * @return 0 on success, -1 on failure.
+ */
+static int plan_chunks(fatimage_backend* be, const BYTE* map, uint64_t size, uint64_t n_blocks, BYTE* buffer, chunk_list* l) {
+    for (uint64_t b = 0; b < n_blocks; ) {
+        if (!block_mapped(map, b)) {
+            if (add_block(l, CHUNK_TYPE_DONT_CARE, 0, b) != 0) {
+                return -1;
+            }
+            b++;
+            continue;
+        }
+        // 连续的已映射块一批读入
+        uint32_t n = 1;
+        while (n < SIMG_BATCH && b + n < n_blocks && block_mapped(map, b + n)) {
+            n++;
+        }
+        if (read_blocks(be, size, b, n, buffer) != 0) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            const uint32_t* w = (const uint32_t*)(buffer + (size_t)i * SIMG_BLOCK);
+            uint32_t k = 1;
+            while (k < SIMG_BLOCK / 4 && w[k] == w[0]) {
+                k++;
+            }
+            int ret = (k == SIMG_BLOCK / 4) ? add_block(l, CHUNK_TYPE_FILL, w[0], b + i)
+                                            : add_block(l, CHUNK_TYPE_RAW, 0, b + i);
+            if (ret != 0) {
+                return -1;
+            }
+        }
+        b += n;
+    }
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Converts an image to an Android sparse image (as written by img2simg) using the map of
+ *        written blocks: unwritten blocks become DONT_CARE chunks, blocks filled with one 32-bit value
+ *        FILL chunks, everything else RAW chunks.
+ * @param be Backend of the finished image (already synced).
+ * @param map One bit per MAP_BLOCK_SIZE block, set for blocks that were written.
+ * @param size Image size in bytes.
+ * @param f Output file or stream, written sequentially.
+ * @return 0 on success, -1 on failure.
+ */
+int write_sparse_image(fatimage_backend* be, const BYTE* map, uint64_t size, FILE* f) {
+    uint64_t n_blocks = (size + SIMG_BLOCK - 1) / SIMG_BLOCK;
+    BYTE* buffer = (BYTE*)malloc((size_t)SIMG_BATCH * SIMG_BLOCK);
+    chunk_list l = { 0 };
+    BYTE hdr[SIMG_FILE_HDR_SZ];
+    int ret = -1;
+
+    if (!buffer || n_blocks > 0xFFFFFFFFu || plan_chunks(be, map, size, n_blocks, buffer, &l) != 0 ||
+        l.n > 0xFFFFFFFFu) {
+        goto done;
+    }
+
+    // 文件头：版本1.0，没有整体校验和
+    put32(hdr, SIMG_MAGIC);
+    put16(hdr + 4, 1);
+    put16(hdr + 6, 0);
+    put16(hdr + 8, SIMG_FILE_HDR_SZ);
+    put16(hdr + 10, SIMG_CHUNK_HDR_SZ);
+    put32(hdr + 12, SIMG_BLOCK);
+    put32(hdr + 16, (uint32_t)n_blocks);
+    put32(hdr + 20, (uint32_t)l.n);
+    put32(hdr + 24, 0);
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < l.n; i++) {
+        const simg_chunk* c = &l.chunks[i];
+        BYTE ch[SIMG_CHUNK_HDR_SZ + 4];
+        uint32_t data = (c->type == CHUNK_TYPE_RAW) ? c->count * SIMG_BLOCK : (c->type == CHUNK_TYPE_FILL) ? 4 : 0;
+
+        put16(ch, c->type);
+        put16(ch + 2, 0);
+        put32(ch + 4, c->count);
+        put32(ch + 8, SIMG_CHUNK_HDR_SZ + data);
+        put32(ch + 12, c->fill);
+        size_t hdr_len = SIMG_CHUNK_HDR_SZ + (c->type == CHUNK_TYPE_FILL ? 4 : 0);
+        if (fwrite(ch, 1, hdr_len, f) != hdr_len) {
+            goto done;
+        }
+        // RAW 块的数据从镜像中再读一次，写入输出
+        for (uint32_t k = 0; c->type == CHUNK_TYPE_RAW && k < c->count; ) {
+            uint32_t n = (c->count - k > SIMG_BATCH) ? SIMG_BATCH : c->count - k;
+            if (read_blocks(be, size, c->start + k, n, buffer) != 0 ||
+                fwrite(buffer, SIMG_BLOCK, n, f) != n) {
+                goto done;
+            }
+            k += n;
+        }
+    }
+    ret = 0;
+
+done:
+    free(l.chunks);
+    free(buffer);
+    return ret;
+}
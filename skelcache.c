@@ -0,0 +1,192 @@
+#include "skelcache.h"
+#include "tools.h"      // copy_verbose
+#include <windows.h>    // 用于缓存文件的读写和原子替换
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SKEL_MAGIC      "FISKEL01"
+// 保存骨架时单次读取镜像的字节数
+#define SKEL_IO_CHUNK   (1024 * 1024)
+
+/*
+ 骨架文件 = 刚格式化完的镜像的前 length 字节（分区表、引导扇区、FAT、exFAT 的位图/大写表/根目录等）
+          + 文件末尾的 skel_trailer。
+ 数据放在文件开头，恢复时后端可以用 copy_file 把它一次性拷贝（或块克隆）到新镜像的偏移0处。
+*/
+typedef struct {
+    char magic[8];          // SKEL_MAGIC
+    uint64_t image_size;    // 镜像大小（字节）
+    uint64_t length;        // 骨架数据的字节数
+    DWORD au_size;          // 簇大小，0表示 f_mkfs 默认
+    DWORD revision;         // FatFs 版本(FF_DEFINED)，不同版本的格式化结果可能不同
+    WORD sector_size;       // 扇区大小
+    BYTE fmt;               // MKFS_PARM.fmt
+    BYTE reserved[5];
+} skel_trailer;
+
+/*
+=================================================================================
+ 1. 辅助函数
+=================================================================================
+*/
+
+/**
+ * @brief Builds the cache file name from the key (image size, format, cluster size, sector size, and
+ *        the fixed build time for reproducible images).
+ */
+static void skel_path(const fatimage* img, char* buf, size_t len) {
+    int n = snprintf(buf, len, "%s\\skel-%llu-%02X-%lu-%u", img->cfg.skel_dir,
+                     (unsigned long long)img->cfg.size, img->cfg.fmt, (unsigned long)img->cfg.au_size, (unsigned)FF_MAX_SS);
+    // 可重现模式的卷序列号由固定的生成时间决定，骨架单独保存
+    if (img->cfg.deterministic && n > 0 && (size_t)n < len) {
+        n += snprintf(buf + n, len - n, "-r%08lX", (unsigned long)fatimage_reproducible_time());
+    }
+    if (n > 0 && (size_t)n < len) {
+        snprintf(buf + n, len - n, ".bin");
+    }
+}
+
+/**
+ * @brief Copies the first bytes of a PC file to the image with read/write, for backends without copy_file.
+ */
+static int copy_with_write(fatimage_backend* be, const char* path, uint64_t bytes) {
+    FILE* f = fopen(path, "rb");
+    BYTE* buffer = (BYTE*)malloc(SKEL_IO_CHUNK);
+    uint64_t done = 0;
+
+    while (f && buffer && done < bytes) {
+        size_t n = (bytes - done > SKEL_IO_CHUNK) ? SKEL_IO_CHUNK : (size_t)(bytes - done);
+        if (fread(buffer, 1, n, f) != n || be->write(be, buffer, done, n) != 0) {
+            break;
+        }
+        done += n;
+    }
+    free(buffer);
+    if (f) {
+        fclose(f);
+    }
+    return (done == bytes) ? 0 : -1;
+}
+
+/*
+=================================================================================
+ 2. 对外接口：恢复和保存骨架
+=================================================================================
+*/
+
+/**
+ * @brief Formats the image by copying a cached skeleton with the same key into it.
+ *        Only whole-disk images with cfg.skel_dir set use the cache.
+ * @return 0 when restored, 1 when there is no usable skeleton (run f_mkfs), -1 on an I/O error.
+ */
+int skel_restore(fatimage* img) {
+    char path[MAX_PATH];
+    skel_trailer t;
+    LARGE_INTEGER fsize;
+    OVERLAPPED ov = { 0 };
+    DWORD got;
+    int ok;
+
+    if (!img->cfg.skel_dir || img->parent) {
+        return 1;
+    }
+    skel_path(img, path, sizeof(path));
+
+    HANDLE h = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        return 1;
+    }
+    ok = GetFileSizeEx(h, &fsize) && fsize.QuadPart >= (LONGLONG)sizeof(t);
+    if (ok) {
+        uint64_t pos = (uint64_t)fsize.QuadPart - sizeof(t);
+        ov.Offset = (DWORD)pos;
+        ov.OffsetHigh = (DWORD)(pos >> 32);
+        ok = ReadFile(h, &t, sizeof(t), &got, &ov) && got == sizeof(t);
+    }
+    CloseHandle(h);
+
+    // 键或文件本身不匹配（例如被截断）时当作未缓存
+    if (!ok || memcmp(t.magic, SKEL_MAGIC, sizeof(t.magic)) != 0 ||
+        t.image_size != img->cfg.size || t.fmt != img->cfg.fmt || t.au_size != img->cfg.au_size ||
+        t.sector_size != FF_MAX_SS || t.revision != FF_DEFINED ||
+        t.length + sizeof(t) != (uint64_t)fsize.QuadPart || t.length > img->cfg.size) {
+        return 1;
+    }
+
+    int rc = img->be->copy_file ? img->be->copy_file(img->be, path, 0, t.length)
+                                : copy_with_write(img->be, path, t.length);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Failed to copy skeleton '%s' into '%s'.\n", path, img->cfg.path);
+        return -1;
+    }
+    if (copy_verbose) {
+        printf("Formatted from skeleton cache '%s'.\n", path);
+    }
+    return 0;
+}
+
+/**
+ * @brief Saves the metadata of a freshly formatted and mounted image as a skeleton: everything up to
+ *        the end of the last cluster f_mkfs allocated (FAT32 root directory, exFAT bitmap/up-case
+ *        table/root directory). The file is written under a temporary name and then renamed, so
+ *        concurrent builders never see a partial skeleton.
+ * @return 0 on success or when the cache is not used, -1 on failure (a warning is printed; the
+ *         image itself is not affected).
+ */
+int skel_store(fatimage* img) {
+    char path[MAX_PATH], tmp[MAX_PATH];
+    FATFS* fs = &img->fs;
+    FATFS* pfs;
+    DWORD nfree, put;
+    skel_trailer t;
+    BYTE* buffer;
+    int ok = 1;
+
+    if (!img->cfg.skel_dir || img->parent) {
+        return 0;
+    }
+    if (f_getfree(img->drive, &nfree, &pfs) != FR_OK) {
+        return -1;
+    }
+
+    // 格式化后已分配的簇总是从2号簇开始连续存放
+    memset(&t, 0, sizeof(t));
+    memcpy(t.magic, SKEL_MAGIC, sizeof(t.magic));
+    t.image_size = img->cfg.size;
+    t.length = ((uint64_t)fs->database + (uint64_t)(fs->n_fatent - 2 - nfree) * fs->csize) * FF_MIN_SS;
+    t.au_size = img->cfg.au_size;
+    t.revision = FF_DEFINED;
+    t.sector_size = FF_MAX_SS;
+    t.fmt = img->cfg.fmt;
+
+    skel_path(img, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%lu-%u.tmp", path, (unsigned long)GetCurrentProcessId(), (unsigned)img->slot);
+    HANDLE h = CreateFile(tmp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    buffer = (BYTE*)malloc(SKEL_IO_CHUNK);
+    if (h == INVALID_HANDLE_VALUE || !buffer) {
+        fprintf(stderr, "Warning: Cannot write skeleton cache '%s'.\n", tmp);
+        if (h != INVALID_HANDLE_VALUE) {
+            CloseHandle(h);
+            DeleteFile(tmp);
+        }
+        free(buffer);
+        return -1;
+    }
+
+    for (uint64_t off = 0; ok && off < t.length; ) {
+        DWORD n = (t.length - off > SKEL_IO_CHUNK) ? SKEL_IO_CHUNK : (DWORD)(t.length - off);
+        ok = img->be->read(img->be, buffer, off, n) == 0 && WriteFile(h, buffer, n, &put, NULL) && put == n;
+        off += n;
+    }
+    ok = ok && WriteFile(h, &t, sizeof(t), &put, NULL) && put == sizeof(t);
+    CloseHandle(h);
+    free(buffer);
+
+    if (!ok || !MoveFileEx(tmp, path, MOVEFILE_REPLACE_EXISTING)) {
+        fprintf(stderr, "Warning: Cannot write skeleton cache '%s'.\n", path);
+        DeleteFile(tmp);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __SKELCACHE_H__
+#define __SKELCACHE_H__
+#include "fatimage.h"
+
+/* 格式化骨架缓存：保存刚格式化完的镜像元数据区域，相同大小/格式/簇大小的镜像直接拷贝，不再执行 f_mkfs */
+int skel_restore(fatimage* img);
+int skel_store(fatimage* img);
+#endif
@@ -0,0 +1,276 @@
+#include "srccache.h"
+#include "sha256.h"
+#include <windows.h>    // 用于临界区和条件变量
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define CACHE_BUCKETS 4096
+// 计算摘要时单次读取源文件的字节数
+#define HASH_CHUNK    (1024 * 1024)
+
+/* 缓存项状态 */
+enum {
+    ENTRY_LOADING,  // 正在由某个线程读取，其它线程等待
+    ENTRY_READY,    // 内容已在内存中
+    ENTRY_UNCACHED, // 超出缓存容量，调用者直接从磁盘读取
+    ENTRY_FAILED    // 读取失败
+};
+
+typedef struct cache_entry {
+    struct cache_entry* next;
+    char* path;
+    int state;
+    void* data;
+    uint64_t size;
+} cache_entry;
+
+struct src_cache {
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE loaded;      // 有缓存项读取完成时广播
+    cache_entry* buckets[CACHE_BUCKETS];
+    uint64_t max_bytes;             // 缓存容量上限
+    uint64_t used_bytes;            // 已占用（含正在读取的预留）
+    uint64_t hits, misses;
+};
+
+/*
+=================================================================================
+ 1. 辅助函数：路径比较（Windows路径不区分大小写，'/' 与 '\' 等价）
+=================================================================================
+*/
+
+static int path_char(char c) {
+    return (c == '\\') ? '/' : tolower((unsigned char)c);
+}
+
+static DWORD path_hash(const char* path) {
+    DWORD h = 2166136261u;
+    for (; *path; path++) {
+        h = (h ^ (DWORD)path_char(*path)) * 16777619u;
+    }
+    return h % CACHE_BUCKETS;
+}
+
+static int path_equal(const char* a, const char* b) {
+    for (; *a && *b; a++, b++) {
+        if (path_char(*a) != path_char(*b)) {
+            return 0;
+        }
+    }
+    return *a == *b;
+}
+
+/**
+ * @brief Reads a whole file into memory if it fits in the remaining cache budget.
+ * @return ENTRY_READY, ENTRY_UNCACHED or ENTRY_FAILED.
+ */
+static int load_entry(src_cache* cache, cache_entry* e) {
+    FILE* fp = fopen(e->path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open PC file '%s'.\n", e->path);
+        return ENTRY_FAILED;
+    }
+    if (_fseeki64(fp, 0, SEEK_END) != 0) {
+        fclose(fp);
+        return ENTRY_FAILED;
+    }
+    long long size = _ftelli64(fp);
+    rewind(fp);
+
+    // 预留缓存空间，放不下的文件不缓存
+    int fits;
+    EnterCriticalSection(&cache->lock);
+    fits = (size >= 0 && cache->used_bytes + (uint64_t)size <= cache->max_bytes);
+    if (fits) {
+        cache->used_bytes += (uint64_t)size;
+    }
+    LeaveCriticalSection(&cache->lock);
+    if (!fits || (uint64_t)size != (size_t)size) {
+        fclose(fp);
+        return ENTRY_UNCACHED;
+    }
+
+    e->size = (uint64_t)size;
+    e->data = malloc(size ? (size_t)size : 1);
+    if (!e->data || fread(e->data, 1, (size_t)size, fp) != (size_t)size) {
+        fprintf(stderr, "Error: Failed reading from PC file '%s'.\n", e->path);
+        fclose(fp);
+        free(e->data);
+        e->data = NULL;
+        EnterCriticalSection(&cache->lock);
+        cache->used_bytes -= (uint64_t)size;
+        LeaveCriticalSection(&cache->lock);
+        return ENTRY_FAILED;
+    }
+    fclose(fp);
+    return ENTRY_READY;
+}
+
+/*
+=================================================================================
+ 2. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Creates an empty source file cache.
+ * @param max_bytes Upper bound on the bytes kept in memory; larger files are not cached.
+ * @return New cache, or NULL when out of memory.
+ */
+src_cache* src_cache_create(uint64_t max_bytes) {
+    src_cache* cache = (src_cache*)calloc(1, sizeof(src_cache));
+    if (!cache) {
+        return NULL;
+    }
+    InitializeCriticalSection(&cache->lock);
+    InitializeConditionVariable(&cache->loaded);
+    cache->max_bytes = max_bytes;
+    return cache;
+}
+
+/**
+ * @brief Frees the cache and every cached file. No src_cache_get data may be used afterwards.
+ */
+void src_cache_destroy(src_cache* cache) {
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        cache_entry* e = cache->buckets[i];
+        while (e) {
+            cache_entry* next = e->next;
+            free(e->data);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+    }
+    DeleteCriticalSection(&cache->lock);
+    free(cache);
+}
+
+/**
+ * @brief Returns the contents of a PC file, reading it from disk only the first time it is requested.
+ *        Concurrent requests for the same file wait for the first reader instead of reading it again.
+ * @param cache Shared cache.
+ * @param pc_path Full path to the source file on the PC.
+ * @param data Receives a pointer to the file contents (valid until src_cache_destroy).
+ * @param size Receives the file size in bytes.
+ * @return 0 when data is valid, 1 when the file is too large to cache (read it directly), -1 on failure.
+ */
+int src_cache_get(src_cache* cache, const char* pc_path, const void** data, uint64_t* size) {
+    DWORD h = path_hash(pc_path);
+    cache_entry* e;
+    int state;
+
+    EnterCriticalSection(&cache->lock);
+    for (e = cache->buckets[h]; e; e = e->next) {
+        if (path_equal(e->path, pc_path)) {
+            break;
+        }
+    }
+
+    if (e) {
+        // 其它线程正在读取该文件，等待它完成
+        while (e->state == ENTRY_LOADING) {
+            SleepConditionVariableCS(&cache->loaded, &cache->lock, INFINITE);
+        }
+        if (e->state == ENTRY_READY) {
+            cache->hits++;
+        }
+        state = e->state;
+        LeaveCriticalSection(&cache->lock);
+    } else {
+        // 第一次请求：先登记为读取中，再在锁外读取文件
+        e = (cache_entry*)calloc(1, sizeof(cache_entry));
+        if (!e || !(e->path = _strdup(pc_path))) {
+            LeaveCriticalSection(&cache->lock);
+            free(e);
+            return -1;
+        }
+        e->state = ENTRY_LOADING;
+        e->next = cache->buckets[h];
+        cache->buckets[h] = e;
+        cache->misses++;
+        LeaveCriticalSection(&cache->lock);
+
+        state = load_entry(cache, e);
+
+        EnterCriticalSection(&cache->lock);
+        e->state = state;
+        WakeAllConditionVariable(&cache->loaded);
+        LeaveCriticalSection(&cache->lock);
+    }
+
+    if (state == ENTRY_READY) {
+        *data = e->data;
+        *size = e->size;
+        return 0;
+    }
+    return (state == ENTRY_UNCACHED) ? 1 : -1;
+}
+
+/**
+ * @brief Computes the SHA-256 of a PC file's contents, from the cache when it holds the file.
+ * @param cache Shared cache, or NULL to read the file directly.
+ * @param pc_path Full path to the source file on the PC.
+ * @param digest Receives the digest.
+ * @return 0 on success, -1 on failure.
+ */
+int src_cache_digest(src_cache* cache, const char* pc_path, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    sha256_ctx ctx;
+    sha256_init(&ctx);
+
+    if (cache) {
+        const void* data;
+        uint64_t size;
+        int rc = src_cache_get(cache, pc_path, &data, &size);
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc == 0) {
+            // 之后拷贝时同一份缓存内容还会被用到，源文件只读取一次
+            for (const uint8_t* p = (const uint8_t*)data; size > 0; ) {
+                size_t n = (size > HASH_CHUNK) ? HASH_CHUNK : (size_t)size;
+                sha256_update(&ctx, p, n);
+                p += n;
+                size -= n;
+            }
+            sha256_final(&ctx, digest);
+            return 0;
+        }
+    }
+
+    FILE* f = fopen(pc_path, "rb");
+    uint8_t* buffer = (uint8_t*)malloc(HASH_CHUNK);
+    size_t n;
+    int ret = -1;
+    if (f && buffer) {
+        while ((n = fread(buffer, 1, HASH_CHUNK, f)) > 0) {
+            sha256_update(&ctx, buffer, n);
+        }
+        if (!ferror(f)) {
+            sha256_final(&ctx, digest);
+            ret = 0;
+        }
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Error: Failed reading from PC file '%s'.\n", pc_path);
+    }
+    free(buffer);
+    if (f) {
+        fclose(f);
+    }
+    return ret;
+}
+
+/**
+ * @brief Reports cache hits (requests served from memory), misses (files read from disk) and cached bytes.
+ */
+void src_cache_stats(const src_cache* cache, uint64_t* hits, uint64_t* misses, uint64_t* bytes) {
+    *hits = cache->hits;
+    *misses = cache->misses;
+    *bytes = cache->used_bytes;
+}
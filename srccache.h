@@ -0,0 +1,14 @@
+#ifndef __SRCCACHE_H__
+#define __SRCCACHE_H__
+#include <stdint.h>
+#include "sha256.h"
+
+/* 多个镜像任务共享的源文件读取缓存：同一个PC文件只从磁盘读取一次 */
+typedef struct src_cache src_cache;
+
+src_cache* src_cache_create(uint64_t max_bytes);
+void src_cache_destroy(src_cache* cache);
+int src_cache_get(src_cache* cache, const char* pc_path, const void** data, uint64_t* size);
+int src_cache_digest(src_cache* cache, const char* pc_path, uint8_t digest[SHA256_DIGEST_SIZE]);
+void src_cache_stats(const src_cache* cache, uint64_t* hits, uint64_t* misses, uint64_t* bytes);
+#endif
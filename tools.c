@@ -1,4 +1,6 @@
 #include "tools.h"
+#include "srccache.h"
+#include "fatimage.h"   // 连续簇直写
 #include <windows.h>    // 用于Windows文件和目录遍历
 #include "ff.h"         // FatFs库
 #include <stdlib.h>     // 用于 strtoull
@@ -7,6 +9,11 @@
 
 // 定义一个足够大的缓冲区用于文件读写
 #define COPY_BUFFER_SIZE (8 * 1024)
+// 从缓存写入时单次 f_write 的最大字节数
+#define COPY_CHUNK_MAX  0x40000000u
+
+/* 是否打印每个文件/目录的拷贝信息（并行生成多个镜像时关闭） */
+int copy_verbose = 1;
 
 /*
 =================================================================================
@@ -14,13 +21,75 @@
 =================================================================================
 */
 
+/**
+ * @brief Closes a FatFs file that has just been written. For the first file of a duplicate group,
+ *        the cluster chain is recorded so that the other files of the group can share it.
+ */
+static FRESULT close_dst(FIL* fp, dedup_group* group) {
+    FRESULT res = f_sync(fp);
+
+    // 分配状态在 f_sync 之后才确定（exFAT 写入中途碎片化的文件此时补写FAT）
+    if (res == FR_OK && group && fp->obj.sclust != 0 && f_size(fp) == group->size) {
+        group->sclust = fp->obj.sclust;
+#if FF_FS_EXFAT
+        group->nofat = (fp->obj.fs->fs_type == FS_EXFAT && fp->obj.stat == 2); // FAT卷上 f_expand 同样置2，但簇链写在FAT中
+#endif
+    }
+    FRESULT close_res = f_close(fp);
+    return (res != FR_OK) ? res : close_res;
+}
+
+/**
+ * @brief Creates a FatFs file that shares the cluster chain of an identical file already in the image.
+ * @return 0 on success, -1 on failure.
+ */
+static int share_file_in_fatfs(const char* pc_path, DIR* dir, const char* name, const char* fatfs_path, const dedup_group* group) {
+    FIL f_dst;
+
+    FRESULT res = f_openat(dir, &f_dst, name, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: Cannot create FatFs file '%s'. FRESULT: %d\n", fatfs_path, res);
+        return -1;
+    }
+    if (copy_verbose) {
+        printf("Sharing clusters: '%s' -> '%s'\n", pc_path, fatfs_path);
+    }
+    res = f_sharechain(&f_dst, group->sclust, group->size, group->nofat);
+    FRESULT close_res = f_close(&f_dst);
+    if (res != FR_OK || close_res != FR_OK) {
+        fprintf(stderr, "Error: Failed to link FatFs file '%s'. FRESULT: %d\n", fatfs_path, res != FR_OK ? res : close_res);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Allocates a contiguous cluster run for a file that must be stored in one piece (COPY_CONTIGUOUS)
+ *        when fatimage_write_extent did not (small file). The data is then written with f_write.
+ * @return 1 when allocated (write the data with f_write), -1 if there is no contiguous free space.
+ */
+static int expand_contiguous(FIL* fp, uint64_t size, const char* fatfs_path) {
+    if (size > 0 && f_expand(fp, (FSIZE_t)size, 1) != FR_OK) {
+        fprintf(stderr, "Error: No contiguous free space for '%s' (%llu bytes).\n", fatfs_path, (unsigned long long)size);
+        return -1;
+    }
+    return 1;
+}
+
 /**
  * @brief Copies a single file from the local PC filesystem to the FatFs virtual disk.
  * @param pc_path Full path to the source file on the PC.
- * @param fatfs_path Full path to the destination file within the FatFs image (e.g., "0:/images/pic.png").
+ * @param dir Open FatFs directory to create the file in.
+ * @param name Name of the destination file within dir.
+ * @param fatfs_path Full path of the destination file (e.g., "0:/images/pic.png"), only used in messages.
+ * @param cache Shared source cache, or NULL to read the PC file directly.
+ * @param group Duplicate group of the file whose cluster chain is to be recorded, or NULL.
+ * @param flags COPY_CONTIGUOUS to fail unless the file gets one contiguous cluster run (implied for the
+ *        files listed in the image's cfg.contig); other bits are ignored.
  * @return 0 on success, -1 on failure.
  */
-static int copy_file_to_fatfs(const char* pc_path, const char* fatfs_path) {
+int copy_file_to_fatfs(const char* pc_path, DIR* dir, const char* name, const char* fatfs_path, src_cache* cache,
+                       dedup_group* group, int flags) {
     FILE* f_src = NULL;
     FIL f_dst;
     FRESULT res;
@@ -29,6 +98,56 @@ static int copy_file_to_fatfs(const char* pc_path, const char* fatfs_path) {
     UINT bytes_written;
     int ret = -1; // 默认返回失败
 
+    // 镜像配置中指定必须连续存放的文件（例如引导程序按 LBA 读取的文件）
+    if (fatimage_wants_contiguous(fatfs_path)) {
+        flags |= COPY_CONTIGUOUS;
+    }
+
+    // 0. 优先使用共享缓存中的文件内容，每个源文件只从磁盘读取一次
+    if (cache) {
+        const void* data;
+        uint64_t size;
+        int rc = src_cache_get(cache, pc_path, &data, &size);
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc == 0) {
+            res = f_openat(dir, &f_dst, name, FA_CREATE_ALWAYS | FA_WRITE);
+            if (res != FR_OK) {
+                fprintf(stderr, "Error: Cannot create FatFs file '%s'. FRESULT: %d\n", fatfs_path, res);
+                return -1;
+            }
+            if (copy_verbose) {
+                printf("Copying file: '%s' -> '%s'\n", pc_path, fatfs_path);
+            }
+            // 大文件：分配连续簇后直接从内存写入镜像
+            int ext = fatimage_write_extent(&f_dst, pc_path, data, size);
+            if (ext == 1 && (flags & COPY_CONTIGUOUS)) {
+                ext = expand_contiguous(&f_dst, size, fatfs_path);
+            }
+            if (ext != 1) {
+                if (ext < 0) {
+                    fprintf(stderr, "Error: Failed writing FatFs file '%s'.\n", fatfs_path);
+                }
+                return (close_dst(&f_dst, group) == FR_OK && ext == 0) ? 0 : -1;
+            }
+            const BYTE* p = (const BYTE*)data;
+            while (size > 0) {
+                UINT chunk = (size > COPY_CHUNK_MAX) ? COPY_CHUNK_MAX : (UINT)size;
+                res = f_write(&f_dst, p, chunk, &bytes_written);
+                if (res != FR_OK || bytes_written < chunk) {
+                    fprintf(stderr, "Error: Failed writing to FatFs file. Disk may be full. FRESULT: %d\n", res);
+                    f_close(&f_dst);
+                    return -1;
+                }
+                p += chunk;
+                size -= chunk;
+            }
+            return (close_dst(&f_dst, group) == FR_OK) ? 0 : -1;
+        }
+        // rc == 1：文件太大未缓存，按原方式流式拷贝
+    }
+
     // 1. 以二进制读模式打开PC上的源文件
     f_src = fopen(pc_path, "rb");
     if (!f_src) {
@@ -37,16 +156,38 @@ static int copy_file_to_fatfs(const char* pc_path, const char* fatfs_path) {
     }
 
     // 2. 在FatFs中创建并打开目标文件
-    res = f_open(&f_dst, fatfs_path, FA_CREATE_ALWAYS | FA_WRITE);
+    res = f_openat(dir, &f_dst, name, FA_CREATE_ALWAYS | FA_WRITE);
     if (res != FR_OK) {
         fprintf(stderr, "Error: Cannot create FatFs file '%s'. FRESULT: %d\n", fatfs_path, res);
         fclose(f_src);
         return -1;
     }
 
-    printf("Copying file: '%s' -> '%s'\n", pc_path, fatfs_path);
+    if (copy_verbose) {
+        printf("Copying file: '%s' -> '%s'\n", pc_path, fatfs_path);
+    }
 
-    // 3. 循环读写，直到源文件结束
+    // 3. 大文件：分配连续簇，由后端把数据直接拷贝到镜像中的对应位置（不经过 f_write）
+    if (_fseeki64(f_src, 0, SEEK_END) == 0) {
+        long long src_size = _ftelli64(f_src);
+        rewind(f_src);
+        if (src_size > 0) {
+            int ext = fatimage_write_extent(&f_dst, pc_path, NULL, (uint64_t)src_size);
+            if (ext == 1 && (flags & COPY_CONTIGUOUS)) {
+                ext = expand_contiguous(&f_dst, (uint64_t)src_size, fatfs_path);
+            }
+            if (ext == 0) {
+                ret = 0;
+                goto cleanup;
+            }
+            if (ext < 0) {
+                fprintf(stderr, "Error: Failed writing FatFs file '%s'.\n", fatfs_path);
+                goto cleanup;
+            }
+        }
+    }
+
+    // 4. 循环读写，直到源文件结束
     while ((bytes_read = fread(buffer, 1, sizeof(buffer), f_src)) > 0) {
         res = f_write(&f_dst, buffer, bytes_read, &bytes_written);
         if (res != FR_OK || bytes_written < bytes_read) {
@@ -63,8 +204,10 @@ static int copy_file_to_fatfs(const char* pc_path, const char* fatfs_path) {
     }
 
 cleanup:
-    // 4. 关闭两个文件句柄
-    f_close(&f_dst);
+    // 5. 关闭两个文件句柄
+    if (close_dst(&f_dst, group) != FR_OK) {
+        ret = -1;
+    }
     fclose(f_src);
     return ret;
 }
@@ -76,17 +219,99 @@ cleanup:
 */
 
 /**
- * @brief Recursively copies the contents of a PC directory to a directory in the FatFs image.
- * @param pc_dir_path Path to the source directory on the PC (e.g., "C:/my_assets").
- * @param fatfs_dir_path Path to the destination directory in FatFs (e.g., "0:/").
+ * @brief Converts a PC file time (UTC) to a FAT packed date/time.
+ * @param utc Keep the time in UTC instead of converting it to local time (reproducible on any machine).
+ * @return FAT date/time, or 0 if it cannot be represented (before 1980), meaning the build time.
+ */
+DWORD fat_time_of(const FILETIME* ft, int utc) {
+    FILETIME local = *ft;
+    WORD date, time;
+
+    if ((!utc && !FileTimeToLocalFileTime(ft, &local)) || !FileTimeToDosDateTime(&local, &date, &time)) {
+        return 0;
+    }
+    return ((DWORD)date << 16) | time;
+}
+
+static int copy_directory_at(const char* pc_dir_path, DIR* dir, const char* fatfs_dir_path, src_cache* cache,
+                             dedup_table* dedup, int flags);
+
+/**
+ * @brief Copies one entry of a PC directory (a file, or a directory recursively) into an open FatFs directory.
  * @return 0 on success, -1 on failure.
  */
-int copy_directory_to_fatfs(const char* pc_dir_path, const char* fatfs_dir_path) {
+static int copy_entry(const char* pc_dir_path, DIR* dir, const char* fatfs_dir_path, const WIN32_FIND_DATA* find_data,
+                      src_cache* cache, dedup_table* dedup, int flags) {
+    char src_path_full[MAX_PATH];
+    char dst_path_full[MAX_PATH];
+
+    // 构造当前项的完整源路径和目标路径（目标路径只用于打印）
+    snprintf(src_path_full, sizeof(src_path_full), "%s/%s", pc_dir_path, find_data->cFileName);
+    snprintf(dst_path_full, sizeof(dst_path_full), "%s/%s", fatfs_dir_path, find_data->cFileName);
+
+    // 源文件的修改时间在创建目录项（以及关闭文件）时直接写入，不必之后再用 f_utime 修改
+    if (flags & COPY_KEEP_TIMES) {
+        fatimage_set_time(fat_time_of(&find_data->ftLastWriteTime, flags & COPY_SORTED));
+    }
+
+    // 如果是文件，则调用文件拷贝函数；与已写入的文件内容相同时共用它的簇
+    if (!(find_data->dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        dedup_group* group = dedup ? dedup_find(dedup, src_path_full) : NULL;
+        if (group && group->sclust != 0) {
+            // 已写入的那份可能是碎片化的，必须连续存放的文件单独拷贝一份
+            if (!fatimage_wants_contiguous(dst_path_full)) {
+                return share_file_in_fatfs(src_path_full, dir, find_data->cFileName, dst_path_full, group);
+            }
+            group = NULL;
+        }
+        return copy_file_to_fatfs(src_path_full, dir, find_data->cFileName, dst_path_full, cache, group, flags);
+    }
+
+    DIR sub;
+    if (copy_verbose) {
+        printf("Creating directory: '%s'\n", dst_path_full);
+    }
+
+    // 在当前目录中创建对应的目录并打开它
+    FRESULT res = f_mkdirat(dir, find_data->cFileName);
+    if (res == FR_OK || res == FR_EXIST) {
+        res = f_opendirat(dir, &sub, find_data->cFileName);
+    }
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: Failed to create FatFs directory '%s'. FRESULT: %d\n", dst_path_full, res);
+        return -1;
+    }
+
+    // 递归进入子目录
+    int sub_ret = copy_directory_at(src_path_full, &sub, dst_path_full, cache, dedup, flags);
+    f_closedir(&sub);
+    return sub_ret;
+}
+
+static int cmp_find_name(const void* a, const void* b) {
+    return strcmp(((const WIN32_FIND_DATA*)a)->cFileName, ((const WIN32_FIND_DATA*)b)->cFileName);
+}
+
+/**
+ * @brief Recursively copies the contents of a PC directory into an open FatFs directory.
+ *        Every level keeps its own DIR, so files and sub-directories are created with f_openat/f_mkdirat
+ *        relative to it instead of resolving the full path from the root each time.
+ * @param pc_dir_path Path to the source directory on the PC.
+ * @param dir Open destination directory.
+ * @param fatfs_dir_path Path of the destination directory, only used in messages.
+ * @param cache Shared source cache, or NULL to read PC files directly.
+ * @param dedup Duplicate files whose clusters are shared, or NULL.
+ * @param flags COPY_xxx options.
+ * @return 0 on success, -1 on failure.
+ */
+static int copy_directory_at(const char* pc_dir_path, DIR* dir, const char* fatfs_dir_path, src_cache* cache,
+                             dedup_table* dedup, int flags) {
     WIN32_FIND_DATA find_data;
     HANDLE h_find = INVALID_HANDLE_VALUE;
     char search_path[MAX_PATH];
-    char src_path_full[MAX_PATH];
-    char dst_path_full[MAX_PATH];
+    WIN32_FIND_DATA* entries = NULL;
+    size_t n_entries = 0, cap = 0;
+    int ret = 0;
 
     // 构造Windows API的搜索路径，例如 "C:/my_assets/*"
     snprintf(search_path, sizeof(search_path), "%s\\*", pc_dir_path);
@@ -103,38 +328,211 @@ int copy_directory_to_fatfs(const char* pc_dir_path, const char* fatfs_dir_path)
             continue;
         }
 
-        // 构造当前项的完整源路径和目标路径
-        snprintf(src_path_full, sizeof(src_path_full), "%s/%s", pc_dir_path, find_data.cFileName);
-        snprintf(dst_path_full, sizeof(dst_path_full), "%s/%s", fatfs_dir_path, find_data.cFileName);
-
-        // 判断当前项是目录还是文件
-        if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            printf("Creating directory: '%s'\n", dst_path_full);
-            
-            // 在FatFs中创建对应的目录
-            FRESULT res = f_mkdir(dst_path_full);
-            if (res != FR_OK && res != FR_EXIST) {
-                fprintf(stderr, "Error: Failed to create FatFs directory '%s'. FRESULT: %d\n", dst_path_full, res);
-                FindClose(h_find);
-                return -1;
+        if (!(flags & COPY_SORTED)) {
+            // 按 FindFirstFile 返回的顺序边遍历边拷贝
+            if (copy_entry(pc_dir_path, dir, fatfs_dir_path, &find_data, cache, dedup, flags) != 0) {
+                ret = -1; // 如果拷贝失败，则中止
+                break;
             }
+            continue;
+        }
 
-            // 递归进入子目录
-            if (copy_directory_to_fatfs(src_path_full, dst_path_full) != 0) {
-                FindClose(h_find);
-                return -1; // 如果子目录拷贝失败，则中止
+        // 排序模式：先收集整个目录，排序后再拷贝
+        if (n_entries == cap) {
+            size_t new_cap = (cap == 0) ? 64 : cap * 2;
+            WIN32_FIND_DATA* p = (WIN32_FIND_DATA*)realloc(entries, new_cap * sizeof(WIN32_FIND_DATA));
+            if (!p) {
+                fprintf(stderr, "Error: Out of memory while listing '%s'.\n", pc_dir_path);
+                ret = -1;
+                break;
             }
+            entries = p;
+            cap = new_cap;
+        }
+        entries[n_entries++] = find_data;
+    } while (FindNextFile(h_find, &find_data) != 0);
 
-        } else {
-            // 如果是文件，则调用文件拷贝函数
-            if (copy_file_to_fatfs(src_path_full, dst_path_full) != 0) {
-                FindClose(h_find);
-                return -1; // 如果文件拷贝失败，则中止
+    FindClose(h_find);
+
+    if (ret == 0 && n_entries > 0) {
+        qsort(entries, n_entries, sizeof(WIN32_FIND_DATA), cmp_find_name);
+        for (size_t i = 0; i < n_entries && ret == 0; i++) {
+            ret = copy_entry(pc_dir_path, dir, fatfs_dir_path, &entries[i], cache, dedup, flags);
+        }
+    }
+    free(entries);
+    return ret;
+}
+
+/**
+ * @brief Recursively copies the contents of a PC directory to a directory in the FatFs image.
+ * @param pc_dir_path Path to the source directory on the PC (e.g., "C:/my_assets").
+ * @param fatfs_dir_path Path to the destination directory in FatFs (e.g., "0:/").
+ * @param cache Shared source cache, or NULL to read PC files directly.
+ * @param dedup Duplicate files found by dedup_plan for this source folder; every file of a group after
+ *        the first shares the first one's clusters. NULL to give every file its own clusters.
+ * @param flags COPY_KEEP_TIMES to use the source modification times instead of the build time,
+ *        COPY_SORTED to copy every directory in name order (and keep source times in UTC).
+ * @return 0 on success, -1 on failure.
+ */
+int copy_directory_to_fatfs(const char* pc_dir_path, const char* fatfs_dir_path, src_cache* cache, dedup_table* dedup,
+                            int flags) {
+    DIR dir;
+
+    // 只有起点目录按完整路径打开，之后的文件和子目录都相对于已打开的目录创建
+    FRESULT res = f_opendir(&dir, fatfs_dir_path);
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: Cannot open FatFs directory '%s'. FRESULT: %d\n", fatfs_dir_path, res);
+        return -1;
+    }
+    int ret = copy_directory_at(pc_dir_path, &dir, fatfs_dir_path, cache, dedup, flags);
+    f_closedir(&dir);
+    fatimage_set_time(0);
+    return ret;
+}
+
+/*
+=================================================================================
+ 3. 按路径逐项创建：路径规范化与父目录缓存
+=================================================================================
+*/
+
+/**
+ * @brief Normalizes a path from an archive or manifest into a path relative to the image root: strips
+ *        leading separators and "./", drops empty and "." components, and accepts both '/' and '\'.
+ *        Paths containing ".." are rejected.
+ * @return 0 on success (out may be empty for the root itself), -1 if the path is unsafe or too long.
+ */
+int normalize_image_path(const char* in, char* out, size_t cap) {
+    size_t len = 0;
+
+    while (*in) {
+        size_t n = strcspn(in, "/\\");
+        if (n == 2 && in[0] == '.' && in[1] == '.') {
+            return -1;
+        }
+        if (n > 0 && !(n == 1 && in[0] == '.')) {
+            if (len + (len ? 1 : 0) + n + 1 > cap) {
+                return -1;
+            }
+            if (len) {
+                out[len++] = '/';
             }
+            memcpy(out + len, in, n);
+            len += n;
+        }
+        in += n;
+        if (*in) {
+            in++;
         }
+    }
+    out[len] = '\0';
+    return 0;
+}
 
-    } while (FindNextFile(h_find, &find_data) != 0);
+/**
+ * @brief Decodes the UTF-8 character at *s and advances *s past it. A byte that does not start a
+ *        valid sequence is returned as it is, so every string still compares consistently.
+ */
+static DWORD next_code_point(const char** s) {
+    const BYTE* p = (const BYTE*)*s;
+    DWORD u = p[0];
+    int n = (u >= 0xF8) ? 0 : (u >= 0xF0) ? 3 : (u >= 0xE0) ? 2 : (u >= 0xC0) ? 1 : 0;  // 后续字节数
 
-    FindClose(h_find);
-    return 0; // 整个目录成功复制
+    for (int i = 1; i <= n; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            n = 0;  // 截断或无效的序列：按单个字节处理
+            break;
+        }
+    }
+    if (n > 0) {
+        u &= 0x3F >> n;
+        for (int i = 1; i <= n; i++) {
+            u = (u << 6) | (p[i] & 0x3F);
+        }
+    }
+    *s += n + 1;
+    return u;
+}
+
+/**
+ * @brief Compares two UTF-8 image paths the way FatFs matches names: every character up-cased with
+ *        ff_wtoupper (so non-ASCII letters fold too), '\\' and '/' as the same separator.
+ * @return <0, 0 or >0 like strcmp.
+ */
+int compare_image_paths(const char* a, const char* b) {
+    for (;;) {
+        DWORD ua = next_code_point(&a);
+        DWORD ub = next_code_point(&b);
+        ua = (ua == '\\') ? '/' : ff_wtoupper(ua);
+        ub = (ub == '\\') ? '/' : ff_wtoupper(ub);
+        if (ua != ub || ua == 0) {
+            return (ua < ub) ? -1 : (ua > ub);
+        }
+    }
+}
+
+/**
+ * @brief Opens the parent directory of rel (creating missing directories) as pd->dir and returns the
+ *        last path component in *name. The directory stays open for the next entry in the same place.
+ * @param root Image root (e.g., "0:").
+ * @param rel Normalized path relative to root (see normalize_image_path), not empty.
+ * @param n_created Incremented for every directory created, or NULL.
+ * @return 0 on success, -1 on failure.
+ */
+int open_parent_dir(parent_dir* pd, const char* root, char* rel, const char** name, uint64_t* n_created) {
+    char path[sizeof(pd->path)];
+    char* slash = strrchr(rel, '/');
+
+    *name = slash ? slash + 1 : rel;
+    if (slash) {
+        *slash = '\0';
+        snprintf(path, sizeof(path), "%s/%s", root, rel);
+        *slash = '/';
+    } else {
+        snprintf(path, sizeof(path), "%s/", root);
+    }
+    if (pd->open && strcmp(pd->path, path) == 0) {
+        return 0;
+    }
+    close_parent_dir(pd);
+
+    FRESULT res = f_opendir(&pd->dir, path);
+    if (res == FR_NO_PATH || res == FR_NO_FILE) {
+        // 父目录不存在：逐级创建
+        for (char* p = path + strlen(root) + 1; ; p++) {
+            if (*p == '/' || *p == '\0') {
+                char c = *p;
+                *p = '\0';
+                res = f_mkdir(path);
+                *p = c;
+                if (res != FR_OK && res != FR_EXIST) {
+                    break;
+                }
+                if (res == FR_OK && n_created) {
+                    (*n_created)++;
+                }
+                if (c == '\0') {
+                    break;
+                }
+            }
+        }
+        if (res == FR_OK || res == FR_EXIST) {
+            res = f_opendir(&pd->dir, path);
+        }
+    }
+    if (res != FR_OK) {
+        fprintf(stderr, "Error: Cannot create FatFs directory '%s'. FRESULT: %d\n", path, res);
+        return -1;
+    }
+    pd->open = 1;
+    snprintf(pd->path, sizeof(pd->path), "%s", path);
+    return 0;
+}
+
+void close_parent_dir(parent_dir* pd) {
+    if (pd->open) {
+        f_closedir(&pd->dir);
+        pd->open = 0;
+    }
 }
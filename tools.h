@@ -1,5 +1,33 @@
 #ifndef __TOOLS_H__
 #define __TOOLS_H__
+#include <windows.h>
+#include "srccache.h"
+#include "dedup.h"
 
-int copy_directory_to_fatfs(const char* pc_dir_path, const char* fatfs_dir_path);
+/* copy_directory_to_fatfs 的选项 */
+#define COPY_KEEP_TIMES 0x01    // 使用源文件的修改时间
+#define COPY_SORTED     0x02    // 按名称排序遍历，源文件时间按UTC换算（可重现的镜像）
+#define COPY_CONTIGUOUS 0x04    // 每个文件必须占用连续的簇，没有足够大的连续空闲区域时失败
+
+extern int copy_verbose;
+/* 源文件时间换算为FAT日期时间（0表示使用生成时间） */
+DWORD fat_time_of(const FILETIME* ft, int utc);
+/* 镜像内路径（不含驱动器号）的最大长度，pax 和 GNU 长文件名可以超过 MAX_PATH */
+#define FAT_PATH_MAX    1024
+
+/* 按路径逐项创建文件时最近使用的父目录，保持打开，同一目录中的后续项用 f_openat/f_mkdirat 相对创建（archive.c、manifest.c） */
+typedef struct {
+    DIR dir;
+    int open;
+    char path[FAT_PATH_MAX + 8];
+} parent_dir;
+
+int normalize_image_path(const char* in, char* out, size_t cap);
+int compare_image_paths(const char* a, const char* b);
+int open_parent_dir(parent_dir* pd, const char* root, char* rel, const char** name, uint64_t* n_created);
+void close_parent_dir(parent_dir* pd);
+int copy_file_to_fatfs(const char* pc_path, DIR* dir, const char* name, const char* fatfs_path, src_cache* cache,
+                       dedup_group* group, int flags);
+int copy_directory_to_fatfs(const char* pc_dir_path, const char* fatfs_dir_path, src_cache* cache, dedup_table* dedup,
+                            int flags);
 #endif
\ No newline at end of file
@@ -0,0 +1,352 @@
+#include "verify.h"
+#include "fatimage.h"
+#include "imgtree.h"
+#include "scan.h"
+#include <windows.h>    // 用于线程和PC文件读取
+#include "ff.h"         // FatFs库
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// 每个线程的读取缓冲区大小（源文件和镜像各一个）
+#define VFY_BUFFER_SIZE (1024 * 1024)
+// 最多的校验线程数
+#define VFY_MAX_THREADS 32
+// 最多逐条报告的不一致项，其余只计数
+#define VFY_MAX_REPORT  20
+
+/*
+ 校验：镜像的目录树（image_tree_load，FatFs）和源文件夹（scan_source_tree）在两个线程上同时遍历，
+ 各自展开成按路径排序的列表后归并比较名称、类型和大小。两边都存在的文件再分给多个线程比较内容：
+ 源文件顺序读取，镜像按文件的区段直接定位读取（不经过 FatFs），逐块比较并报告第一个不同的偏移。
+ FAT 的文件名不区分大小写，路径按不区分大小写的顺序比较。
+*/
+
+/* 源文件夹中的一项，路径相对于源文件夹，以 '/' 分隔 */
+typedef struct {
+    char* path;
+    int is_dir;
+    uint64_t size;
+} vfy_src;
+
+typedef struct {
+    const char* pc_dir;
+    src_node root;
+    vfy_src* items;
+    int n, cap;
+    int ret;
+} vfy_scan;
+
+/* 待比较内容的一对文件 */
+typedef struct {
+    const vfy_src* src;
+    const img_entry* img;
+} vfy_pair;
+
+typedef struct {
+    fatimage* img;
+    const char* pc_dir;
+    vfy_pair* pairs;
+    int n_pairs;
+    volatile LONG next;         // 下一对待比较的文件
+    volatile LONG mismatched;   // 内容不同或无法读取的文件数
+} vfy_pool;
+
+static volatile LONG g_reported;  // 已报告的不一致项
+
+/**
+ * @brief Prints one mismatch, up to VFY_MAX_REPORT in total. Called from several threads.
+ */
+static void report(const char* what, const char* path) {
+    if (InterlockedIncrement(&g_reported) <= VFY_MAX_REPORT) {
+        fprintf(stderr, "Mismatch: %s: '%s'\n", what, path);
+    }
+}
+
+/*
+=================================================================================
+ 1. 源文件夹：扫描并展开成路径列表
+=================================================================================
+*/
+
+static int flatten_source(vfy_scan* sc, const src_node* dir, const char* rel) {
+    char path[MAX_PATH];
+
+    for (size_t i = 0; i < dir->n_children; i++) {
+        const src_node* c = &dir->children[i];
+        if (snprintf(path, sizeof(path), "%s%s%s", rel, rel[0] ? "/" : "", c->name) >= (int)sizeof(path)) {
+            fprintf(stderr, "Error: Path too long: '%s/%s'.\n", rel, c->name);
+            return -1;
+        }
+        if (sc->n == sc->cap) {
+            int new_cap = sc->cap ? sc->cap * 2 : 256;
+            vfy_src* p = (vfy_src*)realloc(sc->items, new_cap * sizeof(vfy_src));
+            if (!p) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                return -1;
+            }
+            sc->items = p;
+            sc->cap = new_cap;
+        }
+        vfy_src* it = &sc->items[sc->n];
+        if (!(it->path = _strdup(path))) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return -1;
+        }
+        it->is_dir = c->is_dir;
+        it->size = c->size;
+        sc->n++;
+        if (c->is_dir && flatten_source(sc, c, path) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int cmp_src_path(const void* a, const void* b) {
+    return _stricmp(((const vfy_src*)a)->path, ((const vfy_src*)b)->path);
+}
+
+static int cmp_img_path(const void* a, const void* b) {
+    return _stricmp((*(const img_entry* const*)a)->path, (*(const img_entry* const*)b)->path);
+}
+
+static DWORD WINAPI scan_thread(LPVOID arg) {
+    vfy_scan* sc = (vfy_scan*)arg;
+
+    sc->ret = -1;
+    if (scan_source_tree(sc->pc_dir, &sc->root) == 0 && flatten_source(sc, &sc->root, "") == 0) {
+        qsort(sc->items, sc->n, sizeof(vfy_src), cmp_src_path);
+        sc->ret = 0;
+    }
+    free_source_tree(&sc->root);
+    return 0;
+}
+
+/*
+=================================================================================
+ 2. 并行比较文件内容
+=================================================================================
+*/
+
+/**
+ * @brief Compares one source file with its copy in the image, chunk by chunk.
+ * @return 0 if identical, -1 if different or unreadable (already reported).
+ */
+static int compare_file(fatimage_backend* be, const char* pc_dir, const vfy_pair* pair, BYTE* src_buf, BYTE* img_buf) {
+    char pc_path[MAX_PATH];
+    char what[64];
+
+    snprintf(pc_path, sizeof(pc_path), "%s/%s", pc_dir, pair->src->path);
+    HANDLE h = CreateFile(pc_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        report("cannot open source file", pair->src->path);
+        return -1;
+    }
+
+    int ret = 0;
+    for (uint64_t done = 0; done < pair->img->size; ) {
+        DWORD chunk = (pair->img->size - done > VFY_BUFFER_SIZE) ? VFY_BUFFER_SIZE : (DWORD)(pair->img->size - done);
+        DWORD got;
+        if (!ReadFile(h, src_buf, chunk, &got, NULL) || got != chunk) {
+            report("cannot read source file", pair->src->path);
+            ret = -1;
+            break;
+        }
+        if (image_read_runs(be, pair->img, done, img_buf, chunk) != 0) {
+            report("cannot read file from image", pair->src->path);
+            ret = -1;
+            break;
+        }
+        if (memcmp(src_buf, img_buf, chunk) != 0) {
+            DWORD i = 0;
+            while (src_buf[i] == img_buf[i]) {
+                i++;
+            }
+            snprintf(what, sizeof(what), "contents differ at offset %llu", (unsigned long long)(done + i));
+            report(what, pair->src->path);
+            ret = -1;
+            break;
+        }
+        done += chunk;
+    }
+    CloseHandle(h);
+    return ret;
+}
+
+static DWORD WINAPI verify_worker(LPVOID arg) {
+    vfy_pool* pool = (vfy_pool*)arg;
+    BYTE* src_buf = (BYTE*)malloc(VFY_BUFFER_SIZE);
+    BYTE* img_buf = (BYTE*)malloc(VFY_BUFFER_SIZE);
+
+    for (;;) {
+        LONG i = InterlockedIncrement(&pool->next) - 1;
+        if (i >= pool->n_pairs) {
+            break;
+        }
+        if (!src_buf || !img_buf) {
+            report("out of memory", pool->pairs[i].src->path);
+            InterlockedIncrement(&pool->mismatched);
+        } else if (compare_file(pool->img->be, pool->pc_dir, &pool->pairs[i], src_buf, img_buf) != 0) {
+            InterlockedIncrement(&pool->mismatched);
+        }
+    }
+    free(src_buf);
+    free(img_buf);
+    return 0;
+}
+
+static int cmp_pair_offset(const void* a, const void* b) {
+    const img_entry* x = ((const vfy_pair*)a)->img;
+    const img_entry* y = ((const vfy_pair*)b)->img;
+    uint64_t ox = x->n_runs ? x->runs[0].offset : 0;
+    uint64_t oy = y->n_runs ? y->runs[0].offset : 0;
+    return (ox < oy) ? -1 : (ox > oy) ? 1 : 0;
+}
+
+/*
+=================================================================================
+ 3. 对外接口
+=================================================================================
+*/
+
+/**
+ * @brief Checks that an image holds exactly the directories and files of a PC folder: same names, types,
+ *        sizes and contents. The image and the folder are listed concurrently; file contents are then
+ *        compared on n_workers threads that read the files' cluster extents straight from the image.
+ *        Mismatches are printed to stderr (the first VFY_MAX_REPORT of them).
+ * @param image_path Raw image file.
+ * @param pc_dir_path Source folder the image was built from.
+ * @param n_workers Compare threads, 0 for one per CPU core.
+ * @return 0 if everything matches, -1 on a mismatch or failure.
+ */
+int verify_image(const char* image_path, const char* pc_dir_path, int n_workers) {
+    vfy_scan sc;
+    vfy_pool pool;
+    img_tree tree;
+    const img_entry** sorted = NULL;
+    int dirs = 0, listed_bad = 0;
+    int ret = -1;
+
+    memset(&sc, 0, sizeof(sc));
+    memset(&pool, 0, sizeof(pool));
+    memset(&tree, 0, sizeof(tree));
+    g_reported = 0;
+    sc.pc_dir = pc_dir_path;
+    pool.pc_dir = pc_dir_path;
+    pool.img = image_open_mounted(image_path);
+    if (!pool.img) {
+        return -1;
+    }
+
+    // 1. 源文件夹在另一个线程上扫描，同时遍历镜像
+    HANDLE th = CreateThread(NULL, 0, scan_thread, &sc, 0, NULL);
+    if (!th) {
+        scan_thread(&sc);
+    }
+    int img_ok = (image_tree_load(pool.img, &tree) == 0);
+    if (th) {
+        WaitForSingleObject(th, INFINITE);
+        CloseHandle(th);
+    }
+    if (!img_ok || sc.ret != 0) {
+        goto done;
+    }
+
+    sorted = (const img_entry**)malloc((tree.n > 0 ? tree.n : 1) * sizeof(img_entry*));
+    pool.pairs = (vfy_pair*)malloc((tree.n > 0 ? tree.n : 1) * sizeof(vfy_pair));
+    if (!sorted || !pool.pairs) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        goto done;
+    }
+    for (int i = 0; i < tree.n; i++) {
+        sorted[i] = &tree.entries[i];
+    }
+    qsort(sorted, tree.n, sizeof(img_entry*), cmp_img_path);
+
+    // 2. 归并两个有序列表：比较名称、类型和大小
+    int i = 0, j = 0;
+    while (i < sc.n || j < tree.n) {
+        int c = (i == sc.n) ? 1 : (j == tree.n) ? -1 : _stricmp(sc.items[i].path, sorted[j]->path);
+        if (c < 0) {
+            report("missing from image", sc.items[i++].path);
+            listed_bad++;
+        } else if (c > 0) {
+            report("not in source folder", sorted[j++]->path);
+            listed_bad++;
+        } else {
+            const vfy_src* s = &sc.items[i++];
+            const img_entry* e = sorted[j++];
+            if (s->is_dir != e->is_dir) {
+                report(s->is_dir ? "folder in source, file in image" : "file in source, folder in image", s->path);
+                listed_bad++;
+            } else if (s->is_dir) {
+                dirs++;
+            } else if (s->size != e->size) {
+                report("size differs", s->path);
+                listed_bad++;
+            } else {
+                pool.pairs[pool.n_pairs].src = s;
+                pool.pairs[pool.n_pairs].img = e;
+                pool.n_pairs++;
+            }
+        }
+    }
+
+    // 3. 多线程比较内容，按镜像中的位置分发
+    if (n_workers <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        n_workers = (int)si.dwNumberOfProcessors;
+    }
+    if (n_workers > VFY_MAX_THREADS) n_workers = VFY_MAX_THREADS;
+    if (n_workers > pool.n_pairs) n_workers = pool.n_pairs;
+    if (n_workers < 1) n_workers = 1;
+
+    qsort(pool.pairs, pool.n_pairs, sizeof(vfy_pair), cmp_pair_offset);
+    HANDLE threads[VFY_MAX_THREADS];
+    int started = 0;
+    for (int k = 1; k < n_workers; k++) {
+        threads[started] = CreateThread(NULL, 0, verify_worker, &pool, 0, NULL);
+        if (!threads[started]) {
+            break; // 剩下的文件由当前线程比较
+        }
+        started++;
+    }
+    verify_worker(&pool);
+    if (started > 0) {
+        WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+    }
+    for (int k = 0; k < started; k++) {
+        CloseHandle(threads[k]);
+    }
+
+    uint64_t bytes = 0;
+    for (int k = 0; k < pool.n_pairs; k++) {
+        bytes += pool.pairs[k].img->size;
+    }
+    LONG bad = listed_bad + pool.mismatched;
+    if (bad) {
+        if (bad > VFY_MAX_REPORT) {
+            fprintf(stderr, "... and %ld more.\n", (long)(bad - VFY_MAX_REPORT));
+        }
+        fprintf(stderr, "Error: Verification of '%s' against '%s' failed: %ld mismatches.\n",
+                image_path, pc_dir_path, (long)bad);
+    } else {
+        printf("Verified %d files (%llu bytes) and %d directories in '%s' against '%s' using %d threads.\n",
+               pool.n_pairs, (unsigned long long)bytes, dirs, image_path, pc_dir_path, started + 1);
+        ret = 0;
+    }
+
+done:
+    for (int k = 0; k < sc.n; k++) {
+        free(sc.items[k].path);
+    }
+    free(sc.items);
+    free(sorted);
+    free(pool.pairs);
+    image_tree_free(&tree);
+    fatimage_close(pool.img);
+    return ret;
+}
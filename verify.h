@@ -0,0 +1,6 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+/* 校验：比较镜像中的目录和文件与PC上的源文件夹（名称、类型、大小和内容），内容由多个线程比较 */
+int verify_image(const char* image_path, const char* pc_dir_path, int n_workers);
+#endif